@@ -0,0 +1,224 @@
+/***********************************************
+/ arp.c : implementation file for the arpeggiator functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "arp.h"
+#include "voice.h"
+#include "mcp4725.h"
+#include "pulse_out.h"
+#include "mod_engine.h"
+#include "event_sched.h"
+#include "hardware/sync.h"
+
+// Global char initiation
+int gArpMode = ARP_MODE_OFF;
+int gArpOctaves = 1;
+int gArpDivision = ARP_DIV_1_16; // Step length in MIDI clock ticks
+int gArpGateLength = ARP_DEFAULT_GATE; // Percent of the step
+bool gArpLatch = false;
+uint8_t gArpSeq[ARP_MAX_STEPS]; // Note numbers of the steps
+int gArpSeqLen = 0;
+
+static uint8_t gArpNotes[VOICE_MAX_NOTES]; // Input notes, latched
+static int gArpNoOfNotes = 0;
+static int gArpIndex = 0; // Step of gArpNext
+static uint8_t gArpNext = 0; // Precomputed note of the next step
+static bool gArpRestart = true; // The next step is the first of the sequence
+static uint32_t gArpRandom = 1;
+
+static inline uint32_t arp_random() {
+    gArpRandom = gArpRandom * 1664525u + 1013904223u;
+    return gArpRandom >> 16;
+}
+
+// Computes gArpNext from gArpIndex
+static inline void arp_prepare_next() {
+    if (gArpSeqLen == 0) {
+        return;
+    }
+    if (gArpMode == ARP_MODE_RANDOM) {
+        gArpIndex = arp_random() % gArpSeqLen;
+    }
+    else if (gArpIndex >= gArpSeqLen) {
+        gArpIndex = 0;
+    }
+    gArpNext = gArpSeq[gArpIndex];
+}
+
+// Expand the input notes over the octaves into the step sequence
+static inline void arp_build_sequence() {
+    uint8_t notes[VOICE_MAX_NOTES];
+    uint8_t seq[ARP_MAX_STEPS];
+    int n = gArpNoOfNotes;
+    int len = 0;
+
+    for (int i = 0; i < n; i++) {
+        notes[i] = gArpNotes[i];
+    }
+
+    // As played keeps the order of the held notes, the others are sorted
+    if (gArpMode != ARP_MODE_AS_PLAYED) {
+        for (int i = 1; i < n; i++) {
+            uint8_t note = notes[i];
+            int j = i - 1;
+            while (j >= 0 && notes[j] > note) {
+                notes[j + 1] = notes[j];
+                j--;
+            }
+            notes[j + 1] = note;
+        }
+    }
+
+    for (int o = 0; o < gArpOctaves; o++) {
+        for (int i = 0; i < n; i++) {
+            int note = notes[i] + 12 * o;
+            if (note <= 127) {
+                seq[len++] = (uint8_t)note;
+            }
+        }
+    }
+
+    if (gArpMode == ARP_MODE_DOWN) {
+        for (int i = 0; i < len / 2; i++) {
+            uint8_t note = seq[i];
+            seq[i] = seq[len - 1 - i];
+            seq[len - 1 - i] = note;
+        }
+    }
+    else if (gArpMode == ARP_MODE_UP_DOWN && len > 2) {
+        // The top and bottom notes are not repeated
+        int upLen = len;
+        for (int i = upLen - 2; i > 0; i--) {
+            seq[len++] = seq[i];
+        }
+    }
+
+    // The clock alarm reads the sequence
+    uint32_t status = save_and_disable_interrupts();
+    for (int i = 0; i < len; i++) {
+        gArpSeq[i] = seq[i];
+    }
+    gArpSeqLen = len;
+    arp_prepare_next();
+    restore_interrupts(status);
+}
+
+void arp_notes_changed() {
+    if (gArpMode == ARP_MODE_OFF) {
+        return;
+    }
+
+    // A latched pattern plays on until a new note is played
+    if (gNoOfHeldNotes == 0 && gArpLatch) {
+        return;
+    }
+
+    if (gArpNoOfNotes == 0) {
+        gArpRestart = true;
+    }
+
+    for (int i = 0; i < gNoOfHeldNotes; i++) {
+        gArpNotes[i] = gHeldNotes[i];
+    }
+    gArpNoOfNotes = gNoOfHeldNotes;
+
+    if (gArpRestart) {
+        gArpIndex = 0;
+    }
+    arp_build_sequence();
+
+    if (gArpNoOfNotes == 0) {
+        pulse_out_gate(false, time_us_64() + PULSE_OUT_LATENCY_US);
+        mod_env_gate(false);
+    }
+}
+
+void SetArpMode(int mode) {
+    if (mode < ARP_MODE_OFF || mode >= ARP_NO_OF_MODES) {
+        return;
+    }
+
+    bool wasOff = gArpMode == ARP_MODE_OFF;
+    gArpMode = mode;
+
+    if (mode == ARP_MODE_OFF) {
+        gArpNoOfNotes = 0;
+        gArpSeqLen = 0;
+        voice_all_notes_off();
+    }
+    else if (wasOff) {
+        gArpNoOfNotes = 0;
+        arp_notes_changed();
+    }
+    else {
+        arp_build_sequence();
+    }
+}
+
+void SetArpOctaves(int octaves) {
+    if (octaves < 1 || octaves > ARP_MAX_OCTAVES) {
+        return;
+    }
+
+    gArpOctaves = octaves;
+    arp_build_sequence();
+}
+
+void SetArpDivision(int clockTicks) {
+    if (clockTicks < 1 || clockTicks > 4 * 24) {
+        return;
+    }
+
+    gArpDivision = clockTicks;
+}
+
+void SetArpGateLength(int percent) {
+    if (percent < 1 || percent > 100) {
+        return;
+    }
+
+    gArpGateLength = percent;
+}
+
+void SetArpLatch(bool latch) {
+    gArpLatch = latch;
+
+    // Releasing the latch with no keys down stops the pattern
+    if (!latch && gNoOfHeldNotes == 0) {
+        arp_notes_changed();
+    }
+}
+
+void arp_clock_tick(uint32_t tick, uint64_t timeUs, uint32_t periodUs) {
+    if (gArpMode == ARP_MODE_OFF || gArpSeqLen == 0) {
+        return;
+    }
+    if (tick % gArpDivision != 0) {
+        return;
+    }
+
+    // The DAC write is done at the time of the gate edge
+    uint64_t edgeUs = timeUs + ARP_EDGE_LATENCY_US;
+    uint32_t stepUs = periodUs * gArpDivision;
+
+    set_midi_pitch_no_glide((uint16_t)gArpNext << 9);
+    set_mcp4725_output_at(edgeUs);
+    pulse_out_gate(true, edgeUs);
+    pulse_out_trigger(PULSE_OUT_RETRIG, edgeUs, PULSE_RETRIG_US);
+    if (gArpGateLength < 100) {
+        pulse_out_gate(false, edgeUs + stepUs / 100 * gArpGateLength);
+    }
+    mod_env_gate(true);
+
+    gArpRestart = false;
+    gArpIndex++;
+    arp_prepare_next();
+
+    // The DAC timer keeps the bus free for the write of the next step,
+    // started at its clock tick
+    event_sched_reserve_dac(periodUs != 0 ? timeUs + stepUs : 0);
+}
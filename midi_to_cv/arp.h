@@ -0,0 +1,74 @@
+/***********************************************
+/ arp.h : header file for the arpeggiator functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef ARP_H
+#define ARP_H
+
+#include "pico/stdlib.h"
+#include "voice.h"
+#include "mcp4725.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The arpeggiator plays the held notes of the voice (see voice.h) on the
+// regenerated MIDI clock or the internal clock (see midi_clock.h).
+//
+// The step sequence is built when the held notes or the settings change,
+// and the next step is computed right after a step. A clock tick on a
+// step boundary starts the DAC write of the precomputed pitch, with no
+// glide, and queues the gate edges for the time the write is done,
+// ARP_EDGE_LATENCY_US after the tick. The pitch and the gate change
+// together, 50 us after the clock output edge. The write of the next step
+// is reserved with event_sched_reserve_dac(), so the DAC timer does not
+// hold the bus at the tick.
+//
+// The sequence is built in a local buffer and swapped in with the
+// interrupts disabled, the clock alarm never sees half a sequence.
+////////////////////////////////////////////////////////////////////////////////
+
+#define ARP_MODE_OFF 0
+#define ARP_MODE_UP 1
+#define ARP_MODE_DOWN 2
+#define ARP_MODE_UP_DOWN 3
+#define ARP_MODE_RANDOM 4
+#define ARP_MODE_AS_PLAYED 5
+#define ARP_NO_OF_MODES 6
+
+#define ARP_MAX_OCTAVES 4
+#define ARP_MAX_STEPS (2 * VOICE_MAX_NOTES * ARP_MAX_OCTAVES)
+
+// Step length in MIDI clock ticks
+#define ARP_DIV_1_4 24
+#define ARP_DIV_1_8 12
+#define ARP_DIV_1_8T 8
+#define ARP_DIV_1_16 6
+#define ARP_DIV_1_16T 4
+#define ARP_DIV_1_32 3
+
+#define ARP_DEFAULT_GATE 50 // Gate length in percent of the step
+#define ARP_EDGE_LATENCY_US MCP4725_WRITE_US // Clock tick to pitch and gate
+
+// Global char extern declaration
+extern int gArpMode;
+extern int gArpOctaves;
+extern int gArpDivision; // Step length in MIDI clock ticks
+extern int gArpGateLength; // Percent of the step
+extern bool gArpLatch;
+extern uint8_t gArpSeq[ARP_MAX_STEPS]; // Note numbers of the steps
+extern int gArpSeqLen;
+
+void SetArpMode(int mode);
+void SetArpOctaves(int octaves);
+void SetArpDivision(int clockTicks);
+void SetArpGateLength(int percent);
+void SetArpLatch(bool latch);
+
+// Called by the voice when the held notes change
+void arp_notes_changed();
+
+// Called on every regenerated MIDI clock tick
+void arp_clock_tick(uint32_t tick, uint64_t timeUs, uint32_t periodUs);
+
+#endif // ARP_H
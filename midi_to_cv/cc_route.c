@@ -0,0 +1,313 @@
+/***********************************************
+/ cc_route.c : implementation file for the CC to CV routing functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "main.h"
+#include "cc_route.h"
+#include "cv_out.h"
+#include "midi_uart.h"
+#include "midi_ump.h"
+#include "mcp4725.h"
+#include "hardware/sync.h"
+
+#define CC_PARAM_NONE 0xFF // No route for the selected parameter
+
+// Global char initiation
+cc_route_t gCcRoute[CC_ROUTE_MAX_ROUTES];
+uint8_t gCcRouteMap[128]; // Controller number to CC_MAP_xxx | route
+
+// Run time state of the routes
+static uint16_t gCcRouteRaw14[CC_ROUTE_MAX_ROUTES]; // Latched 14 bit value
+static int32_t gCcRouteTarget[CC_ROUTE_MAX_ROUTES]; // 16 bit units
+static int32_t gCcRouteCurrent[CC_ROUTE_MAX_ROUTES]; // 16 bit units
+static uint32_t gCcRouteActive = 0; // One bit per route still slewing
+
+// Selected parameter per channel
+static uint8_t gCcParamType[16]; // CC_ROUTE_TYPE_NRPN or RPN
+static uint16_t gCcParamNumber[16];
+static uint8_t gCcParamRoute[16]; // Route of the selected parameter
+static uint16_t gCcParamData[16]; // 14 bit data entry value
+
+static inline void cc_route_build_map() {
+    for (int i = 0; i < 128; i++) {
+        gCcRouteMap[i] = CC_MAP_NONE;
+    }
+
+    // Parameter number and data entry controllers
+    gCcRouteMap[6] = CC_MAP_PARAM;
+    gCcRouteMap[38] = CC_MAP_PARAM;
+    gCcRouteMap[96] = CC_MAP_PARAM;
+    gCcRouteMap[97] = CC_MAP_PARAM;
+    gCcRouteMap[98] = CC_MAP_PARAM;
+    gCcRouteMap[99] = CC_MAP_PARAM;
+    gCcRouteMap[100] = CC_MAP_PARAM;
+    gCcRouteMap[101] = CC_MAP_PARAM;
+
+    for (int r = 0; r < CC_ROUTE_MAX_ROUTES; r++) {
+        cc_route_t *pRoute = &gCcRoute[r];
+
+        if (pRoute->type == CC_ROUTE_TYPE_CC7) {
+            gCcRouteMap[pRoute->number] = CC_MAP_ROUTE | r;
+        }
+        else if (pRoute->type == CC_ROUTE_TYPE_CC14) {
+            gCcRouteMap[pRoute->number] = CC_MAP_ROUTE | r;
+            gCcRouteMap[pRoute->number + 32] = CC_MAP_LSB | r;
+        }
+    }
+
+    // The parameter routes are resolved again on the next selection
+    for (int ch = 0; ch < 16; ch++) {
+        gCcParamRoute[ch] = CC_PARAM_NONE;
+    }
+}
+
+void init_cc_route() {
+    for (int r = 0; r < CC_ROUTE_MAX_ROUTES; r++) {
+        gCcRoute[r].type = CC_ROUTE_TYPE_NONE;
+    }
+    for (int ch = 0; ch < 16; ch++) {
+        gCcParamType[ch] = CC_ROUTE_TYPE_RPN;
+        gCcParamNumber[ch] = CC_RPN_NULL;
+        gCcParamData[ch] = 0;
+    }
+
+    // Default: Mod wheel (CC1 and CC33) to the mod wheel output
+    SetCcRoute(0, CC_ROUTE_TYPE_CC14, 1, CV_OUT_MOD_WHEEL, 
+        CC_ROUTE_SCALE_ONE, 0, CC_ROUTE_NO_SLEW);
+}
+
+void SetCcRoute(int routeNo, int type, int number, int output, int32_t scale, int32_t offset, uint32_t slew) {
+    if (routeNo < 0 || routeNo >= CC_ROUTE_MAX_ROUTES) {
+        return;
+    }
+    if (output < 0 || output >= CV_OUT_NO_OF_OUTPUTS) {
+        return;
+    }
+
+    switch (type) {
+    case CC_ROUTE_TYPE_CC7:
+        // Channel mode messages and the parameter controllers can't be routed
+        if (number < 0 || number > 119 || 
+            (gCcRouteMap[number] & CC_MAP_TYPE_MASK) == CC_MAP_PARAM) {
+            return;
+        }
+        break;
+    case CC_ROUTE_TYPE_CC14:
+        if (number < 0 || number > 31 || number == 6) {
+            return;
+        }
+        break;
+    case CC_ROUTE_TYPE_NRPN:
+    case CC_ROUTE_TYPE_RPN:
+        if (number < 0 || number > 0x3FFF) {
+            return;
+        }
+        break;
+    default:
+        return;
+    }
+
+    gCcRoute[routeNo].type = type;
+    gCcRoute[routeNo].output = output;
+    gCcRoute[routeNo].number = number;
+    gCcRoute[routeNo].scale = scale;
+    gCcRoute[routeNo].offset = offset;
+    gCcRoute[routeNo].slew = slew;
+    gCcRouteRaw14[routeNo] = 0;
+
+    cc_route_build_map();
+}
+
+void ClearCcRoute(int routeNo) {
+    if (routeNo < 0 || routeNo >= CC_ROUTE_MAX_ROUTES) {
+        return;
+    }
+
+    gCcRoute[routeNo].type = CC_ROUTE_TYPE_NONE;
+    gCcRouteActive &= ~(1u << routeNo);
+    cc_route_build_map();
+}
+
+// New 16 bit input value of a route
+static inline void cc_route_set_value(int routeNo, uint16_t value) {
+    cc_route_t *pRoute = &gCcRoute[routeNo];
+    int32_t target = pRoute->offset + 
+        (int32_t)(((int64_t)value * pRoute->scale) >> 16);
+
+    if (target < 0) {
+        target = 0;
+    }
+    else if (target > 0xFFFF) {
+        target = 0xFFFF;
+    }
+
+    gCcRouteTarget[routeNo] = target;
+    gCcRouteActive |= 1u << routeNo;
+    control_timers_wake();
+}
+
+// Find the route of a parameter when it is selected
+static inline uint8_t cc_route_find_param(int type, uint16_t number) {
+    for (int r = 0; r < CC_ROUTE_MAX_ROUTES; r++) {
+        if (gCcRoute[r].type == type && gCcRoute[r].number == number) {
+            return r;
+        }
+    }
+    return CC_PARAM_NONE;
+}
+
+static inline void cc_route_param_select(uint8_t midiCh, int type, uint16_t number) {
+    gCcParamType[midiCh] = type;
+    gCcParamNumber[midiCh] = number;
+    gCcParamRoute[midiCh] = cc_route_find_param(type, number);
+}
+
+// Data entry of the selected parameter, data is 14 bits
+static inline void cc_route_param_data(uint8_t midiCh, uint16_t data) {
+    gCcParamData[midiCh] = data;
+
+    if (gCcParamType[midiCh] == CC_ROUTE_TYPE_RPN) {
+        switch (gCcParamNumber[midiCh]) {
+        case CC_RPN_PITCH_BEND_RANGE:
+            SetHalfPitchWheelRange(data >> 7);
+            return;
+        case CC_RPN_NULL:
+            return;
+        }
+    }
+
+    uint8_t routeNo = gCcParamRoute[midiCh];
+    if (routeNo != CC_PARAM_NONE) {
+        cc_route_set_value(routeNo, (uint16_t)ump_scale_up(data, 14, 16));
+    }
+}
+
+static inline void cc_route_param_control(uint8_t midiCh, uint8_t controlNo, uint8_t value) {
+    uint16_t number = gCcParamNumber[midiCh];
+    uint16_t data = gCcParamData[midiCh];
+
+    switch (controlNo) {
+    case 99: // NRPN MSB
+        cc_route_param_select(midiCh, CC_ROUTE_TYPE_NRPN, 
+            ((uint16_t)value << 7) | (number & 0x7F));
+        break;
+    case 98: // NRPN LSB
+        cc_route_param_select(midiCh, CC_ROUTE_TYPE_NRPN, 
+            (number & 0x3F80) | value);
+        break;
+    case 101: // RPN MSB
+        cc_route_param_select(midiCh, CC_ROUTE_TYPE_RPN, 
+            ((uint16_t)value << 7) | (number & 0x7F));
+        break;
+    case 100: // RPN LSB
+        cc_route_param_select(midiCh, CC_ROUTE_TYPE_RPN, 
+            (number & 0x3F80) | value);
+        break;
+    case 6: // Data entry MSB, clears the LSB
+        cc_route_param_data(midiCh, (uint16_t)value << 7);
+        break;
+    case 38: // Data entry LSB
+        cc_route_param_data(midiCh, (data & 0x3F80) | value);
+        break;
+    case 96: // Data increment
+        if (data < 0x3FFF) {
+            cc_route_param_data(midiCh, data + 1);
+        }
+        break;
+    case 97: // Data decrement
+        if (data > 0) {
+            cc_route_param_data(midiCh, data - 1);
+        }
+        break;
+    }
+}
+
+bool cc_route_control_change(uint8_t midiCh, uint8_t controlNo, uint8_t value) {
+    uint8_t map = gCcRouteMap[controlNo & 0x7F];
+    uint8_t routeNo = map & CC_MAP_ROUTE_MASK;
+
+    midiCh &= 0x0F;
+    value &= 0x7F;
+
+    switch (map & CC_MAP_TYPE_MASK) {
+    case CC_MAP_NONE:
+        return false;
+    case CC_MAP_ROUTE:
+        if (gCcRoute[routeNo].type == CC_ROUTE_TYPE_CC14) {
+            // The MSB clears the LSB
+            gCcRouteRaw14[routeNo] = (uint16_t)value << 7;
+            cc_route_set_value(routeNo, 
+                (uint16_t)ump_scale_up(gCcRouteRaw14[routeNo], 14, 16));
+        }
+        else {
+            cc_route_set_value(routeNo, (uint16_t)ump_scale_up(value, 7, 16));
+        }
+        break;
+    case CC_MAP_LSB:
+        gCcRouteRaw14[routeNo] = (gCcRouteRaw14[routeNo] & 0x3F80) | value;
+        cc_route_set_value(routeNo, 
+            (uint16_t)ump_scale_up(gCcRouteRaw14[routeNo], 14, 16));
+        break;
+    case CC_MAP_PARAM:
+        cc_route_param_control(midiCh, controlNo, value);
+        break;
+    }
+
+    return true;
+}
+
+bool cc_route_controller_32(int type, uint16_t number, uint32_t value) {
+    uint8_t routeNo = CC_PARAM_NONE;
+
+    if (type == CC_ROUTE_TYPE_CC7) {
+        uint8_t map = gCcRouteMap[number & 0x7F];
+        if ((map & CC_MAP_TYPE_MASK) == CC_MAP_ROUTE) {
+            routeNo = map & CC_MAP_ROUTE_MASK;
+        }
+    }
+    else {
+        routeNo = cc_route_find_param(type, number);
+    }
+
+    if (routeNo == CC_PARAM_NONE) {
+        return false;
+    }
+
+    cc_route_set_value(routeNo, (uint16_t)ump_scale_down(value, 32, 16));
+    return true;
+}
+
+// Returns true while a route is slewing
+bool cc_route_update() {
+    uint32_t active = gCcRouteActive;
+
+    while (active) {
+        int r = __builtin_ctz(active);
+        active &= active - 1;
+
+        cc_route_t *pRoute = &gCcRoute[r];
+        int32_t diff = gCcRouteTarget[r] - gCcRouteCurrent[r];
+
+        if (pRoute->slew == CC_ROUTE_NO_SLEW || (uint32_t)abs(diff) <= pRoute->slew) {
+            gCcRouteCurrent[r] = gCcRouteTarget[r];
+
+            // A new value from the MIDI interrupt keeps the route active
+            uint32_t status = save_and_disable_interrupts();
+            if (gCcRouteTarget[r] == gCcRouteCurrent[r]) {
+                gCcRouteActive &= ~(1u << r);
+            }
+            restore_interrupts(status);
+        }
+        else {
+            gCcRouteCurrent[r] += diff > 0 ? (int32_t)pRoute->slew : -(int32_t)pRoute->slew;
+        }
+
+        cv_out_set(pRoute->output, (uint16_t)gCcRouteCurrent[r]);
+    }
+
+    return gCcRouteActive != 0;
+}
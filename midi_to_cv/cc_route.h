@@ -0,0 +1,73 @@
+/***********************************************
+/ cc_route.h : header file for the CC to CV routing functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef CC_ROUTE_H
+#define CC_ROUTE_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// A route maps a controller (7 bit CC, 14 bit CC pair, NRPN or RPN) to a
+// CV output (see cv_out.h) with scale, offset and slew. Incoming values
+// are 16 bits, the output is offset + value * scale.
+//
+// gCcRouteMap[] is indexed by the controller number, an unmapped CC costs
+// one lookup. The NRPN/RPN number is resolved to a route when it is
+// selected, so data entry is also one lookup. The routes are moved
+// towards their targets at control rate by cc_route_update(), which only
+// sets outputs that changed (cv_out marks them dirty).
+////////////////////////////////////////////////////////////////////////////////
+
+#define CC_ROUTE_MAX_ROUTES 8
+
+#define CC_ROUTE_TYPE_NONE 0
+#define CC_ROUTE_TYPE_CC7 1 // 7 bit CC 0 - 119
+#define CC_ROUTE_TYPE_CC14 2 // 14 bit CC, MSB 0 - 31 and LSB 32 - 63
+#define CC_ROUTE_TYPE_NRPN 3 // 14 bit parameter number
+#define CC_ROUTE_TYPE_RPN 4 // 14 bit parameter number
+
+// Dispatch table entries, the low nibble is the route number
+#define CC_MAP_NONE 0x00
+#define CC_MAP_ROUTE 0x10 // 7 bit CC or MSB of a 14 bit CC
+#define CC_MAP_LSB 0x20 // LSB of a 14 bit CC
+#define CC_MAP_PARAM 0x30 // NRPN/RPN number and data entry
+#define CC_MAP_TYPE_MASK 0xF0
+#define CC_MAP_ROUTE_MASK 0x0F
+
+#define CC_ROUTE_SCALE_ONE 0x10000 // Scale 1.0 in Q16
+#define CC_ROUTE_NO_SLEW 0
+
+#define CC_RPN_PITCH_BEND_RANGE 0x0000
+#define CC_RPN_NULL 0x3FFF
+
+typedef struct {
+    uint8_t type; // CC_ROUTE_TYPE_xxx
+    uint8_t output; // CV_OUT_xxx
+    uint16_t number; // Controller or parameter number
+    int32_t scale; // Q16
+    int32_t offset; // 16 bit units
+    uint32_t slew; // Max change per control tick [16 bit units], 0 is no slew
+} cc_route_t;
+
+// Global char extern declaration
+extern cc_route_t gCcRoute[CC_ROUTE_MAX_ROUTES];
+extern uint8_t gCcRouteMap[128];
+
+void init_cc_route();
+void SetCcRoute(int routeNo, int type, int number, int output, int32_t scale, int32_t offset, uint32_t slew);
+void ClearCcRoute(int routeNo);
+
+// MIDI 1.0 control change, returns true if the controller was used
+bool cc_route_control_change(uint8_t midiCh, uint8_t controlNo, uint8_t value);
+
+// MIDI 2.0 controller with a 32 bit value, type is CC_ROUTE_TYPE_CC7,
+// NRPN or RPN, returns true if the controller was used
+bool cc_route_controller_32(int type, uint16_t number, uint32_t value);
+
+// Called at control rate (glide_timer_callback), true while slewing
+bool cc_route_update();
+
+#endif // CC_ROUTE_H
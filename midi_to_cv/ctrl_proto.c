@@ -0,0 +1,390 @@
+/***********************************************
+/ ctrl_proto.c : implementation file for the binary control protocol
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <string.h>
+#include "ctrl_proto.h"
+#include "params.h"
+#include "settings.h"
+#include "midi_uart.h"
+#include "midi_clock.h"
+#include "midi_thru.h"
+#include "mcp4725.h"
+#include "pulse_out.h"
+#include "voice.h"
+#include "cv_out.h"
+#include "usb_midi.h"
+#include "sysex.h"
+#include "event_sched.h"
+#include "power.h"
+#include "selftest.h"
+#include "i2c_sched.h"
+#include "pio_midi.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+
+// Global char initiation
+uint32_t gCtrlFrames = 0;
+uint32_t gCtrlErrors = 0;
+uint32_t gCtrlTxDropped = 0;
+uint16_t gCtrlStreamMs = 0;
+
+static uint8_t gCtrlRx[CTRL_RX_SIZE];
+static int gCtrlRxLen = 0;
+static uint8_t gCtrlTx[CTRL_MAX_FRAME]; // The payload is written in place
+static uint64_t gCtrlNextStateUs = 0;
+
+static inline uint8_t ctrl_crc8(const uint8_t *data, int len) {
+    uint8_t crc = 0;
+
+    for (int i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static inline void ctrl_put_u16(uint8_t *p, uint16_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static inline void ctrl_put_u32(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+// The payload is already in gCtrlTx after the header
+static inline void ctrl_send(uint8_t cmd, int len) {
+    int frameLen = CTRL_HEADER_SIZE + len + 1;
+
+    gCtrlTx[0] = CTRL_SYNC;
+    gCtrlTx[1] = cmd;
+    gCtrlTx[2] = (uint8_t)len;
+    gCtrlTx[CTRL_HEADER_SIZE + len] = ctrl_crc8(&gCtrlTx[1], len + 2);
+
+    if (tud_cdc_n_write_available(CTRL_PROTO_CDC_ITF) < (uint32_t)frameLen) {
+        gCtrlTxDropped++;
+        return;
+    }
+    tud_cdc_n_write(CTRL_PROTO_CDC_ITF, gCtrlTx, frameLen);
+    tud_cdc_n_write_flush(CTRL_PROTO_CDC_ITF);
+}
+
+static inline void ctrl_send_error(uint8_t cmd, uint8_t err) {
+    gCtrlTx[CTRL_HEADER_SIZE] = cmd;
+    gCtrlTx[CTRL_HEADER_SIZE + 1] = err;
+    ctrl_send(CTRL_CMD_ERROR, 2);
+}
+
+static inline void ctrl_send_param(uint8_t cmd, int id) {
+    int value = 0;
+
+    if (!param_get(id, &value)) {
+        ctrl_send_error(cmd & ~CTRL_REPLY, CTRL_ERR_RANGE);
+        return;
+    }
+
+    uint8_t *p = &gCtrlTx[CTRL_HEADER_SIZE];
+    p[0] = (uint8_t)id;
+    ctrl_put_u16(&p[1], (uint16_t)value);
+    ctrl_send(cmd, 3);
+}
+
+static inline void ctrl_send_dump() {
+    uint8_t *p = &gCtrlTx[CTRL_HEADER_SIZE];
+    int len = 0;
+
+    p[len++] = PARAM_NO_OF_PARAMS;
+    for (int id = 0; id < PARAM_NO_OF_PARAMS; id++) {
+        int value = 0;
+        param_get(id, &value);
+        ctrl_put_u16(&p[len], (uint16_t)value);
+        len += 2;
+    }
+    ctrl_send(CTRL_CMD_PARAM_DUMP | CTRL_REPLY, len);
+}
+
+static inline void ctrl_send_counters() {
+    uint32_t counters[CTRL_NO_OF_COUNTERS];
+
+    counters[CTRL_COUNTER_USB_PACKETS] = gUsbMidiPackets;
+    counters[CTRL_COUNTER_USB_ERRORS] = gUsbMidiErrors;
+    counters[CTRL_COUNTER_SYSEX_MESSAGES] = gSysexMessages;
+    counters[CTRL_COUNTER_SYSEX_DROPPED] = gSysexDropped;
+    counters[CTRL_COUNTER_THRU_DROPPED] = gThruDropped;
+    counters[CTRL_COUNTER_PULSE_EDGES] = gPulseStats.edges;
+    counters[CTRL_COUNTER_PULSE_LATE] = gPulseStats.late;
+    counters[CTRL_COUNTER_PULSE_DROPPED] = gPulseStats.dropped;
+    counters[CTRL_COUNTER_SCHED_QUEUED] = gSchedStats.queued;
+    counters[CTRL_COUNTER_SCHED_LATE] = gSchedStats.late;
+    counters[CTRL_COUNTER_SCHED_OVERFLOWS] = gSchedStats.overflows;
+    counters[CTRL_COUNTER_SETTINGS_ERASES] = gSettingsErases;
+    counters[CTRL_COUNTER_SETTINGS_DROPPED] = gSettingsDropped;
+    counters[CTRL_COUNTER_POWER_SLEEPS] = gPowerSleeps;
+    counters[CTRL_COUNTER_CONTROL_IDLE] = gControlIdleCount;
+    counters[CTRL_COUNTER_WAKE_TO_DAC_MAX_US] = gControlWakeToDacMaxUs;
+    counters[CTRL_COUNTER_CTRL_FRAMES] = gCtrlFrames;
+    counters[CTRL_COUNTER_CTRL_ERRORS] = gCtrlErrors;
+    counters[CTRL_COUNTER_CTRL_TX_DROPPED] = gCtrlTxDropped;
+    counters[CTRL_COUNTER_UART0_OVERRUNS] = gUartOverruns[0];
+    counters[CTRL_COUNTER_UART1_OVERRUNS] = gUartOverruns[1];
+    counters[CTRL_COUNTER_I2C0_LOAD] = gI2cStats[I2C_SCHED_BUS0].loadPermille;
+    counters[CTRL_COUNTER_I2C1_LOAD] = gI2cStats[I2C_SCHED_BUS1].loadPermille;
+    counters[CTRL_COUNTER_I2C_PITCH_WAIT_MAX_US] = gI2cStats[I2C_SCHED_BUS0].maxWaitUs[I2C_PRIO_PITCH];
+    counters[CTRL_COUNTER_I2C_ERRORS] = gI2cStats[I2C_SCHED_BUS0].errors + gI2cStats[I2C_SCHED_BUS1].errors;
+    counters[CTRL_COUNTER_I2C_NACKS] = gI2cStats[I2C_SCHED_BUS0].nacks + gI2cStats[I2C_SCHED_BUS1].nacks;
+    counters[CTRL_COUNTER_I2C_TIMEOUTS] = gI2cStats[I2C_SCHED_BUS0].timeouts + gI2cStats[I2C_SCHED_BUS1].timeouts;
+    counters[CTRL_COUNTER_I2C_RECOVERIES] = gI2cStats[I2C_SCHED_BUS0].recoveries + gI2cStats[I2C_SCHED_BUS1].recoveries;
+    counters[CTRL_COUNTER_PIO_MIDI_OVERRUNS] = gPioMidiOverruns[0] + gPioMidiOverruns[1];
+
+    uint8_t *p = &gCtrlTx[CTRL_HEADER_SIZE];
+    p[0] = CTRL_NO_OF_COUNTERS;
+    for (int i = 0; i < CTRL_NO_OF_COUNTERS; i++) {
+        ctrl_put_u32(&p[1 + 4 * i], counters[i]);
+    }
+    ctrl_send(CTRL_CMD_COUNTERS | CTRL_REPLY, 1 + 4 * CTRL_NO_OF_COUNTERS);
+}
+
+// state u8 (SELFTEST_STATE_xxx), pass u8, duration [ms] u32,
+// 2 x (sent u32, parsed u32, clocks sent u32, clocks parsed u32,
+// overruns u32, ISR max [us] u32), SysEx sent u32, parsed u32, dropped u32
+static inline void ctrl_send_selftest_report() {
+    uint8_t *p = &gCtrlTx[CTRL_HEADER_SIZE];
+    int len = 0;
+
+    p[len++] = (uint8_t)gSelftestReport.state;
+    p[len++] = gSelftestReport.isPass ? 1 : 0;
+    ctrl_put_u32(&p[len], gSelftestReport.durationMs);
+    len += 4;
+    for (int i = 0; i < 2; i++) {
+        const selftest_uart_report_t *pUart = &gSelftestReport.uart[i];
+        uint32_t values[6] = { pUart->sent, pUart->parsed, pUart->clocksSent,
+            pUart->clocksParsed, pUart->overruns, pUart->isrMaxUs };
+        for (int j = 0; j < 6; j++) {
+            ctrl_put_u32(&p[len], values[j]);
+            len += 4;
+        }
+    }
+    ctrl_put_u32(&p[len], gSelftestReport.sysexSent);
+    len += 4;
+    ctrl_put_u32(&p[len], gSelftestReport.sysexParsed);
+    len += 4;
+    ctrl_put_u32(&p[len], gSelftestReport.sysexDropped);
+    len += 4;
+    ctrl_send(CTRL_CMD_SELFTEST_REPORT | CTRL_REPLY, len);
+}
+
+// time [ms] u32, note u8 (0xFF is none), gate u8, DAC value u16,
+// clock BPM x 100 u32, pitch wheel [Q16 half notes] i32,
+// CV_OUT_NO_OF_OUTPUTS x cv output u16
+static inline void ctrl_send_state() {
+    uint8_t *p = &gCtrlTx[CTRL_HEADER_SIZE];
+    int len = 0;
+
+    // A consistent snapshot of the values the interrupts change
+    uint32_t status = save_and_disable_interrupts();
+    int noOfHeldNotes = gNoOfHeldNotes;
+    uint8_t note = noOfHeldNotes > 0 ? gHeldNotes[noOfHeldNotes - 1] : 0xFF;
+    uint16_t dacValue = (uint16_t)gDACValOld;
+    int32_t pitchWheel = gPWCurrent;
+    uint16_t cvOut[CV_OUT_NO_OF_OUTPUTS];
+    memcpy(cvOut, gCvOut, sizeof(cvOut));
+    restore_interrupts(status);
+
+    ctrl_put_u32(&p[len], (uint32_t)(time_us_64() / 1000));
+    len += 4;
+    p[len++] = note;
+    p[len++] = noOfHeldNotes > 0 ? 1 : 0;
+    ctrl_put_u16(&p[len], dacValue);
+    len += 2;
+    ctrl_put_u32(&p[len], midi_clock_get_bpm_x100(gMidiClk));
+    len += 4;
+    ctrl_put_u32(&p[len], (uint32_t)pitchWheel);
+    len += 4;
+    for (int i = 0; i < CV_OUT_NO_OF_OUTPUTS; i++) {
+        ctrl_put_u16(&p[len], cvOut[i]);
+        len += 2;
+    }
+    ctrl_send(CTRL_CMD_STATE, len);
+}
+
+// The setters are shared with the MIDI interrupts
+static inline bool ctrl_param_set(int id, int value) {
+    uint32_t status = save_and_disable_interrupts();
+    bool isSet = param_set(id, value);
+    restore_interrupts(status);
+    return isSet;
+}
+
+static inline uint16_t ctrl_get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// The payload points into the receive buffer
+static inline void ctrl_handle_frame(uint8_t cmd, const uint8_t *payload, int len) {
+    uint8_t *p = &gCtrlTx[CTRL_HEADER_SIZE];
+
+    switch (cmd) {
+    case CTRL_CMD_PING:
+        p[0] = CTRL_PROTO_VERSION;
+        p[1] = PARAM_NO_OF_PARAMS;
+        ctrl_send(cmd | CTRL_REPLY, 2);
+        break;
+    case CTRL_CMD_PARAM_GET:
+        if (len != 1) {
+            ctrl_send_error(cmd, CTRL_ERR_LENGTH);
+            break;
+        }
+        ctrl_send_param(cmd | CTRL_REPLY, payload[0]);
+        break;
+    case CTRL_CMD_PARAM_SET:
+        if (len != 3) {
+            ctrl_send_error(cmd, CTRL_ERR_LENGTH);
+            break;
+        }
+        if (!ctrl_param_set(payload[0], ctrl_get_u16(&payload[1]))) {
+            ctrl_send_error(cmd, CTRL_ERR_RANGE);
+            break;
+        }
+        settings_save_current();
+        ctrl_send_param(cmd | CTRL_REPLY, payload[0]);
+        break;
+    case CTRL_CMD_PARAM_DUMP:
+        ctrl_send_dump();
+        break;
+    case CTRL_CMD_STREAM:
+        {
+            if (len != 2) {
+                ctrl_send_error(cmd, CTRL_ERR_LENGTH);
+                break;
+            }
+            uint16_t periodMs = ctrl_get_u16(payload);
+            if (periodMs != 0 && periodMs < CTRL_MIN_STREAM_MS) {
+                periodMs = CTRL_MIN_STREAM_MS;
+            }
+            gCtrlStreamMs = periodMs;
+            gCtrlNextStateUs = time_us_64();
+            ctrl_put_u16(p, periodMs);
+            ctrl_send(cmd | CTRL_REPLY, 2);
+        }
+        break;
+    case CTRL_CMD_COUNTERS:
+        ctrl_send_counters();
+        break;
+    case CTRL_CMD_PRESET_STORE:
+        if (len != 1) {
+            ctrl_send_error(cmd, CTRL_ERR_LENGTH);
+            break;
+        }
+        if (payload[0] >= SETTINGS_NO_OF_PRESETS) {
+            ctrl_send_error(cmd, CTRL_ERR_RANGE);
+            break;
+        }
+        settings_store_preset(payload[0]);
+        p[0] = payload[0];
+        ctrl_send(cmd | CTRL_REPLY, 1);
+        break;
+    case CTRL_CMD_SELFTEST:
+        {
+            if (len != 2) {
+                ctrl_send_error(cmd, CTRL_ERR_LENGTH);
+                break;
+            }
+            uint16_t durationMs = ctrl_get_u16(payload);
+            if (durationMs == 0) {
+                durationMs = SELFTEST_DEFAULT_MS;
+            }
+            if (!selftest_start(durationMs)) {
+                ctrl_send_error(cmd, CTRL_ERR_BUSY);
+                break;
+            }
+            ctrl_put_u16(p, (uint16_t)gSelftestReport.durationMs);
+            ctrl_send(cmd | CTRL_REPLY, 2);
+        }
+        break;
+    case CTRL_CMD_SELFTEST_REPORT:
+        ctrl_send_selftest_report();
+        break;
+    default:
+        ctrl_send_error(cmd, CTRL_ERR_UNKNOWN);
+        break;
+    }
+}
+
+// Handles the complete frames in the receive buffer, returns the number
+// of bytes used. A partial frame is left for the next call.
+static inline int ctrl_parse(int maxFrames) {
+    int pos = 0;
+
+    while (maxFrames > 0 && pos < gCtrlRxLen) {
+        if (gCtrlRx[pos] != CTRL_SYNC) {
+            pos++;
+            gCtrlErrors++;
+            continue;
+        }
+        if (gCtrlRxLen - pos < CTRL_HEADER_SIZE) {
+            break;
+        }
+
+        int len = gCtrlRx[pos + 2];
+        if (len > CTRL_MAX_PAYLOAD) {
+            pos++;
+            gCtrlErrors++;
+            continue;
+        }
+        if (gCtrlRxLen - pos < CTRL_HEADER_SIZE + len + 1) {
+            break;
+        }
+
+        if (ctrl_crc8(&gCtrlRx[pos + 1], len + 2) != gCtrlRx[pos + CTRL_HEADER_SIZE + len]) {
+            // Maybe a sync byte in the data, look for the next one
+            pos++;
+            gCtrlErrors++;
+            continue;
+        }
+
+        gCtrlFrames++;
+        ctrl_handle_frame(gCtrlRx[pos + 1], &gCtrlRx[pos + CTRL_HEADER_SIZE], len);
+        pos += CTRL_HEADER_SIZE + len + 1;
+        maxFrames--;
+    }
+
+    return pos;
+}
+
+void ctrl_proto_task() {
+    if (!tud_cdc_n_connected(CTRL_PROTO_CDC_ITF)) {
+        gCtrlStreamMs = 0;
+        gCtrlRxLen = 0;
+        return;
+    }
+
+    if (gCtrlRxLen < CTRL_RX_SIZE && tud_cdc_n_available(CTRL_PROTO_CDC_ITF) > 0) {
+        gCtrlRxLen += (int)tud_cdc_n_read(CTRL_PROTO_CDC_ITF, &gCtrlRx[gCtrlRxLen],
+            CTRL_RX_SIZE - gCtrlRxLen);
+    }
+
+    int used = ctrl_parse(CTRL_FRAMES_PER_TASK);
+    if (used > 0) {
+        // Only the start of the next frame is moved down
+        gCtrlRxLen -= used;
+        memmove(gCtrlRx, &gCtrlRx[used], gCtrlRxLen);
+    }
+
+    uint64_t now = time_us_64();
+    if (gCtrlStreamMs != 0 && now >= gCtrlNextStateUs) {
+        gCtrlNextStateUs += (uint64_t)gCtrlStreamMs * 1000;
+        if (gCtrlNextStateUs <= now) {
+            // Fallen behind, no burst of old states
+            gCtrlNextStateUs = now + (uint64_t)gCtrlStreamMs * 1000;
+        }
+        ctrl_send_state();
+    }
+}
@@ -0,0 +1,106 @@
+/***********************************************
+/ ctrl_proto.h : header file for the binary control protocol over USB CDC
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef CTRL_PROTO_H
+#define CTRL_PROTO_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The second CDC interface of the USB device carries a framed binary
+// protocol, the first one is stdio. A frame is
+//
+//   CTRL_SYNC, command, payload length, payload, CRC-8
+//
+// The CRC-8 (polynomial 0x07) covers the command, the length and the
+// payload, values are little endian. A bad frame is skipped up to the
+// next sync byte. Every request is answered with command | CTRL_REPLY or
+// with CTRL_CMD_ERROR.
+//
+// The frames are parsed by ctrl_proto_task() in the main loop, the
+// interrupts never wait for it. A frame is handled in place in the receive
+// buffer and the answer is built in place in the transmit frame. A full
+// CDC transmit FIFO drops the answer, the task never blocks.
+//
+// The parameters are the parameter table (see params.h). The state
+// stream sends CTRL_CMD_STATE frames every period until it is set to 0.
+////////////////////////////////////////////////////////////////////////////////
+
+#define CTRL_PROTO_CDC_ITF 1 // CDC interface 0 is stdio
+#define CTRL_SYNC 0xA5
+#define CTRL_HEADER_SIZE 3 // Sync, command and length
+#define CTRL_MAX_PAYLOAD 128
+#define CTRL_MAX_FRAME (CTRL_HEADER_SIZE + CTRL_MAX_PAYLOAD + 1)
+#define CTRL_RX_SIZE (2 * CTRL_MAX_FRAME)
+#define CTRL_FRAMES_PER_TASK 4 // Frames handled per ctrl_proto_task() call
+#define CTRL_MIN_STREAM_MS 10
+
+#define CTRL_REPLY 0x80
+
+// Requests
+#define CTRL_CMD_PING 0x00 // -> protocol version u8, number of parameters u8
+#define CTRL_CMD_PARAM_GET 0x01 // id u8 -> id u8, value u16
+#define CTRL_CMD_PARAM_SET 0x02 // id u8, value u16 -> id u8, value u16
+#define CTRL_CMD_PARAM_DUMP 0x03 // -> number u8, number x value u16
+#define CTRL_CMD_STREAM 0x04 // period u16 [ms], 0 is off -> period u16
+#define CTRL_CMD_COUNTERS 0x05 // -> number u8, number x counter u32
+#define CTRL_CMD_PRESET_STORE 0x06 // preset u8 -> preset u8
+#define CTRL_CMD_SELFTEST 0x07 // duration u16 [ms], 0 is the default -> duration u16
+#define CTRL_CMD_SELFTEST_REPORT 0x08 // -> see ctrl_send_selftest_report()
+
+// Sent by the device
+#define CTRL_CMD_STATE 0x90 // See ctrl_send_state()
+#define CTRL_CMD_ERROR 0xFF // command u8, CTRL_ERR_xxx u8
+
+#define CTRL_ERR_UNKNOWN 1 // Unknown command
+#define CTRL_ERR_LENGTH 2 // Wrong payload length
+#define CTRL_ERR_RANGE 3 // Parameter ID or value out of range
+#define CTRL_ERR_BUSY 4 // A self test is running or no DMA channel is free
+
+#define CTRL_PROTO_VERSION 1
+
+// Order of the counters in the CTRL_CMD_COUNTERS answer
+#define CTRL_COUNTER_USB_PACKETS 0
+#define CTRL_COUNTER_USB_ERRORS 1
+#define CTRL_COUNTER_SYSEX_MESSAGES 2
+#define CTRL_COUNTER_SYSEX_DROPPED 3
+#define CTRL_COUNTER_THRU_DROPPED 4
+#define CTRL_COUNTER_PULSE_EDGES 5
+#define CTRL_COUNTER_PULSE_LATE 6
+#define CTRL_COUNTER_PULSE_DROPPED 7
+#define CTRL_COUNTER_SCHED_QUEUED 8
+#define CTRL_COUNTER_SCHED_LATE 9
+#define CTRL_COUNTER_SCHED_OVERFLOWS 10
+#define CTRL_COUNTER_SETTINGS_ERASES 11
+#define CTRL_COUNTER_SETTINGS_DROPPED 12
+#define CTRL_COUNTER_POWER_SLEEPS 13
+#define CTRL_COUNTER_CONTROL_IDLE 14
+#define CTRL_COUNTER_WAKE_TO_DAC_MAX_US 15
+#define CTRL_COUNTER_CTRL_FRAMES 16
+#define CTRL_COUNTER_CTRL_ERRORS 17
+#define CTRL_COUNTER_CTRL_TX_DROPPED 18
+#define CTRL_COUNTER_UART0_OVERRUNS 19
+#define CTRL_COUNTER_UART1_OVERRUNS 20
+#define CTRL_COUNTER_I2C0_LOAD 21 // Permille
+#define CTRL_COUNTER_I2C1_LOAD 22 // Permille
+#define CTRL_COUNTER_I2C_PITCH_WAIT_MAX_US 23
+#define CTRL_COUNTER_I2C_ERRORS 24
+#define CTRL_COUNTER_I2C_NACKS 25
+#define CTRL_COUNTER_I2C_TIMEOUTS 26
+#define CTRL_COUNTER_I2C_RECOVERIES 27
+#define CTRL_COUNTER_PIO_MIDI_OVERRUNS 28
+#define CTRL_NO_OF_COUNTERS 29
+
+// Global char extern declaration
+extern uint32_t gCtrlFrames; // Valid frames received
+extern uint32_t gCtrlErrors; // Bad CRC, bad length or skipped bytes
+extern uint32_t gCtrlTxDropped; // Answers and state frames not sent
+extern uint16_t gCtrlStreamMs; // State stream period, 0 is off
+
+// Called from the main loop
+void ctrl_proto_task();
+
+#endif // CTRL_PROTO_H
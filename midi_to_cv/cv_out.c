@@ -0,0 +1,35 @@
+/***********************************************
+/ cv_out.c : implementation file for the secondary CV output functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "cv_out.h"
+#include "mcp4725.h"
+#include "hardware/sync.h"
+
+// Global char initiation
+uint16_t gCvOut[CV_OUT_NO_OF_OUTPUTS];
+uint32_t gCvOutDirty = 0; // One bit per output
+
+void cv_out_set(int output, uint16_t value) {
+    if (output < 0 || output >= CV_OUT_NO_OF_OUTPUTS) {
+        return;
+    }
+    if (gCvOut[output] == value) {
+        return;
+    }
+
+    gCvOut[output] = value;
+    gCvOutDirty |= 1u << output;
+    control_timers_wake();
+}
+
+uint32_t cv_out_take_dirty() {
+    uint32_t status = save_and_disable_interrupts();
+    uint32_t dirty = gCvOutDirty;
+    gCvOutDirty = 0;
+    restore_interrupts(status);
+
+    return dirty;
+}
@@ -0,0 +1,33 @@
+/***********************************************
+/ cv_out.h : header file for the secondary CV output functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef CV_OUT_H
+#define CV_OUT_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The secondary CV outputs (everything except V/oct) are 16 bit values.
+// Setting a value marks the output dirty, the output driver only writes
+// the outputs that changed since the last update.
+////////////////////////////////////////////////////////////////////////////////
+
+#define CV_OUT_VELOCITY 0
+#define CV_OUT_MOD_WHEEL 1
+#define CV_OUT_AFTERTOUCH 2
+#define CV_OUT_TIMBRE 3 // MPE CC74
+#define CV_OUT_NO_OF_OUTPUTS 4
+
+// Global char extern declaration
+extern uint16_t gCvOut[CV_OUT_NO_OF_OUTPUTS];
+extern uint32_t gCvOutDirty; // One bit per output
+
+void cv_out_set(int output, uint16_t value);
+
+// Returns the dirty bits and clears them
+uint32_t cv_out_take_dirty();
+
+#endif // CV_OUT_H
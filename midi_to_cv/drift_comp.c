@@ -0,0 +1,228 @@
+/***********************************************
+/ drift_comp.c : implementation file for the V/oct drift compensation
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "drift_comp.h"
+#include "mcp4725.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+
+#define DRIFT_WEIGHT_SHIFT 8 // Weight of a new point in the sums
+
+// Global char initiation
+int gDriftCompMode = DRIFT_COMP_OFF;
+int32_t gDriftGainQ16 = 1 << 16;
+int32_t gDriftOffsetQ4 = 0;
+uint32_t gDriftCaptures = 0;
+uint32_t gDriftDiscarded = 0;
+
+static int32_t gDriftInvGainQ16 = 1 << 16; // 1 / gain, read by the interrupts
+static int gDriftDma = -1;
+static uint16_t gDriftBuf[DRIFT_SAMPLES];
+static bool gDriftCapturing = false;
+static uint64_t gDriftNextUs = 0; // Earliest start of the next capture
+static uint64_t gDriftStableUs = 0; // The DAC value was first seen
+static int gDriftStableValue = -1;
+static uint32_t gDriftStableIdleCount = 0;
+
+// Decaying least squares sums, written x and read back y in 1/16 DAC codes
+static int64_t gDriftN = 0;
+static int64_t gDriftSx = 0;
+static int64_t gDriftSy = 0;
+static int64_t gDriftSxx = 0;
+static int64_t gDriftSxy = 0;
+
+static inline void drift_comp_reset() {
+    gDriftN = 0;
+    gDriftSx = 0;
+    gDriftSy = 0;
+    gDriftSxx = 0;
+    gDriftSxy = 0;
+
+    uint32_t status = save_and_disable_interrupts();
+    gDriftGainQ16 = 1 << 16;
+    gDriftOffsetQ4 = 0;
+    gDriftInvGainQ16 = 1 << 16;
+    restore_interrupts(status);
+}
+
+void init_drift_comp() {
+    adc_init();
+    adc_gpio_init(DRIFT_ADC_PIN);
+    adc_select_input(DRIFT_ADC_INPUT);
+    // FIFO with DREQ at every sample, no error bit, 12 bit samples
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv(DRIFT_ADC_CLKDIV);
+
+    gDriftDma = dma_claim_unused_channel(false);
+    drift_comp_reset();
+}
+
+static inline void drift_comp_stop_capture() {
+    if (gDriftCapturing) {
+        dma_channel_abort(gDriftDma);
+        adc_run(false);
+        adc_fifo_drain();
+        gDriftCapturing = false;
+    }
+}
+
+void SetDriftComp(int mode) {
+    if (mode < DRIFT_COMP_OFF || mode > DRIFT_COMP_ON) {
+        return;
+    }
+    if (mode == gDriftCompMode) {
+        return;
+    }
+
+    drift_comp_stop_capture();
+    drift_comp_reset();
+    gDriftCompMode = mode;
+    control_timers_wake();
+}
+
+// Fits y = gain * x + offset from the sums
+static inline void drift_comp_fit() {
+    int64_t mx = gDriftSx / gDriftN;
+    int64_t my = gDriftSy / gDriftN;
+    int64_t var = gDriftSxx / gDriftN - mx * mx;
+    int64_t cov = gDriftSxy / gDriftN - mx * my;
+
+    int32_t gain = gDriftGainQ16;
+    if (var >= (int64_t)DRIFT_MIN_SPREAD_Q4 * DRIFT_MIN_SPREAD_Q4) {
+        gain = (int32_t)((cov << 16) / var);
+    }
+    if (gain < (1 << 16) - DRIFT_MAX_GAIN_ERR_Q16) {
+        gain = (1 << 16) - DRIFT_MAX_GAIN_ERR_Q16;
+    }
+    else if (gain > (1 << 16) + DRIFT_MAX_GAIN_ERR_Q16) {
+        gain = (1 << 16) + DRIFT_MAX_GAIN_ERR_Q16;
+    }
+
+    int32_t offset = (int32_t)(my - ((mx * gain) >> 16));
+    if (offset < -DRIFT_MAX_OFFSET_Q4) {
+        offset = -DRIFT_MAX_OFFSET_Q4;
+    }
+    else if (offset > DRIFT_MAX_OFFSET_Q4) {
+        offset = DRIFT_MAX_OFFSET_Q4;
+    }
+
+    if (gain == gDriftGainQ16 && offset == gDriftOffsetQ4) {
+        return;
+    }
+
+    int32_t invGain = (int32_t)((1ll << 32) / gain);
+    uint32_t status = save_and_disable_interrupts();
+    gDriftGainQ16 = gain;
+    gDriftOffsetQ4 = offset;
+    gDriftInvGainQ16 = invGain;
+    restore_interrupts(status);
+
+    // The held note moves to the corrected value
+    control_timers_wake();
+}
+
+static inline void drift_comp_add_point(int32_t xQ4, int32_t yQ4) {
+    gDriftN -= gDriftN >> DRIFT_FORGET_SHIFT;
+    gDriftSx -= gDriftSx >> DRIFT_FORGET_SHIFT;
+    gDriftSy -= gDriftSy >> DRIFT_FORGET_SHIFT;
+    gDriftSxx -= gDriftSxx >> DRIFT_FORGET_SHIFT;
+    gDriftSxy -= gDriftSxy >> DRIFT_FORGET_SHIFT;
+
+    gDriftN += 1 << DRIFT_WEIGHT_SHIFT;
+    gDriftSx += (int64_t)xQ4 << DRIFT_WEIGHT_SHIFT;
+    gDriftSy += (int64_t)yQ4 << DRIFT_WEIGHT_SHIFT;
+    gDriftSxx += ((int64_t)xQ4 * xQ4) << DRIFT_WEIGHT_SHIFT;
+    gDriftSxy += ((int64_t)xQ4 * yQ4) << DRIFT_WEIGHT_SHIFT;
+
+    gDriftCaptures++;
+    drift_comp_fit();
+}
+
+// The capture is done, the mean of the samples against the DAC value
+static inline void drift_comp_end_capture() {
+    adc_run(false);
+    adc_fifo_drain();
+    gDriftCapturing = false;
+
+    if (!control_timers_is_idle() || gDACValOld != gDriftStableValue ||
+        gControlIdleCount != gDriftStableIdleCount) {
+        gDriftDiscarded++;
+        return;
+    }
+
+    uint32_t sum = 0;
+    for (int i = 0; i < DRIFT_SAMPLES; i++) {
+        sum += gDriftBuf[i] & 0x0FFF;
+    }
+    int32_t adcQ4 = (int32_t)(sum >> (DRIFT_SAMPLES_SHIFT - 4));
+
+    // Clipped at the ends of the ADC range
+    if (adcQ4 < (DRIFT_ADC_MARGIN << 4) || adcQ4 > ((4095 - DRIFT_ADC_MARGIN) << 4)) {
+        gDriftDiscarded++;
+        return;
+    }
+
+    int32_t readQ4 = (DAC_VALUE_C0_NOTE << 4) + (adcQ4 - (DRIFT_ADC_C0 << 4)) *
+        (12 * DAC_HALF_NOTE_VALUE) / DRIFT_ADC_PER_OCTAVE;
+    drift_comp_add_point(gDriftStableValue << 4, readQ4);
+}
+
+void drift_comp_task() {
+    if (gDriftCompMode == DRIFT_COMP_OFF || gDriftDma < 0) {
+        return;
+    }
+
+    if (gDriftCapturing) {
+        if (!dma_channel_is_busy(gDriftDma)) {
+            drift_comp_end_capture();
+        }
+        return;
+    }
+
+    // The settle time starts when a new DAC value or a wake is seen
+    uint64_t now = time_us_64();
+    if (gDACValOld != gDriftStableValue || gControlIdleCount != gDriftStableIdleCount) {
+        gDriftStableValue = gDACValOld;
+        gDriftStableIdleCount = gControlIdleCount;
+        gDriftStableUs = now;
+        return;
+    }
+    if (now < gDriftNextUs || now - gDriftStableUs < DRIFT_SETTLE_US ||
+        !control_timers_is_idle() || gDACVal != gDACValOld) {
+        return;
+    }
+
+    gDriftNextUs = now + DRIFT_PERIOD_MS * 1000;
+    gDriftCapturing = true;
+
+    dma_channel_config c = dma_channel_get_default_config(gDriftDma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, DREQ_ADC);
+
+    adc_fifo_drain();
+    dma_channel_configure(gDriftDma, &c, gDriftBuf, &adc_hw->fifo, DRIFT_SAMPLES, true);
+    adc_run(true);
+}
+
+uint32_t drift_comp_poll_us() {
+    if (gDriftCompMode == DRIFT_COMP_OFF || gDriftDma < 0) {
+        return 0;
+    }
+    return gDriftCapturing ? DRIFT_CAPTURE_US : DRIFT_PERIOD_MS * 1000;
+}
+
+// written = (wanted - offset) / gain
+int32_t drift_comp_apply(int32_t dacValue) {
+    if (gDriftCompMode == DRIFT_COMP_OFF) {
+        return dacValue;
+    }
+
+    int64_t value = (int64_t)(dacValue * 16 - gDriftOffsetQ4) * gDriftInvGainQ16;
+    return (int32_t)((value + (1 << 19)) >> 20);
+}
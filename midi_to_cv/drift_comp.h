@@ -0,0 +1,77 @@
+/***********************************************
+/ drift_comp.h : header file for the V/oct drift compensation functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef DRIFT_COMP_H
+#define DRIFT_COMP_H
+
+#include "pico/stdlib.h"
+#include "mcp4725.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The pitch CV after the output stage is read back on ADC0 (GPIO26)
+// through a divider. The gain and offset of the output stage drift with
+// temperature and supply, the drift is fitted from the read back values
+// and taken out of the DAC value in calculate_dac_value().
+//
+// A capture is started from drift_comp_task() in the main loop, only when
+// the control timers are stopped and the DAC value has not changed for
+// DRIFT_SETTLE_US, at most once every DRIFT_PERIOD_MS. The ADC runs free
+// and a DMA channel moves DRIFT_SAMPLES samples, one mains period, the
+// CPU only sums them when the DMA is done. A capture is thrown away if the
+// DAC moved while it ran. No interrupt is used and nothing waits for it.
+//
+// Every capture is a point, DAC value written against the value read back
+// in DAC units, both in 1/16 DAC codes. The points go into a least squares
+// fit of read back = gain * written + offset, the sums decay by
+// 1/2^DRIFT_FORGET_SHIFT per point so the fit follows the drift. The gain
+// is only fitted when the points spread over DRIFT_MIN_SPREAD_Q4, with one
+// held note the offset alone is fitted.
+//
+// DRIFT_ADC_C0 and DRIFT_ADC_PER_OCTAVE are the ADC codes of a board
+// without drift, here 1 V/oct through a 20k/8.2k divider and a 3.0 V
+// reference on ADC_VREF. The ADC reference must not drift with the supply.
+////////////////////////////////////////////////////////////////////////////////
+
+#define DRIFT_COMP_OFF 0
+#define DRIFT_COMP_ON 1
+
+#define DRIFT_ADC_PIN 26
+#define DRIFT_ADC_INPUT 0
+#define DRIFT_ADC_C0 0 // ADC code of the C0 output (0 V)
+#define DRIFT_ADC_PER_OCTAVE 397 // ADC codes per octave (1 V)
+#define DRIFT_ADC_MARGIN 32 // Captures this close to the ADC range ends are not used
+#define DRIFT_ADC_CLKDIV 7499 // 48 MHz / 7500 = 6.4 kS/s
+#define DRIFT_SAMPLES 128 // 20 ms
+#define DRIFT_SAMPLES_SHIFT 7
+#define DRIFT_CAPTURE_US 20000
+#define DRIFT_SETTLE_US 10000 // The output stage and the filter settle
+#define DRIFT_PERIOD_MS 1000 // Between captures, about 2 % ADC duty cycle
+
+#define DRIFT_FORGET_SHIFT 6 // The fit remembers about 64 points
+#define DRIFT_MIN_SPREAD_Q4 ((6 * DAC_HALF_NOTE_VALUE) << 4) // Half an octave
+#define DRIFT_MAX_GAIN_ERR_Q16 3277 // 5 %
+#define DRIFT_MAX_OFFSET_Q4 ((2 * DAC_HALF_NOTE_VALUE) << 4) // Two half notes
+
+// Global char extern declaration
+extern int gDriftCompMode;
+extern int32_t gDriftGainQ16; // Fitted gain, 65536 is 1.0
+extern int32_t gDriftOffsetQ4; // Fitted offset [1/16 DAC codes]
+extern uint32_t gDriftCaptures; // Points added to the fit
+extern uint32_t gDriftDiscarded; // Captures thrown away, the DAC moved
+
+void init_drift_comp();
+void SetDriftComp(int mode);
+
+// Called from the main loop
+void drift_comp_task();
+
+// Wake up time for drift_comp_task() while sleeping, 0 when off
+uint32_t drift_comp_poll_us();
+
+// Wanted DAC value to the value to write, called by calculate_dac_value()
+int32_t drift_comp_apply(int32_t dacValue);
+
+#endif // DRIFT_COMP_H
@@ -0,0 +1,163 @@
+/***********************************************
+/ event_sched.c : implementation file for the timestamped event scheduler
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "event_sched.h"
+#include "midi_uart.h"
+#include "mcp4725.h"
+#include "pulse_out.h"
+#include "hardware/sync.h"
+
+// Global char initiation
+int gSchedLatencyUs = EVENT_SCHED_OFF;
+event_sched_stats_t gSchedStats;
+
+// Sorted on the due time, the first event is the next one
+static sched_event_t gSchedQueue[EVENT_SCHED_QUEUE_SIZE];
+static int gSchedLen = 0;
+static uint64_t gSchedEventUs = 0; // Due time of the message being handled
+static uint64_t gSchedReserveUs = 0; // Reserved DAC write, 0 when none
+
+// The first event, taken out of the queue
+static inline sched_event_t event_sched_pop() {
+    sched_event_t event = gSchedQueue[0];
+    gSchedLen--;
+    for (int i = 0; i < gSchedLen; i++) {
+        gSchedQueue[i] = gSchedQueue[i + 1];
+    }
+    return event;
+}
+
+void init_event_sched() {
+    gSchedStats.minErrorUs = INT32_MAX;
+    gSchedStats.maxErrorUs = INT32_MIN;
+
+    hardware_alarm_claim(EVENT_SCHED_HW_ALARM);
+    hardware_alarm_set_callback(EVENT_SCHED_HW_ALARM, &event_sched_alarm_callback);
+}
+
+// 0 is off, the queued messages are still handled on time
+void SetSchedLatency(int latencyUs) {
+    if (latencyUs != EVENT_SCHED_OFF && (latencyUs < EVENT_SCHED_MIN_LATENCY_US ||
+        latencyUs > EVENT_SCHED_MAX_LATENCY_US)) {
+        return;
+    }
+
+    gSchedLatencyUs = latencyUs;
+}
+
+void event_sched_message(int portNo, int midiChFilter, uint8_t status, uint8_t data1, uint8_t data2, uint64_t timeUs) {
+    if (gSchedLatencyUs == EVENT_SCHED_OFF || status >= 0xF0) {
+        midi_dispatch_message(portNo, midiChFilter, status, data1, data2);
+        return;
+    }
+
+    uint32_t save = save_and_disable_interrupts();
+    uint64_t dueUs = timeUs + gSchedLatencyUs;
+
+    // A full queue hands out the first message now, early but in order,
+    // the DAC timer writes its pitch
+    if (gSchedLen >= EVENT_SCHED_QUEUE_SIZE) {
+        gSchedStats.overflows++;
+        if (dueUs < gSchedQueue[0].dueUs) {
+            midi_dispatch_message(portNo, midiChFilter, status, data1, data2);
+            restore_interrupts(save);
+            return;
+        }
+        sched_event_t event = event_sched_pop();
+        midi_dispatch_message(event.portNo, event.midiChFilter, event.status,
+            event.data1, event.data2);
+    }
+
+    // The ports interleave, a short message can be due before a long one
+    // that started earlier
+    int i = gSchedLen;
+    while (i > 0 && gSchedQueue[i - 1].dueUs > dueUs) {
+        gSchedQueue[i] = gSchedQueue[i - 1];
+        i--;
+    }
+
+    sched_event_t *pEvent = &gSchedQueue[i];
+    pEvent->dueUs = dueUs;
+    pEvent->portNo = (uint8_t)portNo;
+    pEvent->midiChFilter = (uint8_t)midiChFilter;
+    pEvent->status = status;
+    pEvent->data1 = data1;
+    pEvent->data2 = data2;
+    gSchedLen++;
+    gSchedStats.queued++;
+
+    if (i == 0) {
+        event_sched_service();
+    }
+
+    restore_interrupts(save);
+}
+
+uint64_t event_sched_edge_time_us() {
+    if (gSchedEventUs != 0) {
+        return gSchedEventUs;
+    }
+    return time_us_64() + PULSE_OUT_LATENCY_US;
+}
+
+bool event_sched_is_due_within(uint32_t us) {
+    uint64_t now = time_us_64();
+    uint64_t reserveUs = gSchedReserveUs;
+
+    if (reserveUs != 0 && reserveUs <= now + us && now < reserveUs + EVENT_SCHED_LEAD_US) {
+        return true;
+    }
+    return gSchedLen > 0 &&
+        gSchedQueue[0].dueUs - EVENT_SCHED_LEAD_US <= now + us;
+}
+
+void event_sched_reserve_dac(uint64_t writeUs) {
+    gSchedReserveUs = writeUs;
+}
+
+// Handle the events within EVENT_SCHED_LEAD_US and arm the alarm for
+// the next one
+static inline void event_sched_service() {
+    while (gSchedLen > 0) {
+        uint64_t now = time_us_64();
+        uint64_t dueUs = gSchedQueue[0].dueUs;
+
+        if (dueUs > now + EVENT_SCHED_LEAD_US) {
+            // Returns true if the time has already passed, then go again
+            if (!hardware_alarm_set_target(EVENT_SCHED_HW_ALARM,
+                from_us_since_boot(dueUs - EVENT_SCHED_LEAD_US))) {
+                return;
+            }
+            continue;
+        }
+
+        sched_event_t event = event_sched_pop();
+        if (now > dueUs) {
+            gSchedStats.late++;
+        }
+
+        gSchedEventUs = dueUs;
+        midi_dispatch_message(event.portNo, event.midiChFilter, event.status,
+            event.data1, event.data2);
+        gSchedEventUs = 0;
+
+        // A note or bend that moved the pitch is written for the due time
+        uint64_t writeUs = set_mcp4725_output_at(dueUs);
+        if (writeUs != 0) {
+            int32_t error = (int32_t)(writeUs - dueUs);
+            if (error < gSchedStats.minErrorUs) {
+                gSchedStats.minErrorUs = error;
+            }
+            if (error > gSchedStats.maxErrorUs) {
+                gSchedStats.maxErrorUs = error;
+            }
+        }
+    }
+}
+
+static inline void event_sched_alarm_callback(uint alarmNum) {
+    event_sched_service();
+}
@@ -0,0 +1,79 @@
+/***********************************************
+/ event_sched.h : header file for the timestamped event scheduler
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef EVENT_SCHED_H
+#define EVENT_SCHED_H
+
+#include "pico/stdlib.h"
+#include "hardware/timer.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Without the scheduler a channel message is handled when its last byte
+// arrives and the pitch reaches the DAC on the next glide and DAC timer
+// ticks, the delay varies with more than a millisecond.
+//
+// With a latency set (SetSchedLatency), every channel message gets the
+// arrival time of its status byte and is queued until arrival + latency.
+// A hardware alarm dispatches it EVENT_SCHED_LEAD_US ahead of that time,
+// the gate edges are timed by the PIO (see pulse_out.h) and the DAC write
+// is started so the output changes at the due time. A small constant delay
+// for close to no jitter.
+//
+// The DAC timer leaves the bus free when a scheduled write is near, or a
+// write reserved by event_sched_reserve_dac(), the arpeggiator steps are
+// written from the clock alarm outside the queue. A reservation lapses
+// EVENT_SCHED_LEAD_US after its time, a stopped clock does not hold the
+// bus. System messages, SysEx and MIDI 2.0 UMP are not delayed.
+////////////////////////////////////////////////////////////////////////////////
+
+#define EVENT_SCHED_HW_ALARM 2 // Hardware alarm used for the due times
+#define EVENT_SCHED_QUEUE_SIZE 32
+#define EVENT_SCHED_LEAD_US 150 // Dispatch and DAC write ahead of the due time
+#define EVENT_SCHED_OFF 0 // Messages are handled at arrival
+#define EVENT_SCHED_MIN_LATENCY_US 1000 // Two data bytes (640 us) and the lead
+#define EVENT_SCHED_MAX_LATENCY_US 10000
+
+typedef struct {
+    uint64_t dueUs;
+    uint8_t portNo;
+    uint8_t midiChFilter;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+} sched_event_t;
+
+typedef struct {
+    uint32_t queued;
+    uint32_t late; // Dispatched after the due time
+    uint32_t overflows; // The queue was full, the first message was handled early
+    int32_t minErrorUs; // Smallest DAC write - due time
+    int32_t maxErrorUs; // Largest DAC write - due time
+} event_sched_stats_t;
+
+// Global char extern declaration
+extern int gSchedLatencyUs; // EVENT_SCHED_OFF or the fixed latency
+extern event_sched_stats_t gSchedStats;
+
+void init_event_sched();
+void SetSchedLatency(int latencyUs);
+
+// Called by the MIDI parsers for a complete message, timeUs is the
+// arrival time of the status byte
+void event_sched_message(int portNo, int midiChFilter, uint8_t status, uint8_t data1, uint8_t data2, uint64_t timeUs);
+
+// Time for the gate edges of the message being handled
+uint64_t event_sched_edge_time_us();
+
+// True if a scheduled dispatch or a reserved DAC write is within us from now
+bool event_sched_is_due_within(uint32_t us);
+
+// Reserves the DAC bus for a write started at writeUs outside the queue
+void event_sched_reserve_dac(uint64_t writeUs);
+
+static inline void event_sched_service();
+static inline void event_sched_alarm_callback(uint alarmNum);
+
+#endif // EVENT_SCHED_H
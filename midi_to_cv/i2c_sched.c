@@ -0,0 +1,476 @@
+/***********************************************
+/ i2c_sched.c : implementation file for the I2C transaction scheduler
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "i2c_sched.h"
+#include "pico/binary_info.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+
+#define I2C_SCHED_OK 0
+#define I2C_SCHED_NACK 1 // The write is tried again after I2C_SCHED_RETRY_US
+
+// Bus recovery steps, one per I2C_SCHED_RECOVERY_HALF_US
+#define I2C_RECOVERY_CLOCK 0 // SCL is released, SDA is checked
+#define I2C_RECOVERY_CLOCK_HIGH 1
+#define I2C_RECOVERY_STOP_SDA_LOW 2
+#define I2C_RECOVERY_STOP_SCL_HIGH 3
+#define I2C_RECOVERY_STOP_SDA_HIGH 4
+#define I2C_RECOVERY_DONE 5
+
+typedef struct {
+    bool isUsed;
+    uint8_t addr;
+    uint8_t prio;
+    uint8_t len;
+    uint8_t data[I2C_SCHED_MAX_LEN];
+    uint32_t seq; // Queue order
+    uint64_t queuedUs;
+    uint64_t retryUs; // Not started before, 0 when ready
+} i2c_sched_write_t;
+
+// Global char initiation
+i2c_sched_stats_t gI2cStats[I2C_SCHED_NO_OF_BUSES];
+
+static i2c_inst_t *gI2cInst[I2C_SCHED_NO_OF_BUSES];
+static const uint gI2cSda[I2C_SCHED_NO_OF_BUSES] = { I2C0_SDA, I2C1_SDA };
+static const uint gI2cScl[I2C_SCHED_NO_OF_BUSES] = { I2C0_SCL, I2C1_SCL };
+static uint gI2cBaudrate[I2C_SCHED_NO_OF_BUSES];
+static i2c_sched_write_t gI2cQueue[I2C_SCHED_NO_OF_BUSES][I2C_SCHED_QUEUE_SIZE];
+static i2c_sched_write_t gI2cCurrent[I2C_SCHED_NO_OF_BUSES]; // The write on the bus
+static volatile bool gI2cActive[I2C_SCHED_NO_OF_BUSES]; // A write is on the bus
+static volatile bool gI2cRecovering[I2C_SCHED_NO_OF_BUSES];
+static int gI2cResult[I2C_SCHED_NO_OF_BUSES]; // Of the write on the bus
+static alarm_id_t gI2cTimeoutAlarm[I2C_SCHED_NO_OF_BUSES];
+static alarm_id_t gI2cRetryAlarm[I2C_SCHED_NO_OF_BUSES];
+static int gI2cRecoveryStep[I2C_SCHED_NO_OF_BUSES];
+static int gI2cRecoveryClocks[I2C_SCHED_NO_OF_BUSES];
+static uint64_t gI2cStartUs[I2C_SCHED_NO_OF_BUSES];
+static uint32_t gI2cSeq = 0;
+static uint64_t gI2cLoadUs = 0; // Start of the load window
+static uint64_t gI2cLoadBusyUs[I2C_SCHED_NO_OF_BUSES];
+
+static inline void i2c_sched_init_bus(int bus) {
+    i2c_init(gI2cInst[bus], gI2cBaudrate[bus]);
+    gpio_set_function(gI2cSda[bus], GPIO_FUNC_I2C);
+    gpio_set_function(gI2cScl[bus], GPIO_FUNC_I2C);
+    gpio_pull_up(gI2cSda[bus]);
+    gpio_pull_up(gI2cScl[bus]);
+
+    // The interrupts are only unmasked while a queued write is on the bus
+    i2c_get_hw(gI2cInst[bus])->intr_mask = 0;
+    gI2cActive[bus] = false;
+}
+
+void init_i2c_sched() {
+    gI2cInst[I2C_SCHED_BUS0] = i2c0;
+    gI2cInst[I2C_SCHED_BUS1] = i2c1;
+
+    for (int bus = 0; bus < I2C_SCHED_NO_OF_BUSES; bus++) {
+        gI2cBaudrate[bus] = I2C_SCHED_BAUDRATE;
+        i2c_sched_init_bus(bus);
+    }
+
+    // Make the I2C pins available to picotool
+    bi_decl(bi_2pins_with_func(I2C0_SDA, I2C0_SCL, GPIO_FUNC_I2C));
+    bi_decl(bi_2pins_with_func(I2C1_SDA, I2C1_SCL, GPIO_FUNC_I2C));
+
+    irq_set_exclusive_handler(I2C0_IRQ, i2c0_sched_irq_handler);
+    irq_set_exclusive_handler(I2C1_IRQ, i2c1_sched_irq_handler);
+    irq_set_enabled(I2C0_IRQ, true);
+    irq_set_enabled(I2C1_IRQ, true);
+
+    gI2cLoadUs = time_us_64();
+}
+
+i2c_inst_t *i2c_sched_get_inst(int bus) {
+    return gI2cInst[bus];
+}
+
+// Kept for the bus recovery, it initiates the controller again
+void i2c_sched_set_baudrate(int bus, uint baudrate) {
+    if (bus < I2C_SCHED_BUS0 || bus >= I2C_SCHED_NO_OF_BUSES) {
+        return;
+    }
+
+    gI2cBaudrate[bus] = baudrate;
+    i2c_set_baudrate(gI2cInst[bus], baudrate);
+}
+
+// The most urgent write that may start, the oldest first within a
+// priority, -1 if none. pRetryUs is the first retry time of the others.
+static inline int i2c_sched_next(int bus, uint64_t now, uint64_t *pRetryUs) {
+    int next = -1;
+    *pRetryUs = 0;
+    for (int i = 0; i < I2C_SCHED_QUEUE_SIZE; i++) {
+        i2c_sched_write_t *pWrite = &gI2cQueue[bus][i];
+        if (!pWrite->isUsed) {
+            continue;
+        }
+        if (pWrite->retryUs > now) {
+            if (*pRetryUs == 0 || pWrite->retryUs < *pRetryUs) {
+                *pRetryUs = pWrite->retryUs;
+            }
+            continue;
+        }
+        if (next < 0 || pWrite->prio < gI2cQueue[bus][next].prio ||
+            (pWrite->prio == gI2cQueue[bus][next].prio &&
+            (int32_t)(pWrite->seq - gI2cQueue[bus][next].seq) < 0)) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+static inline void i2c_sched_start(int bus);
+
+static int64_t i2c_sched_retry_callback(alarm_id_t id, void *user_data) {
+    int bus = (int)(intptr_t)user_data;
+
+    gI2cRetryAlarm[bus] = 0;
+    if (!gI2cActive[bus] && !gI2cRecovering[bus]) {
+        i2c_sched_start(bus);
+    }
+    return 0;
+}
+
+static inline void i2c_sched_recover(int bus);
+
+// A write without its stop condition in time, SCL or SDA is held low
+static int64_t i2c_sched_timeout_callback(alarm_id_t id, void *user_data) {
+    int bus = (int)(intptr_t)user_data;
+
+    if (!gI2cActive[bus] || gI2cTimeoutAlarm[bus] != id) {
+        return 0;
+    }
+
+    gI2cTimeoutAlarm[bus] = 0;
+    gI2cStats[bus].timeouts++;
+    gI2cStats[bus].errors++;
+    i2c_sched_recover(bus);
+    return 0;
+}
+
+// Puts the next write in the TX FIFO, called with the bus free from the
+// I2C interrupt or with the interrupts disabled
+static inline void i2c_sched_start(int bus) {
+    uint64_t now = time_us_64();
+    uint64_t retryUs = 0;
+    int next = i2c_sched_next(bus, now, &retryUs);
+    if (next < 0) {
+        // Only writes to a device that did not answer are waiting
+        if (retryUs != 0 && gI2cRetryAlarm[bus] == 0) {
+            gI2cRetryAlarm[bus] = add_alarm_at(from_us_since_boot(retryUs),
+                &i2c_sched_retry_callback, (void *)(intptr_t)bus, true);
+            if (gI2cRetryAlarm[bus] < 0) {
+                gI2cRetryAlarm[bus] = 0;
+            }
+        }
+        return;
+    }
+
+    i2c_sched_write_t *pWrite = &gI2cQueue[bus][next];
+    i2c_hw_t *hw = i2c_get_hw(gI2cInst[bus]);
+
+    uint32_t waitUs = (uint32_t)(now - pWrite->queuedUs);
+    if (waitUs > gI2cStats[bus].maxWaitUs[pWrite->prio]) {
+        gI2cStats[bus].maxWaitUs[pWrite->prio] = waitUs;
+    }
+
+    // The target address can only be changed with the controller disabled
+    hw->enable = 0;
+    hw->tar = pWrite->addr;
+    hw->enable = 1;
+
+    for (int i = 0; i < pWrite->len; i++) {
+        hw->data_cmd = pWrite->data[i] |
+            (i == pWrite->len - 1 ? I2C_IC_DATA_CMD_STOP_BITS : 0);
+    }
+
+    gI2cCurrent[bus] = *pWrite;
+    pWrite->isUsed = false;
+    gI2cActive[bus] = true;
+    gI2cResult[bus] = I2C_SCHED_OK;
+    gI2cStartUs[bus] = now;
+    gI2cStats[bus].writes++;
+
+    gI2cTimeoutAlarm[bus] = add_alarm_in_us(I2C_SCHED_TIMEOUT_US,
+        &i2c_sched_timeout_callback, (void *)(intptr_t)bus, true);
+    if (gI2cTimeoutAlarm[bus] < 0) {
+        gI2cTimeoutAlarm[bus] = 0;
+    }
+    hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+}
+
+// The write on the bus is done or given up
+static inline void i2c_sched_end(int bus) {
+    if (gI2cTimeoutAlarm[bus] != 0) {
+        cancel_alarm(gI2cTimeoutAlarm[bus]);
+        gI2cTimeoutAlarm[bus] = 0;
+    }
+    i2c_get_hw(gI2cInst[bus])->intr_mask = 0;
+    gI2cActive[bus] = false;
+    gI2cStats[bus].busyUs += time_us_64() - gI2cStartUs[bus];
+}
+
+// The failed write goes back in the queue unless a newer write to the
+// same device is waiting, that one gets the retry time
+static inline void i2c_sched_requeue(int bus, uint64_t retryUs) {
+    i2c_sched_write_t *pFree = NULL;
+    for (int i = 0; i < I2C_SCHED_QUEUE_SIZE; i++) {
+        i2c_sched_write_t *pWrite = &gI2cQueue[bus][i];
+        if (pWrite->isUsed && pWrite->addr == gI2cCurrent[bus].addr) {
+            if (retryUs > pWrite->retryUs) {
+                pWrite->retryUs = retryUs;
+                pWrite->queuedUs = retryUs;
+            }
+            return;
+        }
+        if (!pWrite->isUsed && pFree == NULL) {
+            pFree = pWrite;
+        }
+    }
+
+    if (pFree == NULL) {
+        gI2cStats[bus].dropped++;
+        return;
+    }
+
+    *pFree = gI2cCurrent[bus];
+    pFree->isUsed = true;
+    pFree->retryUs = retryUs;
+    // The wait is counted from the retry time
+    pFree->queuedUs = retryUs != 0 ? retryUs : time_us_64();
+}
+
+// The 9 clock bus recovery, a device in the middle of a read lets SDA go
+// within 9 clocks, and a stop condition ends it. The pins are moved to
+// the SIO and driven open drain, one step per alarm.
+static int64_t i2c_sched_recovery_callback(alarm_id_t id, void *user_data) {
+    int bus = (int)(intptr_t)user_data;
+    uint sda = gI2cSda[bus];
+    uint scl = gI2cScl[bus];
+
+    switch (gI2cRecoveryStep[bus]) {
+    case I2C_RECOVERY_CLOCK:
+        gpio_set_dir(scl, GPIO_OUT);
+        if (gpio_get(sda) || gI2cRecoveryClocks[bus] >= I2C_SCHED_RECOVERY_CLOCKS) {
+            gI2cRecoveryStep[bus] = I2C_RECOVERY_STOP_SDA_LOW;
+        }
+        else {
+            gI2cRecoveryStep[bus] = I2C_RECOVERY_CLOCK_HIGH;
+        }
+        break;
+    case I2C_RECOVERY_CLOCK_HIGH:
+        gpio_set_dir(scl, GPIO_IN);
+        gI2cRecoveryClocks[bus]++;
+        gI2cRecoveryStep[bus] = I2C_RECOVERY_CLOCK;
+        break;
+    case I2C_RECOVERY_STOP_SDA_LOW:
+        gpio_set_dir(sda, GPIO_OUT);
+        gI2cRecoveryStep[bus] = I2C_RECOVERY_STOP_SCL_HIGH;
+        break;
+    case I2C_RECOVERY_STOP_SCL_HIGH:
+        gpio_set_dir(scl, GPIO_IN);
+        gI2cRecoveryStep[bus] = I2C_RECOVERY_STOP_SDA_HIGH;
+        break;
+    case I2C_RECOVERY_STOP_SDA_HIGH:
+        gpio_set_dir(sda, GPIO_IN);
+        gI2cRecoveryStep[bus] = I2C_RECOVERY_DONE;
+        break;
+    default:
+        gI2cRecoveryStep[bus] = I2C_RECOVERY_CLOCK;
+        gI2cRecoveryClocks[bus] = 0;
+        if (!gpio_get(sda) || !gpio_get(scl)) {
+            // Still held low, a short or no pull-ups, tried again later
+            gI2cStats[bus].stuck++;
+            return -(int64_t)I2C_SCHED_RECOVERY_RETRY_US;
+        }
+
+        // The first queued write probes the device again
+        i2c_sched_init_bus(bus);
+        gI2cRecovering[bus] = false;
+        gI2cStats[bus].recoveries++;
+        i2c_sched_start(bus);
+        return 0;
+    }
+    return -(int64_t)I2C_SCHED_RECOVERY_HALF_US;
+}
+
+// The controller is reset, it lets go of the bus
+static inline void i2c_sched_recover(int bus) {
+    i2c_sched_end(bus);
+    i2c_sched_requeue(bus, 0);
+    gI2cRecovering[bus] = true;
+
+    i2c_deinit(gI2cInst[bus]);
+    gpio_init(gI2cSda[bus]);
+    gpio_init(gI2cScl[bus]);
+    gpio_put(gI2cSda[bus], false);
+    gpio_put(gI2cScl[bus], false);
+
+    gI2cRecoveryStep[bus] = I2C_RECOVERY_CLOCK;
+    gI2cRecoveryClocks[bus] = 0;
+    if (add_alarm_in_us(I2C_SCHED_RECOVERY_HALF_US, &i2c_sched_recovery_callback,
+        (void *)(intptr_t)bus, true) < 0) {
+        // No free alarm, the controller is initiated as it is
+        i2c_sched_init_bus(bus);
+        gI2cRecovering[bus] = false;
+    }
+}
+
+bool i2c_sched_write(int bus, uint8_t addr, const uint8_t *pData, int len, int prio) {
+    if (bus < I2C_SCHED_BUS0 || bus >= I2C_SCHED_NO_OF_BUSES || len < 1 ||
+        len > I2C_SCHED_MAX_LEN || prio < I2C_PRIO_PITCH || prio >= I2C_PRIO_NO_OF_LEVELS) {
+        return false;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+
+    // A waiting write to the same device is stale, a retry time is kept
+    i2c_sched_write_t *pWrite = NULL;
+    for (int i = 0; i < I2C_SCHED_QUEUE_SIZE; i++) {
+        if (gI2cQueue[bus][i].isUsed && gI2cQueue[bus][i].addr == addr) {
+            pWrite = &gI2cQueue[bus][i];
+            gI2cStats[bus].merged++;
+            if (prio > pWrite->prio) {
+                prio = pWrite->prio;
+            }
+            break;
+        }
+    }
+
+    if (pWrite == NULL) {
+        for (int i = 0; i < I2C_SCHED_QUEUE_SIZE; i++) {
+            if (!gI2cQueue[bus][i].isUsed) {
+                pWrite = &gI2cQueue[bus][i];
+                pWrite->isUsed = true;
+                pWrite->seq = gI2cSeq++;
+                pWrite->queuedUs = time_us_64();
+                pWrite->retryUs = 0;
+                break;
+            }
+        }
+    }
+
+    if (pWrite == NULL) {
+        gI2cStats[bus].dropped++;
+        restore_interrupts(status);
+        return false;
+    }
+
+    pWrite->addr = addr;
+    pWrite->prio = (uint8_t)prio;
+    pWrite->len = (uint8_t)len;
+    for (int i = 0; i < len; i++) {
+        pWrite->data[i] = pData[i];
+    }
+
+    if (!gI2cActive[bus] && !gI2cRecovering[bus]) {
+        i2c_sched_start(bus);
+    }
+
+    restore_interrupts(status);
+    return true;
+}
+
+// True while a write is running or a queued write may start
+static inline bool i2c_sched_is_busy(int bus) {
+    uint64_t retryUs = 0;
+    return gI2cActive[bus] || gI2cRecovering[bus] ||
+        i2c_sched_next(bus, time_us_64(), &retryUs) >= 0;
+}
+
+bool i2c_sched_flush(int bus) {
+    uint64_t endUs = time_us_64() + I2C_SCHED_FLUSH_US;
+    while (i2c_sched_is_busy(bus) && time_us_64() < endUs) {
+        tight_loop_contents();
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+    bool isFlushed = !i2c_sched_is_busy(bus);
+    if (isFlushed) {
+        // The writes left wait for a retry, they would start in the middle
+        // of the blocking calls. They are dropped with their alarm.
+        for (int i = 0; i < I2C_SCHED_QUEUE_SIZE; i++) {
+            if (gI2cQueue[bus][i].isUsed) {
+                gI2cQueue[bus][i].isUsed = false;
+                gI2cStats[bus].dropped++;
+            }
+        }
+        if (gI2cRetryAlarm[bus] != 0) {
+            cancel_alarm(gI2cRetryAlarm[bus]);
+            gI2cRetryAlarm[bus] = 0;
+        }
+    }
+    restore_interrupts(status);
+    return isFlushed;
+}
+
+bool i2c_sched_is_idle() {
+    for (int bus = 0; bus < I2C_SCHED_NO_OF_BUSES; bus++) {
+        if (gI2cActive[bus] || gI2cRecovering[bus]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void i2c_sched_task() {
+    uint64_t now = time_us_64();
+    uint64_t windowUs = now - gI2cLoadUs;
+    if (windowUs < I2C_SCHED_LOAD_MS * 1000) {
+        return;
+    }
+
+    for (int bus = 0; bus < I2C_SCHED_NO_OF_BUSES; bus++) {
+        uint64_t busyUs = gI2cStats[bus].busyUs;
+        gI2cStats[bus].loadPermille = (uint32_t)((busyUs - gI2cLoadBusyUs[bus]) * 1000 / windowUs);
+        gI2cLoadBusyUs[bus] = busyUs;
+    }
+    gI2cLoadUs = now;
+}
+
+// The stop condition ends every write, also one without an ACK. A lost
+// arbitration with one master on the bus is a fault on SDA.
+static inline void i2c_sched_irq(int bus) {
+    i2c_hw_t *hw = i2c_get_hw(gI2cInst[bus]);
+    uint32_t stat = hw->intr_stat;
+
+    if (stat & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) {
+        uint32_t source = hw->tx_abrt_source;
+        (void)hw->clr_tx_abrt;
+        gI2cStats[bus].errors++;
+
+        if (source & I2C_IC_TX_ABRT_SOURCE_ARB_LOST_BITS) {
+            gI2cStats[bus].arbLost++;
+            i2c_sched_recover(bus);
+            return;
+        }
+        if (source & (I2C_IC_TX_ABRT_SOURCE_ABRT_7B_ADDR_NOACK_BITS |
+            I2C_IC_TX_ABRT_SOURCE_ABRT_TXDATA_NOACK_BITS)) {
+            gI2cStats[bus].nacks++;
+            gI2cResult[bus] = I2C_SCHED_NACK;
+        }
+    }
+
+    if (stat & I2C_IC_INTR_STAT_R_STOP_DET_BITS) {
+        (void)hw->clr_stop_det;
+        i2c_sched_end(bus);
+        if (gI2cResult[bus] == I2C_SCHED_NACK) {
+            // The device is missing or busy, the other devices go on
+            i2c_sched_requeue(bus, time_us_64() + I2C_SCHED_RETRY_US);
+        }
+        i2c_sched_start(bus);
+    }
+}
+
+static inline void i2c0_sched_irq_handler() {
+    i2c_sched_irq(I2C_SCHED_BUS0);
+}
+
+static inline void i2c1_sched_irq_handler() {
+    i2c_sched_irq(I2C_SCHED_BUS1);
+}
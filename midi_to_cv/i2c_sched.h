@@ -0,0 +1,110 @@
+/***********************************************
+/ i2c_sched.h : header file for the I2C transaction scheduler
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef I2C_SCHED_H
+#define I2C_SCHED_H
+
+#include "pico/stdlib.h"
+#include "hardware/i2c.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The scheduler owns both I2C controllers. A write is queued with a
+// priority and returns at once, the controller interrupt starts the next
+// write when the one on the bus has its stop condition. The two buses run
+// in parallel, each with its own queue.
+//
+// The next write on a bus is the queued one with the highest priority,
+// the oldest first within a priority. A write to a device that already has
+// a write waiting replaces that one, only the last value of a DAC goes on
+// the bus. It keeps its place in the queue and the higher of the two
+// priorities.
+//
+// A write on the bus is not stopped for a more urgent one, a pitch write
+// can wait for one write of the other priorities. The pitch DAC is alone
+// on bus 0, new outputs go on bus 1 so they never delay the pitch.
+//
+// Every write has I2C_SCHED_TIMEOUT_US to reach its stop condition. A
+// write without an ACK is queued again and tried every
+// I2C_SCHED_RETRY_US, that probes a missing device in the background
+// while the other devices on the bus go on, newer values replace the
+// waiting one as before. A timeout or a lost arbitration means SCL or SDA
+// is held low, the controller is reset and the bus is clocked free with
+// up to 9 SCL pulses and a stop condition, one step per alarm. The failed
+// write is then the first one on the bus again.
+//
+// The bus time is summed per bus, i2c_sched_task() turns it into the load
+// of the last I2C_SCHED_LOAD_MS.
+////////////////////////////////////////////////////////////////////////////////
+
+#define I2C_SCHED_NO_OF_BUSES 2
+#define I2C_SCHED_BUS0 0 // i2c0, the pitch DAC
+#define I2C_SCHED_BUS1 1 // i2c1, the other outputs
+#define I2C_SCHED_BAUDRATE 400000
+#define I2C_SCHED_QUEUE_SIZE 8 // Writes waiting per bus
+#define I2C_SCHED_MAX_LEN 4 // Bytes per write
+#define I2C_SCHED_LOAD_MS 1000
+#define I2C_SCHED_TIMEOUT_US 1000 // A 4 byte write takes 100 us at 400 kHz
+#define I2C_SCHED_RETRY_US 10000 // After a write without an ACK
+#define I2C_SCHED_RECOVERY_CLOCKS 9
+#define I2C_SCHED_RECOVERY_HALF_US 5 // 100 kHz recovery clock
+#define I2C_SCHED_RECOVERY_RETRY_US 100000 // The bus is still held low
+#define I2C_SCHED_FLUSH_US 5000
+#define I2C_SCHED_BLOCKING_TIMEOUT_US 2000 // For the blocking SDK functions at init
+
+//#define I2C0_SDA PICO_DEFAULT_I2C_SDA_PIN
+//#define I2C0_SCL PICO_DEFAULT_I2C_SCL_PIN
+#define I2C0_SDA 8
+#define I2C0_SCL 9
+#define I2C1_SDA 6
+#define I2C1_SCL 7
+
+// Priorities, 0 is the most urgent
+#define I2C_PRIO_PITCH 0 // V/oct
+#define I2C_PRIO_GATE 1 // Outputs moving with the gate, velocity, envelopes
+#define I2C_PRIO_MOD 2 // Modulation and other slow CVs
+#define I2C_PRIO_NO_OF_LEVELS 3
+
+typedef struct {
+    uint32_t writes; // Writes put on the bus
+    uint32_t merged; // Writes that replaced a waiting one
+    uint32_t dropped; // The queue was full
+    uint32_t errors; // Aborted, no ACK, lost arbitration or timed out
+    uint32_t nacks; // No ACK from the device
+    uint32_t arbLost; // Lost arbitration
+    uint32_t timeouts; // No stop condition in I2C_SCHED_TIMEOUT_US
+    uint32_t recoveries; // The bus was clocked free
+    uint32_t stuck; // Still held low after a recovery
+    uint64_t busyUs; // Time on the bus
+    uint32_t loadPermille; // Bus time of the last I2C_SCHED_LOAD_MS
+    uint32_t maxWaitUs[I2C_PRIO_NO_OF_LEVELS]; // Queued to start
+} i2c_sched_stats_t;
+
+// Global char extern declaration
+extern i2c_sched_stats_t gI2cStats[I2C_SCHED_NO_OF_BUSES];
+
+void init_i2c_sched();
+i2c_inst_t *i2c_sched_get_inst(int bus);
+void i2c_sched_set_baudrate(int bus, uint baudrate);
+
+// Queues a write, false if it was dropped. Safe from interrupts.
+bool i2c_sched_write(int bus, uint8_t addr, const uint8_t *pData, int len, int prio);
+
+// Waits until the bus has no write queued or running, at most
+// I2C_SCHED_FLUSH_US. Writes only waiting for a retry are dropped and
+// their alarm cancelled. When true the queue is empty and the blocking SDK
+// functions can be used until the next i2c_sched_write().
+bool i2c_sched_flush(int bus);
+
+// True when no write is queued or running on any bus
+bool i2c_sched_is_idle();
+
+// Called from the main loop
+void i2c_sched_task();
+
+static inline void i2c0_sched_irq_handler();
+static inline void i2c1_sched_irq_handler();
+
+#endif // I2C_SCHED_H
@@ -0,0 +1,370 @@
+/***********************************************
+/ looper.c : implementation file for the clock synced looper functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <string.h>
+#include "midi_clock.h"
+#include "looper.h"
+#include "voice.h"
+#include "mcp4725.h"
+#include "cc_route.h"
+#include "midi_uart.h"
+#include "hardware/sync.h"
+
+// Global char initiation
+int gLooperMode = LOOPER_MODE_STOP;
+int gLooperBars = LOOPER_DEFAULT_BARS;
+int gLooperEvents = 0;
+uint32_t gLooperDropped = 0;
+
+static uint32_t gLooperArena[2][LOOPER_MAX_EVENTS]; // Played and merged into
+static volatile int gLooperArenaNo = 0; // The arena played
+static uint32_t gLooperPass[2][LOOPER_PASS_EVENTS]; // Recorded and waiting
+static int gLooperPassNo = 0; // The pass recorded, the other one waits
+static int gLooperPassLen = 0;
+static volatile int gLooperPendingLen = 0; // Records waiting for looper_task()
+static int gLooperPendingCursor = 0; // First waiting record not played yet
+static uint32_t gLooperClears = 0; // A merge running over a clear is dropped
+static bool gLooperRecording = false; // The first loop start passed in record mode
+static int gLooperCursor = 0; // First record not played yet
+static uint32_t gLooperPos = 0; // Loop position of the latest tick
+static uint32_t gLooperNextSongPos = 0; // Song position of the next tick
+static uint64_t gLooperTickUs = 0; // Time of the latest tick
+static uint32_t gLooperPeriodUs = 0;
+static uint32_t gLooperNotesOn[4]; // Notes sounded by the playback
+static uint32_t gLooperRecHeld[4]; // Notes held in the recording pass
+
+void init_looper() {
+    gLooperEvents = 0;
+    gLooperPassLen = 0;
+    gLooperPendingLen = 0;
+    gLooperCursor = 0;
+    gLooperPendingCursor = 0;
+    memset(gLooperNotesOn, 0, sizeof(gLooperNotesOn));
+    memset(gLooperRecHeld, 0, sizeof(gLooperRecHeld));
+}
+
+static inline uint32_t looper_length() {
+    return (uint32_t)gLooperBars * LOOPER_TICKS_PER_BAR;
+}
+
+// Note off for the notes the playback left on
+static inline void looper_notes_off() {
+    for (int i = 0; i < 4; i++) {
+        while (gLooperNotesOn[i]) {
+            int b = __builtin_ctz(gLooperNotesOn[i]);
+            gLooperNotesOn[i] &= gLooperNotesOn[i] - 1;
+            voice_note_off((uint8_t)(32 * i + b));
+        }
+    }
+}
+
+void SetLooperMode(int mode) {
+    if (mode < LOOPER_MODE_STOP || mode >= LOOPER_NO_OF_MODES) {
+        return;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+    if (mode == LOOPER_MODE_STOP) {
+        looper_notes_off();
+    }
+    else if (mode == LOOPER_MODE_RECORD) {
+        looper_notes_off();
+        gLooperEvents = 0;
+        gLooperPassLen = 0;
+        gLooperPendingLen = 0;
+        gLooperCursor = 0;
+        gLooperPendingCursor = 0;
+        gLooperClears++;
+        gLooperRecording = false;
+        memset(gLooperRecHeld, 0, sizeof(gLooperRecHeld));
+    }
+    gLooperMode = mode;
+    restore_interrupts(status);
+}
+
+// First record at or after tick, binary search
+static inline int looper_seek(const uint32_t *pRecs, int len, uint32_t tick) {
+    int lo = 0;
+    int hi = len;
+    uint32_t key = LOOPER_RECORD(tick, 0, 0, 0);
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (pRecs[mid] < key) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Both cursors at the first record of the tick
+static inline void looper_seek_all(uint32_t tick) {
+    gLooperCursor = looper_seek(gLooperArena[gLooperArenaNo], gLooperEvents, tick);
+    gLooperPendingCursor = looper_seek(gLooperPass[gLooperPassNo ^ 1], gLooperPendingLen, tick);
+}
+
+// The recorded pass waits for looper_task(), the recording goes on in the
+// other buffer. False while the last pass still waits.
+static inline bool looper_hand_over_pass() {
+    if (gLooperPendingLen != 0) {
+        return false;
+    }
+
+    gLooperPassNo ^= 1;
+    gLooperPendingLen = gLooperPassLen;
+    gLooperPassLen = 0;
+    return true;
+}
+
+// The records after the new end are kept, they play again if the loop
+// gets longer. The notes they would end are ended now.
+void SetLooperBars(int bars) {
+    if (bars < 1 || bars > LOOPER_MAX_BARS) {
+        return;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+    if (bars < gLooperBars) {
+        looper_notes_off();
+    }
+    gLooperBars = bars;
+
+    // The cursors move to the position of the next tick in the new length
+    uint32_t length = looper_length();
+    uint32_t pos = gLooperNextSongPos % length;
+    looper_seek_all(pos);
+    gLooperPos = (pos + length - 1) % length;
+    restore_interrupts(status);
+}
+
+bool looper_is_pending() {
+    return gLooperPendingLen != 0;
+}
+
+// Merge the waiting pass and the arena into the other arena, then play
+// from that one
+void looper_task() {
+    if (gLooperPendingLen == 0) {
+        return;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+    uint32_t clears = gLooperClears;
+    int from = gLooperArenaNo;
+    int n = gLooperEvents;
+    int m = gLooperPendingLen;
+    const uint32_t *pPass = gLooperPass[gLooperPassNo ^ 1];
+    restore_interrupts(status);
+
+    // The last records of the pass do not fit
+    int dropped = 0;
+    if (n + m > LOOPER_MAX_EVENTS) {
+        dropped = n + m - LOOPER_MAX_EVENTS;
+        m = LOOPER_MAX_EVENTS - n;
+    }
+
+    const uint32_t *pArena = gLooperArena[from];
+    uint32_t *pTo = gLooperArena[from ^ 1];
+    int i = 0;
+    int j = 0;
+    int k = 0;
+    while (j < m) {
+        if (i < n && pArena[i] <= pPass[j]) {
+            pTo[k++] = pArena[i++];
+        }
+        else {
+            pTo[k++] = pPass[j++];
+        }
+    }
+    while (i < n) {
+        pTo[k++] = pArena[i++];
+    }
+
+    status = save_and_disable_interrupts();
+    if (gLooperClears == clears) {
+        gLooperDropped += dropped;
+        gLooperArenaNo = from ^ 1;
+        gLooperEvents = k;
+        gLooperPendingLen = 0;
+        gLooperPendingCursor = 0;
+        // Both sources are played up to the latest tick
+        gLooperCursor = looper_seek(pTo, k, gLooperPos + 1);
+    }
+    restore_interrupts(status);
+}
+
+// Insertion into the sorted pass, the records mostly arrive in order and
+// an out of order one, like the notes of a chord, only moves a few
+static inline void looper_pass_insert(uint32_t rec) {
+    uint32_t *pPass = gLooperPass[gLooperPassNo];
+    int i = gLooperPassLen++;
+    while (i > 0 && pPass[i - 1] > rec) {
+        pPass[i] = pPass[i - 1];
+        i--;
+    }
+    pPass[i] = rec;
+}
+
+// The notes still held when the recording pass ends are closed on the
+// last tick of the loop
+static inline void looper_close_recording() {
+    uint32_t lastTick = looper_length() - 1;
+
+    for (int i = 0; i < 4; i++) {
+        while (gLooperRecHeld[i] && gLooperPassLen < LOOPER_PASS_EVENTS) {
+            int b = __builtin_ctz(gLooperRecHeld[i]);
+            gLooperRecHeld[i] &= gLooperRecHeld[i] - 1;
+            looper_pass_insert(LOOPER_RECORD(lastTick, LOOPER_TYPE_NOTE_OFF, 32 * i + b, 0));
+        }
+        gLooperRecHeld[i] = 0;
+    }
+}
+
+// Loop position of an event now, rounded to the nearest tick but never
+// over the end of the loop
+static inline uint32_t looper_event_pos() {
+    uint32_t pos = gLooperPos;
+
+    if (time_us_64() - gLooperTickUs > gLooperPeriodUs / 2 &&
+        pos + 1 < looper_length()) {
+        pos++;
+    }
+    return pos;
+}
+
+void looper_record(uint8_t status, uint8_t data1, uint8_t data2) {
+    if (gLooperMode == LOOPER_MODE_RECORD) {
+        if (!gLooperRecording) {
+            return;
+        }
+    }
+    else if (gLooperMode != LOOPER_MODE_OVERDUB) {
+        return;
+    }
+    if (!gClockRunning) {
+        return;
+    }
+
+    int type = 0;
+    switch (status & 0xF0) {
+    case 0x80:
+        type = LOOPER_TYPE_NOTE_OFF;
+        break;
+    case 0x90:
+        type = data2 == 0 ? LOOPER_TYPE_NOTE_OFF : LOOPER_TYPE_NOTE_ON;
+        break;
+    case 0xB0:
+        type = LOOPER_TYPE_CC;
+        break;
+    case 0xE0:
+        type = LOOPER_TYPE_PITCH_BEND;
+        break;
+    default:
+        return;
+    }
+
+    if (type == LOOPER_TYPE_NOTE_ON) {
+        gLooperRecHeld[(data1 >> 5) & 3] |= 1u << (data1 & 31);
+    }
+    else if (type == LOOPER_TYPE_NOTE_OFF) {
+        gLooperRecHeld[(data1 >> 5) & 3] &= ~(1u << (data1 & 31));
+    }
+
+    uint32_t rec = LOOPER_RECORD(looper_event_pos(), type, data1, data2);
+
+    // A full pass waits for the merge now
+    if (gLooperPassLen >= LOOPER_PASS_EVENTS && looper_hand_over_pass()) {
+        gLooperPendingCursor = looper_seek(gLooperPass[gLooperPassNo ^ 1],
+            gLooperPendingLen, gLooperPos + 1);
+    }
+    if (gLooperPassLen >= LOOPER_PASS_EVENTS) {
+        gLooperDropped++;
+        return;
+    }
+    looper_pass_insert(rec);
+}
+
+static inline void looper_play(uint32_t rec) {
+    uint8_t data1 = (uint8_t)LOOPER_DATA1(rec);
+    uint8_t data2 = (uint8_t)LOOPER_DATA2(rec);
+
+    switch (LOOPER_TYPE(rec)) {
+    case LOOPER_TYPE_NOTE_OFF:
+        gLooperNotesOn[data1 >> 5] &= ~(1u << (data1 & 31));
+        voice_note_off(data1);
+        break;
+    case LOOPER_TYPE_NOTE_ON:
+        gLooperNotesOn[data1 >> 5] |= 1u << (data1 & 31);
+        voice_note_on(data1, data2);
+        break;
+    case LOOPER_TYPE_PITCH_BEND:
+        set_pitch_wheel(data1, data2, gHPWRange);
+        break;
+    case LOOPER_TYPE_CC:
+        cc_route_control_change(0, data1, data2);
+        break;
+    }
+}
+
+void looper_clock_tick(uint32_t songPos, uint64_t timeUs, uint32_t periodUs) {
+    if (gLooperMode == LOOPER_MODE_STOP) {
+        return;
+    }
+
+    uint32_t pos = songPos % looper_length();
+    bool isJump = songPos != gLooperNextSongPos;
+
+    gLooperTickUs = timeUs;
+    gLooperPeriodUs = periodUs;
+    gLooperNextSongPos = songPos + 1;
+
+    if (pos == 0 || isJump) {
+        if (pos == 0 && gLooperMode == LOOPER_MODE_RECORD) {
+            if (!gLooperRecording) {
+                gLooperRecording = true;
+            }
+            else if (!isJump) {
+                looper_close_recording();
+                gLooperMode = LOOPER_MODE_PLAY;
+            }
+        }
+        looper_hand_over_pass();
+        looper_seek_all(pos);
+    }
+    gLooperPos = pos;
+
+    if (gLooperMode == LOOPER_MODE_RECORD) {
+        return;
+    }
+
+    // Only the records of this tick, from the arena and the pass waiting
+    // for the merge, in record order
+    const uint32_t *pArena = gLooperArena[gLooperArenaNo];
+    const uint32_t *pPending = gLooperPass[gLooperPassNo ^ 1];
+    while (true) {
+        bool isArena = gLooperCursor < gLooperEvents &&
+            LOOPER_TICK(pArena[gLooperCursor]) == pos;
+        bool isPending = gLooperPendingCursor < gLooperPendingLen &&
+            LOOPER_TICK(pPending[gLooperPendingCursor]) == pos;
+
+        if (isArena && (!isPending || pArena[gLooperCursor] <= pPending[gLooperPendingCursor])) {
+            looper_play(pArena[gLooperCursor++]);
+        }
+        else if (isPending) {
+            looper_play(pPending[gLooperPendingCursor++]);
+        }
+        else {
+            break;
+        }
+    }
+}
+
+void looper_clock_stop() {
+    looper_notes_off();
+}
@@ -0,0 +1,86 @@
+/***********************************************
+/ looper.h : header file for the clock synced looper functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef LOOPER_H
+#define LOOPER_H
+
+#include "pico/stdlib.h"
+#include "midi_clock.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The looper records notes, pitch bend and control changes with their
+// position in MIDI clock ticks and plays them back on the running clock,
+// MIDI or internal (see midi_clock.h). The position is the song position
+// modulo the loop length, a song position pointer moves the playback.
+//
+// An event is one 32 bit record, tick << 16 | type << 14 | data1 << 7 |
+// data2, kept sorted in a static arena. Comparing the records compares the
+// ticks first, a note off sorts before a note on at the same tick. A
+// cursor follows the clock, every tick only looks at the records of that
+// tick, the cost does not grow with the loop. A jump searches the new
+// cursor once.
+//
+// A recording pass goes to its own buffer, kept sorted by insertion. At
+// the end of the loop, or when the buffer is full, it is handed over and
+// the recording goes on in a second pass buffer. Until looper_task()
+// has merged it, the clock plays the waiting pass next to the arena.
+// looper_task() merges both into the second arena from the main loop and
+// swaps the arenas, no records are moved in the clock interrupt. The
+// events of a pass are not played back until the next pass. A pass
+// filled while the last one still waits keeps growing, the events that do
+// not fit are dropped. LOOPER_MODE_RECORD clears the
+// loop, waits for the loop start, records one pass and goes on to
+// LOOPER_MODE_PLAY, notes still held at the end of that pass get a note
+// off on the last tick.
+////////////////////////////////////////////////////////////////////////////////
+
+#define LOOPER_MODE_STOP 0
+#define LOOPER_MODE_RECORD 1 // Clear, record the next pass, then play
+#define LOOPER_MODE_PLAY 2
+#define LOOPER_MODE_OVERDUB 3 // Play and record
+#define LOOPER_NO_OF_MODES 4
+
+#define LOOPER_MAX_EVENTS 4096 // 16 KB per arena
+#define LOOPER_PASS_EVENTS 512 // Events recorded per pass
+#define LOOPER_MAX_BARS 64
+#define LOOPER_DEFAULT_BARS 4
+#define LOOPER_TICKS_PER_BAR (4 * MIDI_CLK_PPQN)
+
+#define LOOPER_TYPE_NOTE_OFF 0
+#define LOOPER_TYPE_NOTE_ON 1
+#define LOOPER_TYPE_PITCH_BEND 2 // data1 is the LSB, data2 the MSB
+#define LOOPER_TYPE_CC 3
+
+#define LOOPER_RECORD(tick, type, data1, data2) (((uint32_t)(tick) << 16) | \
+    ((uint32_t)(type) << 14) | ((uint32_t)((data1) & 0x7F) << 7) | ((data2) & 0x7F))
+#define LOOPER_TICK(rec) ((rec) >> 16)
+#define LOOPER_TYPE(rec) (((rec) >> 14) & 0x03)
+#define LOOPER_DATA1(rec) (((rec) >> 7) & 0x7F)
+#define LOOPER_DATA2(rec) ((rec) & 0x7F)
+
+// Global char extern declaration
+extern int gLooperMode;
+extern int gLooperBars;
+extern int gLooperEvents; // Records in the arena
+extern uint32_t gLooperDropped; // Events that did not fit
+
+void init_looper();
+void SetLooperMode(int mode);
+void SetLooperBars(int bars);
+
+bool looper_is_pending(); // A pass waits for looper_task()
+
+// Called from the main loop
+void looper_task();
+
+// Called for every channel message that passed the channel filter
+void looper_record(uint8_t status, uint8_t data1, uint8_t data2);
+
+// Called on every regenerated MIDI clock tick while the clock is running
+void looper_clock_tick(uint32_t songPos, uint64_t timeUs, uint32_t periodUs);
+void looper_clock_stop();
+
+#endif // LOOPER_H
@@ -8,51 +8,140 @@
 #include "midi_uart.h"
 #include "error_list.h"
 #include "mcp4725.h"
+#include "midi_clock.h"
+#include "pulse_out.h"
+#include "midi_thru.h"
+#include "usb_midi.h"
+#include "mpe.h"
+#include "cc_route.h"
+#include "pwm_cv.h"
+#include "mod_engine.h"
+#include "tuning.h"
+#include "sysex.h"
+#include "settings.h"
+#include "power.h"
+#include "event_sched.h"
+#include "ctrl_proto.h"
+#include "looper.h"
+#include "selftest.h"
+#include "drift_comp.h"
+#include "pio_midi.h"
+#include "i2c_sched.h"
+#include "pico/stdio_usb.h"
 
 bool gPM = false; // Print debug messages if true
+int gBootErrors = 0; // BOOT_ERR_xxx of the init functions that failed
+uint64_t gBootReadyUs = 0; // Time from reset until MIDI in and the DAC are up
+uint64_t gBootFirstNoteUs = 0; // Time from reset until the first note on
 
-int main() {
-    // Initialize chosen serial port
-    stdio_init_all();
+// The banner and the boot diagnostics are printed when the host opens
+// the CDC, the MIDI handling does not wait for it
+static inline void boot_report_task() {
+    static bool isBannerPrinted = false;
+    static bool isFirstNotePrinted = false;
 
-    int errNo = 0;
-    
-    // Initiate uart0 and its interrupt
-    errNo = init_uart0_for_MIDI_and_interrupt();
-    if (errNo != MIDI_HOST_UART_ERR_SUCCESS) {
-        sleep_ms(10000);
-        printf("Error while initiating\n");
-        printf("init_uart0_for_MIDI_and_iterrupt()\n");
-        return 1;
+    if (!stdio_usb_connected()) {
+        return;
     }
 
-    // Initiate uart1 and its interrupt
-    errNo = init_uart1_for_MIDI_and_interrupt();
-    if (errNo != MIDI_HOST_UART_ERR_SUCCESS) {
-        sleep_ms(10000);
-        printf("Error while initiating\n");
-        printf("init_uart1_for_MIDI_and_iterrupt()\n");
-        return 1;
+    if (!isBannerPrinted) {
+        isBannerPrinted = true;
+        printf("MIDI_TO_CV 0.00.01.008\n");
+        if (gBootErrors & BOOT_ERR_UART0) {
+            printf("Error while initiating\n");
+            printf("init_uart0_for_MIDI_and_iterrupt()\n");
+        }
+        if (gBootErrors & BOOT_ERR_UART1) {
+            printf("Error while initiating\n");
+            printf("init_uart1_for_MIDI_and_iterrupt()\n");
+        }
+        if (gBootErrors & BOOT_ERR_MCP4725) {
+            printf("Error while initiating\n");
+            printf("init_i2c_mcp4725()\n");
+        }
+        printf("Boot: MIDI ready after %llu us\n", gBootReadyUs);
     }
 
-    // Initiate DAC MCP4725 via i2c
+    if (!isFirstNotePrinted && gBootFirstNoteUs != 0) {
+        isFirstNotePrinted = true;
+        printf("Boot: first note after %llu us\n", gBootFirstNoteUs);
+    }
+}
+
+int main() {
+    int errNo = 0;
+    
+    // clk_peri is moved to the USB PLL before the UARTs take their baud rate
+    init_power();
+
+    // Initiate the MIDI thru/merge rings before the UART interrupts
+    init_midi_thru();
+    init_mpe();
+    init_cc_route();
+
+    // The outputs are set up before MIDI can reach them
+    init_pulse_out();
+    init_pwm_cv();
+    init_mod_engine();
+    init_tuning();
+    init_event_sched();
+    init_looper();
+    init_drift_comp();
+
+    // Both I2C buses, the writes are queued from here on
+    init_i2c_sched();
+
+    // Initiate DAC MCP4725 via i2c, the output is set to a known value
     errNo = (int)init_i2c_mcp4725(MCP4725_ADDR, MCP4725_BAUDRATE);
     if (errNo != (int)true) {
-        sleep_ms(10000);
-        printf("Error while initiating\n");
-        printf("init_i2c_mcp4725()\n");
-        return 1;
+        gBootErrors |= BOOT_ERR_MCP4725;
     }
-    
+
     // Init automatic DAC, update every 250 us
     init_mcp4725_us_timer_event(MCP4725_TIMER_UPDATE_250);
     // Init gliede event, update every 1000 us
     init_glide_timer_event();
 
-    sleep_ms(10000);
-    printf("MIDI_TO_CV 0.00.01.008\n");
+    // Initiate the MIDI clock, following the gMidiClk source
+    init_midi_clock_check(MIDI_CLK_DEFAULT_BPM);
+
+    // Load the stored settings over the defaults, after the timers and the
+    // clock so the loaded BPM and clock source are applied to running ones
+    init_settings();
+
+    // Initiate uart0 and its interrupt, a failing UART does not stop the
+    // other one, the errors are printed by boot_report_task()
+    errNo = init_uart0_for_MIDI_and_interrupt();
+    if (errNo != MIDI_HOST_UART_ERR_SUCCESS) {
+        gBootErrors |= BOOT_ERR_UART0;
+    }
+
+    // Initiate uart1 and its interrupt
+    errNo = init_uart1_for_MIDI_and_interrupt();
+    if (errNo != MIDI_HOST_UART_ERR_SUCCESS) {
+        gBootErrors |= BOOT_ERR_UART1;
+    }
+
+    // The PIO MIDI inputs enabled by the settings
+    init_pio_midi();
+
+    gBootReadyUs = time_us_64();
+
+    // The USB device enumerates in the background from usb_midi_task(),
+    // stdio uses its CDC interface
+    init_usb_midi();
+    stdio_init_all();
 
     while (1) {
-        tight_loop_contents();
+        usb_midi_task();
+        sysex_task();
+        settings_task();
+        ctrl_proto_task();
+        looper_task();
+        selftest_task();
+        drift_comp_task();
+        i2c_sched_task();
+        boot_report_task();
+        power_idle();
     }
 }
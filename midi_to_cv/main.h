@@ -13,7 +13,14 @@
 #include "hardware/uart.h"
 #include "hardware/irq.h"
 
+#define BOOT_ERR_UART0 0x01
+#define BOOT_ERR_UART1 0x02
+#define BOOT_ERR_MCP4725 0x04
+
 extern bool gPM; // Print MIDI Messages
+extern int gBootErrors; // BOOT_ERR_xxx of the init functions that failed
+extern uint64_t gBootReadyUs; // Time from reset until MIDI in and the DAC are up
+extern uint64_t gBootFirstNoteUs; // Time from reset until the first note on
 
 int main();
 
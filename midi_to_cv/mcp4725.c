@@ -5,10 +5,23 @@
 #include <stdio.h>
 #include "main.h"
 #include "mcp4725.h"
+#include "midi_ump.h"
+#include "cc_route.h"
+#include "pwm_cv.h"
+#include "mod_engine.h"
+#include "tuning.h"
+#include "event_sched.h"
+#include "drift_comp.h"
+#include "hardware/sync.h"
 
 int gDACVal = 0;
 int gDACValOld = 0;
-int16_t gPW_DACVal = 0;
+int32_t gPWChannel = 0; // Channel pitch bend [Q16 half notes]
+int32_t gPWNote = 0; // Per-note pitch bend of the sounding note [Q16 half notes]
+int32_t gPWTarget = 0; // Pitch wheel target [Q16 half notes]
+int32_t gPWCurrent = 0; // Pitch wheel output [Q16 half notes]
+int32_t gPWStep = 0; // Pitch wheel increment per glide tick
+int gPWStepsLeft = 0; // Glide ticks left until gPWTarget is reached
 int gMIDINote = 0;
 int gGlideVal = 89; // DEBUG ONLY!!!
 int gGlideType = GLIDE_TYPE_GLISSANDO; // DEBUG ONLY!!!
@@ -41,27 +54,50 @@ float gCurrentNote = 0.f;
 float gBeginNote = 0.f;
 float gEndNote = 0.f;
 
-
+// The control and DAC timers stop when nothing moves, see control_timers_wake()
+volatile bool gControlIdle = false;
+uint32_t gControlIdleCount = 0; // Times the control timers were stopped
+uint32_t gControlWakeToDacUs = 0; // Latest wake to DAC write time
+uint32_t gControlWakeToDacMaxUs = 0;
+static repeating_timer_t gDacTimer;
+static repeating_timer_t gGlideTimer;
+static int gDacTimerUs = MCP4725_TIMER_UPDATE_250;
+static volatile bool gDacTimerRunning = false;
+static uint64_t gControlWakeUs = 0; // Time of the wake, 0 when measured
+static alarm_id_t gGlissAlarm = 0; // Next glissando step, 0 when none
+static int gGlissStep = 0; // Half note of the glissando output
+static int gGlissNextStep = 0;
+static uint64_t gGlissNextUs = 0; // Crossing time of gGlissNextStep
+
+
+// The bus is set up by init_i2c_sched(), nothing else is queued on it
+// while the DAC is probed
 bool init_i2c_mcp4725(uint8_t addr, uint baudrate) {
-    // This example will use I2C0 on the default SDA and SCL pins (8, 9 on a Pico)
-    i2c_init(i2c_default, baudrate);
-    gpio_set_function(I2C0_SDA, GPIO_FUNC_I2C);
-    gpio_set_function(I2C0_SCL, GPIO_FUNC_I2C);
-    gpio_pull_up(I2C0_SDA);
-    gpio_pull_up(I2C0_SCL);
-
-    // Make the I2C pins available to picotool
-    bi_decl(bi_2pins_with_func(I2C0_SDA, I2C0_SCL, GPIO_FUNC_I2C));
-    uint8_t rxdata = 0x00;
-    int ret = i2c_read_blocking(i2c_default, addr, &rxdata, 1, false);
-
-    if (ret != PICO_ERROR_GENERIC) {
-        setDefault_i2c_mcp4725(addr, 0);    
+    i2c_sched_set_baudrate(MCP4725_I2C_BUS, baudrate);
+
+    // Status, DAC register and EEPROM in one read, it also probes the chip.
+    // A missing DAC is probed again by the scheduler with every write.
+    uint8_t rxdata[MCP4725_READ_SIZE] = { 0 };
+    int ret = i2c_read_timeout_us(i2c_sched_get_inst(MCP4725_I2C_BUS), addr, rxdata,
+        MCP4725_READ_SIZE, false, I2C_SCHED_BLOCKING_TIMEOUT_US);
+
+    if (ret == MCP4725_READ_SIZE) {
+        // The output goes to a known value at once (fast write, no EEPROM)
+        setOutput_i2c_mcp4725(addr, MCP4725_BOOT_VALUE);
+
+        // The EEPROM write takes several ms, skip it when the power on
+        // value is already stored (power down bits 0 and the data 0)
+        uint16_t eepromValue = ((uint16_t)(rxdata[3] & 0x0F) << 8) | rxdata[4];
+        uint8_t eepromPD = (rxdata[3] >> 5) & 0x03;
+        if (eepromValue != MCP4725_BOOT_VALUE || eepromPD != 0) {
+            setDefault_i2c_mcp4725(addr, MCP4725_BOOT_VALUE);
+        }
     }
 
-    return ret != PICO_ERROR_GENERIC? true : false;
+    return ret == MCP4725_READ_SIZE;
 }
 
+// Queued with the pitch priority, a waiting value is replaced
 static inline bool setOutput_i2c_mcp4725(uint8_t addr, uint16_t output) {
     // Upper data bits (D11.D10.D9.D8.D7.D6.D5.D4)
     // Lower data bits (D3.D2.D1.D0.x.x.x.x)
@@ -69,61 +105,241 @@ static inline bool setOutput_i2c_mcp4725(uint8_t addr, uint16_t output) {
         (uint8_t)(output >> 4), 
         (uint8_t)((output & 0x000f) << 4) };
 
-    int ret = i2c_write_blocking(i2c_default, addr, packet, 3, false);
-
-    return ret != PICO_ERROR_GENERIC? true : false;
+    return i2c_sched_write(MCP4725_I2C_BUS, addr, packet, 3, I2C_PRIO_PITCH);
 }
 
+// Blocking, the EEPROM write is only done at init
 bool setDefault_i2c_mcp4725(uint8_t addr, uint16_t output) {
     uint8_t packet[3] = { MCP4725_CMD_WRITEDACEEPROM, 
         (uint8_t)(output >> 4), 
         (uint8_t)((output & 0x000f) << 4) };
 
-    int ret = i2c_write_blocking(i2c_default, addr, packet, 3, false);
+    if (!i2c_sched_flush(MCP4725_I2C_BUS)) {
+        return false;
+    }
+    int ret = i2c_write_timeout_us(i2c_sched_get_inst(MCP4725_I2C_BUS), addr, packet, 3,
+        false, I2C_SCHED_BLOCKING_TIMEOUT_US);
 
-    return ret != PICO_ERROR_GENERIC? true : false;
+    return ret == 3;
 }
 
 void init_mcp4725_us_timer_event(int us_timer_event) { // Minimum 250 us
-    static repeating_timer_t timer;
+    gDacTimerUs = us_timer_event;
+    gDacTimerRunning = true;
     add_repeating_timer_us(us_timer_event, 
-        &mcp4725_us_timer_callback, NULL, &timer);
+        &mcp4725_us_timer_callback, NULL, &gDacTimer);
 }
 
 static inline bool mcp4725_us_timer_callback(repeating_timer_t *rt) {
     
+    // The bus is left free for a scheduled write, see event_sched.h
+    if (event_sched_is_due_within(MCP4725_WRITE_US)) {
+        return true;
+    }
+
     if (gDACValOld != gDACVal) {
+        // A full queue is tried again on the next tick
+        if (!setOutput_i2c_mcp4725(MCP4725_ADDR, gDACVal)) {
+            return true;
+        }
         gDACValOld = gDACVal;
-        setOutput_i2c_mcp4725(MCP4725_ADDR, gDACVal);
+
+        if (gControlWakeUs != 0) {
+            gControlWakeToDacUs = (uint32_t)(time_us_64() - gControlWakeUs);
+            if (gControlWakeToDacUs > gControlWakeToDacMaxUs) {
+                gControlWakeToDacMaxUs = gControlWakeToDacUs;
+            }
+            gControlWakeUs = 0;
+        }
+    }
+    else if (gControlIdle) {
+        // The last value is written and the control timer is stopped
+        gDacTimerRunning = false;
+        return false;
     }
     return true;
 }
 
 void init_glide_timer_event() { // Every 1000 us
-    static repeating_timer_t timer;
     add_repeating_timer_us(GLIDE_TIMER_UPDATE, 
-        &glide_timer_callback, NULL, &timer);
+        &glide_timer_callback, NULL, &gGlideTimer);
+}
+
+// Restarts the control and DAC timers, called by everything that moves
+// the pitch or a CV output. Cheap when the timers are running.
+void control_timers_wake() {
+    if (!gControlIdle) {
+        return;
+    }
+
+    uint32_t save = save_and_disable_interrupts();
+    if (gControlIdle) {
+        gControlIdle = false;
+        gControlWakeUs = time_us_64();
+        add_repeating_timer_us(GLIDE_TIMER_UPDATE, 
+            &glide_timer_callback, NULL, &gGlideTimer);
+        if (!gDacTimerRunning) {
+            gDacTimerRunning = true;
+            add_repeating_timer_us(gDacTimerUs, 
+                &mcp4725_us_timer_callback, NULL, &gDacTimer);
+        }
+    }
+    restore_interrupts(save);
+}
+
+// True when both timers are stopped and the DAC holds the last value
+bool control_timers_is_idle() {
+    return gControlIdle && !gDacTimerRunning;
 }
 
 static inline bool glide_timer_callback(repeating_timer_t *rt) {
+    bool isBusy = update_glide_note();
+
+    isBusy |= update_pitch_wheel();
+    isBusy |= cc_route_update();
+    isBusy |= mod_engine_update();
+
+    // The PWM outputs dither by DMA, they do not keep the tick running
+    pwm_cv_update();
+
+    set_get_mcp4725_dac_value(true, calculate_dac_value());
+
+    if (!isBusy) {
+        // Started again by control_timers_wake()
+        gControlIdle = true;
+        gControlIdleCount++;
+        gControlWakeUs = 0; // The wake did not move the DAC
+        return false;
+    }
+    return true;
+}
+
+// Moves gCurrentNote along the glide, returns true while gliding.
+// The glissando steps are moved by glissando_alarm_callback().
+static inline bool update_glide_note() {
     gCurrentTick  = time_us_64();
 
+    if (gGlideType == GLIDE_TYPE_GLISSANDO) {
+        return false;
+    }
+
     if (gCurrentTick > gEndTick) {
         gCurrentNote = gEndNote;
+        return false;
+    }
+
+    // The calculation without gCurrentNoteFactor
+    //gCurrentNote = (float)(gCurrentTick - gBeginTick) / 
+    //    (float)(gEndTick - gBeginTick) * (gEndNote - gBeginNote) + gBeginNote;
+
+    // The calculation with gCurrentNoteFactor
+    gCurrentNote = (float)(gCurrentTick - gBeginTick) * gCurrentNoteFactor + 
+        gBeginNote;
+    return true;
+}
+
+// Time the glide crosses into the next half note towards gEndNote, the
+// truncated note goes down as soon as it is below the half note.
+// Returns false when gGlissStep is the last step.
+static inline bool glissando_next_step() {
+    int endStep = (int)gEndNote;
+    if (gGlissStep == endStep || gEndTick <= gBeginTick) {
+        return false;
+    }
+
+    float crossNote = 0.f;
+    if (endStep > gGlissStep) {
+        gGlissNextStep = gGlissStep + 1;
+        crossNote = (float)gGlissNextStep;
     }
     else {
-        // The calculation without gCurrentNoteFactor
-        //gCurrentNote = (float)(gCurrentTick - gBeginTick) / 
-        //    (float)(gEndTick - gBeginTick) * (gEndNote - gBeginNote) + gBeginNote;
+        gGlissNextStep = gGlissStep - 1;
+        crossNote = (float)gGlissStep;
+    }
 
-        // The calculation with gCurrentNoteFactor
-        gCurrentNote = (float)(gCurrentTick - gBeginTick) * gCurrentNoteFactor + 
-            gBeginNote;
+    float deltaUs = (crossNote - gBeginNote) / gCurrentNoteFactor;
+    if (deltaUs < 0.f) {
+        deltaUs = 0.f;
+    }
+    gGlissNextUs = gBeginTick + (uint64_t)deltaUs;
+    if (gGlissNextUs > gEndTick) {
+        gGlissNextUs = gEndTick;
+    }
+    return true;
+}
+
+// Starts the step alarms from gCurrentNote, called with a new glide or
+// glide type. The crossing times are from the start of the glide, the
+// steps do not drift.
+static inline void glissando_arm() {
+    if (gGlissAlarm != 0) {
+        cancel_alarm(gGlissAlarm);
+        gGlissAlarm = 0;
+    }
+    if (gGlideType != GLIDE_TYPE_GLISSANDO) {
+        return;
+    }
+
+    gGlissStep = (int)gCurrentNote;
+    if (!glissando_next_step()) {
+        gCurrentNote = gEndNote;
+        return;
     }
 
+    gGlissAlarm = add_alarm_at(from_us_since_boot(gGlissNextUs - MCP4725_WRITE_US),
+        &glissando_alarm_callback, NULL, true);
+    if (gGlissAlarm < 0) {
+        // No free alarm, the glide jumps to the end
+        gGlissAlarm = 0;
+        gCurrentNote = gEndNote;
+    }
+}
+
+// The DAC write is started so the step is on the output at the crossing
+static inline int64_t glissando_alarm_callback(alarm_id_t id, void *user_data) {
+    uint64_t stepUs = gGlissNextUs;
+
+    gGlissStep = gGlissNextStep;
+    gCurrentNote = gGlissStep == (int)gEndNote ? gEndNote : (float)gGlissStep;
     set_get_mcp4725_dac_value(true, calculate_dac_value());
+    if (gDACVal != gDACValOld) {
+        if (setOutput_i2c_mcp4725(MCP4725_ADDR, gDACVal)) {
+            gDACValOld = gDACVal;
+        }
+        else {
+            // Written by the DAC timer when the queue has room
+            control_timers_wake();
+        }
+    }
 
-    return true;
+    if (!glissando_next_step()) {
+        gGlissAlarm = 0;
+        return 0;
+    }
+
+    // Negative is from the time this alarm was due
+    int64_t deltaUs = (int64_t)(gGlissNextUs - stepUs);
+    return deltaUs > 0 ? -deltaUs : -1;
+}
+
+// Writes the DAC now so the output changes at timeUs, called from the
+// event scheduler alarm less than EVENT_SCHED_LEAD_US ahead of timeUs.
+// Returns the time the write is done on the free pitch bus, 0 if the
+// value was unchanged.
+uint64_t set_mcp4725_output_at(uint64_t timeUs) {
+    update_glide_note();
+    set_get_mcp4725_dac_value(true, calculate_dac_value());
+    if (gDACVal == gDACValOld) {
+        return 0;
+    }
+
+    busy_wait_until(from_us_since_boot(timeUs - MCP4725_WRITE_US));
+    if (!setOutput_i2c_mcp4725(MCP4725_ADDR, gDACVal)) {
+        control_timers_wake();
+        return 0;
+    }
+    gDACValOld = gDACVal;
+    return time_us_64() + MCP4725_WRITE_US;
 }
 
 uint16_t set_get_mcp4725_dac_value(bool isSet, uint16_t dacValue) {
@@ -138,20 +354,27 @@ uint16_t set_get_mcp4725_dac_value(bool isSet, uint16_t dacValue) {
     return gDACVal;
 }
 
-// Based on midi note (gMIDINote) and pitch wheel (gPW_DACVal)
+// Based on midi note (gMIDINote), pitch wheel (gPWCurrent) and modulation (gModPitch)
+// The note, glide and pitch wheel are tuned and quantized (see tuning.h),
+// the modulation is added after, all in Q16 half notes
 static inline uint16_t calculate_dac_value() {
-    int16_t dacValue = 0; 
-    
-    if (gGlideType == GLIDE_TYPE_PORTAMENTO) {
-        dacValue = (int16_t)((gCurrentNote - MIDI_C0_NOTE_VALUE) * 
-            DAC_HALF_NOTE_VALUE + DAC_VALUE_C0_NOTE + (float)gPW_DACVal + 0.5f);
+    int32_t pitch = 0;
+
+    if (gGlideType == GLIDE_TYPE_GLISSANDO) {
+        pitch = (int32_t)gCurrentNote << 16;
     }
-    else if (gGlideType == GLIDE_TYPE_GLISSANDO) {
-        float intCurrentNote = (float)((int)(gCurrentNote));
-        dacValue = (int16_t)((intCurrentNote - MIDI_C0_NOTE_VALUE) * 
-            DAC_HALF_NOTE_VALUE + DAC_VALUE_C0_NOTE + (float)gPW_DACVal + 0.5f);
+    else {
+        pitch = (int32_t)(gCurrentNote * 65536.f);
     }
 
+    pitch = tuning_map_pitch(pitch + gPWCurrent) + gModPitch;
+
+    int32_t dacValue = DAC_VALUE_C0_NOTE + (int32_t)(((int64_t)(pitch - 
+        (MIDI_C0_NOTE_VALUE << 16)) * DAC_HALF_NOTE_VALUE + 0x8000) >> 16);
+
+    // The drift of the output stage is taken out, see drift_comp.h
+    dacValue = drift_comp_apply(dacValue);
+
     if (dacValue < MCP4725_MIN_VALUE) {
         return 0;
     }
@@ -164,16 +387,42 @@ static inline uint16_t calculate_dac_value() {
 }
 
 void set_midiNote(uint8_t noteNo) {
-    // Initiate things with glide in mind
+    set_midi_pitch((uint16_t)noteNo << 9);
+}
+
+// The pitch jumps with no glide, for a step written by
+// set_mcp4725_output_at() at the time of its gate edge
+void set_midi_pitch_no_glide(uint16_t pitch) {
+    uint32_t status = save_and_disable_interrupts();
+    gEndNote = (float)pitch * (1.f / 512.f);
+    gBeginNote = gEndNote;
+    gCurrentNote = gEndNote;
+    gBeginTick = time_us_64();
+    gEndTick = gBeginTick;
+    gCurrentNoteFactor = 0.f;
+    glissando_arm();
+    restore_interrupts(status);
+}
+
+// The pitch is a MIDI 2.0 pitch 7.9, note number and 9 bits fraction
+void set_midi_pitch(uint16_t pitch) {
+    // Initiate things with glide in mind, a glissando step alarm does not
+    // run in between
+    uint32_t status = save_and_disable_interrupts();
     gBeginNote = gCurrentNote;
-    gEndNote = (int)noteNo;
+    gEndNote = (float)pitch * (1.f / 512.f);
     gBeginTick = time_us_64();
     gEndTick = calculate_glide_end_tick(gBeginTick, gBeginNote, gEndNote);
     gCurrentNoteFactor = 1.f / (float)(gEndTick - gBeginTick) * 
         (gEndNote - gBeginNote);
+    glissando_arm();
+    restore_interrupts(status);
+    control_timers_wake();
 
-    printf("%.1f %.1f %d %llu %llu | ", gBeginNote, gEndNote, 
-        gGlideTable[gGlideVal], gBeginTick, gEndTick);
+    if (gPM) {
+        printf("%.1f %.1f %d %llu %llu | ", gBeginNote, gEndNote, 
+            gGlideTable[gGlideVal], gBeginTick, gEndTick);
+    }
 
     /*****************************************************/
     /* Since we intruduce the glide the dac value should */
@@ -196,20 +445,83 @@ void set_midiNote(uint8_t noteNo) {
     //}
 }
 
+// Only the target is set here, called from the UART interrupt.
+// The output is moved towards the target in glide_timer_callback()
 void set_pitch_wheel(uint8_t lsb, uint8_t msb, int hpwRange) {
-    const int32_t pwMidValue = 64 * 256 + 0;
-    int32_t pwAbsValue = msb * 256 + lsb;
-    int32_t pwValue = pwAbsValue - pwMidValue;
-    gPW_DACVal = (pwValue * hpwRange * DAC_HALF_NOTE_VALUE) /
-        pwMidValue;
+    // The pitch wheel is 14 bits, msb and lsb are 7 bits each
+    uint32_t pwAbsValue = ((uint32_t)(msb & 0x7F) << 7) | (lsb & 0x7F);
+
+    // MIDI 1.0 to MIDI 2.0 translation, the center stays the center
+    set_pitch_wheel_32(ump_scale_up(pwAbsValue, 14, 32), hpwRange);
+}
+
+// 32 bit pitch bend value to Q16 half notes, 0x80000000 is the center
+static inline int32_t pitch_bend_32_to_q16(uint32_t value, int range) {
+    int32_t pwValue = (int32_t)(value ^ PW_CENTER_32);
+    return (int32_t)(((int64_t)pwValue * range) >> 15);
+}
+
+void set_pitch_wheel_32(uint32_t value, int hpwRange) {
+    gPWChannel = pitch_bend_32_to_q16(value, hpwRange);
+    pitch_wheel_retarget();
+}
 
-    uint16_t dacVal = set_get_mcp4725_dac_value(true, calculate_dac_value());
+// Per-note pitch bend of the sounding note, added to the channel bend
+void set_per_note_pitch_bend(uint32_t value, int range) {
+    gPWNote = pitch_bend_32_to_q16(value, range);
+    pitch_wheel_retarget();
+}
+
+static inline void pitch_wheel_retarget() {
+    gPWTarget = gPWChannel + gPWNote;
+
+    // Linear interpolation from current value to the new target
+    gPWStep = (gPWTarget - gPWCurrent) / PW_INTERP_TICKS;
+    gPWStepsLeft = PW_INTERP_TICKS;
+    control_timers_wake();
 
     if (gPM) {
-        printf("%d ", gPW_DACVal);
+        printf("%ld ", (long)gPWTarget);
     }
 }
 
+// Called every glide tick, returns true while the pitch wheel is moving
+static inline bool update_pitch_wheel() {
+    if (gPWStepsLeft <= 0) {
+        return false;
+    }
+
+    gPWStepsLeft--;
+    if (gPWStepsLeft == 0) {
+        gPWCurrent = gPWTarget; // No rounding error left at the end
+    }
+    else {
+        gPWCurrent += gPWStep;
+    }
+
+    return true;
+}
+
+void SetGlideValue(int glideVal) {
+    if (glideVal < 0 || glideVal > 127) {
+        return;
+    }
+
+    gGlideVal = glideVal;
+}
+
+void SetGlideType(int glideType) {
+    if (glideType != GLIDE_TYPE_PORTAMENTO && glideType != GLIDE_TYPE_GLISSANDO) {
+        return;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+    gGlideType = glideType;
+    glissando_arm();
+    restore_interrupts(status);
+    control_timers_wake();
+}
+
 // Returns the midi_note as a float value
 float dac_value_to_midi_note(uint16_t dacValue) {
     return (float)(dacValue-30) / 42.f + 12.f;
@@ -8,33 +8,46 @@
 #include "pico/stdlib.h"
 #include "pico/binary_info.h"
 #include "hardware/i2c.h"
+#include "i2c_sched.h"
 
-//#define I2C0_SDA PICO_DEFAULT_I2C_SDA_PIN
-//#define I2C0_SCL PICO_DEFAULT_I2C_SCL_PIN
-#define I2C0_SDA 8
-#define I2C0_SCL 9
-
+#define MCP4725_I2C_BUS I2C_SCHED_BUS0 // Alone on the bus, see i2c_sched.h
 #define MCP4725_ADDR 0x62
 #define MCP4725_BAUDRATE 400000
 #define MCP4725_CMD_WRITEDAC 0x40 // Writes data to the DAC
 #define MCP4725_CMD_WRITEDACEEPROM 0x60 // Writes data to the DAC and the EEPROM (persisting the assigned value after reset)
+#define MCP4725_READ_SIZE 5 // Status, DAC register (2) and EEPROM (2)
+#define MCP4725_BOOT_VALUE 0 // DAC output at power on and after init
 #define MCP4725_MIN_VALUE 0
 #define MCP4725_MAX_VALUE 4095
 #define MCP4725_TIMER_UPDATE_250 250 // Update every 250 uS
 #define GLIDE_TIMER_UPDATE 1000 // Update every 1000 uS
+#define MCP4725_WRITE_US 100 // Fast write at 400 kHz, queued on a free bus to output update
+#define PW_INTERP_TICKS 4 // Pitch wheel is interpolated over 4 glide ticks
+#define PW_CENTER_32 0x80000000u // 32 bit pitch bend center value
+#define PNB_DEFAULT_RANGE 48 // Per-note pitch bend range in half notes
 
 #define MIDI_C0_NOTE_VALUE 12 // The MIDI note for C0 note
 #define MIDI_C8_NOTE_VALUE 108 // The MIDI note for C0 note
 #define DAC_VALUE_C0_NOTE 30 // The 12 bit DAC value for C0 note
 #define DAC_HALF_NOTE_VALUE 42 // The 12 bit DAC value from one half note to next
 
+// Portamento moves the pitch on every glide tick. Glissando holds a half
+// note until the glide crosses the next one, every crossing time is known
+// from gBeginTick and gEndTick, so a one-shot alarm writes each step
+// MCP4725_WRITE_US ahead of it and the glide timer does not run for it.
 #define GLIDE_TYPE_PORTAMENTO 1
 #define GLIDE_TYPE_GLISSANDO 2
 
 // Global char extern declaration
 extern int gDACVal;
 extern int gDACValOld;
-extern int16_t gPW_DACVal;
+// Pitch wheel in 1/65536 half notes (Q16), target and slewed value
+extern int32_t gPWChannel;
+extern int32_t gPWNote;
+extern int32_t gPWTarget;
+extern int32_t gPWCurrent;
+extern int32_t gPWStep;
+extern int gPWStepsLeft;
 
 // Minimum glide speed at glide value of 127 is 1 half note / s
 extern int gGlideVal; // Glide value can be 0 - 127
@@ -47,6 +60,10 @@ extern float gCurrentNoteFactor;
 extern float gCurrentNote;
 extern float gBeginNote;
 extern float gEndNote;
+extern volatile bool gControlIdle; // The control and DAC timers are stopped
+extern uint32_t gControlIdleCount;
+extern uint32_t gControlWakeToDacUs; // Latest wake to DAC write time
+extern uint32_t gControlWakeToDacMaxUs;
 
 bool init_i2c_mcp4725(uint8_t addr, uint baudrate);
 static inline bool setOutput_i2c_mcp4725(uint8_t addr, uint16_t output);
@@ -58,12 +75,30 @@ static inline bool mcp4725_us_timer_callback(repeating_timer_t *rt);
 void init_glide_timer_event(); // The glide timer event is every 1000 us
 static inline bool glide_timer_callback(repeating_timer_t *rt);
 
+// The timers stop when the glide, the pitch wheel, the routes and the
+// modulation are still and the DAC is up to date
+void control_timers_wake();
+bool control_timers_is_idle();
+
 uint16_t set_get_mcp4725_dac_value(bool isSet, uint16_t dacValue);
+static inline bool update_glide_note();
+static inline void glissando_arm();
+static inline int64_t glissando_alarm_callback(alarm_id_t id, void *user_data);
+uint64_t set_mcp4725_output_at(uint64_t timeUs);
 
 // Based on midi note, pitch wheel, and portamento
 static inline uint16_t calculate_dac_value(); 
 void set_midiNote(uint8_t noteNo);
+void set_midi_pitch(uint16_t pitch);
+void set_midi_pitch_no_glide(uint16_t pitch);
 void set_pitch_wheel(uint8_t lsb, uint8_t msb, int hpwRange);
+void set_pitch_wheel_32(uint32_t value, int hpwRange);
+void set_per_note_pitch_bend(uint32_t value, int range);
+static inline void pitch_wheel_retarget();
+static inline bool update_pitch_wheel();
+
+void SetGlideValue(int glideVal);
+void SetGlideType(int glideType);
 
 float dac_value_to_midi_note(uint16_t dacValue);
 uint16_t midi_note_to_dac_value(float midiNote);
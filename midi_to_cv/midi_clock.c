@@ -0,0 +1,327 @@
+/***********************************************
+/ midi_clock.c : implementation file for the MIDI clock functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "midi_uart.h"
+#include "midi_clock.h"
+#include "pulse_out.h"
+#include "mod_engine.h"
+#include "arp.h"
+#include "looper.h"
+
+// Global char initiation
+midi_clock_source_t gClockSource[MIDI_CLK_NO_OF_SOURCES];
+bool gClockRunning = false; // Start or continue received and no stop
+uint32_t gClockSongPos = 0; // Song position [ticks]
+uint32_t gClockOutCount = 0; // Number of regenerated ticks
+int gInternalBpm = MIDI_CLK_DEFAULT_BPM; // Internal clock beats per minute
+
+uint32_t gClockBeatTick = 0; // Tick within the beat, 0 - 23
+uint32_t gClockOutIndex = 0; // Input tick number of the next output tick
+uint64_t gClockNextOut = 0; // Time of the next output tick [us]
+int64_t gInternalPhase = 0; // Time of the next internal tick [Q8 us]
+int32_t gInternalPeriod = 0; // Internal tick period [Q8 us]
+
+static inline int32_t bpm_to_tick_period_q8(int bpm) {
+    return (int32_t)(((int64_t)bpm_to_us(bpm) << 8) / MIDI_CLK_PPQN);
+}
+
+static inline int32_t clamp_tick_period_q8(int64_t period) {
+    // Note that the shortest period is at the highest bpm
+    const int32_t minPeriod = bpm_to_tick_period_q8(MIDI_CLK_MAX_BPM);
+    const int32_t maxPeriod = bpm_to_tick_period_q8(MIDI_CLK_MIN_BPM);
+
+    if (period < minPeriod) {
+        return minPeriod;
+    }
+    else if (period > maxPeriod) {
+        return maxPeriod;
+    }
+    else {
+        return (int32_t)period;
+    }
+}
+
+void init_midi_clock(int bpm) {
+    for (int i = 0; i < MIDI_CLK_NO_OF_SOURCES; i++) {
+        gClockSource[i].state = MIDI_CLK_STATE_IDLE;
+        gClockSource[i].lastTick = 0;
+        gClockSource[i].phase = 0;
+        gClockSource[i].period = 0;
+        gClockSource[i].inCount = 0;
+        gClockSource[i].maxError = 0;
+    }
+
+    // An invalid bpm leaves the default tempo
+    gInternalBpm = MIDI_CLK_DEFAULT_BPM;
+    gInternalPeriod = bpm_to_tick_period_q8(MIDI_CLK_DEFAULT_BPM);
+    SetInternalClockBpm(bpm);
+
+    hardware_alarm_claim(MIDI_CLK_HW_ALARM);
+    hardware_alarm_set_callback(MIDI_CLK_HW_ALARM, &midi_clock_alarm_callback);
+
+    midi_clock_source_changed();
+}
+
+void SetInternalClockBpm(int bpm) {
+    if (bpm < MIDI_CLK_MIN_BPM || bpm > MIDI_CLK_MAX_BPM) {
+        return;
+    }
+
+    gInternalBpm = bpm;
+    gInternalPeriod = bpm_to_tick_period_q8(bpm);
+}
+
+// Called by SetClockSource() when gMidiClk has been changed
+void midi_clock_source_changed() {
+    hardware_alarm_cancel(MIDI_CLK_HW_ALARM);
+
+    if (gMidiClk == MIDI_CLK_INTERNAL) {
+        // The internal clock is free running from now on
+        gInternalPhase = ((int64_t)time_us_64() << 8) + gInternalPeriod;
+        gClockSongPos = 0;
+        gClockBeatTick = 0;
+        gClockRunning = true;
+        midi_clock_arm();
+    }
+    else {
+        // Wait for the next tick from the new source
+        gClockOutIndex = gClockSource[gMidiClk - MIDI_CLK_UART0].inCount;
+        gClockRunning = false;
+    }
+}
+
+// The regenerated clock, every tick from the selected source ends up here
+static inline void midi_clock_tick_out(uint64_t timeUs) {
+    gClockOutCount++;
+
+    // The onboard LED follows the quarter note beat
+    if (gClockBeatTick == 0) {
+        gpio_put(PICO_DEFAULT_LED_PIN, 1);
+    }
+    else if (gClockBeatTick == MIDI_CLK_LED_ON_TICKS) {
+        gpio_put(PICO_DEFAULT_LED_PIN, 0);
+    }
+
+    // Synced LFOs and the arpeggiator follow the song position, or the
+    // free running count
+    uint32_t tick = gClockRunning ? gClockSongPos : gClockOutCount;
+    uint32_t periodUs = midi_clock_get_period_us();
+    mod_lfo_clock_tick(tick, periodUs);
+    arp_clock_tick(tick, timeUs, periodUs);
+
+    if (gClockRunning) {
+        pulse_out_clock_tick(gClockSongPos, timeUs + PULSE_OUT_LATENCY_US, 
+            periodUs);
+        looper_clock_tick(gClockSongPos, timeUs, periodUs);
+        gClockSongPos++;
+    }
+
+    gClockBeatTick++;
+    if (gClockBeatTick >= MIDI_CLK_PPQN) {
+        gClockBeatTick = 0;
+    }
+}
+
+// Alpha-beta filter, the phase follows 1/8 and the period 1/64 of the
+// error between the predicted and the time stamped tick
+static inline void midi_clock_filter(midi_clock_source_t *pSrc, uint64_t timeUs) {
+    int64_t t = (int64_t)timeUs << 8;
+
+    if (pSrc->state != MIDI_CLK_STATE_IDLE && 
+        timeUs - pSrc->lastTick > MIDI_CLK_TIMEOUT_US) {
+        pSrc->state = MIDI_CLK_STATE_IDLE;
+    }
+
+    switch (pSrc->state) {
+    case MIDI_CLK_STATE_IDLE:
+        pSrc->phase = t;
+        pSrc->state = MIDI_CLK_STATE_ACQUIRE;
+        break;
+    case MIDI_CLK_STATE_ACQUIRE:
+        pSrc->period = clamp_tick_period_q8((int64_t)(timeUs - pSrc->lastTick) << 8);
+        pSrc->phase = t;
+        pSrc->maxError = 0;
+        pSrc->state = MIDI_CLK_STATE_LOCKED;
+        break;
+    case MIDI_CLK_STATE_LOCKED:
+        {
+            int64_t predicted = pSrc->phase + pSrc->period;
+            int32_t err = (int32_t)(t - predicted);
+
+            if (err > pSrc->period / 2 || err < -pSrc->period / 2) {
+                // Too far off to be jitter, the tempo has jumped
+                pSrc->period = clamp_tick_period_q8((int64_t)(timeUs - pSrc->lastTick) << 8);
+                pSrc->phase = t;
+            }
+            else {
+                pSrc->phase = predicted + (err >> MIDI_CLK_ALPHA_SHIFT);
+                pSrc->period = clamp_tick_period_q8(pSrc->period + 
+                    (err >> MIDI_CLK_BETA_SHIFT));
+
+                int32_t absErr = (err < 0? -err : err) >> 8;
+                if (absErr > pSrc->maxError) {
+                    pSrc->maxError = absErr;
+                }
+            }
+        }
+        break;
+    }
+
+    pSrc->lastTick = timeUs;
+    pSrc->inCount++;
+}
+
+// Outputs the tick at gClockNextOut and moves on to the next one
+static inline void midi_clock_next_out() {
+    midi_clock_tick_out(gClockNextOut);
+
+    if (gMidiClk == MIDI_CLK_INTERNAL) {
+        gInternalPhase += gInternalPeriod;
+
+        // More than a tick late, skip ahead instead of a burst of ticks
+        int64_t now = (int64_t)time_us_64() << 8;
+        if (gInternalPhase < now) {
+            gInternalPhase = now + gInternalPeriod;
+        }
+    }
+    else {
+        gClockOutIndex++;
+    }
+}
+
+// Arm the hardware alarm for the next output tick
+static inline void midi_clock_arm() {
+    while (true) {
+        int64_t due = 0;
+
+        if (gMidiClk == MIDI_CLK_INTERNAL) {
+            due = gInternalPhase;
+        }
+        else {
+            midi_clock_source_t *pSrc = &gClockSource[gMidiClk - MIDI_CLK_UART0];
+            int32_t ahead = (int32_t)(gClockOutIndex - (pSrc->inCount - 1));
+
+            if (pSrc->state != MIDI_CLK_STATE_LOCKED || 
+                ahead > MIDI_CLK_FLYWHEEL_TICKS) {
+                // Wait for the source
+                return;
+            }
+            due = pSrc->phase + (int64_t)ahead * pSrc->period;
+        }
+
+        gClockNextOut = (uint64_t)(due >> 8);
+        if (!hardware_alarm_set_target(MIDI_CLK_HW_ALARM, 
+            from_us_since_boot(gClockNextOut))) {
+            return;
+        }
+
+        // The time has already passed, the tick is output right away. The
+        // flywheel limit and the skip ahead end the loop.
+        midi_clock_next_out();
+    }
+}
+
+static inline void midi_clock_alarm_callback(uint alarmNum) {
+    midi_clock_next_out();
+    midi_clock_arm();
+}
+
+void midi_clock_tick_in(int source, uint64_t timeUs) {
+    if (source < MIDI_CLK_UART0 || source > MIDI_CLK_PIO1) {
+        return;
+    }
+
+    midi_clock_source_t *pSrc = &gClockSource[source - MIDI_CLK_UART0];
+    bool wasLocked = pSrc->state == MIDI_CLK_STATE_LOCKED;
+    midi_clock_filter(pSrc, timeUs);
+
+    if (source != gMidiClk) {
+        return;
+    }
+
+    if (!wasLocked || pSrc->state != MIDI_CLK_STATE_LOCKED) {
+        // No estimate yet, pass the tick straight through
+        midi_clock_tick_out(timeUs);
+        gClockOutIndex = pSrc->inCount;
+        return;
+    }
+
+    // If the alarm was late, catch up with the input
+    if (gClockOutIndex + 1 < pSrc->inCount) {
+        midi_clock_tick_out(timeUs);
+        gClockOutIndex = pSrc->inCount - 1;
+    }
+
+    midi_clock_arm();
+}
+
+void midi_clock_start(int source) {
+    if (source != gMidiClk) {
+        return;
+    }
+
+    // The next tick is the first tick of the song
+    gClockSongPos = 0;
+    gClockBeatTick = 0;
+    gClockRunning = true;
+
+    pulse_out_reset(time_us_64() + PULSE_OUT_LATENCY_US);
+}
+
+void midi_clock_continue(int source) {
+    if (source != gMidiClk) {
+        return;
+    }
+
+    gClockRunning = true;
+}
+
+void midi_clock_stop(int source) {
+    if (source != gMidiClk) {
+        return;
+    }
+
+    gClockRunning = false;
+    looper_clock_stop();
+}
+
+// The song position is in 1/16 notes, 6 MIDI clock ticks each
+void midi_clock_song_position(int source, uint16_t pos) {
+    if (source != gMidiClk) {
+        return;
+    }
+
+    gClockSongPos = (uint32_t)pos * MIDI_CLK_TICKS_PER_SPP;
+    gClockBeatTick = gClockSongPos % MIDI_CLK_PPQN;
+}
+
+uint32_t midi_clock_get_bpm_x100(int source) {
+    if (source == MIDI_CLK_INTERNAL) {
+        return (uint32_t)gInternalBpm * 100;
+    }
+    if (source < MIDI_CLK_UART0 || source > MIDI_CLK_PIO1) {
+        return 0;
+    }
+
+    midi_clock_source_t *pSrc = &gClockSource[source - MIDI_CLK_UART0];
+    if (pSrc->state != MIDI_CLK_STATE_LOCKED) {
+        return 0;
+    }
+
+    // 60 s * 100 / (period * 24)
+    return (uint32_t)((60000000ull * 100ull << 8) / 
+        ((uint64_t)pSrc->period * MIDI_CLK_PPQN));
+}
+
+uint32_t midi_clock_get_period_us() {
+    if (gMidiClk == MIDI_CLK_INTERNAL) {
+        return (uint32_t)(gInternalPeriod >> 8);
+    }
+
+    return (uint32_t)(gClockSource[gMidiClk - MIDI_CLK_UART0].period >> 8);
+}
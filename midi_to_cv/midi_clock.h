@@ -0,0 +1,74 @@
+/***********************************************
+/ midi_clock.h : header file for the MIDI clock functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef MIDI_CLOCK_H
+#define MIDI_CLOCK_H
+
+#include "pico/stdlib.h"
+#include "hardware/timer.h"
+#include "midi_uart.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Every 0xF8 is time stamped per source and runs through an alpha-beta
+// filter (a second order PLL) that estimates the tick period and phase.
+// The selected source is regenerated from a hardware alarm at the filtered
+// tick times, the internal clock free runs on the same alarm.
+////////////////////////////////////////////////////////////////////////////////
+
+#define MIDI_CLK_HW_ALARM 0 // Hardware alarm used for the clock output
+#define MIDI_CLK_PPQN 24 // MIDI clock ticks per quarter note
+#define MIDI_CLK_TICKS_PER_SPP 6 // Song position pointer unit is 1/16 note
+#define MIDI_CLK_DEFAULT_BPM 120
+#define MIDI_CLK_MIN_BPM 20
+#define MIDI_CLK_MAX_BPM 300
+#define MIDI_CLK_TIMEOUT_US 250000 // No tick for 250 ms, the source is lost
+#define MIDI_CLK_FLYWHEEL_TICKS 2 // Ticks regenerated without input ticks
+#define MIDI_CLK_ALPHA_SHIFT 3 // Phase correction 1/8 of the error
+#define MIDI_CLK_BETA_SHIFT 6 // Period correction 1/64 of the error
+#define MIDI_CLK_LED_ON_TICKS 5 // The LED is on 5 ticks every beat
+
+#define MIDI_CLK_NO_OF_SOURCES (MIDI_CLK_PIO1 - MIDI_CLK_UART0 + 1)
+
+#define MIDI_CLK_STATE_IDLE 0 // No tick received
+#define MIDI_CLK_STATE_ACQUIRE 1 // One tick received, no period yet
+#define MIDI_CLK_STATE_LOCKED 2 // The filter is tracking the source
+
+// Filter state of a clock source, times are in us << 8 (Q8)
+typedef struct {
+    int state;
+    uint64_t lastTick; // Raw time stamp of the last tick [us]
+    int64_t phase; // Filtered time of the last tick [Q8 us]
+    int32_t period; // Filtered tick period [Q8 us]
+    uint32_t inCount; // Number of ticks received
+    int32_t maxError; // Largest phase error seen while locked [us]
+} midi_clock_source_t;
+
+// Global char extern declaration
+extern midi_clock_source_t gClockSource[];
+extern bool gClockRunning; // Start or continue received and no stop
+extern uint32_t gClockSongPos; // Song position [ticks]
+extern uint32_t gClockOutCount; // Number of regenerated ticks
+extern int gInternalBpm; // Internal clock beats per minute
+
+void init_midi_clock(int bpm);
+void SetInternalClockBpm(int bpm);
+void midi_clock_source_changed();
+
+// Called from the MIDI interrupt handlers, source is MIDI_CLK_xxx
+void midi_clock_tick_in(int source, uint64_t timeUs);
+void midi_clock_start(int source);
+void midi_clock_continue(int source);
+void midi_clock_stop(int source);
+void midi_clock_song_position(int source, uint16_t pos);
+
+static inline void midi_clock_tick_out(uint64_t timeUs);
+static inline void midi_clock_arm();
+static inline void midi_clock_alarm_callback(uint alarmNum);
+
+uint32_t midi_clock_get_bpm_x100(int source);
+uint32_t midi_clock_get_period_us();
+
+#endif // MIDI_CLOCK_H
@@ -0,0 +1,344 @@
+/***********************************************
+/ midi_thru.c : implementation file for the MIDI thru and merge functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "midi_uart.h"
+#include "midi_thru.h"
+#include "hardware/sync.h"
+
+#define MIDI_THRU_RING_MASK (MIDI_THRU_RING_SIZE - 1)
+#define MIDI_THRU_RT_RING_MASK (MIDI_THRU_RT_RING_SIZE - 1)
+
+// Global char initiation
+int gThruInputs[MIDI_THRU_NO_OF_OUTPUTS] = { MIDI_THRU_UART0, MIDI_THRU_NONE };
+int gThruFilter[MIDI_THRU_NO_OF_OUTPUTS] = { MIDI_THRU_FILTER_NONE, MIDI_THRU_FILTER_NONE };
+uint32_t gThruDropped = 0; // Messages that did not fit in a ring
+
+// The received bytes, one ring per input
+uint8_t gThruRing[MIDI_THRU_NO_OF_INPUTS][MIDI_THRU_RING_SIZE];
+uint32_t gThruWrite[MIDI_THRU_NO_OF_INPUTS]; // Next byte to write
+uint32_t gThruCommit[MIDI_THRU_NO_OF_INPUTS]; // Bytes the outputs may read
+uint32_t gThruRead[MIDI_THRU_NO_OF_OUTPUTS][MIDI_THRU_NO_OF_INPUTS];
+
+// Message tracking per input
+bool gThruIsMerged[MIDI_THRU_NO_OF_INPUTS]; // An output merges this input
+uint8_t gThruRunStatus[MIDI_THRU_NO_OF_INPUTS]; // Running status
+int gThruDataCount[MIDI_THRU_NO_OF_INPUTS]; // Data bytes since status
+int gThruDataExpected[MIDI_THRU_NO_OF_INPUTS]; // Data bytes in message
+bool gThruInSysEx[MIDI_THRU_NO_OF_INPUTS];
+bool gThruSkip[MIDI_THRU_NO_OF_INPUTS]; // Drop until the next status
+
+// Real time bytes, one ring per output
+uint8_t gThruRtRing[MIDI_THRU_NO_OF_OUTPUTS][MIDI_THRU_RT_RING_SIZE];
+uint32_t gThruRtWrite[MIDI_THRU_NO_OF_OUTPUTS];
+uint32_t gThruRtRead[MIDI_THRU_NO_OF_OUTPUTS];
+
+// Output arbitration
+int gThruOwner[MIDI_THRU_NO_OF_OUTPUTS]; // Input owning the output, or -1
+int gThruNextInput[MIDI_THRU_NO_OF_OUTPUTS]; // Round robin start
+bool gThruOutInSysEx[MIDI_THRU_NO_OF_OUTPUTS];
+
+static inline uart_inst_t *midi_thru_uart(int output) {
+    return output == 0? UART_0 : UART_1;
+}
+
+// Recalculate which inputs are merged and restart all rings
+static inline void midi_thru_configure() {
+    for (int i = 0; i < MIDI_THRU_NO_OF_INPUTS; i++) {
+        gThruIsMerged[i] = false;
+        gThruCommit[i] = gThruWrite[i];
+        gThruDataCount[i] = 0;
+        gThruDataExpected[i] = 0;
+        gThruRunStatus[i] = 0;
+        gThruInSysEx[i] = false;
+        gThruSkip[i] = false;
+    }
+
+    for (int o = 0; o < MIDI_THRU_NO_OF_OUTPUTS; o++) {
+        bool isMerge = (gThruInputs[o] & (gThruInputs[o] - 1)) != 0;
+        for (int i = 0; i < MIDI_THRU_NO_OF_INPUTS; i++) {
+            if (isMerge && (gThruInputs[o] & (1 << i))) {
+                gThruIsMerged[i] = true;
+            }
+            gThruRead[o][i] = gThruWrite[i];
+        }
+        gThruRtRead[o] = gThruRtWrite[o];
+        gThruOwner[o] = -1;
+        gThruNextInput[o] = 0;
+        gThruOutInSysEx[o] = false;
+    }
+}
+
+void init_midi_thru() {
+    for (int i = 0; i < MIDI_THRU_NO_OF_INPUTS; i++) {
+        gThruWrite[i] = 0;
+    }
+    for (int o = 0; o < MIDI_THRU_NO_OF_OUTPUTS; o++) {
+        gThruRtWrite[o] = 0;
+    }
+    midi_thru_configure();
+}
+
+void SetThruInputs(int output, int inputMask) {
+    if (output < 0 || output >= MIDI_THRU_NO_OF_OUTPUTS) {
+        return;
+    }
+    if (inputMask < 0 || inputMask >= (1 << MIDI_THRU_NO_OF_INPUTS)) {
+        return;
+    }
+
+    uint32_t save = save_and_disable_interrupts();
+    gThruInputs[output] = inputMask;
+    midi_thru_configure();
+    restore_interrupts(save);
+}
+
+void SetThruFilter(int output, int filterMask) {
+    if (output < 0 || output >= MIDI_THRU_NO_OF_OUTPUTS) {
+        return;
+    }
+
+    gThruFilter[output] = filterMask;
+}
+
+// Start sending on the outputs that have committed bytes from this input
+static inline void midi_thru_kick(int input) {
+    for (int o = 0; o < MIDI_THRU_NO_OF_OUTPUTS; o++) {
+        if ((gThruInputs[o] & (1 << input)) && 
+            gThruRead[o][input] != gThruCommit[input]) {
+            uart_set_irq_enables(midi_thru_uart(o), true, true);
+        }
+    }
+}
+
+static inline bool midi_thru_is_filtered(int output, uint8_t val) {
+    switch (val) {
+    case 0xF8:
+        return (gThruFilter[output] & MIDI_THRU_FILTER_CLOCK) != 0;
+    case 0xFA:
+    case 0xFB:
+    case 0xFC:
+        return (gThruFilter[output] & MIDI_THRU_FILTER_TRANSPORT) != 0;
+    case 0xFE:
+        return (gThruFilter[output] & MIDI_THRU_FILTER_ACTIVE_SENSING) != 0;
+    }
+    return false;
+}
+
+// Free bytes in the ring of an input, limited by the slowest output
+static inline uint32_t midi_thru_free(int input) {
+    uint32_t used = 0;
+
+    for (int o = 0; o < MIDI_THRU_NO_OF_OUTPUTS; o++) {
+        if (gThruInputs[o] & (1 << input)) {
+            uint32_t u = gThruWrite[input] - gThruRead[o][input];
+            if (u > used) {
+                used = u;
+            }
+        }
+    }
+    return MIDI_THRU_RING_SIZE - used;
+}
+
+static inline void midi_thru_put(int input, uint8_t val) {
+    if (gThruSkip[input]) {
+        return;
+    }
+    if (midi_thru_free(input) == 0) {
+        // Drop the rest of the message
+        gThruWrite[input] = gThruCommit[input];
+        gThruSkip[input] = true;
+        gThruDropped++;
+        return;
+    }
+
+    gThruRing[input][gThruWrite[input] & MIDI_THRU_RING_MASK] = val;
+    gThruWrite[input]++;
+}
+
+static inline void midi_thru_commit(int input) {
+    gThruCommit[input] = gThruWrite[input];
+}
+
+void midi_thru_byte(int input, uint8_t val) {
+    if (input < 0 || input >= MIDI_THRU_NO_OF_INPUTS) {
+        return;
+    }
+
+    // Real time bytes go straight to the outputs
+    if (val >= 0xF8) {
+        for (int o = 0; o < MIDI_THRU_NO_OF_OUTPUTS; o++) {
+            if (!(gThruInputs[o] & (1 << input)) || midi_thru_is_filtered(o, val)) {
+                continue;
+            }
+            if (gThruRtWrite[o] - gThruRtRead[o] >= MIDI_THRU_RT_RING_SIZE) {
+                gThruDropped++;
+                continue;
+            }
+            gThruRtRing[o][gThruRtWrite[o] & MIDI_THRU_RT_RING_MASK] = val;
+            gThruRtWrite[o]++;
+            uart_set_irq_enables(midi_thru_uart(o), true, true);
+        }
+        return;
+    }
+
+    bool isMerged = gThruIsMerged[input];
+
+    if (val & 0x80) {
+        gThruSkip[input] = false;
+
+        if (gThruInSysEx[input]) {
+            // Any status ends a SysEx
+            gThruInSysEx[input] = false;
+            if (val == 0xF7) {
+                midi_thru_put(input, val);
+                midi_thru_commit(input);
+                midi_thru_kick(input);
+                return;
+            }
+            midi_thru_put(input, 0xF7);
+            midi_thru_commit(input);
+        }
+
+        gThruDataCount[input] = 0;
+        if (val < 0xF0) {
+            gThruRunStatus[input] = val;
+            gThruDataExpected[input] = ((val & 0xE0) == 0xC0)? 1 : 2;
+        }
+        else {
+            // System common messages clear the running status
+            gThruRunStatus[input] = 0;
+            switch (val) {
+            case 0xF0:
+                gThruInSysEx[input] = true;
+                gThruDataExpected[input] = 0;
+                break;
+            case 0xF1:
+            case 0xF3:
+                gThruDataExpected[input] = 1;
+                break;
+            case 0xF2:
+                gThruDataExpected[input] = 2;
+                break;
+            case 0xF6:
+                gThruDataExpected[input] = 0;
+                break;
+            default: // 0xF4, 0xF5 and a lone 0xF7 are not forwarded
+                gThruDataExpected[input] = -1;
+                return;
+            }
+        }
+
+        // Start of a message
+        midi_thru_put(input, val);
+        if (!isMerged || gThruInSysEx[input] || gThruDataExpected[input] == 0) {
+            midi_thru_commit(input);
+        }
+    }
+    else {
+        if (gThruInSysEx[input]) {
+            midi_thru_put(input, val);
+            midi_thru_commit(input);
+        }
+        else {
+            if (gThruDataExpected[input] <= 0) {
+                // Orphan data byte
+                return;
+            }
+            if (gThruDataCount[input] >= gThruDataExpected[input]) {
+                if (!gThruRunStatus[input]) {
+                    return;
+                }
+                // Running status, a merged output needs the status byte
+                gThruDataCount[input] = 0;
+                gThruSkip[input] = false;
+                if (isMerged) {
+                    midi_thru_put(input, gThruRunStatus[input]);
+                }
+            }
+
+            midi_thru_put(input, val);
+            gThruDataCount[input]++;
+            if (!isMerged || gThruDataCount[input] >= gThruDataExpected[input]) {
+                midi_thru_commit(input);
+            }
+        }
+    }
+
+    midi_thru_kick(input);
+}
+
+// Returns false if nothing is waiting for the output
+static inline bool midi_thru_next_byte(int output, uint8_t *pVal) {
+    // Real time bytes cut in anywhere
+    if (gThruRtRead[output] != gThruRtWrite[output]) {
+        *pVal = gThruRtRing[output][gThruRtRead[output] & MIDI_THRU_RT_RING_MASK];
+        gThruRtRead[output]++;
+        return true;
+    }
+
+    int input = gThruOwner[output];
+    if (input < 0) {
+        // Round robin among the inputs with complete messages
+        for (int k = 0; k < MIDI_THRU_NO_OF_INPUTS; k++) {
+            int i = (gThruNextInput[output] + k) % MIDI_THRU_NO_OF_INPUTS;
+            if ((gThruInputs[output] & (1 << i)) && 
+                gThruRead[output][i] != gThruCommit[i]) {
+                input = i;
+                break;
+            }
+        }
+        if (input < 0) {
+            return false;
+        }
+        gThruOwner[output] = input;
+        gThruNextInput[output] = (input + 1) % MIDI_THRU_NO_OF_INPUTS;
+    }
+
+    if (gThruRead[output][input] == gThruCommit[input]) {
+        // The owner is in the middle of a SysEx, wait for more bytes
+        return false;
+    }
+
+    uint8_t val = gThruRing[input][gThruRead[output][input] & MIDI_THRU_RING_MASK];
+    gThruRead[output][input]++;
+
+    if (val == 0xF0) {
+        gThruOutInSysEx[output] = true;
+    }
+    else if (val & 0x80) {
+        gThruOutInSysEx[output] = false;
+    }
+
+    // Keep the output until the message is done
+    bool isMore = gThruRead[output][input] != gThruCommit[input] && 
+        !(gThruRing[input][gThruRead[output][input] & MIDI_THRU_RING_MASK] & 0x80);
+    if (!isMore && !gThruOutInSysEx[output]) {
+        gThruOwner[output] = -1;
+    }
+
+    *pVal = val;
+    return true;
+}
+
+void midi_thru_tx(int output) {
+    if (output < 0 || output >= MIDI_THRU_NO_OF_OUTPUTS) {
+        return;
+    }
+
+    uart_inst_t *uart = midi_thru_uart(output);
+    uint8_t val = 0;
+
+    while (uart_is_writable(uart)) {
+        if (!midi_thru_next_byte(output, &val)) {
+            // Nothing more, stop the TX interrupt
+            uart_set_irq_enables(uart, true, false);
+            return;
+        }
+        uart_putc_raw(uart, (char)val);
+    }
+}
@@ -0,0 +1,56 @@
+/***********************************************
+/ midi_thru.h : header file for the MIDI thru and merge functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef MIDI_THRU_H
+#define MIDI_THRU_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Every received byte is written once into the ring of its input. Each
+// output reads the rings of its inputs with its own read index, straight
+// from the UART TX interrupt.
+// With one input on an output every byte is forwarded at once. When an
+// output merges inputs, a message is committed to the ring when it is
+// complete, and the output takes one whole message at a time from each
+// input. Real time bytes go to a separate ring per output and cut in
+// between any two bytes.
+////////////////////////////////////////////////////////////////////////////////
+
+#define MIDI_THRU_NO_OF_INPUTS 5 // UART0 RX, UART1 RX, USB and the PIO inputs, the port numbers
+#define MIDI_THRU_NO_OF_OUTPUTS 2 // UART0 TX and UART1 TX
+#define MIDI_THRU_RING_SIZE 256 // Bytes per input, must be a power of 2
+#define MIDI_THRU_RT_RING_SIZE 16 // Real time bytes per output, power of 2
+
+// Input masks for SetThruInputs()
+#define MIDI_THRU_NONE 0x00
+#define MIDI_THRU_UART0 0x01
+#define MIDI_THRU_UART1 0x02
+#define MIDI_THRU_USB 0x04
+#define MIDI_THRU_PIO0 0x08
+#define MIDI_THRU_PIO1 0x10
+
+// Filter masks for SetThruFilter()
+#define MIDI_THRU_FILTER_NONE 0x00
+#define MIDI_THRU_FILTER_CLOCK 0x01 // 0xF8
+#define MIDI_THRU_FILTER_TRANSPORT 0x02 // 0xFA, 0xFB and 0xFC
+#define MIDI_THRU_FILTER_ACTIVE_SENSING 0x04 // 0xFE
+
+// Global char extern declaration
+extern int gThruInputs[MIDI_THRU_NO_OF_OUTPUTS]; // Input mask per output
+extern int gThruFilter[MIDI_THRU_NO_OF_OUTPUTS]; // Filter mask per output
+extern uint32_t gThruDropped; // Messages that did not fit in a ring
+
+void init_midi_thru();
+void SetThruInputs(int output, int inputMask);
+void SetThruFilter(int output, int filterMask);
+
+// Called from the UART RX interrupt for every received byte
+void midi_thru_byte(int input, uint8_t val);
+// Called from the UART interrupt to feed the TX of that UART
+void midi_thru_tx(int output);
+
+#endif // MIDI_THRU_H
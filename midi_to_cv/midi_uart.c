@@ -10,24 +10,29 @@
 #include "error_list.h"
 #include "midi.h"
 #include "mcp4725.h"
+#include "midi_clock.h"
+#include "voice.h"
+#include "midi_thru.h"
+#include "mpe.h"
+#include "cc_route.h"
+#include "midi_ump.h"
+#include "sysex.h"
+#include "settings.h"
+#include "event_sched.h"
+#include "looper.h"
 
 // Global char initiation
 bool gLEDPinValue = true; // On board LED
 int gMidiChUart0 = MIDI_CH_1; // DIN MIDI
 int gMidiChUart1 = MIDI_CH_1; // USB MIDI
+int gMidiChUsb = MIDI_CH_1; // USB MIDI device
+int gMidiChPio0 = MIDI_CH_1; // PIO MIDI input 0
+int gMidiChPio1 = MIDI_CH_1; // PIO MIDI input 1
 int gMidiClk = MIDI_CLK_UART0; // MIDI clock source
 int gHPWRange = 12; // Half Pitch Wheel range
-
-// The blinking is done via timer interrupt with the timer_callback
-// function below
-bool midi_clock_check_callback( repeating_timer_t *rt ) {
-    const uint LED_PIN = PICO_DEFAULT_LED_PIN;
-    gpio_put(LED_PIN, gLEDPinValue);
-
-    gLEDPinValue = gLEDPinValue? false : true;
-
-    return true;
-}
+uint32_t gUartRxMessages[MIDI_NO_OF_PORTS]; // Channel and system common messages parsed
+uint32_t gUartOverruns[2] = { 0, 0 }; // Bytes lost, the RX interrupt came too late
+uint32_t gUartIsrMaxUs[2] = { 0, 0 }; // Longest RX interrupt
 
 // The function below converts bpm to ms
 uint32_t bpm_to_ms(uint32_t bpm) {
@@ -39,42 +44,50 @@ uint32_t bpm_to_us(uint32_t bpm) {
     return 60000000 / bpm;
 }
 
+// The onboard LED follows the beat of the regenerated MIDI clock,
+// bpm is the tempo of the internal clock (MIDI_CLK_INTERNAL)
 void init_midi_clock_check(int bpm) {
     const uint LED_PIN = PICO_DEFAULT_LED_PIN;
     gpio_init(LED_PIN);
     gpio_set_dir(LED_PIN, GPIO_OUT);
 
-    int tick_ms = bpm_to_ms(bpm);
-
-    static repeating_timer_t timer;
-    add_repeating_timer_us((tick_ms >> 1), 
-        &midi_clock_check_callback, NULL, &timer );
+    init_midi_clock(bpm);
 } 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 // The code below belong to misc MIDI control
-void SetMidiChannel(int uartNo, int midiCh) {
-    if (uartNo < 0 || uartNo > 1) {
+void SetMidiChannel(int portNo, int midiCh) {
+    if (portNo < MIDI_PORT_UART0 || portNo >= MIDI_NO_OF_PORTS) {
         return;
     }
     if (midiCh < MIDI_CH_1 || midiCh > MIDI_CH_ALL) {
         return;
     }
-    if (uartNo == 0) {
+    if (portNo == MIDI_PORT_UART0) {
         gMidiChUart0 = midiCh;
     }
-    else { // uartNo == 1
+    else if (portNo == MIDI_PORT_UART1) {
         gMidiChUart1 = midiCh;
     }
+    else if (portNo == MIDI_PORT_USB) {
+        gMidiChUsb = midiCh;
+    }
+    else if (portNo == MIDI_PORT_PIO0) {
+        gMidiChPio0 = midiCh;
+    }
+    else { // portNo == MIDI_PORT_PIO1
+        gMidiChPio1 = midiCh;
+    }
 }
 
 void SetClockSource(int clockSource) {
-    if (clockSource < MIDI_CLK_UART0 || clockSource > MIDI_CLK_INTERNAL) {
+    if (clockSource < MIDI_CLK_UART0 || clockSource > MIDI_CLK_PIO1) {
         return;
     }
 
     gMidiClk = clockSource;
+    midi_clock_source_changed();
 }
 
 void SetHalfPitchWheelRange(int noOfhalfNotes) {
@@ -85,6 +98,28 @@ void SetHalfPitchWheelRange(int noOfhalfNotes) {
     gHPWRange = noOfhalfNotes;
 }
 
+// MIDI_CLK_INTERNAL sits between the USB and the PIO ports
+int midi_port_clock_source(int portNo) {
+    if (portNo >= MIDI_PORT_PIO0) {
+        return MIDI_CLK_PIO0 + portNo - MIDI_PORT_PIO0;
+    }
+    return MIDI_CLK_UART0 + portNo;
+}
+
+int midi_port_channel(int portNo) {
+    switch (portNo) {
+    case MIDI_PORT_UART0:
+        return gMidiChUart0;
+    case MIDI_PORT_UART1:
+        return gMidiChUart1;
+    case MIDI_PORT_USB:
+        return gMidiChUsb;
+    case MIDI_PORT_PIO0:
+        return gMidiChPio0;
+    }
+    return gMidiChPio1;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // The code below belong to UART X interrupt handling
 
@@ -135,13 +170,14 @@ int init_uartX_for_MIDI_and_interrupt(int uartNo) {
 
     // Set the TX and RX pins by using the function select on the GPIO
     // Set datasheet for more information on function select
+    // The TX pin is the MIDI thru/merge output, see midi_thru.h
     // (void return)
-    // gpio_set_function(uartNo == 0? UART0_TX_PIN : UART1_TX_PIN, 
-    //    GPIO_FUNC_UART);
     if (uartNo == 0) {
+        gpio_set_function(UART0_TX_PIN, GPIO_FUNC_UART);
         gpio_set_function(UART0_RX_PIN, GPIO_FUNC_UART);
     }
     else {
+        gpio_set_function(UART1_TX_PIN, GPIO_FUNC_UART);
         gpio_set_function(UART1_RX_PIN, GPIO_FUNC_UART);
     }
 
@@ -205,7 +241,8 @@ int init_uartX_for_MIDI_and_interrupt(int uartNo) {
         irq_set_enabled(UART1_IRQ, true);
     }
 
-    // Now enable the UART to send interrupts - RX only
+    // Now enable the UART to send interrupts - RX only, the TX interrupt
+    // is enabled by midi_thru.c when there is something to send
     // (void return)
     if (uartNo == 0) {
         uart_set_irq_enables(UART_0, true, false);
@@ -218,70 +255,99 @@ int init_uartX_for_MIDI_and_interrupt(int uartNo) {
     return MIDI_HOST_UART_ERR_SUCCESS;
 }
 
-// UART0 RX interrupt handler
+// Reads the data register, the overrun flag comes with the byte
+static inline uint8_t uartX_read_byte(int uartNo) {
+    uint32_t dr = uart_get_hw(uartNo == 0 ? UART_0 : UART_1)->dr;
+
+    if (dr & UART_UARTDR_OE_BITS) {
+        gUartOverruns[uartNo]++;
+    }
+    return (uint8_t)dr;
+}
+
+static inline void uartX_isr_time(int uartNo, uint32_t startUs) {
+    uint32_t us = time_us_32() - startUs;
+
+    if (us > gUartIsrMaxUs[uartNo]) {
+        gUartIsrMaxUs[uartNo] = us;
+    }
+}
+
+// UART0 RX interrupt handler, also feeds the thru output on UART0 TX
 static inline void on_uart0_rx_for_MIDI_intr_handler() {
+    uint32_t startUs = time_us_32();
+
     while (uart_is_readable(UART_0)) {
-        uint8_t val = uart_getc(UART_0);
-        uartX_rx_for_MIDI_intr_handler(0, gMidiChUart0, val);
+        uint8_t val = uartX_read_byte(0);
+        midi_thru_byte(0, val);
+        uartX_rx_for_MIDI_intr_handler(0, gMidiChUart0, val, time_us_64());
     }
+    midi_thru_tx(0);
+    uartX_isr_time(0, startUs);
 }
 
-// UART1 RX interrupt handler
+// UART1 RX interrupt handler, also feeds the thru output on UART1 TX
 static inline void on_uart1_rx_for_MIDI_intr_handler() {
+    uint32_t startUs = time_us_32();
+
     while (uart_is_readable(UART_1)) {
-        uint8_t val = uart_getc(UART_1);
-        uartX_rx_for_MIDI_intr_handler(1, gMidiChUart1, val);
+        uint8_t val = uartX_read_byte(1);
+        midi_thru_byte(1, val);
+        uartX_rx_for_MIDI_intr_handler(1, gMidiChUart1, val, time_us_64());
     }
+    midi_thru_tx(1);
+    uartX_isr_time(1, startUs);
 }
 
 // UART X RX interrupt handler
-// Called by on_uart0_rx_intr_handler(), and on_uart1_rx_intr_handler()
-static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_t val) {
-    // Since this function is listening on both MIDI messages from
-    // both UART0 and UART1, all static variables must be
-    // tagged with uart number!
-    static enum midiStatus midiStat_u0 = reset;
-    static enum midiStatus midiStat_u1 = reset;
-    enum midiStatus *pmidiStat = NULL;
-    pmidiStat = (uartNo == 0)? &midiStat_u0 : &midiStat_u1;
-
-    static uint8_t status_u0 = 0; // MIDI Status value u0
-    static uint8_t status_u1 = 0; // MIDI Status value u1
-    uint8_t *pstatus = NULL;
-    pstatus = (uartNo == 0)? &status_u0 : &status_u1;
-
-    static uint8_t data1_u0 = 0; // MIDI data1 value u0
-    static uint8_t data1_u1 = 0; // MIDI data1 value u1
-    uint8_t *pdata1 = NULL;
-    pdata1 = (uartNo == 0)? &data1_u0 : &data1_u1;
-
-    static uint8_t data2_u0 = 0; // MIDI data2 value u0
-    static uint8_t data2_u1 = 0; // MIDI data2 value u1
-    uint8_t *pdata2 = NULL;
-    pdata2 = (uartNo == 0)? &data2_u0 : &data2_u1;
-
-    static int byteCount_u0 = 0; // Count the number of bytes since MIDI Status
-    static int byteCount_u1 = 0; // Count the number of bytes since MIDI Status
-    int *pbyteCount = NULL;
-    pbyteCount = (uartNo == 0)? &byteCount_u0 : &byteCount_u1;
-
-    static int expectedByteCount_u0 = 0; // Number of expected bytes dependent
-    // on the MIDI message
-    static int expectedByteCount_u1 = 0; // Number of expected bytes dependent
-    // on the MIDI message
-    int *pexpectedByteCount = NULL;
-    pexpectedByteCount = (uartNo == 0)? &expectedByteCount_u0 : 
-        &expectedByteCount_u1;
+// Called by on_uart0_rx_intr_handler(), on_uart1_rx_intr_handler() and
+// the PIO MIDI inputs (see pio_midi.h), timeUs is the arrival of the byte
+static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_t val, uint64_t timeUs) {
+    // Since this function is listening on MIDI messages from all the
+    // serial ports, all static variables are kept per port number!
+    static enum midiStatus midiStat[MIDI_NO_OF_PORTS];
+    enum midiStatus *pmidiStat = &midiStat[uartNo];
+
+    static uint8_t status[MIDI_NO_OF_PORTS]; // MIDI Status value
+    uint8_t *pstatus = &status[uartNo];
+
+    static uint8_t data1[MIDI_NO_OF_PORTS]; // MIDI data1 value
+    uint8_t *pdata1 = &data1[uartNo];
+
+    static uint8_t data2[MIDI_NO_OF_PORTS]; // MIDI data2 value
+    uint8_t *pdata2 = &data2[uartNo];
+
+    static uint64_t msgTimeUs[MIDI_NO_OF_PORTS]; // Arrival time of the MIDI Status
+    uint64_t *ptimeUs = &msgTimeUs[uartNo];
+
+    static int byteCount[MIDI_NO_OF_PORTS]; // Count the number of bytes since MIDI Status
+    int *pbyteCount = &byteCount[uartNo];
+
+    static int expectedByteCount[MIDI_NO_OF_PORTS]; // Number of expected bytes
+    // dependent on the MIDI message
+    int *pexpectedByteCount = &expectedByteCount[uartNo];
 
     // Test if the it is status or data
     bool isStatus = (val & 0x80) == 0x80? true : false;
     uint8_t sys = 0; // MIDI System Status value
       
     if (isStatus) {
+        // Real time bytes interleave a SysEx, any other status ends it
+        if (val < 0xF8 && sysex_is_active(uartNo)) {
+            if (val == 0xF7) {
+                sysex_end(uartNo);
+            }
+            else {
+                sysex_abort(uartNo);
+            }
+        }
+
         if ((val & 0xF0) < 0xF0) {
             *pstatus = val;
+            *ptimeUs = timeUs;
             *pbyteCount = 1;
-            *pexpectedByteCount = 3;
+            // Program change and channel pressure have one data byte
+            *pexpectedByteCount = ((val & 0xE0) == 0xC0)? 2 : 3;
         }
 
         switch (val & 0xF0) {
@@ -310,10 +376,12 @@ static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_
             {
                 switch (val) {
                 case 0xF0:
+                    // The payload is streamed to sysex.c
                     *pstatus = val;
-                    *pbyteCount = 1;
-                    *pexpectedByteCount = 3;
+                    *pbyteCount = 0;
+                    *pexpectedByteCount = 0;
                     *pmidiStat = sysExStart;
+                    sysex_start(uartNo);
                     break;   
                 case 0xF1:
                     *pstatus = val;
@@ -334,10 +402,14 @@ static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_
                     *pmidiStat = songSelect;
                     break;   
                 case 0xF4: // Undefined
+                    *pbyteCount = 0;
                     break;   
                 case 0xF5: // Undefined
+                    *pbyteCount = 0;
                     break;   
                 case 0xF6:
+                    // Ends the running status
+                    *pbyteCount = 0;
                     sys = val;
                     *pmidiStat = tuneRequest;
                     break;   
@@ -383,12 +455,17 @@ static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_
         }
 
         if (sys) {
-            if (!sys_msg_callback(sys)) {
+            if (!sys_msg_callback(uartNo, sys, timeUs)) {
                 // Do something with the error
             }
         }
     }
     else {
+        if (sysex_is_active(uartNo)) {
+            sysex_byte(uartNo, val);
+            return;
+        }
+
         if (!*pbyteCount) {
             // If byteCount is 0, no MIDI status has been sent
             return;
@@ -398,6 +475,11 @@ static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_
             *pbyteCount = *pbyteCount + 1;
         }
 
+        // A running status message arrives with its first data byte
+        if (*ptimeUs == 0) {
+            *ptimeUs = timeUs;
+        }
+
         if (*pbyteCount == 2) {
             *pdata1 = val;
         }
@@ -407,75 +489,17 @@ static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_
 
         if (*pbyteCount >= *pexpectedByteCount) {
 
-            if ((*pstatus & 0xF0) < 0xF0) {
-                uint8_t midiCh = *pstatus & 0x0F;
-
-                switch(*pstatus & 0xF0) {
-                case 0x80:
-                    if (!midi_note_off_callback(midiCh, *pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;
-                case 0x90:
-                    if (!midi_note_on_callback(midiCh, *pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;
-                case 0xA0:
-                    if (!polyphonic_aftertouch_callback(midiCh, *pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;
-                case 0xB0:
-                    if (!control_change_callback(midiCh, *pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;
-                case 0xC0:
-                    if (!program_change_callback(midiCh, *pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;
-                case 0xD0:
-                    if (!channel_aftertouch_callback(midiCh, *pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;
-                case 0xE0:
-                    if (!pitch_wheel_callback(midiCh, *pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;
-                }
-            }
-            else { // status >= 0xF0
-                switch (*pstatus) {
-                case 0xF0:
-                    if (!sysExStart_callback(*pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;   
-                case 0xF1:
-                    if (!quarterFrame_callback(*pdata1)) {
-                        // Do something when error
-                    }
-                    break;   
-                case 0xF2:
-                    if (!songPointer_callback(*pdata1, *pdata2)) {
-                        // Do something when error
-                    }
-                    break;   
-                case 0xF3:
-                    if (!songSelect_callback(*pdata1)) {
-                        // Do something when error
-                    }
-                    break;   
-                case 0xF9:
-                    if (!measureEnd_callback(*pdata1)) {
-                        // Do something when error
-                    }
-                    break;   
-                }
+            gUartRxMessages[uartNo]++;
+            event_sched_message(uartNo, midiCh, *pstatus, *pdata1, *pdata2, *ptimeUs);
+
+            // Running status, the data bytes of the next message may
+            // follow without the status byte
+            if (*pstatus < 0xF0) {
+                *pdata1 = 0;
+                *pdata2 = 0;
+                *ptimeUs = 0;
+                *pbyteCount = 1;
+                return;
             }
 
             // Time to reset variables
@@ -489,15 +513,125 @@ static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_
     }
 }
 
-static inline bool midi_note_off_callback(uint8_t midiCh, uint8_t noteNo, uint8_t velocity) {    
+// Dispatch a complete MIDI message to its callback, used by the UART
+// parser and by the USB-MIDI packet parser (usb_midi.c)
+void midi_dispatch_message(int portNo, int midiChFilter, uint8_t status, uint8_t data1, uint8_t data2) {
+    // Flash writes wait for a quiet moment
+    settings_activity();
+
+    if ((status & 0xF0) < 0xF0) {
+        uint8_t midiCh = status & 0x0F;
+
+        // MPE zone channels bypass the port channel filter, see mpe.h
+        if (gMpeMode) {
+            if (mpe_channel_message(status, data1, data2)) {
+                return;
+            }
+            if (gMpeChZone[midiCh] != MPE_ZONE_NONE) {
+                midiChFilter = MIDI_CH_ALL;
+            }
+        }
+
+        // Channel messages on other channels than the port channel are ignored
+        if (midiChFilter != MIDI_CH_ALL && midiCh != midiChFilter) {
+            return;
+        }
+
+        looper_record(status, data1, data2);
+
+        switch(status & 0xF0) {
+        case 0x80:
+            if (!midi_note_off_callback(portNo, midiCh, data1, data2)) {
+                // Do something when error
+            }
+            break;
+        case 0x90:
+            if (!midi_note_on_callback(portNo, midiCh, data1, data2)) {
+                // Do something when error
+            }
+            break;
+        case 0xA0:
+            if (!polyphonic_aftertouch_callback(portNo, midiCh, data1, data2)) {
+                // Do something when error
+            }
+            break;
+        case 0xB0:
+            if (!control_change_callback(midiCh, data1, data2)) {
+                // Do something when error
+            }
+            break;
+        case 0xC0:
+            if (!program_change_callback(midiCh, data1, data2)) {
+                // Do something when error
+            }
+            break;
+        case 0xD0:
+            if (!channel_aftertouch_callback(portNo, midiCh, data1, data2)) {
+                // Do something when error
+            }
+            break;
+        case 0xE0:
+            if (!pitch_wheel_callback(portNo, midiCh, data1, data2)) {
+                // Do something when error
+            }
+            break;
+        }
+    }
+    else { // status >= 0xF0
+        switch (status) {
+        case 0xF1:
+            if (!quarterFrame_callback(data1)) {
+                // Do something when error
+            }
+            break;   
+        case 0xF2:
+            if (!songPointer_callback(portNo, data1, data2)) {
+                // Do something when error
+            }
+            break;   
+        case 0xF3:
+            if (!songSelect_callback(data1)) {
+                // Do something when error
+            }
+            break;   
+        case 0xF9:
+            if (!measureEnd_callback(data1)) {
+                // Do something when error
+            }
+            break;   
+        }
+    }
+}
+
+// Dispatch a one byte system message (tune request and real time)
+void midi_dispatch_sys(int portNo, uint8_t sys) {
+    if (!sys_msg_callback(portNo, sys, time_us_64())) {
+        // Do something with the error
+    }
+}
+
+void midi_port_rx_byte(int portNo, int midiCh, uint8_t val, uint64_t timeUs) {
+    midi_thru_byte(portNo, val);
+    uartX_rx_for_MIDI_intr_handler(portNo, midiCh, val, timeUs);
+}
+
+static inline bool midi_note_off_callback(int portNo, uint8_t midiCh, uint8_t noteNo, uint8_t velocity) {    
     if (gPM) {
         printf("NoteOff ");
     }
+
+    ump_midi1_voice(portNo, 0x80 | midiCh, noteNo, velocity);
+
     return true;
 }
 
-static inline bool midi_note_on_callback(uint8_t midiCh, uint8_t noteNo, uint8_t velocity) {
-    set_midiNote(noteNo);
+static inline bool midi_note_on_callback(int portNo, uint8_t midiCh, uint8_t noteNo, uint8_t velocity) {
+    // Note on with velocity 0 is a note off
+    if (velocity == 0) {
+        return midi_note_off_callback(portNo, midiCh, noteNo, velocity);
+    }
+
+    ump_midi1_voice(portNo, 0x90 | midiCh, noteNo, velocity);
     uint16_t dacValue = set_get_mcp4725_dac_value(false, 0);
     if (gPM) {
         printf("NoteOn(%d, %d) ", noteNo, dacValue);    
@@ -505,23 +639,33 @@ static inline bool midi_note_on_callback(uint8_t midiCh, uint8_t noteNo, uint8_t
     return true;
 }
 
-static inline bool polyphonic_aftertouch_callback(uint8_t midiCh, uint8_t noteNo, uint8_t pressure) {
+static inline bool polyphonic_aftertouch_callback(int portNo, uint8_t midiCh, uint8_t noteNo, uint8_t pressure) {
     if (gPM) {
         printf("PolyAfter ");
     }
+
+    ump_midi1_voice(portNo, 0xA0 | midiCh, noteNo, pressure);
+
     return true;
 }
 
 static inline bool control_change_callback(uint8_t midiCh, uint8_t controlNo, uint8_t data) {
     if (gPM) {
         printf("CtrlChang ");
-        switch (controlNo) {
-        case 1:
-            break;
+    }
 
-        default:
-            break;
-        }
+    // Routed controllers, NRPN and RPN, see cc_route.h
+    if (cc_route_control_change(midiCh, controlNo, data)) {
+        return true;
+    }
+
+    switch (controlNo) {
+    case 123: // All notes off
+        voice_all_notes_off();
+        break;
+
+    default:
+        break;
     }
     return true;
 }
@@ -530,22 +674,29 @@ static inline bool program_change_callback(uint8_t midiCh, uint8_t programNo, ui
     if (gPM) {
         printf("PrgChang ");
     }
+
+    // Presets are recalled from the RAM index, see settings.h
+    settings_recall_preset(programNo);
+
     return true;
 }
 
-static inline bool channel_aftertouch_callback(uint8_t midiCh, uint8_t pressure, uint8_t unused) {
+static inline bool channel_aftertouch_callback(int portNo, uint8_t midiCh, uint8_t pressure, uint8_t unused) {
     if (gPM) {
         printf("ChanAfter ");
     }
+
+    ump_midi1_voice(portNo, 0xD0 | midiCh, pressure, 0);
+
     return true;
 }
 
-static inline bool pitch_wheel_callback(uint8_t midiCh, uint8_t lsb, uint8_t msb) {
+static inline bool pitch_wheel_callback(int portNo, uint8_t midiCh, uint8_t lsb, uint8_t msb) {
     if (gPM) {
         printf("PW(%d %d) ", msb, lsb);
     }
 
-    set_pitch_wheel(lsb, msb, gHPWRange);
+    ump_midi1_voice(portNo, 0xE0 | midiCh, lsb, msb);
 
     //const int32_t pwMidValue = 64 * 256 + 0;
     //int32_t pwAbsValue = msb * 256 + lsb;
@@ -558,13 +709,6 @@ static inline bool pitch_wheel_callback(uint8_t midiCh, uint8_t lsb, uint8_t msb
     return true;
 }
 
-static inline bool sysExStart_callback(uint8_t anufID, uint8_t data) {
-    if (gPM) {
-        printf("SysExStart ");
-    }
-    return true;
-}
-
 static inline bool quarterFrame_callback(uint8_t data) {
     if (gPM) {
         printf("QuartFrame ");
@@ -572,10 +716,14 @@ static inline bool quarterFrame_callback(uint8_t data) {
     return true;
 }
 
-static inline bool songPointer_callback(uint8_t lsb, uint8_t msb) {
+static inline bool songPointer_callback(int uartNo, uint8_t lsb, uint8_t msb) {
     if (gPM) {
         printf("SongPtr ");
     }
+
+    uint16_t pos = ((uint16_t)msb << 7) | lsb;
+    midi_clock_song_position(midi_port_clock_source(uartNo), pos);
+
     return true;
 }
 
@@ -593,31 +741,28 @@ static inline bool measureEnd_callback(uint8_t unused) {
     return true;
 }
 
-static inline bool sys_msg_callback(uint8_t sys) {
-    static int timerCount = 0;
-    
-    if (sys == 0xF8) { // midi.timingClock
-        //printf("f8 ");
-
-        if (timerCount == 0) {
-            gpio_put(PICO_DEFAULT_LED_PIN, 1);
-        }
-        else if(timerCount == 5) {
-            gpio_put(PICO_DEFAULT_LED_PIN, 0);
-        }
-
-        timerCount++;
+static inline bool sys_msg_callback(int uartNo, uint8_t sys, uint64_t timeUs) {
+    int clockSource = midi_port_clock_source(uartNo);
 
-        if (timerCount >= 24) {
-            timerCount = 0;
-        }
-    }
+    // A clock or active sensing stream also keeps the flash writes away
+    settings_activity();
 
-    if (sys == 0xFA) { // midi.start
+    switch (sys) {
+    case 0xF8: // midi.timingClock
+        midi_clock_tick_in(clockSource, timeUs);
+        break;
+    case 0xFA: // midi.start
         if (gPM) {
             printf("timingSync ");
         }
-        timerCount = 0;
+        midi_clock_start(clockSource);
+        break;
+    case 0xFB: // midi.cont
+        midi_clock_continue(clockSource);
+        break;
+    case 0xFC: // midi.stop
+        midi_clock_stop(clockSource);
+        break;
     }
 
     return true;
@@ -9,9 +9,17 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 // MIDI DIN is connected to UART0
-// MIDI USB is connected to UART1
+// MIDI USB is connected to UART1 (USB host chip)
+// MIDI USB device is the native USB port of the RP2040, see usb_midi.h
 ////////////////////////////////////////////////////////////////////////////////
 
+#define MIDI_PORT_UART0 0
+#define MIDI_PORT_UART1 1
+#define MIDI_PORT_USB 2
+#define MIDI_PORT_PIO0 3 // PIO MIDI inputs, see pio_midi.h
+#define MIDI_PORT_PIO1 4
+#define MIDI_NO_OF_PORTS 5
+
 // The code below is to set up UART0 for receiving MIDI BYTES
 #define UART_0 uart0
 #define UART_1 uart1
@@ -46,32 +54,51 @@
 #define MIDI_CH_16 0x0F
 #define MIDI_CH_ALL 0x10
 
+// MIDI_CLK_UART0 + port number is the clock source of a port, the PIO
+// inputs come after the internal clock, see midi_port_clock_source()
 #define MIDI_CLK_UART0 0x100
 #define MIDI_CLK_UART1 0x101
-#define MIDI_CLK_INTERNAL 0x102
+#define MIDI_CLK_USB 0x102
+#define MIDI_CLK_INTERNAL 0x103
+#define MIDI_CLK_PIO0 0x104
+#define MIDI_CLK_PIO1 0x105
 
 // Global char extern declaration
 extern bool gLEDPinValue; // On board LED
 extern int gMidiChUart0; // DIN MIDI
 extern int gMidiChUart1; // USB MIDI
+extern int gMidiChUsb; // USB MIDI device
+extern int gMidiChPio0; // PIO MIDI input 0
+extern int gMidiChPio1; // PIO MIDI input 1
 extern int gMidiClk; // MIDI clock source
 extern int gHPWRange; // Half Pitch Wheel range
+extern uint32_t gUartRxMessages[MIDI_NO_OF_PORTS]; // Channel and system common messages parsed
+extern uint32_t gUartOverruns[2]; // Bytes lost, the RX interrupt came too late
+extern uint32_t gUartIsrMaxUs[2]; // Longest RX interrupt
 
-// (A callback is what an interrupt handler calls)
-bool midi_clock_check_callback(repeating_timer_t *rt);
 uint32_t bpm_to_ms(uint32_t bpm);
 uint32_t bpm_to_us(uint32_t bpm);
 void init_midi_clock_check(int bpm);
 
 // Midi misc functions
-void SetMidiChannel(int uartNo, int midiCh);
+void SetMidiChannel(int portNo, int midiCh);
 void SetClockSource(int clockSource);
 void SetHalfPitchWheelRange(int noOfhalfNotes);
+int midi_port_clock_source(int portNo);
+int midi_port_channel(int portNo); // Receive channel, MIDI_CH_ALL for omni
 
 // Initiate MIDI interrupt
 int init_uart0_for_MIDI_and_interrupt();
 int init_uart1_for_MIDI_and_interrupt();
 
+// Dispatch decoded messages from any port to the callbacks below
+void midi_dispatch_message(int portNo, int midiChFilter, uint8_t status, uint8_t data1, uint8_t data2);
+void midi_dispatch_sys(int portNo, uint8_t sys);
+
+// A byte from a serial port without its own interrupt handler (see
+// pio_midi.h) to the thru rings and the parser, timeUs is its arrival
+void midi_port_rx_byte(int portNo, int midiCh, uint8_t val, uint64_t timeUs);
+
 // This function is called by init_uart0_for_MIDI_and_interrupt()
 // and init_uart1_for_MIDI_and_interrupt(). Both init interrupt use
 // the same code so it is important to have it in one function.
@@ -80,25 +107,26 @@ int init_uartX_for_MIDI_and_interrupt(int uartNo);
 // Interrupt handler for MIDI UART
 static inline void on_uart0_rx_for_MIDI_intr_handler();
 static inline void on_uart1_rx_for_MIDI_intr_handler();
+static inline uint8_t uartX_read_byte(int uartNo);
+static inline void uartX_isr_time(int uartNo, uint32_t startUs);
 
 // This function is called by on_uart0_rx_intr_handler()
 // and on_uart1_rx_intr_handler(). Both handler use the
 // same code so it is important to have it in one function.
-static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_t val);
+static inline void uartX_rx_for_MIDI_intr_handler(int uartNo, int midiCh, uint8_t val, uint64_t timeUs);
 
-static inline bool midi_note_off_callback(uint8_t midiCh, uint8_t noteNo, uint8_t velocity);
-static inline bool midi_note_on_callback(uint8_t midiCh, uint8_t noteNo, uint8_t velocity);
-static inline bool polyphonic_aftertouch_callback(uint8_t midiCh, uint8_t noteNo, uint8_t pressure);
+static inline bool midi_note_off_callback(int portNo, uint8_t midiCh, uint8_t noteNo, uint8_t velocity);
+static inline bool midi_note_on_callback(int portNo, uint8_t midiCh, uint8_t noteNo, uint8_t velocity);
+static inline bool polyphonic_aftertouch_callback(int portNo, uint8_t midiCh, uint8_t noteNo, uint8_t pressure);
 static inline bool control_change_callback(uint8_t midiCh, uint8_t controlNo, uint8_t data);
 static inline bool program_change_callback(uint8_t midiCh, uint8_t programNo, uint8_t unused);
-static inline bool channel_aftertouch_callback(uint8_t midiCh, uint8_t pressure, uint8_t unused);
-static inline bool pitch_wheel_callback(uint8_t midiCh, uint8_t lsb, uint8_t msb);
-static inline bool sysExStart_callback(uint8_t manufID, uint8_t data);
+static inline bool channel_aftertouch_callback(int portNo, uint8_t midiCh, uint8_t pressure, uint8_t unused);
+static inline bool pitch_wheel_callback(int portNo, uint8_t midiCh, uint8_t lsb, uint8_t msb);
 static inline bool quarterFrame_callback(uint8_t data);
-static inline bool songPointer_callback(uint8_t lsb, uint8_t msb);
+static inline bool songPointer_callback(int uartNo, uint8_t lsb, uint8_t msb);
 static inline bool songSelect_callback(uint8_t songNo);
 static inline bool measureEnd_callback(uint8_t unused);
-static inline bool sys_msg_callback(uint8_t sys);
+static inline bool sys_msg_callback(int uartNo, uint8_t sys, uint64_t timeUs);
 
 // Old stuff !!!
 void old_on_uart0_rx_intr_handler();
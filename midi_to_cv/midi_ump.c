@@ -0,0 +1,251 @@
+/***********************************************
+/ midi_ump.c : implementation file for the MIDI 2.0 Universal MIDI Packet functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "midi_uart.h"
+#include "midi_ump.h"
+#include "mcp4725.h"
+#include "voice.h"
+#include "cc_route.h"
+#include "cv_out.h"
+#include "sysex.h"
+
+// Global char initiation
+uint32_t gUmpPackets = 0; // Decoded packets
+uint32_t gUmpIgnored = 0; // Packets of unsupported types
+
+// Number of 32 bit words per message type
+static const uint8_t gUmpWords[16] = {
+    1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4 };
+
+// Values up to the center are shifted, above the center the lower bits
+// are repeated so the maximum maps to the maximum
+uint32_t ump_scale_up(uint32_t srcVal, uint8_t srcBits, uint8_t dstBits) {
+    uint8_t scaleBits = dstBits - srcBits;
+    uint32_t bitShiftedValue = srcVal << scaleBits;
+    uint32_t srcCenter = 1u << (srcBits - 1);
+
+    if (srcVal <= srcCenter) {
+        return bitShiftedValue;
+    }
+
+    uint8_t repeatBits = srcBits - 1;
+    uint32_t repeatMask = (1u << repeatBits) - 1;
+    uint32_t repeatValue = srcVal & repeatMask;
+
+    if (scaleBits > repeatBits) {
+        repeatValue <<= scaleBits - repeatBits;
+    }
+    else {
+        repeatValue >>= repeatBits - scaleBits;
+    }
+
+    while (repeatValue != 0) {
+        bitShiftedValue |= repeatValue;
+        repeatValue >>= repeatBits;
+    }
+
+    return bitShiftedValue;
+}
+
+uint32_t ump_scale_down(uint32_t srcVal, uint8_t srcBits, uint8_t dstBits) {
+    return srcVal >> (srcBits - dstBits);
+}
+
+int ump_words(uint32_t word0) {
+    return gUmpWords[word0 >> 28];
+}
+
+int ump_from_midi1(uint8_t group, uint8_t status, uint8_t data1, uint8_t data2, uint32_t *words) {
+    uint32_t w0 = ((uint32_t)UMP_MT_MIDI2_CV << 28) | ((uint32_t)(group & 0x0F) << 24) | 
+        ((uint32_t)status << 16);
+    uint32_t w1 = 0;
+
+    data1 &= 0x7F;
+    data2 &= 0x7F;
+
+    switch (status & 0xF0) {
+    case 0x90:
+        if (data2 == 0) {
+            // Note on with velocity 0 is a note off
+            w0 = (w0 & 0xFF0FFFFF) | ((uint32_t)UMP_OP_NOTE_OFF << 20);
+            w0 |= (uint32_t)data1 << 8;
+            break;
+        }
+        // Fall through
+    case 0x80:
+        w0 |= (uint32_t)data1 << 8;
+        w1 = ump_scale_up(data2, 7, 16) << 16;
+        break;
+    case 0xA0:
+    case 0xB0:
+        w0 |= (uint32_t)data1 << 8;
+        w1 = ump_scale_up(data2, 7, 32);
+        break;
+    case 0xC0:
+        w1 = (uint32_t)data1 << 24;
+        break;
+    case 0xD0:
+        w1 = ump_scale_up(data1, 7, 32);
+        break;
+    case 0xE0:
+        w1 = ump_scale_up(((uint32_t)data2 << 7) | data1, 14, 32);
+        break;
+    default:
+        return 0;
+    }
+
+    words[0] = w0;
+    words[1] = w1;
+    return 2;
+}
+
+void ump_midi1_voice(int portNo, uint8_t status, uint8_t data1, uint8_t data2) {
+    uint32_t word = ((uint32_t)UMP_MT_MIDI1_CV << 28) | ((uint32_t)status << 16) | 
+        ((uint32_t)(data1 & 0x7F) << 8) | (data2 & 0x7F);
+
+    // The port channel filter has been applied by midi_dispatch_message()
+    ump_decode(portNo, MIDI_CH_ALL, &word, 1);
+}
+
+// Data 64 bit SysEx7 packet, up to 6 bytes to the SysEx stream decoder
+static inline void ump_decode_sysex7(int portNo, uint32_t w0, uint32_t w1) {
+    uint8_t status = (w0 >> 20) & 0x0F;
+    int count = (w0 >> 16) & 0x0F;
+    uint8_t bytes[6] = { (w0 >> 8) & 0x7F, w0 & 0x7F, (w1 >> 24) & 0x7F, 
+        (w1 >> 16) & 0x7F, (w1 >> 8) & 0x7F, w1 & 0x7F };
+
+    if (status == UMP_SYSEX7_COMPLETE || status == UMP_SYSEX7_START) {
+        sysex_start(portNo);
+    }
+    for (int i = 0; i < count && i < 6; i++) {
+        sysex_byte(portNo, bytes[i]);
+    }
+    if (status == UMP_SYSEX7_COMPLETE || status == UMP_SYSEX7_END) {
+        sysex_end(portNo);
+    }
+}
+
+static inline void ump_decode_midi2(int portNo, int midiChFilter, uint32_t w0, uint32_t w1) {
+    uint8_t opcode = (w0 >> 20) & 0x0F;
+    uint8_t midiCh = (w0 >> 16) & 0x0F;
+    uint8_t index = (w0 >> 8) & 0x7F; // Note number, controller or bank
+    uint8_t lsb = w0 & 0xFF; // Attribute type, RPN/NRPN index or flags
+
+    if (midiChFilter != MIDI_CH_ALL && midiCh != midiChFilter) {
+        return;
+    }
+
+    switch (opcode) {
+    case UMP_OP_NOTE_ON:
+        if (lsb == UMP_ATTR_PITCH_7_9) {
+            voice_note_on_pitch(index, (uint16_t)(w1 & 0xFFFF), (uint16_t)(w1 >> 16));
+        }
+        else {
+            voice_note_on_pitch(index, (uint16_t)index << 9, (uint16_t)(w1 >> 16));
+        }
+        break;
+    case UMP_OP_NOTE_OFF:
+        voice_note_off(index);
+        break;
+    case UMP_OP_PITCH_BEND:
+        set_pitch_wheel_32(w1, gHPWRange);
+        break;
+    case UMP_OP_PER_NOTE_PITCH_BEND:
+        voice_per_note_bend(index, w1);
+        break;
+    case UMP_OP_RPN:
+        // RPN 0/0 is the pitch bend sensitivity, the top 7 bits are half notes
+        if (index == 0 && (lsb & 0x7F) == 0) {
+            SetHalfPitchWheelRange((int)(w1 >> 25));
+        }
+        else {
+            cc_route_controller_32(CC_ROUTE_TYPE_RPN, 
+                ((uint16_t)index << 7) | (lsb & 0x7F), w1);
+        }
+        break;
+    case UMP_OP_NRPN:
+        cc_route_controller_32(CC_ROUTE_TYPE_NRPN, 
+            ((uint16_t)index << 7) | (lsb & 0x7F), w1);
+        break;
+    case UMP_OP_CONTROL_CHANGE:
+        // Routed controllers keep the 32 bit resolution
+        if (index < 120 && cc_route_controller_32(CC_ROUTE_TYPE_CC7, index, w1)) {
+            break;
+        }
+        midi_dispatch_message(portNo, MIDI_CH_ALL, 0xB0 | midiCh, index, 
+            (uint8_t)ump_scale_down(w1, 32, 7));
+        break;
+    case UMP_OP_POLY_PRESSURE:
+        voice_poly_pressure(index, (uint16_t)ump_scale_down(w1, 32, 16));
+        break;
+    case UMP_OP_CHANNEL_PRESSURE:
+        cv_out_set(CV_OUT_AFTERTOUCH, (uint16_t)ump_scale_down(w1, 32, 16));
+        break;
+    case UMP_OP_PROGRAM_CHANGE:
+        midi_dispatch_message(portNo, MIDI_CH_ALL, 0xC0 | midiCh, 
+            (uint8_t)((w1 >> 24) & 0x7F), 0);
+        break;
+    default:
+        gUmpIgnored++;
+        break;
+    }
+}
+
+int ump_decode(int portNo, int midiChFilter, const uint32_t *words, int count) {
+    int i = 0;
+
+    while (i < count) {
+        uint32_t w0 = words[i];
+        int size = gUmpWords[w0 >> 28];
+
+        if (i + size > count) {
+            break;
+        }
+
+        switch (w0 >> 28) {
+        case UMP_MT_UTILITY:
+            // NOOP and jitter reduction time stamps
+            break;
+        case UMP_MT_SYSTEM:
+            {
+                uint8_t status = (w0 >> 16) & 0xFF;
+                if (status >= 0xF6) {
+                    midi_dispatch_sys(portNo, status);
+                }
+                else {
+                    midi_dispatch_message(portNo, midiChFilter, status, 
+                        (w0 >> 8) & 0x7F, w0 & 0x7F);
+                }
+            }
+            break;
+        case UMP_MT_MIDI1_CV:
+            {
+                uint32_t midi2[2];
+                if (ump_from_midi1((w0 >> 24) & 0x0F, (w0 >> 16) & 0xFF, 
+                    (w0 >> 8) & 0x7F, w0 & 0x7F, midi2)) {
+                    ump_decode_midi2(portNo, midiChFilter, midi2[0], midi2[1]);
+                }
+            }
+            break;
+        case UMP_MT_DATA_64:
+            ump_decode_sysex7(portNo, w0, words[i + 1]);
+            break;
+        case UMP_MT_MIDI2_CV:
+            ump_decode_midi2(portNo, midiChFilter, w0, words[i + 1]);
+            break;
+        default:
+            gUmpIgnored++;
+            break;
+        }
+
+        gUmpPackets++;
+        i += size;
+    }
+
+    return i;
+}
@@ -0,0 +1,83 @@
+/***********************************************
+/ midi_ump.h : header file for the MIDI 2.0 Universal MIDI Packet functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef MIDI_UMP_H
+#define MIDI_UMP_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The midi_ump.h is based on: 
+// Universal MIDI Packet (UMP) Format and MIDI 2.0 Protocol
+// document version 1.1.2, M2-104-UM
+//
+// A packet is 1 - 4 32 bit words, the message type in the top nibble of
+// the first word gives the size. Decoding is one table lookup and one
+// switch per packet, no byte state. MIDI 2.0 channel voice messages go to
+// the high resolution pitch pipeline (pitch 7.9, 32 bit pitch bend and
+// per-note pitch bend). MIDI 1.0 channel voice packets are translated to
+// MIDI 2.0 first with min-center-max scaling.
+////////////////////////////////////////////////////////////////////////////////
+
+// Message types
+#define UMP_MT_UTILITY 0x0
+#define UMP_MT_SYSTEM 0x1
+#define UMP_MT_MIDI1_CV 0x2
+#define UMP_MT_DATA_64 0x3
+#define UMP_MT_MIDI2_CV 0x4
+#define UMP_MT_DATA_128 0x5
+
+// MIDI 2.0 channel voice opcodes
+#define UMP_OP_REG_PER_NOTE_CTRL 0x0
+#define UMP_OP_ASSIGN_PER_NOTE_CTRL 0x1
+#define UMP_OP_RPN 0x2
+#define UMP_OP_NRPN 0x3
+#define UMP_OP_REL_RPN 0x4
+#define UMP_OP_REL_NRPN 0x5
+#define UMP_OP_PER_NOTE_PITCH_BEND 0x6
+#define UMP_OP_NOTE_OFF 0x8
+#define UMP_OP_NOTE_ON 0x9
+#define UMP_OP_POLY_PRESSURE 0xA
+#define UMP_OP_CONTROL_CHANGE 0xB
+#define UMP_OP_PROGRAM_CHANGE 0xC
+#define UMP_OP_CHANNEL_PRESSURE 0xD
+#define UMP_OP_PITCH_BEND 0xE
+#define UMP_OP_PER_NOTE_MANAGEMENT 0xF
+
+// Data 64 bit SysEx7 status
+#define UMP_SYSEX7_COMPLETE 0x0
+#define UMP_SYSEX7_START 0x1
+#define UMP_SYSEX7_CONTINUE 0x2
+#define UMP_SYSEX7_END 0x3
+
+#define UMP_ATTR_PITCH_7_9 0x03 // Note on/off attribute is a pitch 7.9
+
+// Global char extern declaration
+extern uint32_t gUmpPackets; // Decoded packets
+extern uint32_t gUmpIgnored; // Packets of unsupported types
+
+// Min-center-max scaling between resolutions
+uint32_t ump_scale_up(uint32_t srcVal, uint8_t srcBits, uint8_t dstBits);
+uint32_t ump_scale_down(uint32_t srcVal, uint8_t srcBits, uint8_t dstBits);
+
+// Returns the number of words of the packet starting with word0
+int ump_words(uint32_t word0);
+
+// Decodes count words and returns the number of words used, a packet that
+// is not complete is left for the next call
+int ump_decode(int portNo, int midiChFilter, const uint32_t *words, int count);
+
+// MIDI 1.0 channel voice message to a MIDI 2.0 packet in words[0..1],
+// returns the number of words (2) or 0 if it is not a channel voice message
+int ump_from_midi1(uint8_t group, uint8_t status, uint8_t data1, uint8_t data2, uint32_t *words);
+
+// MIDI 1.0 channel voice message of a MIDI 1.0 port, decoded as a MIDI 1.0
+// packet by ump_decode(). Used for the notes, pressure and pitch bend, the
+// control and program changes keep the MIDI 1.0 path for the 14 bit CC
+// pairs, NRPN/RPN and the presets.
+void ump_midi1_voice(int portNo, uint8_t status, uint8_t data1, uint8_t data2);
+
+#endif // MIDI_UMP_H
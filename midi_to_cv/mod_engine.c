@@ -0,0 +1,307 @@
+/***********************************************
+/ mod_engine.c : implementation file for the LFO and envelope modulation functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "mod_engine.h"
+#include "cv_out.h"
+#include "mcp4725.h"
+
+// Global char initiation
+int32_t gModPitch = 0; // Sum of the pitch modulation [Q16 half notes]
+
+uint32_t gLfoPhase[MOD_NO_OF_LFOS];
+uint32_t gLfoInc[MOD_NO_OF_LFOS]; // Phase increment per tick
+uint8_t gLfoWave[MOD_NO_OF_LFOS];
+uint16_t gLfoSyncTicks[MOD_NO_OF_LFOS]; // MIDI clock ticks per cycle, 0 is free
+int16_t gLfoOut[MOD_NO_OF_LFOS]; // Q15
+
+uint8_t gEnvStage[MOD_NO_OF_ENVS];
+uint32_t gEnvLevel[MOD_NO_OF_ENVS]; // Q24
+
+static uint8_t gLfoDest[MOD_NO_OF_LFOS];
+static int32_t gLfoDepth[MOD_NO_OF_LFOS]; // Q16
+static int32_t gLfoOffset[MOD_NO_OF_LFOS];
+
+static uint32_t gEnvAttack[MOD_NO_OF_ENVS]; // Q24 per tick
+static uint32_t gEnvDecay[MOD_NO_OF_ENVS]; // Q24 per tick
+static uint32_t gEnvSustain[MOD_NO_OF_ENVS]; // Q24
+static uint32_t gEnvRelease[MOD_NO_OF_ENVS]; // Q24 per tick
+static uint8_t gEnvDest[MOD_NO_OF_ENVS];
+static int32_t gEnvDepth[MOD_NO_OF_ENVS]; // Q16
+static int32_t gEnvOffset[MOD_NO_OF_ENVS];
+
+// One sine cycle in Q15, the last entry is the first for the interpolation
+static const int16_t gModSineTable[(1 << MOD_SINE_TABLE_BITS) + 1] = {
+    0, 804, 1608, 2410, 3212, 4011, 4808, 5602,
+    6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+    12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530,
+    18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+    23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790,
+    27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+    30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971,
+    32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+    32767, 32757, 32728, 32678, 32609, 32521, 32412, 32285,
+    32137, 31971, 31785, 31580, 31356, 31113, 30852, 30571,
+    30273, 29956, 29621, 29268, 28898, 28510, 28105, 27683,
+    27245, 26790, 26319, 25832, 25329, 24811, 24279, 23731,
+    23170, 22594, 22005, 21403, 20787, 20159, 19519, 18868,
+    18204, 17530, 16846, 16151, 15446, 14732, 14010, 13279,
+    12539, 11793, 11039, 10278, 9512, 8739, 7962, 7179,
+    6393, 5602, 4808, 4011, 3212, 2410, 1608, 804,
+    0, -804, -1608, -2410, -3212, -4011, -4808, -5602,
+    -6393, -7179, -7962, -8739, -9512, -10278, -11039, -11793,
+    -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530,
+    -18204, -18868, -19519, -20159, -20787, -21403, -22005, -22594,
+    -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+    -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956,
+    -30273, -30571, -30852, -31113, -31356, -31580, -31785, -31971,
+    -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+    -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285,
+    -32137, -31971, -31785, -31580, -31356, -31113, -30852, -30571,
+    -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+    -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731,
+    -23170, -22594, -22005, -21403, -20787, -20159, -19519, -18868,
+    -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+    -12539, -11793, -11039, -10278, -9512, -8739, -7962, -7179,
+    -6393, -5602, -4808, -4011, -3212, -2410, -1608, -804,
+    0
+};
+
+void init_mod_engine() {
+    for (int i = 0; i < MOD_NO_OF_LFOS; i++) {
+        gLfoPhase[i] = 0;
+        gLfoWave[i] = MOD_WAVE_SINE;
+        gLfoSyncTicks[i] = 0;
+        gLfoOut[i] = 0;
+        gLfoDest[i] = MOD_DEST_NONE;
+        SetLfoRate(i, 1000);
+    }
+    for (int i = 0; i < MOD_NO_OF_ENVS; i++) {
+        gEnvStage[i] = MOD_ENV_IDLE;
+        gEnvLevel[i] = 0;
+        gEnvDest[i] = MOD_DEST_NONE;
+        SetEnvelope(i, 10, 200, 0x8000, 300);
+    }
+}
+
+void SetLfoWave(int lfoNo, int wave) {
+    if (lfoNo < 0 || lfoNo >= MOD_NO_OF_LFOS) {
+        return;
+    }
+    if (wave < 0 || wave >= MOD_NO_OF_WAVES) {
+        return;
+    }
+
+    gLfoWave[lfoNo] = wave;
+}
+
+// Free running rate, 1 mHz to 100 Hz
+void SetLfoRate(int lfoNo, uint32_t rateMilliHz) {
+    if (lfoNo < 0 || lfoNo >= MOD_NO_OF_LFOS) {
+        return;
+    }
+    if (rateMilliHz < 1 || rateMilliHz > 100000) {
+        return;
+    }
+
+    gLfoInc[lfoNo] = (uint32_t)(((uint64_t)rateMilliHz * MOD_TICK_US << 32) / 
+        1000000000ull);
+}
+
+// Cycle length in MIDI clock ticks (24 is a quarter note), 0 is free running
+void SetLfoSync(int lfoNo, int clockTicks) {
+    if (lfoNo < 0 || lfoNo >= MOD_NO_OF_LFOS) {
+        return;
+    }
+    if (clockTicks < 0 || clockTicks > 24 * 64) {
+        return;
+    }
+
+    gLfoSyncTicks[lfoNo] = clockTicks;
+}
+
+void SetLfoDestination(int lfoNo, int dest, int32_t depth, int32_t offset) {
+    if (lfoNo < 0 || lfoNo >= MOD_NO_OF_LFOS) {
+        return;
+    }
+    if (dest < MOD_DEST_NONE || dest >= MOD_DEST_CV_OUT + CV_OUT_NO_OF_OUTPUTS) {
+        return;
+    }
+
+    gLfoDest[lfoNo] = dest;
+    gLfoDepth[lfoNo] = depth;
+    gLfoOffset[lfoNo] = offset;
+    control_timers_wake();
+}
+
+static inline uint32_t mod_env_rate(uint32_t timeMs) {
+    uint32_t ticks = timeMs * (1000 / MOD_TICK_US);
+    return ticks == 0 ? MOD_ENV_MAX_LEVEL : MOD_ENV_MAX_LEVEL / ticks;
+}
+
+// Times are 0 - 10000 ms, the sustain level is 16 bits
+void SetEnvelope(int envNo, uint32_t attackMs, uint32_t decayMs, uint16_t sustain, uint32_t releaseMs) {
+    if (envNo < 0 || envNo >= MOD_NO_OF_ENVS) {
+        return;
+    }
+    if (attackMs > 10000 || decayMs > 10000 || releaseMs > 10000) {
+        return;
+    }
+
+    gEnvAttack[envNo] = mod_env_rate(attackMs);
+    gEnvDecay[envNo] = mod_env_rate(decayMs);
+    gEnvSustain[envNo] = (uint32_t)sustain << 8;
+    gEnvRelease[envNo] = mod_env_rate(releaseMs);
+}
+
+void SetEnvDestination(int envNo, int dest, int32_t depth, int32_t offset) {
+    if (envNo < 0 || envNo >= MOD_NO_OF_ENVS) {
+        return;
+    }
+    if (dest < MOD_DEST_NONE || dest >= MOD_DEST_CV_OUT + CV_OUT_NO_OF_OUTPUTS) {
+        return;
+    }
+
+    gEnvDest[envNo] = dest;
+    gEnvDepth[envNo] = depth;
+    gEnvOffset[envNo] = offset;
+    control_timers_wake();
+}
+
+void mod_env_gate(bool gate) {
+    for (int i = 0; i < MOD_NO_OF_ENVS; i++) {
+        if (gate) {
+            // Restart from the current level, no click
+            gEnvStage[i] = MOD_ENV_ATTACK;
+        }
+        else if (gEnvStage[i] != MOD_ENV_IDLE) {
+            gEnvStage[i] = MOD_ENV_RELEASE;
+        }
+    }
+    control_timers_wake();
+}
+
+void mod_lfo_clock_tick(uint32_t tick, uint32_t periodUs) {
+    for (int i = 0; i < MOD_NO_OF_LFOS; i++) {
+        uint32_t syncTicks = gLfoSyncTicks[i];
+        if (syncTicks == 0 || periodUs == 0) {
+            continue;
+        }
+
+        // Phase from the clock, increment from the tick period
+        uint32_t cycleTick = tick % syncTicks;
+        gLfoPhase[i] = (uint32_t)(((uint64_t)cycleTick << 32) / syncTicks);
+        gLfoInc[i] = (uint32_t)(((uint64_t)MOD_TICK_US << 32) / 
+            ((uint64_t)syncTicks * periodUs));
+    }
+}
+
+static inline int16_t mod_lfo_wave(uint8_t wave, uint32_t phase) {
+    switch (wave) {
+    case MOD_WAVE_SINE:
+        {
+            uint32_t index = phase >> (32 - MOD_SINE_TABLE_BITS);
+            int32_t frac = (phase >> (16 - MOD_SINE_TABLE_BITS)) & 0xFFFF;
+            int32_t a = gModSineTable[index];
+            int32_t b = gModSineTable[index + 1];
+            return (int16_t)(a + (((b - a) * frac) >> 16));
+        }
+    case MOD_WAVE_TRIANGLE:
+        {
+            // Starts at 0 and rises like the sine
+            int32_t t = (int32_t)((phase + 0x40000000u) >> 15); // 0 - 131071
+            return (int16_t)((t < 65536 ? t : 131071 - t) - 32768);
+        }
+    case MOD_WAVE_SAW:
+        return (int16_t)((phase >> 16) - 32768);
+    case MOD_WAVE_SQUARE:
+        return phase < 0x80000000u ? 32767 : -32767;
+    }
+    return 0;
+}
+
+static inline void mod_env_step(int i) {
+    uint32_t level = gEnvLevel[i];
+
+    switch (gEnvStage[i]) {
+    case MOD_ENV_ATTACK:
+        level += gEnvAttack[i];
+        if (level >= MOD_ENV_MAX_LEVEL) {
+            level = MOD_ENV_MAX_LEVEL;
+            gEnvStage[i] = MOD_ENV_DECAY;
+        }
+        break;
+    case MOD_ENV_DECAY:
+        if (level <= gEnvSustain[i] + gEnvDecay[i]) {
+            level = gEnvSustain[i];
+            gEnvStage[i] = MOD_ENV_SUSTAIN;
+        }
+        else {
+            level -= gEnvDecay[i];
+        }
+        break;
+    case MOD_ENV_SUSTAIN:
+        level = gEnvSustain[i];
+        break;
+    case MOD_ENV_RELEASE:
+        if (level <= gEnvRelease[i]) {
+            level = 0;
+            gEnvStage[i] = MOD_ENV_IDLE;
+        }
+        else {
+            level -= gEnvRelease[i];
+        }
+        break;
+    }
+
+    gEnvLevel[i] = level;
+}
+
+// Source value in Q15 to its destination
+static inline void mod_apply(uint8_t dest, int32_t value, int32_t depth, int32_t offset, int32_t *pPitch) {
+    int32_t out = offset + (int32_t)(((int64_t)value * depth) >> 15);
+
+    if (dest == MOD_DEST_PITCH) {
+        *pPitch += out;
+    }
+    else if (dest >= MOD_DEST_CV_OUT) {
+        if (out < 0) {
+            out = 0;
+        }
+        else if (out > 0xFFFF) {
+            out = 0xFFFF;
+        }
+        cv_out_set(dest - MOD_DEST_CV_OUT, (uint16_t)out);
+    }
+}
+
+// Returns true while an LFO is routed or an envelope is moving
+bool mod_engine_update() {
+    int32_t pitch = 0;
+    bool isActive = false;
+
+    for (int i = 0; i < MOD_NO_OF_LFOS; i++) {
+        gLfoPhase[i] += gLfoInc[i];
+        gLfoOut[i] = mod_lfo_wave(gLfoWave[i], gLfoPhase[i]);
+        if (gLfoDest[i] != MOD_DEST_NONE) {
+            mod_apply(gLfoDest[i], gLfoOut[i], gLfoDepth[i], gLfoOffset[i], &pitch);
+            isActive = true;
+        }
+    }
+
+    for (int i = 0; i < MOD_NO_OF_ENVS; i++) {
+        if (gEnvStage[i] != MOD_ENV_IDLE) {
+            mod_env_step(i);
+            isActive = true;
+        }
+        if (gEnvDest[i] != MOD_DEST_NONE) {
+            mod_apply(gEnvDest[i], (int32_t)(gEnvLevel[i] >> 9), gEnvDepth[i], 
+                gEnvOffset[i], &pitch);
+        }
+    }
+
+    gModPitch = pitch;
+    return isActive;
+}
@@ -0,0 +1,87 @@
+/***********************************************
+/ mod_engine.h : header file for the LFO and envelope modulation functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef MOD_ENGINE_H
+#define MOD_ENGINE_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// LFOs and ADSR envelopes run in the control rate tick (glide_timer_callback,
+// MOD_TICK_US). All state is fixed point and kept as one array per field.
+//
+// An LFO has a 32 bit phase accumulator. It is free running or synced to
+// the regenerated MIDI clock, then the phase is set from the clock tick
+// and the increment from the filtered tick period. The sine is read from a
+// 256 entry table in flash with linear interpolation, the other shapes
+// are computed from the phase.
+//
+// An envelope is started by the gate (note on) and released when the last
+// note is released. The level is Q24, the segments are linear.
+//
+// Every source has a destination, a depth and an offset, the output is
+// offset + source * depth. The LFOs are -1.0 to 1.0 and the envelopes 0 to
+// 1.0, depth 1.0 (Q16) is one half note on the pitch destination (added to
+// V/oct) and 65536 units on the CV destinations (the cv_out outputs).
+////////////////////////////////////////////////////////////////////////////////
+
+#define MOD_TICK_US 1000 // Control rate tick
+#define MOD_NO_OF_LFOS 2
+#define MOD_NO_OF_ENVS 1
+
+#define MOD_WAVE_SINE 0
+#define MOD_WAVE_TRIANGLE 1
+#define MOD_WAVE_SAW 2
+#define MOD_WAVE_SQUARE 3
+#define MOD_NO_OF_WAVES 4
+
+#define MOD_SINE_TABLE_BITS 8 // 256 entries and a guard entry
+
+#define MOD_ENV_IDLE 0
+#define MOD_ENV_ATTACK 1
+#define MOD_ENV_DECAY 2
+#define MOD_ENV_SUSTAIN 3
+#define MOD_ENV_RELEASE 4
+
+#define MOD_ENV_MAX_LEVEL (1 << 24) // Q24 1.0
+
+// Destinations, CV_OUT_xxx + MOD_DEST_CV_OUT is a CV output
+#define MOD_DEST_NONE 0
+#define MOD_DEST_PITCH 1
+#define MOD_DEST_CV_OUT 2
+
+#define MOD_DEPTH_ONE 0x10000 // Depth 1.0 in Q16
+
+// Global char extern declaration
+extern int32_t gModPitch; // Sum of the pitch modulation [Q16 half notes]
+
+extern uint32_t gLfoPhase[MOD_NO_OF_LFOS];
+extern uint32_t gLfoInc[MOD_NO_OF_LFOS]; // Phase increment per tick
+extern uint8_t gLfoWave[MOD_NO_OF_LFOS];
+extern uint16_t gLfoSyncTicks[MOD_NO_OF_LFOS]; // MIDI clock ticks per cycle, 0 is free
+extern int16_t gLfoOut[MOD_NO_OF_LFOS]; // Q15
+
+extern uint8_t gEnvStage[MOD_NO_OF_ENVS];
+extern uint32_t gEnvLevel[MOD_NO_OF_ENVS]; // Q24
+
+void init_mod_engine();
+void SetLfoWave(int lfoNo, int wave);
+void SetLfoRate(int lfoNo, uint32_t rateMilliHz);
+void SetLfoSync(int lfoNo, int clockTicks);
+void SetLfoDestination(int lfoNo, int dest, int32_t depth, int32_t offset);
+void SetEnvelope(int envNo, uint32_t attackMs, uint32_t decayMs, uint16_t sustain, uint32_t releaseMs);
+void SetEnvDestination(int envNo, int dest, int32_t depth, int32_t offset);
+
+// Called from the voice on the first note on and the last note off
+void mod_env_gate(bool gate);
+
+// Called on every regenerated MIDI clock tick, tick is the song position
+void mod_lfo_clock_tick(uint32_t tick, uint32_t periodUs);
+
+// Called at control rate (glide_timer_callback), true while modulating
+bool mod_engine_update();
+
+#endif // MOD_ENGINE_H
@@ -0,0 +1,258 @@
+/***********************************************
+/ mpe.c : implementation file for the MIDI Polyphonic Expression functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "mpe.h"
+#include "midi_uart.h"
+#include "midi_ump.h"
+#include "mcp4725.h"
+#include "voice.h"
+#include "cv_out.h"
+
+// Global char initiation
+bool gMpeMode = false; // MPE is on
+int gMpeLowerMembers = 0; // Number of member channels in the lower zone
+int gMpeUpperMembers = 0; // Number of member channels in the upper zone
+uint8_t gMpeChZone[16]; // Zone of each channel
+uint8_t gMpeChRole[16]; // Role of each channel in its zone
+uint8_t gMpeChNote[16]; // Note sounding on each member channel
+uint32_t gMpeChBend[16]; // 32 bit pitch bend of each channel
+uint16_t gMpeChPressure[16]; // 16 bit channel pressure
+uint16_t gMpeChTimbre[16]; // 16 bit CC74
+uint8_t gMpeNoteCh[128]; // Channel of each held note
+
+// Registered parameter number per channel, CC101 and CC100
+static uint8_t gMpeRpnMsb[16];
+static uint8_t gMpeRpnLsb[16];
+
+void init_mpe() {
+    for (int ch = 0; ch < 16; ch++) {
+        gMpeChNote[ch] = MPE_NO_NOTE;
+        gMpeChBend[ch] = PW_CENTER_32;
+        gMpeChPressure[ch] = 0;
+        gMpeChTimbre[ch] = 0x8000;
+        gMpeRpnMsb[ch] = 0x7F;
+        gMpeRpnLsb[ch] = 0x7F;
+    }
+    for (int note = 0; note < 128; note++) {
+        gMpeNoteCh[note] = MPE_NO_NOTE;
+    }
+    SetMpeZone(MPE_ZONE_LOWER, 0);
+    SetMpeZone(MPE_ZONE_UPPER, 0);
+}
+
+// Rebuild the channel tables from the zone sizes
+static inline void mpe_build_channel_table() {
+    for (int ch = 0; ch < 16; ch++) {
+        gMpeChZone[ch] = MPE_ZONE_NONE;
+        gMpeChRole[ch] = MPE_ROLE_NONE;
+    }
+    if (gMpeLowerMembers > 0) {
+        gMpeChZone[MPE_LOWER_MASTER_CH] = MPE_ZONE_LOWER;
+        gMpeChRole[MPE_LOWER_MASTER_CH] = MPE_ROLE_MASTER;
+        for (int i = 1; i <= gMpeLowerMembers; i++) {
+            gMpeChZone[MPE_LOWER_MASTER_CH + i] = MPE_ZONE_LOWER;
+            gMpeChRole[MPE_LOWER_MASTER_CH + i] = MPE_ROLE_MEMBER;
+        }
+    }
+    if (gMpeUpperMembers > 0) {
+        gMpeChZone[MPE_UPPER_MASTER_CH] = MPE_ZONE_UPPER;
+        gMpeChRole[MPE_UPPER_MASTER_CH] = MPE_ROLE_MASTER;
+        for (int i = 1; i <= gMpeUpperMembers; i++) {
+            gMpeChZone[MPE_UPPER_MASTER_CH - i] = MPE_ZONE_UPPER;
+            gMpeChRole[MPE_UPPER_MASTER_CH - i] = MPE_ROLE_MEMBER;
+        }
+    }
+}
+
+void SetMpeMode(bool mpeMode) {
+    if (gMpeMode == mpeMode) {
+        return;
+    }
+
+    voice_all_notes_off();
+    init_mpe();
+    gMpeMode = mpeMode;
+}
+
+// A new zone shrinks the other zone if they overlap, 0 members removes
+// the zone. The bend ranges are reset to the MPE defaults.
+void SetMpeZone(int zone, int noOfMembers) {
+    if (zone != MPE_ZONE_LOWER && zone != MPE_ZONE_UPPER) {
+        return;
+    }
+    if (noOfMembers < 0 || noOfMembers > MPE_MAX_MEMBERS) {
+        return;
+    }
+
+    if (zone == MPE_ZONE_LOWER) {
+        gMpeLowerMembers = noOfMembers;
+        if (gMpeUpperMembers > 14 - noOfMembers) {
+            gMpeUpperMembers = noOfMembers >= 14 ? 0 : 14 - noOfMembers;
+        }
+    }
+    else {
+        gMpeUpperMembers = noOfMembers;
+        if (gMpeLowerMembers > 14 - noOfMembers) {
+            gMpeLowerMembers = noOfMembers >= 14 ? 0 : 14 - noOfMembers;
+        }
+    }
+    mpe_build_channel_table();
+
+    if (noOfMembers > 0) {
+        gPNBRange = MPE_MEMBER_DEFAULT_RANGE;
+        SetHalfPitchWheelRange(MPE_MASTER_DEFAULT_RANGE);
+    }
+}
+
+// The pressure and timbre outputs follow the channel of the sounding note
+static inline void mpe_update_outputs() {
+    if (gNoOfHeldNotes == 0) {
+        return;
+    }
+
+    uint8_t midiCh = gMpeNoteCh[gHeldNotes[gNoOfHeldNotes - 1]];
+    if (midiCh == MPE_NO_NOTE) {
+        return;
+    }
+
+    cv_out_set(CV_OUT_AFTERTOUCH, gMpeChPressure[midiCh]);
+    cv_out_set(CV_OUT_TIMBRE, gMpeChTimbre[midiCh]);
+}
+
+static inline void mpe_note_off(uint8_t midiCh, uint8_t noteNo) {
+    if (gMpeNoteCh[noteNo] != midiCh) {
+        return;
+    }
+
+    gMpeNoteCh[noteNo] = MPE_NO_NOTE;
+    if (gMpeChNote[midiCh] == noteNo) {
+        gMpeChNote[midiCh] = MPE_NO_NOTE;
+    }
+    voice_note_off(noteNo);
+    mpe_update_outputs();
+}
+
+static inline void mpe_note_on(uint8_t midiCh, uint8_t noteNo, uint8_t velocity) {
+    // A note that is still held on another channel is taken over
+    if (gMpeNoteCh[noteNo] != MPE_NO_NOTE) {
+        gMpeChNote[gMpeNoteCh[noteNo]] = MPE_NO_NOTE;
+    }
+
+    gMpeChNote[midiCh] = noteNo;
+    gMpeNoteCh[noteNo] = midiCh;
+
+    // The controller sends the initial bend before the note on
+    voice_per_note_bend(noteNo, gMpeChBend[midiCh]);
+    voice_note_on(noteNo, velocity);
+    mpe_update_outputs();
+}
+
+// RPN 0 and RPN 6 on the zone channels
+static inline void mpe_data_entry(uint8_t midiCh, uint8_t value) {
+    uint16_t rpn = ((uint16_t)gMpeRpnMsb[midiCh] << 7) | gMpeRpnLsb[midiCh];
+
+    switch (rpn) {
+    case MPE_RPN_MCM:
+        if (midiCh == MPE_LOWER_MASTER_CH) {
+            SetMpeZone(MPE_ZONE_LOWER, value);
+        }
+        else if (midiCh == MPE_UPPER_MASTER_CH) {
+            SetMpeZone(MPE_ZONE_UPPER, value);
+        }
+        break;
+    case MPE_RPN_PITCH_BEND_RANGE:
+        if (gMpeChRole[midiCh] == MPE_ROLE_MEMBER) {
+            if (value <= 96) {
+                gPNBRange = value;
+            }
+        }
+        else {
+            SetHalfPitchWheelRange(value);
+        }
+        break;
+    }
+}
+
+// Returns true if the CC was used
+static inline bool mpe_control_change(uint8_t midiCh, uint8_t controlNo, uint8_t value) {
+    switch (controlNo) {
+    case 101: // RPN MSB
+        gMpeRpnMsb[midiCh] = value;
+        return true;
+    case 100: // RPN LSB
+        gMpeRpnLsb[midiCh] = value;
+        return true;
+    case 6: // Data entry MSB
+        mpe_data_entry(midiCh, value);
+        return true;
+    case MPE_CC_TIMBRE:
+        if (gMpeChRole[midiCh] != MPE_ROLE_MEMBER) {
+            return false;
+        }
+        gMpeChTimbre[midiCh] = (uint16_t)ump_scale_up(value, 7, 16);
+        if (gMpeChNote[midiCh] != MPE_NO_NOTE) {
+            mpe_update_outputs();
+        }
+        return true;
+    }
+    return false;
+}
+
+bool mpe_channel_message(uint8_t status, uint8_t data1, uint8_t data2) {
+    uint8_t midiCh = status & 0x0F;
+    uint8_t role = gMpeChRole[midiCh];
+
+    if (!gMpeMode) {
+        return false;
+    }
+
+    if ((status & 0xF0) == 0xB0) {
+        // The master channels take the configuration message even when
+        // their zone is not set up
+        if (role != MPE_ROLE_NONE || midiCh == MPE_LOWER_MASTER_CH || 
+            midiCh == MPE_UPPER_MASTER_CH) {
+            return mpe_control_change(midiCh, data1, data2);
+        }
+        return false;
+    }
+
+    if (role != MPE_ROLE_MEMBER) {
+        // Master channel messages are handled as normal channel messages
+        return false;
+    }
+
+    switch (status & 0xF0) {
+    case 0x80:
+        mpe_note_off(midiCh, data1);
+        break;
+    case 0x90:
+        if (data2 == 0) {
+            mpe_note_off(midiCh, data1);
+        }
+        else {
+            mpe_note_on(midiCh, data1, data2);
+        }
+        break;
+    case 0xD0:
+        gMpeChPressure[midiCh] = (uint16_t)ump_scale_up(data1, 7, 16);
+        if (gMpeChNote[midiCh] != MPE_NO_NOTE) {
+            mpe_update_outputs();
+        }
+        break;
+    case 0xE0:
+        gMpeChBend[midiCh] = ump_scale_up(((uint32_t)data2 << 7) | data1, 14, 32);
+        if (gMpeChNote[midiCh] != MPE_NO_NOTE) {
+            voice_per_note_bend(gMpeChNote[midiCh], gMpeChBend[midiCh]);
+        }
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
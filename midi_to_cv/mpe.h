@@ -0,0 +1,72 @@
+/***********************************************
+/ mpe.h : header file for the MIDI Polyphonic Expression functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef MPE_H
+#define MPE_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The mpe.h is based on: 
+// MIDI Polyphonic Expression, version 1.0, M1-100-UM
+//
+// The lower zone has its master on channel 1 and members from channel 2
+// upwards, the upper zone has its master on channel 16 and members from
+// channel 15 downwards. A zone is set up by the MPE configuration message
+// (RPN 6 on the master channel) or by SetMpeZone().
+//
+// Each member channel has its pitch bend, channel pressure and CC74 in
+// dense arrays indexed by the channel, and the note sounding on it. The
+// bend is bound to the note as a per-note pitch bend (see voice.h), the
+// pressure and timbre of the channel of the sounding note drive the
+// aftertouch and timbre CV outputs. Every message is one table lookup.
+//
+// Zone channels bypass the port channel filter while MPE is on.
+////////////////////////////////////////////////////////////////////////////////
+
+#define MPE_ZONE_NONE 0
+#define MPE_ZONE_LOWER 1
+#define MPE_ZONE_UPPER 2
+
+#define MPE_ROLE_NONE 0
+#define MPE_ROLE_MASTER 1
+#define MPE_ROLE_MEMBER 2
+
+#define MPE_LOWER_MASTER_CH 0x00 // MIDI channel 1
+#define MPE_UPPER_MASTER_CH 0x0F // MIDI channel 16
+#define MPE_MAX_MEMBERS 15
+
+#define MPE_NO_NOTE 0xFF
+#define MPE_MEMBER_DEFAULT_RANGE 48 // Member pitch bend range in half notes
+#define MPE_MASTER_DEFAULT_RANGE 2 // Master pitch bend range in half notes
+
+#define MPE_RPN_PITCH_BEND_RANGE 0x0000
+#define MPE_RPN_MCM 0x0006 // MPE configuration message
+#define MPE_RPN_NULL 0x3FFF
+
+#define MPE_CC_TIMBRE 74
+
+// Global char extern declaration
+extern bool gMpeMode; // MPE is on
+extern int gMpeLowerMembers; // Number of member channels in the lower zone
+extern int gMpeUpperMembers; // Number of member channels in the upper zone
+extern uint8_t gMpeChZone[16]; // Zone of each channel
+extern uint8_t gMpeChRole[16]; // Role of each channel in its zone
+extern uint8_t gMpeChNote[16]; // Note sounding on each member channel
+extern uint32_t gMpeChBend[16]; // 32 bit pitch bend of each channel
+extern uint16_t gMpeChPressure[16]; // 16 bit channel pressure
+extern uint16_t gMpeChTimbre[16]; // 16 bit CC74
+extern uint8_t gMpeNoteCh[128]; // Channel of each held note
+
+void init_mpe();
+void SetMpeMode(bool mpeMode);
+void SetMpeZone(int zone, int noOfMembers);
+
+// Returns true if the channel message was used by MPE, called from
+// midi_dispatch_message() before the channel filter
+bool mpe_channel_message(uint8_t status, uint8_t data1, uint8_t data2);
+
+#endif // MPE_H
@@ -0,0 +1,109 @@
+/***********************************************
+/ params.c : implementation file for the parameter table functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "params.h"
+#include "midi_uart.h"
+#include "midi_clock.h"
+#include "midi_thru.h"
+#include "mcp4725.h"
+#include "pulse_out.h"
+#include "arp.h"
+#include "mpe.h"
+#include "tuning.h"
+#include "event_sched.h"
+#include "looper.h"
+#include "drift_comp.h"
+#include "pio_midi.h"
+
+static int get_midi_ch_uart0() { return gMidiChUart0; }
+static int get_midi_ch_uart1() { return gMidiChUart1; }
+static int get_midi_ch_usb() { return gMidiChUsb; }
+static void set_midi_ch_uart0(int v) { SetMidiChannel(MIDI_PORT_UART0, v); }
+static void set_midi_ch_uart1(int v) { SetMidiChannel(MIDI_PORT_UART1, v); }
+static void set_midi_ch_usb(int v) { SetMidiChannel(MIDI_PORT_USB, v); }
+static int get_midi_ch_pio0() { return gMidiChPio0; }
+static int get_midi_ch_pio1() { return gMidiChPio1; }
+static void set_midi_ch_pio0(int v) { SetMidiChannel(MIDI_PORT_PIO0, v); }
+static void set_midi_ch_pio1(int v) { SetMidiChannel(MIDI_PORT_PIO1, v); }
+static int get_glide_rate() { return gGlideVal; }
+static int get_glide_type() { return gGlideType; }
+static int get_pitch_bend_range() { return gHPWRange; }
+static int get_clock_source() { return gMidiClk - MIDI_CLK_UART0; }
+static void set_clock_source(int v) { SetClockSource(MIDI_CLK_UART0 + v); }
+static int get_internal_bpm() { return gInternalBpm; }
+static int get_clock_out_ppqn() { return gClockOutPPQN; }
+static int get_arp_mode() { return gArpMode; }
+static int get_arp_octaves() { return gArpOctaves; }
+static int get_arp_division() { return gArpDivision; }
+static int get_arp_gate() { return gArpGateLength; }
+static int get_arp_latch() { return gArpLatch; }
+static void set_arp_latch(int v) { SetArpLatch(v != 0); }
+static int get_mpe_mode() { return gMpeMode; }
+static void set_mpe_mode(int v) { SetMpeMode(v != 0); }
+static int get_scale_mask() { return gScaleMask; }
+static void set_scale_mask(int v) { SetScale(v, gScaleRoot); }
+static int get_scale_root() { return gScaleRoot; }
+static void set_scale_root(int v) { SetScale(gScaleMask, v); }
+static int get_thru_inputs_0() { return gThruInputs[0]; }
+static int get_thru_inputs_1() { return gThruInputs[1]; }
+static void set_thru_inputs_0(int v) { SetThruInputs(0, v); }
+static void set_thru_inputs_1(int v) { SetThruInputs(1, v); }
+static int get_sched_latency() { return gSchedLatencyUs; }
+static int get_looper_mode() { return gLooperMode; }
+static int get_looper_bars() { return gLooperBars; }
+static int get_drift_comp() { return gDriftCompMode; }
+static int get_pio_midi_inputs() { return gPioMidiInputs; }
+
+// Global char initiation
+const param_t gParams[PARAM_NO_OF_PARAMS] = {
+    { MIDI_CH_1, MIDI_CH_ALL, get_midi_ch_uart0, set_midi_ch_uart0 },
+    { MIDI_CH_1, MIDI_CH_ALL, get_midi_ch_uart1, set_midi_ch_uart1 },
+    { MIDI_CH_1, MIDI_CH_ALL, get_midi_ch_usb, set_midi_ch_usb },
+    { 0, 127, get_glide_rate, SetGlideValue },
+    { GLIDE_TYPE_PORTAMENTO, GLIDE_TYPE_GLISSANDO, get_glide_type, SetGlideType },
+    { 0, 24, get_pitch_bend_range, SetHalfPitchWheelRange },
+    { 0, MIDI_CLK_PIO1 - MIDI_CLK_UART0, get_clock_source, set_clock_source },
+    { MIDI_CLK_MIN_BPM, MIDI_CLK_MAX_BPM, get_internal_bpm, SetInternalClockBpm },
+    { 1, 4 * MIDI_CLK_PPQN, get_clock_out_ppqn, SetClockOutPPQN },
+    { ARP_MODE_OFF, ARP_NO_OF_MODES - 1, get_arp_mode, SetArpMode },
+    { 1, ARP_MAX_OCTAVES, get_arp_octaves, SetArpOctaves },
+    { 1, 4 * MIDI_CLK_PPQN, get_arp_division, SetArpDivision },
+    { 1, 100, get_arp_gate, SetArpGateLength },
+    { 0, 1, get_arp_latch, set_arp_latch },
+    { 0, 1, get_mpe_mode, set_mpe_mode },
+    { 1, TUNING_SCALE_CHROMATIC, get_scale_mask, set_scale_mask },
+    { 0, 11, get_scale_root, set_scale_root },
+    { MIDI_THRU_NONE, (1 << MIDI_THRU_NO_OF_INPUTS) - 1, get_thru_inputs_0, set_thru_inputs_0 },
+    { MIDI_THRU_NONE, (1 << MIDI_THRU_NO_OF_INPUTS) - 1, get_thru_inputs_1, set_thru_inputs_1 },
+    { EVENT_SCHED_OFF, EVENT_SCHED_MAX_LATENCY_US, get_sched_latency, SetSchedLatency },
+    { LOOPER_MODE_STOP, LOOPER_NO_OF_MODES - 1, get_looper_mode, SetLooperMode },
+    { 1, LOOPER_MAX_BARS, get_looper_bars, SetLooperBars },
+    { DRIFT_COMP_OFF, DRIFT_COMP_ON, get_drift_comp, SetDriftComp },
+    { MIDI_CH_1, MIDI_CH_ALL, get_midi_ch_pio0, set_midi_ch_pio0 },
+    { MIDI_CH_1, MIDI_CH_ALL, get_midi_ch_pio1, set_midi_ch_pio1 },
+    { 0, (1 << PIO_MIDI_NO_OF_INPUTS) - 1, get_pio_midi_inputs, SetPioMidiInputs },
+};
+
+bool param_set(int id, int value) {
+    if (id < 0 || id >= PARAM_NO_OF_PARAMS) {
+        return false;
+    }
+    if (value < gParams[id].min || value > gParams[id].max) {
+        return false;
+    }
+
+    gParams[id].set(value);
+    return true;
+}
+
+bool param_get(int id, int *pValue) {
+    if (id < 0 || id >= PARAM_NO_OF_PARAMS) {
+        return false;
+    }
+
+    *pValue = gParams[id].get();
+    return true;
+}
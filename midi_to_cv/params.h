@@ -0,0 +1,63 @@
+/***********************************************
+/ params.h : header file for the parameter table functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef PARAMS_H
+#define PARAMS_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Every setting that can be changed without recompiling has a parameter
+// ID. The table holds the range and the get and set functions, the set
+// functions are the SetXxx functions of the modules. Values are 14 bits so
+// they fit in two SysEx data bytes.
+////////////////////////////////////////////////////////////////////////////////
+
+#define PARAM_MIDI_CH_UART0 0 // 0 - 15 is channel 1 - 16, 16 is all
+#define PARAM_MIDI_CH_UART1 1
+#define PARAM_MIDI_CH_USB 2
+#define PARAM_GLIDE_RATE 3 // 0 - 127
+#define PARAM_GLIDE_TYPE 4 // GLIDE_TYPE_xxx
+#define PARAM_PITCH_BEND_RANGE 5 // Half notes
+#define PARAM_CLOCK_SOURCE 6 // 0 - 5 is MIDI_CLK_UART0 - MIDI_CLK_PIO1
+#define PARAM_INTERNAL_BPM 7
+#define PARAM_CLOCK_OUT_PPQN 8
+#define PARAM_ARP_MODE 9
+#define PARAM_ARP_OCTAVES 10
+#define PARAM_ARP_DIVISION 11
+#define PARAM_ARP_GATE 12
+#define PARAM_ARP_LATCH 13
+#define PARAM_MPE_MODE 14
+#define PARAM_SCALE_MASK 15
+#define PARAM_SCALE_ROOT 16
+#define PARAM_THRU_INPUTS_0 17 // MIDI_THRU_xxx mask of UART0 TX
+#define PARAM_THRU_INPUTS_1 18 // MIDI_THRU_xxx mask of UART1 TX
+#define PARAM_SCHED_LATENCY 19 // us, 0 is off
+#define PARAM_LOOPER_MODE 20 // LOOPER_MODE_xxx
+#define PARAM_LOOPER_BARS 21
+#define PARAM_DRIFT_COMP 22 // DRIFT_COMP_xxx
+#define PARAM_MIDI_CH_PIO0 23
+#define PARAM_MIDI_CH_PIO1 24
+#define PARAM_PIO_MIDI_INPUTS 25 // Mask of the enabled PIO MIDI inputs
+#define PARAM_NO_OF_PARAMS 26
+
+#define PARAM_MAX_VALUE 0x3FFF // 14 bits
+
+typedef struct {
+    int16_t min;
+    int16_t max;
+    int (*get)();
+    void (*set)(int value);
+} param_t;
+
+// Global char extern declaration
+extern const param_t gParams[PARAM_NO_OF_PARAMS];
+
+// Returns false if the ID or the value is out of range
+bool param_set(int id, int value);
+bool param_get(int id, int *pValue);
+
+#endif // PARAMS_H
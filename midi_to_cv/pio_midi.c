@@ -0,0 +1,182 @@
+/***********************************************
+/ pio_midi.c : implementation file for the PIO MIDI input functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "main.h"
+#include "pio_midi.h"
+#include "pio_midi.pio.h"
+#include "midi_uart.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "hardware/timer.h"
+#include "hardware/sync.h"
+
+#define PIO_MIDI_RING_MASK (PIO_MIDI_RING_SIZE - 1)
+
+// Global char initiation
+int gPioMidiInputs = PIO_MIDI_NONE;
+uint32_t gPioMidiBytes[PIO_MIDI_NO_OF_INPUTS];
+uint32_t gPioMidiOverruns[PIO_MIDI_NO_OF_INPUTS];
+
+static const uint gPioMidiPins[PIO_MIDI_NO_OF_INPUTS] = { PIO_MIDI_IN0_PIN, PIO_MIDI_IN1_PIN };
+static bool gPioMidiIsInit = false;
+static uint gPioMidiOffset = 0;
+static int gPioMidiDmaByte[PIO_MIDI_NO_OF_INPUTS]; // FIFO to the byte ring
+static int gPioMidiDmaStamp[PIO_MIDI_NO_OF_INPUTS]; // Timer to the stamp ring
+
+// Rings written by the DMA, aligned for the DMA address wrap
+static uint8_t gPioMidiRing[PIO_MIDI_NO_OF_INPUTS][PIO_MIDI_RING_SIZE]
+    __attribute__((aligned(PIO_MIDI_RING_SIZE)));
+static uint32_t gPioMidiStamp[PIO_MIDI_NO_OF_INPUTS][PIO_MIDI_RING_SIZE]
+    __attribute__((aligned(4 * PIO_MIDI_RING_SIZE)));
+static uint32_t gPioMidiRead[PIO_MIDI_NO_OF_INPUTS];
+static uint32_t gPioMidiLastStamp[PIO_MIDI_NO_OF_INPUTS]; // Stamp before gPioMidiRead
+
+static inline void pio_midi_start(int input);
+
+void init_pio_midi() {
+    gPioMidiOffset = pio_add_program(PIO_MIDI_PIO, &pio_midi_rx_program);
+
+    for (int i = 0; i < PIO_MIDI_NO_OF_INPUTS; i++) {
+        pio_sm_claim(PIO_MIDI_PIO, i);
+        gPioMidiDmaByte[i] = dma_claim_unused_channel(true);
+        gPioMidiDmaStamp[i] = dma_claim_unused_channel(true);
+        gPioMidiBytes[i] = 0;
+    }
+
+    irq_set_exclusive_handler(DMA_IRQ_1, pio_midi_dma_irq_handler);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    // The inputs set by the settings are started now
+    uint32_t status = save_and_disable_interrupts();
+    gPioMidiIsInit = true;
+    for (int i = 0; i < PIO_MIDI_NO_OF_INPUTS; i++) {
+        if (gPioMidiInputs & (1 << i)) {
+            pio_midi_start(i);
+        }
+    }
+    restore_interrupts(status);
+}
+
+// Both channels move one word per trigger and start each other, the write
+// addresses wrap in the rings
+static inline void pio_midi_start(int input) {
+    uint byteCh = gPioMidiDmaByte[input];
+    uint stampCh = gPioMidiDmaStamp[input];
+    float div = (float)clock_get_hz(clk_sys) / (PIO_MIDI_CYCLES_PER_BIT * BAUD_RATE_MIDI);
+
+    gPioMidiRead[input] = 0;
+    gPioMidiLastStamp[input] = 0;
+    for (int i = 0; i < PIO_MIDI_RING_SIZE; i++) {
+        gPioMidiStamp[input][i] = 0;
+    }
+
+    dma_channel_config c = dma_channel_get_default_config(stampCh);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, PIO_MIDI_RING_BITS + 2);
+    channel_config_set_dreq(&c, DREQ_FORCE);
+    channel_config_set_chain_to(&c, byteCh);
+    dma_channel_configure(stampCh, &c, gPioMidiStamp[input], &timer_hw->timerawl, 1, false);
+    dma_channel_set_irq1_enabled(stampCh, true);
+
+    // The byte is in bits 31..24 of the FIFO word
+    c = dma_channel_get_default_config(byteCh);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, PIO_MIDI_RING_BITS);
+    channel_config_set_dreq(&c, pio_get_dreq(PIO_MIDI_PIO, input, false));
+    channel_config_set_chain_to(&c, stampCh);
+    dma_channel_configure(byteCh, &c, gPioMidiRing[input],
+        (uint8_t *)pio_sm_get_rx_fifo_addr(PIO_MIDI_PIO, input) + 3, 1, true);
+
+    pio_midi_rx_program_init(PIO_MIDI_PIO, input, gPioMidiOffset, gPioMidiPins[input], div);
+}
+
+static inline void pio_midi_stop(int input) {
+    uint byteCh = gPioMidiDmaByte[input];
+    uint stampCh = gPioMidiDmaStamp[input];
+
+    pio_sm_set_enabled(PIO_MIDI_PIO, input, false);
+    pio_sm_clear_fifos(PIO_MIDI_PIO, input);
+
+    // An abort can trigger the chained channel, so the byte channel is
+    // aborted again
+    dma_channel_set_irq1_enabled(stampCh, false);
+    dma_channel_abort(byteCh);
+    dma_channel_abort(stampCh);
+    dma_channel_abort(byteCh);
+    dma_hw->ints1 = 1u << stampCh;
+}
+
+void SetPioMidiInputs(int inputMask) {
+    if (inputMask < PIO_MIDI_NONE || inputMask >= (1 << PIO_MIDI_NO_OF_INPUTS)) {
+        return;
+    }
+
+    // Before init_pio_midi() only the mask is kept
+    if (!gPioMidiIsInit) {
+        gPioMidiInputs = inputMask;
+        return;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+    for (int i = 0; i < PIO_MIDI_NO_OF_INPUTS; i++) {
+        bool isOn = (gPioMidiInputs & (1 << i)) != 0;
+        bool isWanted = (inputMask & (1 << i)) != 0;
+        if (isWanted && !isOn) {
+            pio_midi_start(i);
+        }
+        else if (!isWanted && isOn) {
+            pio_midi_stop(i);
+        }
+    }
+    gPioMidiInputs = inputMask;
+    restore_interrupts(status);
+}
+
+// One interrupt per byte, the stamps are extended to 64 bits
+static inline void pio_midi_dma_irq_handler() {
+    for (int i = 0; i < PIO_MIDI_NO_OF_INPUTS; i++) {
+        uint stampCh = gPioMidiDmaStamp[i];
+        if (!(dma_hw->ints1 & (1u << stampCh))) {
+            continue;
+        }
+        dma_hw->ints1 = 1u << stampCh;
+
+        // Every byte up to here has its stamp
+        uint32_t write = ((dma_hw->ch[stampCh].write_addr -
+            (uint32_t)(uintptr_t)gPioMidiStamp[i]) >> 2) & PIO_MIDI_RING_MASK;
+        uint32_t count = (write - gPioMidiRead[i]) & PIO_MIDI_RING_MASK;
+        uint64_t now = time_us_64();
+        int midiCh = i == 0 ? gMidiChPio0 : gMidiChPio1;
+
+        // The slot of the last byte handled was written again. With the
+        // write index back at the read index the ring holds exactly
+        // PIO_MIDI_RING_SIZE bytes, all unread. Past it the bytes and the
+        // order are lost, the parser finds the next status byte.
+        uint32_t last = (gPioMidiRead[i] - 1) & PIO_MIDI_RING_MASK;
+        if (gPioMidiStamp[i][last] != gPioMidiLastStamp[i]) {
+            if (count != 0) {
+                gPioMidiOverruns[i]++;
+                gPioMidiRead[i] = write;
+                gPioMidiLastStamp[i] = gPioMidiStamp[i][(write - 1) & PIO_MIDI_RING_MASK];
+                continue;
+            }
+            count = PIO_MIDI_RING_SIZE;
+        }
+
+        while (count-- > 0) {
+            uint32_t r = gPioMidiRead[i];
+            uint64_t timeUs = now - (uint32_t)((uint32_t)now - gPioMidiStamp[i][r]);
+            midi_port_rx_byte(MIDI_PORT_PIO0 + i, midiCh, gPioMidiRing[i][r], timeUs);
+            gPioMidiLastStamp[i] = gPioMidiStamp[i][r];
+            gPioMidiRead[i] = (r + 1) & PIO_MIDI_RING_MASK;
+            gPioMidiBytes[i]++;
+        }
+    }
+}
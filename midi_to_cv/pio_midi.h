@@ -0,0 +1,58 @@
+/***********************************************
+/ pio_midi.h : header file for the PIO MIDI input functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef PIO_MIDI_H
+#define PIO_MIDI_H
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Two more MIDI DIN inputs on spare GPIOs, received by PIO1 state
+// machines. They are the ports MIDI_PORT_PIO0 and MIDI_PORT_PIO1 with
+// their own channel filter, clock source (MIDI_CLK_PIO0/1) and thru input,
+// the bytes go through the same parser as UART0 and UART1. Both inputs
+// are off by default and the pins are free, they are enabled with
+// PARAM_PIO_MIDI_INPUTS (SetPioMidiInputs()) and kept in the settings.
+//
+// Every received byte is moved by a DMA channel into a byte ring, that
+// channel chains to a second one that copies the raw timer into a stamp
+// ring, and back. The stamp is taken by the hardware within a few bus
+// cycles of the stop bit, interrupt latency does not move it. The stamp
+// channel raises DMA_IRQ_1, the handler drains both rings into the parser.
+// If the DMA has written more than a whole ring since the last drain, the
+// stamp before the read index has changed with the write index elsewhere,
+// the ring is dropped and counted in gPioMidiOverruns. A ring of exactly
+// PIO_MIDI_RING_SIZE unread bytes is drained.
+//
+// The PIO bit timing follows clk_sys, so clk_sys is not scaled while
+// sleeping with an input enabled (see power.h).
+////////////////////////////////////////////////////////////////////////////////
+
+#define PIO_MIDI_PIO pio1
+#define PIO_MIDI_NO_OF_INPUTS 2
+#define PIO_MIDI_IN0_PIN 2
+#define PIO_MIDI_IN1_PIN 3
+#define PIO_MIDI_CYCLES_PER_BIT 8
+#define PIO_MIDI_RING_BITS 8 // 82 ms of bytes, longer than a flash erase with the interrupts off
+#define PIO_MIDI_RING_SIZE (1 << PIO_MIDI_RING_BITS) // Bytes and stamps per input
+
+// Input masks for SetPioMidiInputs()
+#define PIO_MIDI_NONE 0x00
+#define PIO_MIDI_IN0 0x01
+#define PIO_MIDI_IN1 0x02
+
+// Global char extern declaration
+extern int gPioMidiInputs; // Enabled inputs
+extern uint32_t gPioMidiBytes[PIO_MIDI_NO_OF_INPUTS];
+extern uint32_t gPioMidiOverruns[PIO_MIDI_NO_OF_INPUTS]; // Rings dropped
+
+void init_pio_midi();
+void SetPioMidiInputs(int inputMask);
+
+static inline void pio_midi_dma_irq_handler();
+
+#endif // PIO_MIDI_H
@@ -0,0 +1,115 @@
+/***********************************************
+/ power.c : implementation file for the low-power idle functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "power.h"
+#include "mcp4725.h"
+#include "pulse_out.h"
+#include "midi_clock.h"
+#include "arp.h"
+#include "usb_midi.h"
+#include "sysex.h"
+#include "settings.h"
+#include "ctrl_proto.h"
+#include "selftest.h"
+#include "drift_comp.h"
+#include "pio_midi.h"
+#include "i2c_sched.h"
+#include "looper.h"
+#include "hardware/sync.h"
+
+// Global char initiation
+int gIdleClockDiv = POWER_IDLE_CLK_DIV_OFF;
+uint32_t gPowerSleeps = 0;
+uint32_t gPowerScaledSleeps = 0;
+uint64_t gPowerSleepUs = 0;
+
+static uint32_t gPowerSysHz = 0; // clk_sys at full speed
+static volatile bool gPowerPollArmed = false;
+
+void init_power() {
+    gPowerSysHz = clock_get_hz(clk_sys);
+
+    // The UART baud rates do not follow clk_sys
+    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+        POWER_PERI_CLK_HZ, POWER_PERI_CLK_HZ);
+}
+
+void SetIdleClockDiv(int div) {
+    if (div < POWER_IDLE_CLK_DIV_OFF || div > POWER_IDLE_CLK_DIV_MAX) {
+        return;
+    }
+
+    gIdleClockDiv = div;
+}
+
+static inline void power_set_sys_clock(uint32_t hz) {
+    clock_configure(clk_sys, CLOCKS_CLK_SYS_CTRL_SRC_VALUE_CLKSRC_CLK_SYS_AUX,
+        CLOCKS_CLK_SYS_CTRL_AUXSRC_VALUE_CLKSRC_PLL_SYS, gPowerSysHz, hz);
+}
+
+static int64_t power_poll_callback(alarm_id_t id, void *user_data) {
+    gPowerPollArmed = false;
+    return 0;
+}
+
+static inline bool power_has_work() {
+    return usb_midi_is_pending() || sysex_is_pending() || selftest_is_running() ||
+        looper_is_pending();
+}
+
+// The pulse edges are counted in clk_sys cycles and the I2C and PWM
+// run from clk_sys, it is only divided when they are all still
+static inline bool power_can_scale() {
+    return control_timers_is_idle() && pulse_out_is_idle() && i2c_sched_is_idle() &&
+        !gClockRunning && (gArpMode == ARP_MODE_OFF || gArpSeqLen == 0) &&
+        gPioMidiInputs == PIO_MIDI_NONE;
+}
+
+void power_idle() {
+    uint32_t save = save_and_disable_interrupts();
+
+    if (power_has_work()) {
+        restore_interrupts(save);
+        return;
+    }
+
+    // settings_task() waits for an idle moment, the state stream of
+    // ctrl_proto_task() runs on time and drift_comp_task() reads the ADC,
+    // they have no interrupt
+    uint32_t pollUs = 0;
+    if (settings_is_pending()) {
+        pollUs = POWER_SETTINGS_POLL_US;
+    }
+    if (gCtrlStreamMs != 0 && (pollUs == 0 || gCtrlStreamMs * 1000u < pollUs)) {
+        pollUs = gCtrlStreamMs * 1000u;
+    }
+    uint32_t driftUs = drift_comp_poll_us();
+    if (driftUs != 0 && (pollUs == 0 || driftUs < pollUs)) {
+        pollUs = driftUs;
+    }
+    if (pollUs != 0 && !gPowerPollArmed) {
+        gPowerPollArmed = true;
+        add_alarm_in_us(pollUs, power_poll_callback, NULL, true);
+    }
+
+    bool isScaled = gIdleClockDiv > POWER_IDLE_CLK_DIV_OFF && power_can_scale();
+    if (isScaled) {
+        power_set_sys_clock(gPowerSysHz / gIdleClockDiv);
+        gPowerScaledSleeps++;
+    }
+
+    uint64_t sleepUs = time_us_64();
+    __wfi();
+    gPowerSleepUs += time_us_64() - sleepUs;
+    gPowerSleeps++;
+
+    if (isScaled) {
+        power_set_sys_clock(gPowerSysHz);
+    }
+
+    // The handler of the waking interrupt runs here
+    restore_interrupts(save);
+}
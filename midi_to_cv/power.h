@@ -0,0 +1,52 @@
+/***********************************************
+/ power.h : header file for the low-power idle functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef POWER_H
+#define POWER_H
+
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The main loop sleeps in WFI when the USB, the SysEx buffers and the
+// settings have nothing waiting. Every MIDI byte, USB transfer and alarm is
+// an interrupt, so the core wakes for it. The check and the WFI are done
+// with the interrupts disabled, a pending interrupt still ends the WFI and
+// its handler runs when they are enabled again, no event is lost between
+// the check and the sleep.
+//
+// The control and DAC timers (see mcp4725.h) stop on their own when nothing
+// moves, an idle module only wakes for MIDI, USB and the MIDI clock.
+//
+// With SetIdleClockDiv() above 1, clk_sys is divided down while sleeping
+// with the control timers stopped, no edges queued, the clock stopped and
+// the arpeggiator off. clk_peri runs from the USB PLL, so the UARTs keep
+// receiving at the right baud rate, and the received byte is the wake up.
+// clk_sys is back at full speed before the interrupt handler runs. The PWM
+// CV carrier is divided too while sleeping, more ripple after the RC filter.
+// The PIO MIDI inputs sample with clk_sys, it is not divided while one of
+// them is enabled.
+////////////////////////////////////////////////////////////////////////////////
+
+#define POWER_IDLE_CLK_DIV_OFF 1 // clk_sys is not scaled
+#define POWER_IDLE_CLK_DIV_MAX 8 // 125 MHz / 8 = 15.6 MHz
+#define POWER_PERI_CLK_HZ (48 * MHZ) // clk_peri from the USB PLL
+#define POWER_SETTINGS_POLL_US 100000 // Wake up for settings_task()
+
+// Global char extern declaration
+extern int gIdleClockDiv; // clk_sys divider while sleeping
+extern uint32_t gPowerSleeps; // Number of WFI
+extern uint32_t gPowerScaledSleeps; // Number of WFI with clk_sys divided
+extern uint64_t gPowerSleepUs; // Total time in WFI
+
+// Must be called before the UARTs are initiated
+void init_power();
+void SetIdleClockDiv(int div);
+
+// Called last in the main loop, returns after the next interrupt
+void power_idle();
+
+#endif // POWER_H
@@ -0,0 +1,306 @@
+/***********************************************
+/ pulse_out.c : implementation file for the gate, trigger and clock outputs
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "pulse_out.h"
+#include "pulse_out.pio.h"
+#include "midi_clock.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+
+#define PULSE_OUT_QUEUE_MASK (PULSE_OUT_QUEUE_SIZE - 1)
+#define PULSE_OUT_PENDING_SIZE 8 // Edges handed to the PIO, FIFO + 1 fits
+
+// Global char initiation
+int gClockOutPPQN = 24; // Pulses per quarter note on CLOCK_OUT_PIN
+pulse_out_stats_t gPulseStats = { 0, 0, 0, INT32_MAX, INT32_MIN };
+pulse_trace_t gPulseTrace[PULSE_OUT_TRACE_SIZE];
+uint32_t gPulseTraceIndex = 0;
+
+const uint gPulsePins[PULSE_OUT_NO_OF_OUTPUTS] = { 
+    GATE_PIN, RETRIG_PIN, CLOCK_OUT_PIN, RESET_OUT_PIN };
+uint32_t gPulseCyclesPerUs = 125;
+
+// Edges waiting to be handed over to the PIO
+pulse_edge_t gPulseQueue[PULSE_OUT_NO_OF_OUTPUTS][PULSE_OUT_QUEUE_SIZE];
+uint32_t gPulseHead[PULSE_OUT_NO_OF_OUTPUTS];
+uint32_t gPulseTail[PULSE_OUT_NO_OF_OUTPUTS];
+uint64_t gPulseLastQueued[PULSE_OUT_NO_OF_OUTPUTS]; // Latest queued edge
+uint64_t gPulseLastEdge[PULSE_OUT_NO_OF_OUTPUTS]; // Latest edge in the PIO
+
+// Edges in the PIO, waiting for their irq
+pulse_edge_t gPulsePending[PULSE_OUT_NO_OF_OUTPUTS][PULSE_OUT_PENDING_SIZE];
+uint32_t gPulsePendHead[PULSE_OUT_NO_OF_OUTPUTS];
+uint32_t gPulsePendTail[PULSE_OUT_NO_OF_OUTPUTS];
+
+void init_pulse_out() {
+    gPulseCyclesPerUs = clock_get_hz(clk_sys) / 1000000;
+
+    uint offset = pio_add_program(PULSE_OUT_PIO, &pulse_out_program);
+
+    for (int i = 0; i < PULSE_OUT_NO_OF_OUTPUTS; i++) {
+        gPulseHead[i] = 0;
+        gPulseTail[i] = 0;
+        gPulseLastQueued[i] = 0;
+        gPulseLastEdge[i] = 0;
+        gPulsePendHead[i] = 0;
+        gPulsePendTail[i] = 0;
+
+        pio_sm_claim(PULSE_OUT_PIO, i);
+        pulse_out_program_init(PULSE_OUT_PIO, i, offset, gPulsePins[i]);
+        pio_set_irq0_source_enabled(PULSE_OUT_PIO, 
+            (enum pio_interrupt_source)(pis_interrupt0 + i), true);
+    }
+
+    irq_set_exclusive_handler(PIO0_IRQ_0, pulse_out_pio_irq_handler);
+    irq_set_enabled(PIO0_IRQ_0, true);
+
+    hardware_alarm_claim(PULSE_OUT_HW_ALARM);
+    hardware_alarm_set_callback(PULSE_OUT_HW_ALARM, &pulse_out_alarm_callback);
+}
+
+// 1 - 24 must divide 24, above 24 it must be a multiple of 24 up to 96
+void SetClockOutPPQN(int ppqn) {
+    if (ppqn < 1 || ppqn > 4 * MIDI_CLK_PPQN) {
+        return;
+    }
+    if (ppqn <= MIDI_CLK_PPQN && (MIDI_CLK_PPQN % ppqn) != 0) {
+        return;
+    }
+    if (ppqn > MIDI_CLK_PPQN && (ppqn % MIDI_CLK_PPQN) != 0) {
+        return;
+    }
+
+    gClockOutPPQN = ppqn;
+}
+
+bool pulse_out_edge(int output, bool level, uint64_t timeUs) {
+    if (output < 0 || output >= PULSE_OUT_NO_OF_OUTPUTS) {
+        return false;
+    }
+
+    uint32_t save = save_and_disable_interrupts();
+
+    if (gPulseTail[output] - gPulseHead[output] >= PULSE_OUT_QUEUE_SIZE) {
+        gPulseStats.dropped++;
+        restore_interrupts(save);
+        return false;
+    }
+
+    // The edges of one output must come in order
+    if (timeUs < gPulseLastQueued[output]) {
+        timeUs = gPulseLastQueued[output];
+    }
+
+    pulse_edge_t *pEdge = &gPulseQueue[output][gPulseTail[output] & PULSE_OUT_QUEUE_MASK];
+    pEdge->timeUs = timeUs;
+    pEdge->level = level;
+    gPulseTail[output]++;
+    gPulseLastQueued[output] = timeUs;
+
+    pulse_out_service();
+
+    restore_interrupts(save);
+    return true;
+}
+
+bool pulse_out_trigger(int output, uint64_t timeUs, uint32_t widthUs) {
+    if (!pulse_out_edge(output, true, timeUs)) {
+        return false;
+    }
+    return pulse_out_edge(output, false, timeUs + widthUs);
+}
+
+void pulse_out_gate(bool on, uint64_t timeUs) {
+    pulse_out_edge(PULSE_OUT_GATE, on, timeUs);
+}
+
+void pulse_out_reset(uint64_t timeUs) {
+    pulse_out_trigger(PULSE_OUT_RESET, timeUs, PULSE_RESET_US);
+}
+
+// Called for every MIDI clock tick while the clock is running,
+// tick is the song position and periodUs the time to the next tick, 0
+// while the source has no locked period
+void pulse_out_clock_tick(uint32_t tick, uint64_t timeUs, uint32_t periodUs) {
+    if (periodUs == 0) {
+        // Nothing to divide or spread, one pulse of the longest width per
+        // tick on the division
+        uint32_t div = gClockOutPPQN < MIDI_CLK_PPQN? MIDI_CLK_PPQN / gClockOutPPQN : 1;
+        if (tick % div == 0) {
+            pulse_out_trigger(PULSE_OUT_CLOCK, timeUs, PULSE_CLOCK_US);
+        }
+    }
+    else if (gClockOutPPQN <= MIDI_CLK_PPQN) {
+        // Clock division, aligned to the song position
+        uint32_t div = MIDI_CLK_PPQN / gClockOutPPQN;
+        if (tick % div == 0) {
+            uint32_t widthUs = periodUs * div / 2;
+            pulse_out_trigger(PULSE_OUT_CLOCK, timeUs, 
+                widthUs < PULSE_CLOCK_US? widthUs : PULSE_CLOCK_US);
+        }
+    }
+    else {
+        // Clock multiplication, the pulses are spread over the period
+        uint32_t mult = gClockOutPPQN / MIDI_CLK_PPQN;
+        uint32_t intervalUs = periodUs / mult;
+        uint32_t widthUs = intervalUs / 2;
+        if (widthUs > PULSE_CLOCK_US) {
+            widthUs = PULSE_CLOCK_US;
+        }
+        for (uint32_t k = 0; k < mult; k++) {
+            pulse_out_trigger(PULSE_OUT_CLOCK, timeUs + k * intervalUs, widthUs);
+        }
+    }
+}
+
+// Hand one edge over to the state machine, returns false if the state
+// machine can not take it right now
+static inline bool pulse_out_hand_over(int output, pulse_edge_t *pEdge, uint64_t now) {
+    uint64_t lastEdge = gPulseLastEdge[output];
+    uint64_t edgeUs = pEdge->timeUs;
+    int64_t cycles = 0;
+
+    if (gPulsePendTail[output] - gPulsePendHead[output] >= PULSE_OUT_PENDING_SIZE) {
+        return false;
+    }
+
+    if (lastEdge > now + PULSE_OUT_BUSY_MARGIN_US) {
+        // The state machine is waiting for its previous edge,
+        // the delay is counted from that edge and is cycle exact
+        if (pio_sm_is_tx_fifo_full(PULSE_OUT_PIO, output)) {
+            return false;
+        }
+        if (edgeUs < lastEdge) {
+            edgeUs = lastEdge;
+        }
+        cycles = (int64_t)(edgeUs - lastEdge) * gPulseCyclesPerUs - 
+            PULSE_OUT_CHAIN_CYCLES;
+        if (cycles < 0) {
+            cycles = 0;
+        }
+        pio_sm_put(PULSE_OUT_PIO, output, 
+            ((uint32_t)pEdge->level << 31) | (uint32_t)cycles);
+    }
+    else if (lastEdge + PULSE_OUT_BUSY_MARGIN_US >= now) {
+        // The state machine is just about to finish, try again
+        return false;
+    }
+    else {
+        // Idle state machine, start on a timer edge to know the
+        // time within the microsecond
+        uint32_t save = save_and_disable_interrupts();
+        uint32_t t0 = time_us_32();
+        while (time_us_32() == t0) {
+            tight_loop_contents();
+        }
+        uint64_t start = time_us_64();
+
+        cycles = (int64_t)(edgeUs - start) * gPulseCyclesPerUs - 
+            PULSE_OUT_FIRST_CYCLES - PULSE_OUT_PUSH_CYCLES;
+        if (edgeUs <= start || cycles < 0) {
+            cycles = 0;
+            edgeUs = start;
+            gPulseStats.late++;
+        }
+        pio_sm_put(PULSE_OUT_PIO, output, 
+            ((uint32_t)pEdge->level << 31) | (uint32_t)cycles);
+        restore_interrupts(save);
+    }
+
+    gPulseLastEdge[output] = edgeUs;
+    gPulsePending[output][gPulsePendTail[output] % PULSE_OUT_PENDING_SIZE] = *pEdge;
+    gPulsePendTail[output]++;
+
+    return true;
+}
+
+// Hand over the edges due within PULSE_OUT_LEAD_US and arm the alarm
+// for the next one
+static inline void pulse_out_service() {
+    bool isArmed = false;
+
+    while (!isArmed) {
+        uint64_t now = time_us_64();
+        uint64_t wake = UINT64_MAX;
+
+        for (int i = 0; i < PULSE_OUT_NO_OF_OUTPUTS; i++) {
+            while (gPulseHead[i] != gPulseTail[i]) {
+                pulse_edge_t *pEdge = &gPulseQueue[i][gPulseHead[i] & PULSE_OUT_QUEUE_MASK];
+
+                if (pEdge->timeUs > now + PULSE_OUT_LEAD_US) {
+                    if (pEdge->timeUs - PULSE_OUT_LEAD_US < wake) {
+                        wake = pEdge->timeUs - PULSE_OUT_LEAD_US;
+                    }
+                    break;
+                }
+                if (!pulse_out_hand_over(i, pEdge, now)) {
+                    if (now + PULSE_OUT_BUSY_MARGIN_US < wake) {
+                        wake = now + PULSE_OUT_BUSY_MARGIN_US;
+                    }
+                    break;
+                }
+                gPulseHead[i]++;
+            }
+        }
+
+        if (wake == UINT64_MAX) {
+            return;
+        }
+
+        // Returns true if wake has already passed, then go again
+        isArmed = !hardware_alarm_set_target(PULSE_OUT_HW_ALARM, 
+            from_us_since_boot(wake));
+    }
+}
+
+bool pulse_out_is_idle() {
+    for (int i = 0; i < PULSE_OUT_NO_OF_OUTPUTS; i++) {
+        if (gPulseHead[i] != gPulseTail[i] || gPulsePendHead[i] != gPulsePendTail[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline void pulse_out_alarm_callback(uint alarmNum) {
+    pulse_out_service();
+}
+
+// One irq per edge, the time is compared against the scheduled time
+static inline void pulse_out_pio_irq_handler() {
+    uint64_t now = time_us_64();
+
+    for (int i = 0; i < PULSE_OUT_NO_OF_OUTPUTS; i++) {
+        if (!pio_interrupt_get(PULSE_OUT_PIO, i)) {
+            continue;
+        }
+        pio_interrupt_clear(PULSE_OUT_PIO, i);
+
+        if (gPulsePendHead[i] == gPulsePendTail[i]) {
+            continue;
+        }
+        pulse_edge_t *pEdge = &gPulsePending[i][gPulsePendHead[i] % PULSE_OUT_PENDING_SIZE];
+        gPulsePendHead[i]++;
+
+        int32_t errUs = (int32_t)(now - pEdge->timeUs);
+        if (errUs < gPulseStats.minErrorUs) {
+            gPulseStats.minErrorUs = errUs;
+        }
+        if (errUs > gPulseStats.maxErrorUs) {
+            gPulseStats.maxErrorUs = errUs;
+        }
+        gPulseStats.edges++;
+
+        pulse_trace_t *pTrace = &gPulseTrace[gPulseTraceIndex % PULSE_OUT_TRACE_SIZE];
+        pTrace->output = (uint8_t)i;
+        pTrace->level = pEdge->level;
+        pTrace->scheduledUs = pEdge->timeUs;
+        pTrace->observedUs = now;
+        gPulseTraceIndex++;
+    }
+}
@@ -0,0 +1,94 @@
+/***********************************************
+/ pulse_out.h : header file for the gate, trigger and clock outputs
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef PULSE_OUT_H
+#define PULSE_OUT_H
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/timer.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Every output is driven by its own PIO state machine. Time stamped edges
+// are queued per output, and a hardware alarm hands them to the state
+// machine PULSE_OUT_LEAD_US ahead of time together with the exact delay in
+// system clock cycles. The CPU load does not move the edges.
+////////////////////////////////////////////////////////////////////////////////
+
+#define PULSE_OUT_PIO pio0
+#define PULSE_OUT_HW_ALARM 1 // Hardware alarm used by the pulse outputs
+
+#define PULSE_OUT_GATE 0
+#define PULSE_OUT_RETRIG 1
+#define PULSE_OUT_CLOCK 2
+#define PULSE_OUT_RESET 3
+#define PULSE_OUT_NO_OF_OUTPUTS 4
+
+// The outputs use consecutive state machines and these pins
+#define GATE_PIN 10
+#define RETRIG_PIN 11
+#define CLOCK_OUT_PIN 12
+#define RESET_OUT_PIN 13
+
+#define PULSE_OUT_QUEUE_SIZE 16 // Edges per output, must be a power of 2
+#define PULSE_OUT_TRACE_SIZE 32 // Last edges kept for jitter checks
+#define PULSE_OUT_LEAD_US 20 // Edges are handed to the PIO 20 us ahead
+#define PULSE_OUT_LATENCY_US 50 // Fixed latency from event to edge
+#define PULSE_OUT_BUSY_MARGIN_US 2 // Guard when a state machine is finishing
+#define PULSE_OUT_FIRST_CYCLES 3 // PIO cycles from pull to edge
+#define PULSE_OUT_CHAIN_CYCLES 5 // PIO cycles from edge to the next edge
+#define PULSE_OUT_PUSH_CYCLES 12 // CPU cycles from timer edge to the FIFO
+
+#define PULSE_RETRIG_US 2000 // Retrigger pulse width
+#define PULSE_RESET_US 2000 // Reset pulse width
+#define PULSE_CLOCK_US 2000 // Longest clock pulse width
+
+// Edge waiting in an output queue
+typedef struct {
+    uint64_t timeUs; // When the edge shall be on the pin
+    bool level;
+} pulse_edge_t;
+
+// Jitter instrumentation, the scheduled time against the edge irq time
+typedef struct {
+    uint32_t edges; // Number of edges on the pins
+    uint32_t late; // Edges that were handed over too late
+    uint32_t dropped; // Edges that did not fit in the queue
+    int32_t minErrorUs; // Smallest observed - scheduled time
+    int32_t maxErrorUs; // Largest observed - scheduled time
+} pulse_out_stats_t;
+
+typedef struct {
+    uint8_t output;
+    bool level;
+    uint64_t scheduledUs;
+    uint64_t observedUs;
+} pulse_trace_t;
+
+// Global char extern declaration
+extern int gClockOutPPQN; // Pulses per quarter note on CLOCK_OUT_PIN
+extern pulse_out_stats_t gPulseStats;
+extern pulse_trace_t gPulseTrace[PULSE_OUT_TRACE_SIZE];
+extern uint32_t gPulseTraceIndex;
+
+void init_pulse_out();
+void SetClockOutPPQN(int ppqn);
+
+// Edges and pulses at absolute times [us since boot]
+bool pulse_out_edge(int output, bool level, uint64_t timeUs);
+bool pulse_out_trigger(int output, uint64_t timeUs, uint32_t widthUs);
+void pulse_out_gate(bool on, uint64_t timeUs);
+void pulse_out_reset(uint64_t timeUs);
+void pulse_out_clock_tick(uint32_t tick, uint64_t timeUs, uint32_t periodUs);
+
+// True when no edge is queued or waiting in a PIO state machine
+bool pulse_out_is_idle();
+
+static inline void pulse_out_service();
+static inline void pulse_out_alarm_callback(uint alarmNum);
+static inline void pulse_out_pio_irq_handler();
+
+#endif // PULSE_OUT_H
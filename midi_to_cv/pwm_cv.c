@@ -0,0 +1,115 @@
+/***********************************************
+/ pwm_cv.c : implementation file for the PWM CV output functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "pwm_cv.h"
+#include "cv_out.h"
+#include "hardware/dma.h"
+
+#define PWM_CV_DITHER_MASK ((1u << PWM_CV_DITHER_BITS) - 1)
+#define PWM_CV_SEQ_RING_BITS (PWM_CV_DITHER_BITS + 2) // 32 bit words
+
+// Global char initiation
+uint16_t gPwmCvLevel[CV_OUT_NO_OF_OUTPUTS]; // Duty cycle without the dither
+
+static const uint gPwmCvPin[CV_OUT_NO_OF_OUTPUTS] = {
+    PWM_CV_VELOCITY_PIN, PWM_CV_MOD_WHEEL_PIN, PWM_CV_AFTERTOUCH_PIN,
+    PWM_CV_TIMBRE_PIN };
+
+static uint8_t gPwmCvSlice[CV_OUT_NO_OF_OUTPUTS];
+static uint8_t gPwmCvChannel[CV_OUT_NO_OF_OUTPUTS];
+static int gPwmCvDma[PWM_CV_NO_OF_SLICES][2]; // Two channels chained in a loop
+
+// Compare register sequences, channel A in the low and B in the high half.
+// Every sequence is aligned to its size for the DMA read ring.
+static uint32_t gPwmCvSeq[PWM_CV_NO_OF_SLICES][PWM_CV_SEQ_LEN]
+    __attribute__((aligned(PWM_CV_SEQ_LEN * sizeof(uint32_t))));
+
+void init_pwm_cv() {
+    pwm_config config = pwm_get_default_config();
+    pwm_config_set_wrap(&config, PWM_CV_WRAP);
+    pwm_config_set_clkdiv_int(&config, 1);
+
+    for (int i = 0; i < CV_OUT_NO_OF_OUTPUTS; i++) {
+        gPwmCvSlice[i] = pwm_gpio_to_slice_num(gPwmCvPin[i]);
+        gPwmCvChannel[i] = pwm_gpio_to_channel(gPwmCvPin[i]);
+        gPwmCvLevel[i] = 0;
+
+        gpio_set_function(gPwmCvPin[i], GPIO_FUNC_PWM);
+        pwm_set_chan_level(gPwmCvSlice[i], gPwmCvChannel[i], 0);
+    }
+
+    // Both channels of a slice are set up by the first output on it
+    for (int i = 0; i < CV_OUT_NO_OF_OUTPUTS; i++) {
+        if (gPwmCvChannel[i] == 0) {
+            pwm_init(gPwmCvSlice[i], &config, true);
+        }
+    }
+
+    // Every PWM wrap takes the next compare word of the sequence. Each
+    // channel of the pair moves one sequence and starts the other, the
+    // read ring brings both back to the start, no CPU is involved.
+    for (int s = 0; s < PWM_CV_NO_OF_SLICES; s++) {
+        uint slice = gPwmCvSlice[s * 2];
+
+        for (int k = 0; k < PWM_CV_SEQ_LEN; k++) {
+            gPwmCvSeq[s][k] = 0;
+        }
+        gPwmCvDma[s][0] = dma_claim_unused_channel(true);
+        gPwmCvDma[s][1] = dma_claim_unused_channel(true);
+
+        for (int d = 0; d < 2; d++) {
+            dma_channel_config c = dma_channel_get_default_config(gPwmCvDma[s][d]);
+            channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+            channel_config_set_read_increment(&c, true);
+            channel_config_set_write_increment(&c, false);
+            channel_config_set_ring(&c, false, PWM_CV_SEQ_RING_BITS);
+            channel_config_set_dreq(&c, pwm_get_dreq(slice));
+            channel_config_set_chain_to(&c, gPwmCvDma[s][d ^ 1]);
+            dma_channel_configure(gPwmCvDma[s][d], &c, &pwm_hw->slice[slice].cc,
+                gPwmCvSeq[s], PWM_CV_SEQ_LEN, d == 0);
+        }
+    }
+}
+
+// Levels of one output over the sequence, the fraction of the 16 bit value
+// spread evenly as one level higher
+static inline void pwm_cv_levels(int i, uint16_t *pLevels) {
+    uint16_t level = gCvOut[i] >> PWM_CV_DITHER_BITS;
+    uint32_t fraction = gCvOut[i] & PWM_CV_DITHER_MASK;
+    uint32_t error = 0;
+
+    gPwmCvLevel[i] = level;
+    for (int k = 0; k < PWM_CV_SEQ_LEN; k++) {
+        error += fraction;
+        pLevels[k] = level;
+        if (error >= PWM_CV_SEQ_LEN) {
+            error -= PWM_CV_SEQ_LEN;
+            pLevels[k]++; // 4096 is always high
+        }
+    }
+}
+
+// Rewrites the sequences of the changed outputs
+void pwm_cv_update() {
+    uint32_t dirty = cv_out_take_dirty();
+
+    for (int s = 0; s < PWM_CV_NO_OF_SLICES && dirty; s++) {
+        uint32_t mask = 3u << (s * 2);
+        if (!(dirty & mask)) {
+            continue;
+        }
+        dirty &= ~mask;
+
+        uint16_t levels[2][PWM_CV_SEQ_LEN];
+        pwm_cv_levels(s * 2, levels[gPwmCvChannel[s * 2]]);
+        pwm_cv_levels(s * 2 + 1, levels[gPwmCvChannel[s * 2 + 1]]);
+
+        // One word at a time, the DMA reads either the old or the new word
+        for (int k = 0; k < PWM_CV_SEQ_LEN; k++) {
+            gPwmCvSeq[s][k] = (uint32_t)levels[0][k] | ((uint32_t)levels[1][k] << 16);
+        }
+    }
+}
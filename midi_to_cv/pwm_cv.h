@@ -0,0 +1,52 @@
+/***********************************************
+/ pwm_cv.h : header file for the PWM CV output functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef PWM_CV_H
+#define PWM_CV_H
+
+#include "pico/stdlib.h"
+#include "hardware/pwm.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The secondary CV outputs (see cv_out.h) are PWM outputs followed by a
+// hardware RC filter. The PWM runs at 125 MHz / 4096 = 30.5 kHz with a
+// 12 bit duty cycle. The 4 bits below the duty cycle are dithered per PWM
+// period: a DMA channel pair per slice, paced by the PWM wrap, writes the
+// compare register from a sequence of 16 words, with the fraction spread
+// evenly as one level higher. The CPU only rewrites a sequence when its
+// outputs change, a still output keeps dithering with the control tick
+// stopped.
+//
+// The sequence repeats every 16 PWM periods, the dither ripple is at most
+// one 12 bit step at 1.9 kHz or above. The mean is exact to 16 bits, the
+// filtered output has 16 bit resolution when the RC corner is well below
+// 1.9 kHz, a faster filter leaves part of the one step ripple.
+//
+// The compare registers are double buffered by the PWM slice, a new level
+// is taken at the end of the PWM period and never glitches the output.
+// The outputs cost no I2C bus time, the MCP4725 bus is left to V/oct.
+////////////////////////////////////////////////////////////////////////////////
+
+#define PWM_CV_WRAP 4095 // 12 bit duty cycle
+#define PWM_CV_DITHER_BITS 4 // 16 bit value - 12 bit duty cycle
+#define PWM_CV_SEQ_LEN (1 << PWM_CV_DITHER_BITS) // PWM periods per dither sequence
+#define PWM_CV_NO_OF_SLICES 2
+
+// The outputs are in cv_out order, two outputs per PWM slice
+#define PWM_CV_VELOCITY_PIN 16
+#define PWM_CV_MOD_WHEEL_PIN 17
+#define PWM_CV_AFTERTOUCH_PIN 18
+#define PWM_CV_TIMBRE_PIN 19
+
+// Global char extern declaration
+extern uint16_t gPwmCvLevel[]; // Duty cycle without the dither
+
+void init_pwm_cv();
+
+// Called at control rate (glide_timer_callback) for the changed outputs
+void pwm_cv_update();
+
+#endif // PWM_CV_H
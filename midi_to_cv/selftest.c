@@ -0,0 +1,282 @@
+/***********************************************
+/ selftest.c : implementation file for the MIDI input load self test
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "selftest.h"
+#include "midi_uart.h"
+#include "midi_clock.h"
+#include "midi_thru.h"
+#include "sysex.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+
+// Global char initiation
+selftest_report_t gSelftestReport = { .state = SELFTEST_STATE_IDLE };
+
+static uint8_t gSelftestBuf[SELFTEST_BUF_SIZE] __attribute__((aligned(SELFTEST_BUF_SIZE)));
+static bool gSelftestBufBuilt = false;
+static int gSelftestDma[2] = { -1, -1 };
+static int gSelftestThruInputs[MIDI_THRU_NO_OF_OUTPUTS];
+static uint64_t gSelftestDrainUs = 0;
+
+// Values at the start of the test
+static uint32_t gSelftestStartMessages[2];
+static uint32_t gSelftestStartClocks[2];
+static uint32_t gSelftestStartOverruns[2];
+static uint32_t gSelftestStartSysex = 0;
+static uint32_t gSelftestStartSysexDropped = 0;
+
+static const uint gSelftestTxPin[2] = { UART0_TX_PIN, UART1_TX_PIN };
+
+static inline uart_inst_t *selftest_uart(int uartNo) {
+    return uartNo == 0 ? UART_0 : UART_1;
+}
+
+// Blocks of running status pitch bend, clocks and a SysEx, the rest of
+// the buffer is one more run of pitch bends. Every pass of the ring
+// starts with the status byte and ends after a complete message.
+static inline void selftest_build() {
+    int len = 0;
+    uint16_t bend = 0;
+
+    while (len + 1 + 2 * SELFTEST_BENDS_PER_BLOCK + SELFTEST_BENDS_PER_BLOCK / SELFTEST_BENDS_PER_CLOCK +
+        SELFTEST_SYSEX_DATA + 5 <= SELFTEST_BUF_SIZE) {
+        gSelftestBuf[len++] = 0xE0;
+        for (int i = 0; i < SELFTEST_BENDS_PER_BLOCK; i++) {
+            gSelftestBuf[len++] = bend & 0x7F;
+            gSelftestBuf[len++] = (bend >> 7) & 0x7F;
+            bend = (bend + 97) & 0x3FFF;
+            if ((i + 1) % SELFTEST_BENDS_PER_CLOCK == 0) {
+                gSelftestBuf[len++] = 0xF8;
+            }
+        }
+
+        gSelftestBuf[len++] = 0xF0;
+        gSelftestBuf[len++] = SYSEX_MANUF_ID;
+        gSelftestBuf[len++] = SELFTEST_SYSEX_DEVICE_ID;
+        for (int i = 0; i < SELFTEST_SYSEX_DATA; i++) {
+            if (i == SELFTEST_SYSEX_DATA / 2) {
+                gSelftestBuf[len++] = 0xF8;
+            }
+            gSelftestBuf[len++] = (uint8_t)i;
+        }
+        gSelftestBuf[len++] = 0xF7;
+    }
+
+    gSelftestBuf[len++] = 0xE0;
+    while (len + 2 <= SELFTEST_BUF_SIZE) {
+        gSelftestBuf[len++] = bend & 0x7F;
+        gSelftestBuf[len++] = (bend >> 7) & 0x7F;
+        bend = (bend + 97) & 0x3FFF;
+    }
+    if (len < SELFTEST_BUF_SIZE) {
+        gSelftestBuf[len++] = 0xF8;
+    }
+}
+
+// Messages, clocks and SysEx in the first len bytes of the buffer
+static inline void selftest_count(int len, uint32_t *pMessages, uint32_t *pClocks, uint32_t *pSysex) {
+    uint8_t status = 0;
+    int noOfData = 0;
+    bool isSysex = false;
+
+    for (int i = 0; i < len; i++) {
+        uint8_t val = gSelftestBuf[i];
+        if (val == 0xF8) {
+            (*pClocks)++;
+        }
+        else if (val == 0xF0) {
+            isSysex = true;
+        }
+        else if (val == 0xF7) {
+            if (isSysex) {
+                (*pSysex)++;
+            }
+            isSysex = false;
+        }
+        else if (val & 0x80) {
+            status = val;
+            noOfData = 0;
+        }
+        else if (!isSysex && status) {
+            noOfData++;
+            if (noOfData == (((status & 0xE0) == 0xC0) ? 1 : 2)) {
+                (*pMessages)++;
+                noOfData = 0;
+            }
+        }
+    }
+}
+
+static inline void selftest_uart_loopback(int uartNo, bool isOn) {
+    uart_inst_t *uart = selftest_uart(uartNo);
+    uint pin = gSelftestTxPin[uartNo];
+
+    if (isOn) {
+        // The MIDI out stays at idle
+        gpio_init(pin);
+        gpio_put(pin, 1);
+        gpio_set_dir(pin, GPIO_OUT);
+        hw_set_bits(&uart_get_hw(uart)->cr, UART_UARTCR_LBE_BITS);
+    }
+    else {
+        hw_clear_bits(&uart_get_hw(uart)->cr, UART_UARTCR_LBE_BITS);
+        gpio_set_function(pin, GPIO_FUNC_UART);
+    }
+}
+
+bool selftest_start(uint32_t durationMs) {
+    if (selftest_is_running()) {
+        return false;
+    }
+    if (durationMs < SELFTEST_MIN_MS) {
+        durationMs = SELFTEST_MIN_MS;
+    }
+    else if (durationMs > SELFTEST_MAX_MS) {
+        durationMs = SELFTEST_MAX_MS;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        gSelftestDma[i] = dma_claim_unused_channel(false);
+    }
+    if (gSelftestDma[0] < 0 || gSelftestDma[1] < 0) {
+        for (int i = 0; i < 2; i++) {
+            if (gSelftestDma[i] >= 0) {
+                dma_channel_unclaim(gSelftestDma[i]);
+            }
+            gSelftestDma[i] = -1;
+        }
+        return false;
+    }
+
+    if (!gSelftestBufBuilt) {
+        selftest_build();
+        gSelftestBufBuilt = true;
+    }
+
+    // What the parser should see, the ring wraps at a message boundary
+    uint32_t noOfBytes = durationMs * SELFTEST_BYTES_PER_S / 1000;
+    uint32_t noOfPasses = noOfBytes / SELFTEST_BUF_SIZE;
+    uint32_t messages = 0;
+    uint32_t clocks = 0;
+    uint32_t sysex = 0;
+    selftest_count(SELFTEST_BUF_SIZE, &messages, &clocks, &sysex);
+    messages *= noOfPasses;
+    clocks *= noOfPasses;
+    sysex *= noOfPasses;
+    selftest_count(noOfBytes % SELFTEST_BUF_SIZE, &messages, &clocks, &sysex);
+
+    gSelftestReport.isPass = false;
+    gSelftestReport.durationMs = durationMs;
+    gSelftestReport.sysexSent = 2 * sysex;
+    for (int i = 0; i < 2; i++) {
+        gSelftestReport.uart[i].sent = messages;
+        gSelftestReport.uart[i].clocksSent = clocks;
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+    for (int i = 0; i < MIDI_THRU_NO_OF_OUTPUTS; i++) {
+        gSelftestThruInputs[i] = gThruInputs[i];
+    }
+    for (int i = 0; i < 2; i++) {
+        gSelftestStartMessages[i] = gUartRxMessages[i];
+        gSelftestStartClocks[i] = gClockSource[i].inCount;
+        gSelftestStartOverruns[i] = gUartOverruns[i];
+        gUartIsrMaxUs[i] = 0;
+    }
+    gSelftestStartSysex = gSysexMessages;
+    gSelftestStartSysexDropped = gSysexDropped;
+    restore_interrupts(status);
+
+    for (int i = 0; i < MIDI_THRU_NO_OF_OUTPUTS; i++) {
+        SetThruInputs(i, MIDI_THRU_NONE);
+    }
+
+    uint32_t mask = 0;
+    for (int i = 0; i < 2; i++) {
+        uart_inst_t *uart = selftest_uart(i);
+        selftest_uart_loopback(i, true);
+
+        dma_channel_config c = dma_channel_get_default_config(gSelftestDma[i]);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_ring(&c, false, SELFTEST_BUF_BITS);
+        channel_config_set_dreq(&c, uart_get_dreq(uart, true));
+        dma_channel_configure(gSelftestDma[i], &c, &uart_get_hw(uart)->dr, gSelftestBuf,
+            noOfBytes, false);
+        mask |= 1u << gSelftestDma[i];
+    }
+
+    gSelftestReport.state = SELFTEST_STATE_RUNNING;
+    dma_start_channel_mask(mask);
+    return true;
+}
+
+bool selftest_is_running() {
+    return gSelftestReport.state == SELFTEST_STATE_RUNNING ||
+        gSelftestReport.state == SELFTEST_STATE_DRAINING;
+}
+
+static inline void selftest_finish() {
+    for (int i = 0; i < 2; i++) {
+        selftest_uart_loopback(i, false);
+        dma_channel_unclaim(gSelftestDma[i]);
+        gSelftestDma[i] = -1;
+    }
+    for (int i = 0; i < MIDI_THRU_NO_OF_OUTPUTS; i++) {
+        SetThruInputs(i, gSelftestThruInputs[i]);
+    }
+
+    bool isPass = true;
+    for (int i = 0; i < 2; i++) {
+        selftest_uart_report_t *pUart = &gSelftestReport.uart[i];
+        pUart->parsed = gUartRxMessages[i] - gSelftestStartMessages[i];
+        pUart->clocksParsed = gClockSource[i].inCount - gSelftestStartClocks[i];
+        pUart->overruns = gUartOverruns[i] - gSelftestStartOverruns[i];
+        pUart->isrMaxUs = gUartIsrMaxUs[i];
+        if (pUart->parsed != pUart->sent || pUart->clocksParsed != pUart->clocksSent ||
+            pUart->overruns != 0 || pUart->isrMaxUs > SELFTEST_ISR_BUDGET_US) {
+            isPass = false;
+        }
+    }
+    gSelftestReport.sysexParsed = gSysexMessages - gSelftestStartSysex;
+    gSelftestReport.sysexDropped = gSysexDropped - gSelftestStartSysexDropped;
+    if (gSelftestReport.sysexParsed != gSelftestReport.sysexSent ||
+        gSelftestReport.sysexDropped != 0) {
+        isPass = false;
+    }
+
+    gSelftestReport.isPass = isPass;
+    gSelftestReport.state = SELFTEST_STATE_DONE;
+
+    printf("Self test %s, %lu ms\n", isPass ? "PASS" : "FAIL",
+        (unsigned long)gSelftestReport.durationMs);
+    for (int i = 0; i < 2; i++) {
+        selftest_uart_report_t *pUart = &gSelftestReport.uart[i];
+        printf("UART%d messages %lu/%lu clocks %lu/%lu overruns %lu ISR max %lu us\n", i,
+            (unsigned long)pUart->parsed, (unsigned long)pUart->sent,
+            (unsigned long)pUart->clocksParsed, (unsigned long)pUart->clocksSent,
+            (unsigned long)pUart->overruns, (unsigned long)pUart->isrMaxUs);
+    }
+    printf("SysEx %lu/%lu dropped %lu\n", (unsigned long)gSelftestReport.sysexParsed,
+        (unsigned long)gSelftestReport.sysexSent, (unsigned long)gSelftestReport.sysexDropped);
+}
+
+void selftest_task() {
+    if (gSelftestReport.state == SELFTEST_STATE_RUNNING) {
+        if (!dma_channel_is_busy(gSelftestDma[0]) && !dma_channel_is_busy(gSelftestDma[1])) {
+            gSelftestDrainUs = time_us_64() + SELFTEST_DRAIN_US;
+            gSelftestReport.state = SELFTEST_STATE_DRAINING;
+        }
+    }
+    else if (gSelftestReport.state == SELFTEST_STATE_DRAINING) {
+        if (time_us_64() >= gSelftestDrainUs) {
+            selftest_finish();
+        }
+    }
+}
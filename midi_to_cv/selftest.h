@@ -0,0 +1,83 @@
+/***********************************************
+/ selftest.h : header file for the MIDI input load self test
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The self test feeds both UART inputs at the full 31250 baud with a worst
+// case stream and checks that nothing is lost. No wiring is needed, the
+// UARTs are put in loopback and a DMA channel per UART writes the stream
+// to its own TX, the RX interrupt and the parser run as for MIDI DIN. The
+// generator takes no CPU time.
+//
+// The stream is running status pitch bend without gaps, a clock every
+// SELFTEST_BENDS_PER_CLOCK bends and a SysEx with a clock inside it every
+// block. It is built once into an aligned buffer that the DMA reads as a
+// ring. The SysEx has another device ID, sysex_task() decodes and ignores
+// it.
+//
+// While the test runs, the thru outputs are off, the TX pins are held at
+// idle and the main loop does not sleep. The pitch bends move the outputs
+// of a voice on MIDI channel 1. selftest_task() ends the test, restores
+// the UARTs and prints the report.
+//
+// The test passes when every message, clock and SysEx sent is parsed,
+// there are no overruns and no RX interrupt took longer than
+// SELFTEST_ISR_BUDGET_US.
+////////////////////////////////////////////////////////////////////////////////
+
+#define SELFTEST_BUF_BITS 10
+#define SELFTEST_BUF_SIZE (1 << SELFTEST_BUF_BITS) // DMA ring, aligned
+#define SELFTEST_BENDS_PER_BLOCK 32
+#define SELFTEST_BENDS_PER_CLOCK 16 // About 250 BPM at the full rate
+#define SELFTEST_SYSEX_DATA 16 // Data bytes per SysEx
+#define SELFTEST_SYSEX_DEVICE_ID 0x7F // Not SYSEX_DEVICE_ID
+#define SELFTEST_BYTES_PER_S 3125 // 31250 baud, 10 bits per byte
+#define SELFTEST_MIN_MS 100
+#define SELFTEST_MAX_MS 60000
+#define SELFTEST_DEFAULT_MS 5000
+#define SELFTEST_DRAIN_US 20000 // For the last byte and sysex_task()
+#define SELFTEST_ISR_BUDGET_US 160 // Half a byte time
+
+#define SELFTEST_STATE_IDLE 0 // Not run since boot
+#define SELFTEST_STATE_RUNNING 1
+#define SELFTEST_STATE_DRAINING 2 // All bytes sent
+#define SELFTEST_STATE_DONE 3
+
+typedef struct {
+    uint32_t sent; // Channel messages
+    uint32_t parsed;
+    uint32_t clocksSent;
+    uint32_t clocksParsed;
+    uint32_t overruns;
+    uint32_t isrMaxUs;
+} selftest_uart_report_t;
+
+typedef struct {
+    int state;
+    bool isPass;
+    uint32_t durationMs;
+    selftest_uart_report_t uart[2];
+    uint32_t sysexSent; // Both UARTs
+    uint32_t sysexParsed;
+    uint32_t sysexDropped;
+} selftest_report_t;
+
+// Global char extern declaration
+extern selftest_report_t gSelftestReport;
+
+// Returns false if a test is already running or there is no free DMA
+// channel
+bool selftest_start(uint32_t durationMs);
+bool selftest_is_running();
+
+// Called from the main loop
+void selftest_task();
+
+#endif // SELFTEST_H
@@ -0,0 +1,287 @@
+/***********************************************
+/ settings.c : implementation file for the flash settings and preset functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "settings.h"
+#include "voice.h"
+#include "midi_clock.h"
+#include "arp.h"
+#include "hardware/sync.h"
+
+// Global char initiation
+uint16_t gSettingsIndex[SETTINGS_NO_OF_KEYS]; // Page of the newest record
+uint32_t gSettingsWrites = 0; // Pages programmed
+uint32_t gSettingsErases = 0; // Sectors erased
+uint32_t gSettingsDropped = 0; // Save requests that did not fit in the queue
+
+static uint32_t gSettingsSeq = 0; // Sequence number of the next record
+static uint16_t gSettingsHead = 0; // Next erased page to write
+static uint16_t gSettingsTail = 0; // Oldest sector in use
+static uint16_t gSettingsFree = SETTINGS_NO_OF_PAGES; // Erased pages from the head to the tail
+static uint16_t gSettingsGcPage = 0; // Next page of the tail sector to copy
+static volatile uint64_t gSettingsLastActivity = 0;
+
+static settings_record_t gSettingsQueue[SETTINGS_QUEUE_SIZE];
+static volatile int gSettingsQueueLen = 0;
+
+static inline const settings_record_t *settings_page(int page) {
+    return (const settings_record_t *)(uintptr_t)(XIP_BASE + SETTINGS_FLASH_OFFSET + 
+        page * FLASH_PAGE_SIZE);
+}
+
+static inline uint32_t settings_crc(const settings_record_t *pRec) {
+    const uint8_t *p = (const uint8_t *)&pRec->seq;
+    int len = 8 + 2 * pRec->noOfValues; // seq, key and noOfValues
+    uint32_t crc = 0xFFFFFFFF;
+
+    if (pRec->noOfValues > PARAM_NO_OF_PARAMS) {
+        return 0;
+    }
+
+    for (int i = 0; i < len; i++) {
+        const uint8_t *pByte = i < 8 ? &p[i] : (const uint8_t *)pRec->values + i - 8;
+        crc ^= *pByte;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+static inline bool settings_is_valid(const settings_record_t *pRec) {
+    return pRec->magic == SETTINGS_MAGIC && pRec->key < SETTINGS_NO_OF_KEYS && 
+        pRec->crc == settings_crc(pRec);
+}
+
+static inline bool settings_is_erased(int page) {
+    const uint32_t *p = (const uint32_t *)settings_page(page);
+    for (int i = 0; i < FLASH_PAGE_SIZE / 4; i++) {
+        if (p[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline void settings_apply(const settings_record_t *pRec) {
+    for (int id = 0; id < pRec->noOfValues && id < PARAM_NO_OF_PARAMS; id++) {
+        param_set(id, pRec->values[id]);
+    }
+}
+
+void init_settings() {
+    bool isUsed[SETTINGS_NO_OF_SECTORS] = { false };
+    uint32_t keySeq[SETTINGS_NO_OF_KEYS];
+    int lastPage = -1;
+
+    for (int k = 0; k < SETTINGS_NO_OF_KEYS; k++) {
+        gSettingsIndex[k] = SETTINGS_NO_PAGE;
+        keySeq[k] = 0;
+    }
+
+    // Build the index, the newest record of a key wins
+    for (int page = 0; page < SETTINGS_NO_OF_PAGES; page++) {
+        const settings_record_t *pRec = settings_page(page);
+        if (pRec->magic == 0xFFFFFFFF && settings_is_erased(page)) {
+            continue;
+        }
+        isUsed[page / SETTINGS_PAGES_PER_SECTOR] = true;
+        if (!settings_is_valid(pRec)) {
+            continue;
+        }
+        if (gSettingsIndex[pRec->key] == SETTINGS_NO_PAGE || pRec->seq > keySeq[pRec->key]) {
+            gSettingsIndex[pRec->key] = page;
+            keySeq[pRec->key] = pRec->seq;
+        }
+        if (lastPage < 0 || pRec->seq >= gSettingsSeq) {
+            gSettingsSeq = pRec->seq + 1;
+            lastPage = page;
+        }
+    }
+
+    // The head is the first erased page after the newest record
+    gSettingsHead = lastPage < 0 ? 0 : (lastPage + 1) % SETTINGS_NO_OF_PAGES;
+    for (int i = 0; i < SETTINGS_NO_OF_PAGES && !settings_is_erased(gSettingsHead); i++) {
+        gSettingsHead = (gSettingsHead + 1) % SETTINGS_NO_OF_PAGES;
+    }
+
+    // The tail is the first used sector after the head sector
+    int headSector = gSettingsHead / SETTINGS_PAGES_PER_SECTOR;
+    gSettingsTail = headSector;
+    for (int i = 1; i <= SETTINGS_NO_OF_SECTORS; i++) {
+        int sector = (headSector + i) % SETTINGS_NO_OF_SECTORS;
+        if (isUsed[sector]) {
+            gSettingsTail = sector;
+            break;
+        }
+    }
+
+    int tailPage = gSettingsTail * SETTINGS_PAGES_PER_SECTOR;
+    if (!isUsed[gSettingsTail]) {
+        gSettingsFree = SETTINGS_NO_OF_PAGES;
+    }
+    else if (tailPage == gSettingsHead) {
+        gSettingsFree = 0;
+    }
+    else {
+        gSettingsFree = (tailPage - gSettingsHead + SETTINGS_NO_OF_PAGES) % 
+            SETTINGS_NO_OF_PAGES;
+    }
+    gSettingsGcPage = 0;
+
+    if (gSettingsIndex[SETTINGS_KEY_CURRENT] != SETTINGS_NO_PAGE) {
+        settings_apply(settings_page(gSettingsIndex[SETTINGS_KEY_CURRENT]));
+    }
+}
+
+// A queued record of the same key is replaced
+static inline void settings_queue(uint16_t key) {
+    uint32_t status = save_and_disable_interrupts();
+    int i = 0;
+
+    for (i = 0; i < gSettingsQueueLen; i++) {
+        if (gSettingsQueue[i].key == key) {
+            break;
+        }
+    }
+    if (i >= SETTINGS_QUEUE_SIZE) {
+        gSettingsDropped++;
+        restore_interrupts(status);
+        return;
+    }
+
+    settings_record_t *pRec = &gSettingsQueue[i];
+    pRec->key = key;
+    pRec->noOfValues = PARAM_NO_OF_PARAMS;
+    for (int id = 0; id < PARAM_NO_OF_PARAMS; id++) {
+        int value = 0;
+        param_get(id, &value);
+        pRec->values[id] = (int16_t)value;
+    }
+    if (i == gSettingsQueueLen) {
+        gSettingsQueueLen++;
+    }
+    restore_interrupts(status);
+}
+
+void settings_save_current() {
+    settings_queue(SETTINGS_KEY_CURRENT);
+}
+
+void settings_store_preset(int presetNo) {
+    if (presetNo < 0 || presetNo >= SETTINGS_NO_OF_PRESETS) {
+        return;
+    }
+
+    settings_queue(SETTINGS_KEY_PRESET + presetNo);
+}
+
+bool settings_recall_preset(int presetNo) {
+    if (presetNo < 0 || presetNo >= SETTINGS_NO_OF_PRESETS) {
+        return false;
+    }
+
+    uint16_t page = gSettingsIndex[SETTINGS_KEY_PRESET + presetNo];
+    if (page == SETTINGS_NO_PAGE) {
+        return false;
+    }
+
+    settings_apply(settings_page(page));
+    return true;
+}
+
+void settings_activity() {
+    gSettingsLastActivity = time_us_64();
+}
+
+// The arpeggiator also steps on the internal clock while stopped, the
+// looper only plays with the clock running
+static inline bool settings_is_idle() {
+    return gNoOfHeldNotes == 0 && !gClockRunning && 
+        (gArpMode == ARP_MODE_OFF || gArpSeqLen == 0) &&
+        time_us_64() - gSettingsLastActivity > SETTINGS_IDLE_US;
+}
+
+// Program one record at the head, the record is complete but for magic,
+// seq and crc
+static inline void settings_write(settings_record_t *pRec) {
+    uint8_t page[FLASH_PAGE_SIZE];
+    int pageNo = gSettingsHead;
+
+    pRec->magic = SETTINGS_MAGIC;
+    pRec->seq = gSettingsSeq++;
+    pRec->crc = settings_crc(pRec);
+    memset(page, 0xFF, sizeof(page));
+    memcpy(page, pRec, sizeof(settings_record_t));
+
+    uint32_t status = save_and_disable_interrupts();
+    flash_range_program(SETTINGS_FLASH_OFFSET + pageNo * FLASH_PAGE_SIZE, 
+        page, FLASH_PAGE_SIZE);
+    restore_interrupts(status);
+
+    gSettingsIndex[pRec->key] = pageNo;
+    gSettingsHead = (gSettingsHead + 1) % SETTINGS_NO_OF_PAGES;
+    gSettingsFree--;
+    gSettingsWrites++;
+}
+
+// One step of the compaction, copy one live record or erase the sector
+static inline void settings_gc_step() {
+    int sectorPage = gSettingsTail * SETTINGS_PAGES_PER_SECTOR;
+
+    // With no erased page left the live records of the tail are lost
+    while (gSettingsFree > 0 && gSettingsGcPage < SETTINGS_PAGES_PER_SECTOR) {
+        int page = sectorPage + gSettingsGcPage++;
+        const settings_record_t *pRec = settings_page(page);
+
+        if (settings_is_valid(pRec) && gSettingsIndex[pRec->key] == page) {
+            settings_record_t rec = *pRec;
+            settings_write(&rec);
+            return;
+        }
+    }
+
+    uint32_t status = save_and_disable_interrupts();
+    flash_range_erase(SETTINGS_FLASH_OFFSET + gSettingsTail * FLASH_SECTOR_SIZE, 
+        FLASH_SECTOR_SIZE);
+    restore_interrupts(status);
+
+    gSettingsErases++;
+    gSettingsFree += SETTINGS_PAGES_PER_SECTOR;
+    gSettingsTail = (gSettingsTail + 1) % SETTINGS_NO_OF_SECTORS;
+    gSettingsGcPage = 0;
+}
+
+void settings_task() {
+    if (!settings_is_idle()) {
+        return;
+    }
+
+    // A sector of erased pages is kept for the live records of the tail
+    if (gSettingsFree <= SETTINGS_PAGES_PER_SECTOR) {
+        settings_gc_step();
+        return;
+    }
+
+    if (gSettingsQueueLen > 0) {
+        settings_record_t rec;
+        uint32_t status = save_and_disable_interrupts();
+        rec = gSettingsQueue[0];
+        for (int i = 1; i < gSettingsQueueLen; i++) {
+            gSettingsQueue[i - 1] = gSettingsQueue[i];
+        }
+        gSettingsQueueLen--;
+        restore_interrupts(status);
+
+        settings_write(&rec);
+    }
+}
+
+bool settings_is_pending() {
+    return gSettingsQueueLen > 0 || gSettingsFree <= SETTINGS_PAGES_PER_SECTOR;
+}
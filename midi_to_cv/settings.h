@@ -0,0 +1,83 @@
+/***********************************************
+/ settings.h : header file for the flash settings and preset functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "params.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The settings (see params.h) are kept in a log at the end of the flash.
+// Every record is one flash page with a key, a sequence number and a CRC,
+// the newest valid record of a key wins. A page that was torn by a power
+// failure fails the CRC and the previous record of the key is used.
+//
+// The log is written as a ring over the sectors, so every sector takes
+// its share of the erases. When the erased space ahead of the head gets
+// small, the live records of the oldest sector are copied to the head and
+// the sector is erased.
+//
+// The RAM index holds the page of the newest record of every key, a
+// preset is recalled by Program Change with one lookup and a read through
+// XIP. Flash writes and erases stop XIP and the interrupts, they are only
+// done from settings_task() in the main loop, one page or one sector at a
+// time, and only when no notes are held, the clock is stopped, the
+// arpeggiator has no steps and there has been no MIDI, clock or active
+// sensing for SETTINGS_IDLE_US.
+////////////////////////////////////////////////////////////////////////////////
+
+#define SETTINGS_FLASH_SIZE (64 * 1024)
+#define SETTINGS_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - SETTINGS_FLASH_SIZE)
+#define SETTINGS_PAGES_PER_SECTOR (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE)
+#define SETTINGS_NO_OF_SECTORS (SETTINGS_FLASH_SIZE / FLASH_SECTOR_SIZE)
+#define SETTINGS_NO_OF_PAGES (SETTINGS_FLASH_SIZE / FLASH_PAGE_SIZE)
+
+#define SETTINGS_NO_OF_PRESETS 64
+#define SETTINGS_KEY_CURRENT 0 // The settings loaded at power on
+#define SETTINGS_KEY_PRESET 1 // + preset number
+#define SETTINGS_NO_OF_KEYS (SETTINGS_KEY_PRESET + SETTINGS_NO_OF_PRESETS)
+
+#define SETTINGS_MAGIC 0x53455431 // "SET1"
+#define SETTINGS_NO_PAGE 0xFFFF
+#define SETTINGS_QUEUE_SIZE 4 // Records waiting to be written
+#define SETTINGS_IDLE_US 500000 // No MIDI for 500 ms before flash writes
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq; // Increases with every record
+    uint16_t key;
+    uint16_t noOfValues;
+    uint32_t crc; // CRC-32 of seq, key, noOfValues and the values
+    int16_t values[PARAM_NO_OF_PARAMS];
+} settings_record_t;
+
+// Global char extern declaration
+extern uint16_t gSettingsIndex[SETTINGS_NO_OF_KEYS]; // Page of the newest record
+extern uint32_t gSettingsWrites; // Pages programmed
+extern uint32_t gSettingsErases; // Sectors erased
+extern uint32_t gSettingsDropped; // Save requests that did not fit in the queue
+
+// Scans the log and applies the stored settings
+void init_settings();
+
+// Queue the current settings, written later by settings_task()
+void settings_save_current();
+void settings_store_preset(int presetNo);
+
+// Constant time recall, called from Program Change
+bool settings_recall_preset(int presetNo);
+
+// Called for every received MIDI message and real time byte, postpones
+// flash writes
+void settings_activity();
+
+// Called from the main loop
+void settings_task();
+bool settings_is_pending(); // Records or a GC step wait for an idle moment
+
+#endif // SETTINGS_H
@@ -0,0 +1,259 @@
+/***********************************************
+/ sysex.c : implementation file for the SysEx stream decoder functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "sysex.h"
+#include "params.h"
+#include "tuning.h"
+#include "settings.h"
+#include "usb_midi_packet.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+
+// F0 7D 4D, the command, the data of a dump and F7
+#define SYSEX_REPLY_SIZE (5 + 3 * PARAM_NO_OF_PARAMS)
+
+// Global char initiation
+uint32_t gSysexMessages = 0; // Complete messages decoded
+uint32_t gSysexDropped = 0; // Messages too long or without a free buffer
+uint32_t gSysexRepliesDropped = 0; // Not read by the host in time
+
+static sysex_buffer_t gSysexBuf[MIDI_NO_OF_PORTS][SYSEX_NO_OF_BUFFERS];
+static uint8_t gSysexState[MIDI_NO_OF_PORTS];
+static sysex_buffer_t *gSysexFill[MIDI_NO_OF_PORTS]; // Buffer being received
+static uint8_t gSysexReply[USB_MIDI_SYSEX_PACKETS(SYSEX_REPLY_SIZE) * USB_MIDI_PACKET_SIZE];
+static int gSysexReplyLen = 0; // Packet bytes of the reply, 0 when none
+static int gSysexReplyPos = 0; // Packet bytes written
+static uint64_t gSysexReplyUs = 0; // Queued
+
+void sysex_start(int portNo) {
+    gSysexFill[portNo] = NULL;
+    gSysexState[portNo] = SYSEX_STATE_DROP;
+
+    for (int i = 0; i < SYSEX_NO_OF_BUFFERS; i++) {
+        if (!gSysexBuf[portNo][i].isReady) {
+            gSysexFill[portNo] = &gSysexBuf[portNo][i];
+            gSysexFill[portNo]->len = 0;
+            gSysexState[portNo] = SYSEX_STATE_RECEIVE;
+            break;
+        }
+    }
+}
+
+void sysex_byte(int portNo, uint8_t val) {
+    if (gSysexState[portNo] != SYSEX_STATE_RECEIVE) {
+        return;
+    }
+
+    sysex_buffer_t *pBuf = gSysexFill[portNo];
+    if (pBuf->len >= SYSEX_BUFFER_SIZE) {
+        gSysexState[portNo] = SYSEX_STATE_DROP;
+        return;
+    }
+    pBuf->data[pBuf->len++] = val;
+}
+
+void sysex_end(int portNo) {
+    if (gSysexState[portNo] == SYSEX_STATE_RECEIVE) {
+        gSysexFill[portNo]->isReady = true;
+    }
+    else if (gSysexState[portNo] == SYSEX_STATE_DROP) {
+        gSysexDropped++;
+    }
+    gSysexState[portNo] = SYSEX_STATE_IDLE;
+}
+
+void sysex_abort(int portNo) {
+    if (gSysexState[portNo] != SYSEX_STATE_IDLE) {
+        gSysexDropped++;
+    }
+    gSysexState[portNo] = SYSEX_STATE_IDLE;
+}
+
+bool sysex_is_active(int portNo) {
+    return gSysexState[portNo] != SYSEX_STATE_IDLE;
+}
+
+// Writes the packets of the reply the USB FIFO has room for, true when
+// no reply is left
+static inline bool sysex_send_flush() {
+    if (gSysexReplyLen == 0) {
+        return true;
+    }
+
+    // The host is gone or does not read, the rest of the reply is dropped
+    if (!tud_midi_mounted() || time_us_64() - gSysexReplyUs > SYSEX_REPLY_TIMEOUT_US) {
+        gSysexRepliesDropped++;
+        gSysexReplyLen = 0;
+        return true;
+    }
+
+    // A packet is written whole or not at all
+    while (gSysexReplyPos < gSysexReplyLen &&
+        tud_midi_n_packet_write(0, &gSysexReply[gSysexReplyPos])) {
+        gSysexReplyPos += USB_MIDI_PACKET_SIZE;
+    }
+    if (gSysexReplyPos >= gSysexReplyLen) {
+        gSysexReplyLen = 0;
+    }
+    return gSysexReplyLen == 0;
+}
+
+// Answers go to the USB MIDI device, the DIN outputs belong to midi_thru.
+// The whole reply is encoded into packets first, sysex_task() writes what
+// does not fit in the FIFO later.
+static inline void sysex_send(const uint8_t *data, int len) {
+    uint8_t msg[SYSEX_REPLY_SIZE];
+    int msgLen = 0;
+
+    if (!tud_midi_mounted() || len + 4 > SYSEX_REPLY_SIZE) {
+        return;
+    }
+
+    msg[msgLen++] = 0xF0;
+    msg[msgLen++] = SYSEX_MANUF_ID;
+    msg[msgLen++] = SYSEX_DEVICE_ID;
+    for (int i = 0; i < len; i++) {
+        msg[msgLen++] = data[i];
+    }
+    msg[msgLen++] = 0xF7;
+
+    gSysexReplyLen = usb_midi_sysex_packets(msg, msgLen, 0, gSysexReply);
+    gSysexReplyPos = 0;
+    gSysexReplyUs = time_us_64();
+    sysex_send_flush();
+}
+
+static inline void sysex_send_param(int id) {
+    int value = 0;
+    if (!param_get(id, &value)) {
+        return;
+    }
+
+    uint8_t msg[4] = { SYSEX_CMD_PARAM_VALUE, (uint8_t)id, 
+        (uint8_t)((value >> 7) & 0x7F), (uint8_t)(value & 0x7F) };
+    sysex_send(msg, sizeof(msg));
+}
+
+static inline void sysex_send_dump() {
+    uint8_t msg[1 + 3 * PARAM_NO_OF_PARAMS];
+    int len = 0;
+
+    msg[len++] = SYSEX_CMD_DUMP;
+    for (int id = 0; id < PARAM_NO_OF_PARAMS; id++) {
+        int value = 0;
+        param_get(id, &value);
+        msg[len++] = (uint8_t)id;
+        msg[len++] = (uint8_t)((value >> 7) & 0x7F);
+        msg[len++] = (uint8_t)(value & 0x7F);
+    }
+    sysex_send(msg, len);
+}
+
+// The setters are shared with the MIDI interrupts
+static inline void sysex_param_set(uint8_t id, uint8_t msb, uint8_t lsb) {
+    uint32_t status = save_and_disable_interrupts();
+    param_set(id, ((int)(msb & 0x7F) << 7) | (lsb & 0x7F));
+    restore_interrupts(status);
+}
+
+static inline void sysex_device_message(const uint8_t *data, int len) {
+    // data[0] is the manufacturer ID and data[1] the device ID
+    if (len < 3 || data[1] != SYSEX_DEVICE_ID) {
+        return;
+    }
+
+    const uint8_t *p = &data[3];
+    int n = len - 3;
+
+    switch (data[2]) {
+    case SYSEX_CMD_PARAM_SET:
+        if (n >= 3) {
+            sysex_param_set(p[0], p[1], p[2]);
+            settings_save_current();
+        }
+        break;
+    case SYSEX_CMD_PARAM_GET:
+        if (n >= 1) {
+            sysex_send_param(p[0]);
+        }
+        break;
+    case SYSEX_CMD_DUMP_REQUEST:
+        sysex_send_dump();
+        break;
+    case SYSEX_CMD_DUMP:
+        for (int i = 0; i + 3 <= n; i += 3) {
+            sysex_param_set(p[i], p[i + 1], p[i + 2]);
+        }
+        settings_save_current();
+        break;
+    case SYSEX_CMD_PRESET_STORE:
+        if (n >= 1) {
+            settings_store_preset(p[0]);
+        }
+        break;
+    }
+}
+
+static inline void sysex_decode(int portNo, const uint8_t *data, int len) {
+    if (len < 1) {
+        return;
+    }
+
+    if (gPM) {
+        printf("SysEx(%02X %d) ", data[0], len);
+    }
+
+    switch (data[0]) {
+    case SYSEX_MANUF_ID:
+        sysex_device_message(data, len);
+        break;
+    case SYSEX_NON_REAL_TIME:
+    case SYSEX_REAL_TIME:
+        tuning_mts_sysex(data, len, midi_port_channel(portNo));
+        break;
+    }
+}
+
+void sysex_task() {
+    // A reply still going out holds up the next messages, they wait in
+    // their buffers
+    if (!sysex_send_flush()) {
+        return;
+    }
+
+    for (int port = 0; port < MIDI_NO_OF_PORTS; port++) {
+        for (int i = 0; i < SYSEX_NO_OF_BUFFERS; i++) {
+            sysex_buffer_t *pBuf = &gSysexBuf[port][i];
+            if (!pBuf->isReady) {
+                continue;
+            }
+
+            sysex_decode(port, pBuf->data, pBuf->len);
+            gSysexMessages++;
+            pBuf->isReady = false;
+            if (gSysexReplyLen != 0) {
+                return;
+            }
+        }
+    }
+}
+
+bool sysex_is_pending() {
+    if (gSysexReplyLen != 0) {
+        return true;
+    }
+
+    for (int port = 0; port < MIDI_NO_OF_PORTS; port++) {
+        for (int i = 0; i < SYSEX_NO_OF_BUFFERS; i++) {
+            if (gSysexBuf[port][i].isReady) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
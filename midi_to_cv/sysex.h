@@ -0,0 +1,79 @@
+/***********************************************
+/ sysex.h : header file for the SysEx stream decoder functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef SYSEX_H
+#define SYSEX_H
+
+#include "pico/stdlib.h"
+#include "midi_uart.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// SysEx bytes are streamed one at a time from the MIDI interrupts into a
+// bounded buffer per port, every byte is a store and an increment. Real
+// time bytes interleave freely, any other status byte aborts the SysEx.
+// Every port has two buffers, a complete message waits in one while the
+// next one is received into the other. Complete messages are decoded in
+// sysex_task() from the main loop, so a long dump never holds up note or
+// clock handling. A message longer than the buffer is dropped.
+//
+// Device protocol, manufacturer ID 0x7D (non-commercial):
+// F0 7D 4D <command> <data> F7, values are 14 bits MSB first
+// 01 id msb lsb : set a parameter (see params.h)
+// 02 id : request a parameter, answered with 03 id msb lsb
+// 04 : request all parameters, answered with 05 (id msb lsb) x n
+// 05 (id msb lsb) x n : set several parameters (a preset)
+// 06 n : store the settings as preset n, recalled by Program Change n
+// Changed settings are saved to flash (see settings.h).
+// Answers are sent on the USB MIDI device as whole packets. An answer the
+// FIFO has no room for waits in sysex_task(), and so do the next
+// messages. An answer the host has not read after SYSEX_REPLY_TIMEOUT_US
+// is dropped.
+//
+// Universal real time and non-real time messages go to the MIDI Tuning
+// Standard decoder (see tuning.h).
+////////////////////////////////////////////////////////////////////////////////
+
+#define SYSEX_BUFFER_SIZE 512 // Holds an MTS bulk dump (408 bytes)
+#define SYSEX_NO_OF_BUFFERS 2 // Per port
+#define SYSEX_REPLY_TIMEOUT_US 500000
+
+#define SYSEX_MANUF_ID 0x7D // Non-commercial
+#define SYSEX_DEVICE_ID 0x4D // 'M'
+
+#define SYSEX_CMD_PARAM_SET 0x01
+#define SYSEX_CMD_PARAM_GET 0x02
+#define SYSEX_CMD_PARAM_VALUE 0x03
+#define SYSEX_CMD_DUMP_REQUEST 0x04
+#define SYSEX_CMD_DUMP 0x05
+#define SYSEX_CMD_PRESET_STORE 0x06
+
+#define SYSEX_STATE_IDLE 0
+#define SYSEX_STATE_RECEIVE 1
+#define SYSEX_STATE_DROP 2 // No free buffer or the message is too long
+
+typedef struct {
+    uint8_t data[SYSEX_BUFFER_SIZE]; // Without F0 and F7
+    uint16_t len;
+    volatile bool isReady; // Complete and waiting for sysex_task()
+} sysex_buffer_t;
+
+// Global char extern declaration
+extern uint32_t gSysexMessages; // Complete messages decoded
+extern uint32_t gSysexDropped; // Messages too long or without a free buffer
+extern uint32_t gSysexRepliesDropped; // Not read by the host in time
+
+// Called from the MIDI interrupts for F0, data bytes and F7
+void sysex_start(int portNo);
+void sysex_byte(int portNo, uint8_t val);
+void sysex_end(int portNo);
+void sysex_abort(int portNo);
+bool sysex_is_active(int portNo);
+
+// Called from the main loop
+void sysex_task();
+bool sysex_is_pending(); // A message or an answer is waiting for sysex_task()
+
+#endif // SYSEX_H
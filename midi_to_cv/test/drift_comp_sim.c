@@ -0,0 +1,182 @@
+/***********************************************
+/ drift_comp_sim.c : host simulation of the V/oct drift compensation
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs drift_comp.c on the host against a synthetic output stage whose
+// gain and offset drift, read back by a noisy 12 bit ADC. The ADC and DMA
+// stubs fill the capture buffer from the DAC value at once, the clock is
+// moved by hand. Every scenario plays held notes over five octaves and
+// checks the pitch error of the compensated output at the end.
+//
+// Build and run from midi_to_cv:
+//   gcc -std=c11 -O2 -I test/stubs -I . test/drift_comp_sim.c -lm -o drift_comp_sim
+//   ./drift_comp_sim
+// The exit code is 0 when every scenario ends within SIM_MAX_ERROR_CENTS.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+// Only the DAC scale of mcp4725.h is used, the I2C parts are left out
+#define MCP4725_H
+#define DAC_VALUE_C0_NOTE 30
+#define DAC_HALF_NOTE_VALUE 42
+extern int gDACVal;
+extern int gDACValOld;
+extern uint32_t gControlIdleCount;
+void control_timers_wake();
+bool control_timers_is_idle();
+
+#include "drift_comp.c"
+
+#define SIM_STEPS 3000 // Held notes per scenario, 2 hours
+#define SIM_CAPTURES_PER_STEP 4 // drift_comp_task() calls, 600 ms apart
+#define SIM_ADC_NOISE 2.0 // Peak ADC noise [codes]
+#define SIM_MAX_ERROR_CENTS 3.0 // About one DAC code
+
+typedef struct {
+    const char *pName;
+    double gainErr; // Output stage gain - 1
+    double gainPeriod; // Steps per radian of a sine drift, 0 for a fixed gain
+    double offsetV; // Output stage offset [V]
+} sim_scenario_t;
+
+uint64_t gSimNowUs = 0;
+int gDACVal = 0;
+int gDACValOld = 0;
+uint32_t gControlIdleCount = 0;
+
+static adc_hw_t gSimAdc;
+adc_hw_t *adc_hw = &gSimAdc;
+static double gSimGain = 1.0;
+static double gSimOffsetV = 0.0;
+
+void control_timers_wake() {
+    gControlIdleCount++;
+}
+
+bool control_timers_is_idle() {
+    return true;
+}
+
+// Output voltage of a DAC value, 1 V/oct
+static inline double sim_volts(double gain, double offsetV, int dacValue) {
+    return gain * (dacValue - DAC_VALUE_C0_NOTE) / (12.0 * DAC_HALF_NOTE_VALUE) + offsetV;
+}
+
+void adc_init() {}
+void adc_gpio_init(uint gpio) {}
+void adc_select_input(uint input) {}
+void adc_fifo_setup(bool en, bool dreqEn, uint16_t dreqThresh, bool errInFifo, bool byteShift) {}
+void adc_set_clkdiv(float clkdiv) {}
+void adc_run(bool run) {}
+void adc_fifo_drain() {}
+
+int dma_claim_unused_channel(bool required) {
+    return 0;
+}
+void dma_channel_abort(uint channel) {}
+bool dma_channel_is_busy(uint channel) {
+    return false;
+}
+dma_channel_config dma_channel_get_default_config(uint channel) {
+    dma_channel_config c = { 0 };
+    return c;
+}
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) {}
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) {}
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) {}
+void channel_config_set_dreq(dma_channel_config *c, uint dreq) {}
+
+// The whole capture of the DAC value being output
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *writeAddr,
+    const volatile void *readAddr, uint transferCount, bool trigger) {
+    uint16_t *pBuf = (uint16_t *)writeAddr;
+    double volts = sim_volts(gSimGain, gSimOffsetV, gDACValOld);
+
+    for (uint i = 0; i < transferCount; i++) {
+        double noise = ((rand() % 2001) - 1000) / 1000.0 * SIM_ADC_NOISE;
+        double code = DRIFT_ADC_C0 + volts * DRIFT_ADC_PER_OCTAVE + noise;
+        if (code < 0.0) {
+            code = 0.0;
+        }
+        else if (code > 4095.0) {
+            code = 4095.0;
+        }
+        pBuf[i] = (uint16_t)lround(code);
+    }
+}
+
+static inline int sim_note_dac_value(int note) {
+    return DAC_VALUE_C0_NOTE + (note - 12) * DAC_HALF_NOTE_VALUE;
+}
+
+// Worst pitch error over the notes with the fit at the end of the run
+static double sim_run(const sim_scenario_t *pScen) {
+    static const int notes[] = { 36, 48, 60, 72, 84, 43, 67 };
+    const int noOfNotes = sizeof(notes) / sizeof(notes[0]);
+
+    // The clock goes on from the last scenario, the capture timing keeps working
+    srand(1);
+    gDriftCaptures = 0;
+    gDriftDiscarded = 0;
+    gDriftCompMode = DRIFT_COMP_OFF;
+    init_drift_comp();
+    SetDriftComp(DRIFT_COMP_ON);
+
+    for (int step = 0; step < SIM_STEPS; step++) {
+        gSimGain = 1.0 + (pScen->gainPeriod > 0.0 ?
+            pScen->gainErr * sin(step / pScen->gainPeriod) : pScen->gainErr);
+        gSimOffsetV = pScen->offsetV;
+
+        int want = sim_note_dac_value(notes[(step / 3) % noOfNotes]);
+        for (int k = 0; k < SIM_CAPTURES_PER_STEP; k++) {
+            gDACVal = gDACValOld = drift_comp_apply(want);
+            gSimNowUs += 600000;
+            drift_comp_task();
+        }
+    }
+
+    double maxCents = 0.0;
+    for (int i = 0; i < noOfNotes; i++) {
+        int want = sim_note_dac_value(notes[i]);
+        double cents = 1200.0 * fabs(sim_volts(gSimGain, gSimOffsetV, drift_comp_apply(want)) -
+            sim_volts(1.0, 0.0, want));
+        if (cents > maxCents) {
+            maxCents = cents;
+        }
+    }
+
+    printf("%-24s gain %.4f offset %+.3f V | fit gain %.4f offset %+.2f | "
+        "error %.2f cents, captures %u discarded %u\n", pScen->pName, gSimGain,
+        gSimOffsetV, gDriftGainQ16 / 65536.0, gDriftOffsetQ4 / 16.0, maxCents,
+        gDriftCaptures, gDriftDiscarded);
+    return maxCents;
+}
+
+int main() {
+    static const sim_scenario_t scenarios[] = {
+        { "no drift", 0.0, 0.0, 0.0 },
+        { "gain +3 %", 0.03, 0.0, 0.0 },
+        { "gain -2 %, offset +40 mV", -0.02, 0.0, 0.040 },
+        { "offset -60 mV", 0.0, 0.0, -0.060 },
+        { "warm up, gain 2 %", 0.02, 3000.0, 0.020 },
+    };
+    const int noOfScenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+    int failed = 0;
+
+    for (int i = 0; i < noOfScenarios; i++) {
+        if (sim_run(&scenarios[i]) > SIM_MAX_ERROR_CENTS) {
+            failed++;
+        }
+    }
+
+    printf("%s, %d of %d scenarios over %.1f cents\n", failed ? "FAIL" : "PASS",
+        failed, noOfScenarios, SIM_MAX_ERROR_CENTS);
+    return failed ? 1 : 0;
+}
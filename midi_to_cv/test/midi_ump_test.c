@@ -0,0 +1,406 @@
+/***********************************************
+/ midi_ump_test.c : host test of the Universal MIDI Packet decoder
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+// Builds midi_ump.c on the host with the voice, pitch, controller and
+// SysEx functions replaced by stubs that log the last call. Checks the
+// min-center-max scaling (7 to 16 and 32 bits, 14 to 32 bits and back),
+// the MIDI 1.0 to 2.0 translation and the word at a time decode of every
+// supported message type, the channel filter and partial packets.
+//
+// Build and run from midi_to_cv:
+//   gcc -std=c11 -O2 -I test/stubs -I . test/midi_ump_test.c -o midi_ump_test
+//   ./midi_ump_test
+// The exit code is 0 when every check passes.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+// Only the pitch bend of mcp4725.h is used, the I2C parts are left out
+#define MCP4725_H
+void set_pitch_wheel_32(uint32_t value, int hpwRange);
+
+#include "midi_ump.c"
+
+typedef struct {
+    const char *pName; // Last stub called, NULL when none
+    int calls;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+} test_log_t;
+
+static test_log_t gLog;
+static int gTestChecks = 0;
+static int gTestFailed = 0;
+static int gSysexBytes = 0;
+static uint8_t gSysexBuf[16];
+
+uint64_t gSimNowUs = 0;
+int gHPWRange = 2;
+
+#define CHECK(cond) test_check((cond), #cond, __LINE__)
+
+static inline void test_check(bool isOk, const char *pText, int line) {
+    gTestChecks++;
+    if (!isOk) {
+        gTestFailed++;
+        printf("FAIL line %d: %s\n", line, pText);
+    }
+}
+
+static inline void test_log(const char *pName, uint32_t a, uint32_t b, uint32_t c) {
+    gLog.pName = pName;
+    gLog.calls++;
+    gLog.a = a;
+    gLog.b = b;
+    gLog.c = c;
+}
+
+static inline void test_log_clear() {
+    memset(&gLog, 0, sizeof(gLog));
+}
+
+static inline bool test_logged(const char *pName, uint32_t a, uint32_t b, uint32_t c) {
+    return gLog.calls == 1 && gLog.pName != NULL && strcmp(gLog.pName, pName) == 0 &&
+        gLog.a == a && gLog.b == b && gLog.c == c;
+}
+
+void voice_note_on_pitch(uint8_t noteNo, uint16_t pitch, uint16_t velocity) {
+    test_log("note_on", noteNo, pitch, velocity);
+}
+void voice_note_off(uint8_t noteNo) {
+    test_log("note_off", noteNo, 0, 0);
+}
+void voice_per_note_bend(uint8_t noteNo, uint32_t value) {
+    test_log("per_note_bend", noteNo, value, 0);
+}
+void voice_poly_pressure(uint8_t noteNo, uint16_t pressure) {
+    test_log("poly_pressure", noteNo, pressure, 0);
+}
+void set_pitch_wheel_32(uint32_t value, int hpwRange) {
+    test_log("pitch_bend", value, (uint32_t)hpwRange, 0);
+}
+void SetHalfPitchWheelRange(int noOfhalfNotes) {
+    test_log("bend_range", (uint32_t)noOfhalfNotes, 0, 0);
+}
+void cv_out_set(int output, uint16_t value) {
+    test_log("cv_out", (uint32_t)output, value, 0);
+}
+// Controller 1 and NRPN 0x0101 are routed
+bool cc_route_controller_32(int type, uint16_t number, uint32_t value) {
+    test_log("cc_route", (uint32_t)type, number, value);
+    return (type == CC_ROUTE_TYPE_CC7 && number == 1) ||
+        (type == CC_ROUTE_TYPE_NRPN && number == 0x0101);
+}
+void midi_dispatch_message(int portNo, int midiChFilter, uint8_t status, uint8_t data1, uint8_t data2) {
+    test_log("midi1", status, data1, data2);
+}
+void midi_dispatch_sys(int portNo, uint8_t sys) {
+    test_log("sys", (uint32_t)portNo, sys, 0);
+}
+void sysex_start(int portNo) {
+    gSysexBytes = 0;
+    test_log("sysex_start", (uint32_t)portNo, 0, 0);
+}
+void sysex_byte(int portNo, uint8_t val) {
+    if (gSysexBytes < (int)sizeof(gSysexBuf)) {
+        gSysexBuf[gSysexBytes++] = val;
+    }
+}
+void sysex_end(int portNo) {
+    test_log("sysex_end", (uint32_t)portNo, (uint32_t)gSysexBytes, 0);
+}
+
+// Decodes the words and checks that all of them were used
+static inline bool test_decode(int midiChFilter, const uint32_t *words, int count) {
+    test_log_clear();
+    return ump_decode(MIDI_PORT_USB, midiChFilter, words, count) == count;
+}
+
+// Min-center-max: below the center a plain shift, the center to the
+// center, the maximum to the maximum and within 1 LSB of a straight line
+// in between
+static void test_scale_up(uint8_t srcBits, uint8_t dstBits) {
+    const uint32_t srcMax = (1u << srcBits) - 1;
+    const uint32_t srcCenter = 1u << (srcBits - 1);
+    const double dstMax = dstBits == 32 ? 4294967295.0 : (double)((1u << dstBits) - 1);
+    const double dstCenter = (double)(1u << (dstBits - 1));
+    uint32_t last = 0;
+    bool isExact = true;
+    bool isMonotonic = true;
+
+    for (uint32_t v = 0; v <= srcMax; v++) {
+        uint32_t out = ump_scale_up(v, srcBits, dstBits);
+        double line = v <= srcCenter ? (double)v * dstCenter / srcCenter :
+            dstCenter + (v - srcCenter) * (dstMax - dstCenter) / (srcMax - srcCenter);
+
+        if (out - line > 1.0 || line - out > 1.0) {
+            isExact = false;
+        }
+        if (v > 0 && out <= last) {
+            isMonotonic = false;
+        }
+        if (v <= srcCenter && out != v << (dstBits - srcBits)) {
+            isExact = false;
+        }
+        last = out;
+    }
+
+    CHECK(ump_scale_up(0, srcBits, dstBits) == 0);
+    CHECK(ump_scale_up(srcCenter, srcBits, dstBits) == (uint32_t)dstCenter);
+    CHECK(ump_scale_up(srcMax, srcBits, dstBits) == (uint32_t)dstMax);
+    CHECK(isExact);
+    CHECK(isMonotonic);
+}
+
+static void test_scaling() {
+    test_scale_up(7, 16);
+    test_scale_up(7, 32);
+    test_scale_up(14, 32);
+    test_scale_up(14, 16);
+
+    // Spot values, 7 bit velocity and 14 bit pitch bend
+    CHECK(ump_scale_up(0x01, 7, 16) == 0x0200);
+    CHECK(ump_scale_up(0x41, 7, 16) == 0x8208);
+    CHECK(ump_scale_up(0x7F, 7, 16) == 0xFFFF);
+    CHECK(ump_scale_up(0x2000, 14, 32) == 0x80000000);
+    CHECK(ump_scale_up(0x3FFF, 14, 32) == 0xFFFFFFFF);
+    CHECK(ump_scale_up(0x1FFF, 14, 32) == 0x7FFC0000);
+
+    // 7 to 32 bits and down to 16 is the same as 7 to 16 bits
+    bool isSame = true;
+    for (uint32_t v = 0; v < 128; v++) {
+        if (ump_scale_down(ump_scale_up(v, 7, 32), 32, 16) != ump_scale_up(v, 7, 16)) {
+            isSame = false;
+        }
+    }
+    CHECK(isSame);
+
+    // Down and up again
+    bool isRoundTrip = true;
+    for (uint32_t v = 0; v < 0x4000; v++) {
+        if (ump_scale_down(ump_scale_up(v, 14, 32), 32, 14) != v) {
+            isRoundTrip = false;
+        }
+    }
+    CHECK(isRoundTrip);
+    CHECK(ump_scale_down(0xFFFFFFFF, 32, 7) == 0x7F);
+    CHECK(ump_scale_down(0x80000000, 32, 16) == 0x8000);
+}
+
+static void test_words() {
+    static const int sizes[16] = { 1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4 };
+
+    for (uint32_t mt = 0; mt < 16; mt++) {
+        CHECK(ump_words(mt << 28) == sizes[mt]);
+    }
+}
+
+static void test_midi2_channel_voice() {
+    // Note on with a pitch 7.9 attribute, C4 plus half a half note
+    uint32_t noteOnPitch[] = { 0x40913C03, 0xC0007900 };
+    CHECK(test_decode(MIDI_CH_ALL, noteOnPitch, 2));
+    CHECK(test_logged("note_on", 0x3C, 0x7900, 0xC000));
+
+    // Without an attribute the pitch is the note
+    uint32_t noteOn[] = { 0x40913C00, 0xFFFF0000 };
+    CHECK(test_decode(MIDI_CH_ALL, noteOn, 2));
+    CHECK(test_logged("note_on", 0x3C, 0x3C << 9, 0xFFFF));
+
+    uint32_t noteOff[] = { 0x40813C00, 0x00000000 };
+    CHECK(test_decode(MIDI_CH_ALL, noteOff, 2));
+    CHECK(test_logged("note_off", 0x3C, 0, 0));
+
+    uint32_t bend[] = { 0x40E10000, 0x80001234 };
+    CHECK(test_decode(MIDI_CH_ALL, bend, 2));
+    CHECK(test_logged("pitch_bend", 0x80001234, 2, 0));
+
+    uint32_t perNoteBend[] = { 0x40614000, 0x90000000 };
+    CHECK(test_decode(MIDI_CH_ALL, perNoteBend, 2));
+    CHECK(test_logged("per_note_bend", 0x40, 0x90000000, 0));
+
+    // RPN 0/0 is the bend range, 12 half notes in the top 7 bits
+    uint32_t rpnRange[] = { 0x40210000, 12u << 25 };
+    CHECK(test_decode(MIDI_CH_ALL, rpnRange, 2));
+    CHECK(test_logged("bend_range", 12, 0, 0));
+
+    uint32_t rpn[] = { 0x40210102, 0x12345678 };
+    CHECK(test_decode(MIDI_CH_ALL, rpn, 2));
+    CHECK(test_logged("cc_route", CC_ROUTE_TYPE_RPN, 0x0082, 0x12345678));
+
+    uint32_t nrpn[] = { 0x40310101, 0xABCDEF01 };
+    CHECK(test_decode(MIDI_CH_ALL, nrpn, 2));
+    CHECK(test_logged("cc_route", CC_ROUTE_TYPE_NRPN, 0x0081, 0xABCDEF01));
+
+    // A routed controller keeps 32 bits, the others go on as 7 bit CCs
+    uint32_t ccRouted[] = { 0x40B10100, 0xFFFFFFFF };
+    CHECK(test_decode(MIDI_CH_ALL, ccRouted, 2));
+    CHECK(test_logged("cc_route", CC_ROUTE_TYPE_CC7, 1, 0xFFFFFFFF));
+
+    uint32_t cc[] = { 0x40B10700, 0x80000000 };
+    CHECK(test_decode(MIDI_CH_ALL, cc, 2));
+    CHECK(gLog.calls == 2 && strcmp(gLog.pName, "midi1") == 0 && gLog.a == 0xB1 &&
+        gLog.b == 0x07 && gLog.c == 0x40);
+
+    // Controllers 120 - 127 are channel mode messages, never routed
+    uint32_t ccMode[] = { 0x40B17800, 0x00000000 };
+    CHECK(test_decode(MIDI_CH_ALL, ccMode, 2));
+    CHECK(test_logged("midi1", 0xB1, 0x78, 0));
+
+    uint32_t polyPressure[] = { 0x40A13C00, 0x12345678 };
+    CHECK(test_decode(MIDI_CH_ALL, polyPressure, 2));
+    CHECK(test_logged("poly_pressure", 0x3C, 0x1234, 0));
+
+    uint32_t chPressure[] = { 0x40D10000, 0xFEDCBA98 };
+    CHECK(test_decode(MIDI_CH_ALL, chPressure, 2));
+    CHECK(test_logged("cv_out", CV_OUT_AFTERTOUCH, 0xFEDC, 0));
+
+    uint32_t program[] = { 0x40C10000, 0x05000000 };
+    CHECK(test_decode(MIDI_CH_ALL, program, 2));
+    CHECK(test_logged("midi1", 0xC1, 0x05, 0));
+
+    // Per-note management is not supported
+    uint32_t ignoredBefore = gUmpIgnored;
+    uint32_t management[] = { 0x40F13C00, 0x00000000 };
+    CHECK(test_decode(MIDI_CH_ALL, management, 2));
+    CHECK(gLog.calls == 0);
+    CHECK(gUmpIgnored == ignoredBefore + 1);
+}
+
+static void test_channel_filter() {
+    uint32_t noteOn[] = { 0x40953C00, 0x80000000 };
+
+    CHECK(test_decode(MIDI_CH_5, noteOn, 2));
+    CHECK(gLog.calls == 0);
+    CHECK(test_decode(MIDI_CH_6, noteOn, 2));
+    CHECK(test_logged("note_on", 0x3C, 0x3C << 9, 0x8000));
+}
+
+// MIDI 1.0 channel voice packets go through the MIDI 2.0 translation
+static void test_midi1_translation() {
+    uint32_t words[2];
+
+    CHECK(ump_from_midi1(3, 0x92, 0x40, 0x7F, words) == 2);
+    CHECK(words[0] == 0x43924000);
+    CHECK(words[1] == 0xFFFF0000);
+
+    // Note on with velocity 0 is a note off
+    CHECK(ump_from_midi1(0, 0x92, 0x40, 0x00, words) == 2);
+    CHECK(words[0] == 0x40824000);
+    CHECK(words[1] == 0);
+
+    CHECK(ump_from_midi1(0, 0xE0, 0x00, 0x40, words) == 2);
+    CHECK(words[1] == 0x80000000);
+    CHECK(ump_from_midi1(0, 0xE0, 0x7F, 0x7F, words) == 2);
+    CHECK(words[1] == 0xFFFFFFFF);
+    CHECK(ump_from_midi1(0, 0xB0, 0x07, 0x40, words) == 2);
+    CHECK(words[1] == 0x80000000);
+    CHECK(ump_from_midi1(0, 0xC0, 0x05, 0x00, words) == 2);
+    CHECK(words[1] == 0x05000000);
+    CHECK(ump_from_midi1(0, 0xF8, 0x00, 0x00, words) == 0);
+
+    // As MIDI 1.0 packets in the decoder
+    uint32_t noteOn = 0x20913C64;
+    CHECK(test_decode(MIDI_CH_ALL, &noteOn, 1));
+    CHECK(test_logged("note_on", 0x3C, 0x3C << 9, ump_scale_up(0x64, 7, 16)));
+
+    uint32_t noteOnZero = 0x20913C00;
+    CHECK(test_decode(MIDI_CH_ALL, &noteOnZero, 1));
+    CHECK(test_logged("note_off", 0x3C, 0, 0));
+
+    uint32_t bend = 0x20E17F7F;
+    CHECK(test_decode(MIDI_CH_ALL, &bend, 1));
+    CHECK(test_logged("pitch_bend", 0xFFFFFFFF, 2, 0));
+
+    uint32_t polyPressure = 0x20A13C40;
+    CHECK(test_decode(MIDI_CH_ALL, &polyPressure, 1));
+    CHECK(test_logged("poly_pressure", 0x3C, 0x8000, 0));
+
+    uint32_t chPressure = 0x20D17F00;
+    CHECK(test_decode(MIDI_CH_ALL, &chPressure, 1));
+    CHECK(test_logged("cv_out", CV_OUT_AFTERTOUCH, 0xFFFF, 0));
+
+    // The MIDI 1.0 ports
+    test_log_clear();
+    ump_midi1_voice(MIDI_PORT_UART0, 0xE3, 0x00, 0x40);
+    CHECK(test_logged("pitch_bend", 0x80000000, 2, 0));
+    test_log_clear();
+    ump_midi1_voice(MIDI_PORT_UART0, 0x83, 0x30, 0x40);
+    CHECK(test_logged("note_off", 0x30, 0, 0));
+}
+
+static void test_system_and_data() {
+    uint32_t clock = 0x10F80000;
+    CHECK(test_decode(MIDI_CH_ALL, &clock, 1));
+    CHECK(test_logged("sys", MIDI_PORT_USB, 0xF8, 0));
+
+    uint32_t songPos = 0x10F20102;
+    CHECK(test_decode(MIDI_CH_ALL, &songPos, 1));
+    CHECK(test_logged("midi1", 0xF2, 0x01, 0x02));
+
+    uint32_t noop = 0x00000000;
+    CHECK(test_decode(MIDI_CH_ALL, &noop, 1));
+    CHECK(gLog.calls == 0);
+
+    // A complete SysEx7 of 5 bytes in one packet
+    uint32_t sysex[] = { 0x30057D01, 0x02030400 };
+    CHECK(test_decode(MIDI_CH_ALL, sysex, 2));
+    CHECK(gLog.calls == 2 && strcmp(gLog.pName, "sysex_end") == 0 && gLog.b == 5);
+    CHECK(memcmp(gSysexBuf, "\x7D\x01\x02\x03\x04", 5) == 0);
+
+    // Start, continue and end over three packets
+    uint32_t sysexParts[] = {
+        0x30167D01, 0x02030405,
+        0x30260607, 0x08090A0B,
+        0x30310C00, 0x00000000,
+    };
+    CHECK(test_decode(MIDI_CH_ALL, sysexParts, 6));
+    CHECK(strcmp(gLog.pName, "sysex_end") == 0 && gLog.b == 13);
+    CHECK(gSysexBuf[0] == 0x7D && gSysexBuf[12] == 0x0C);
+}
+
+// Packets of several sizes in one buffer, a partial packet is left over
+static void test_stream() {
+    uint32_t words[] = {
+        0x20903C64, // MIDI 1.0 note on, 1 word
+        0x40E00000, 0x80000000, // MIDI 2.0 pitch bend, 2 words
+        0x50000000, 0, 0, 0, // Data 128, 4 words, not supported
+        0x10F80000, // Clock, 1 word
+        0x40903C00, // Half of a MIDI 2.0 note on
+    };
+    const int count = sizeof(words) / sizeof(words[0]);
+    uint32_t packetsBefore = gUmpPackets;
+    uint32_t ignoredBefore = gUmpIgnored;
+
+    test_log_clear();
+    CHECK(ump_decode(MIDI_PORT_USB, MIDI_CH_ALL, words, count) == count - 1);
+    CHECK(gLog.calls == 3);
+    CHECK(strcmp(gLog.pName, "sys") == 0);
+    CHECK(gUmpPackets == packetsBefore + 4);
+    CHECK(gUmpIgnored == ignoredBefore + 1);
+
+    test_log_clear();
+    CHECK(ump_decode(MIDI_PORT_USB, MIDI_CH_ALL, &words[count - 1], 1) == 0);
+    CHECK(gLog.calls == 0);
+    CHECK(ump_decode(MIDI_PORT_USB, MIDI_CH_ALL, words, 0) == 0);
+}
+
+int main() {
+    test_scaling();
+    test_words();
+    test_midi2_channel_voice();
+    test_channel_filter();
+    test_midi1_translation();
+    test_system_and_data();
+    test_stream();
+
+    printf("%s, %d of %d checks failed\n", gTestFailed ? "FAIL" : "PASS",
+        gTestFailed, gTestChecks);
+    return gTestFailed ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+/***********************************************
+/ mod_engine_bench.c : host benchmark of the modulation engine tick
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+// Builds mod_engine.c and cv_out.c on the host and times
+// mod_engine_update(), the work the modulation adds to every control
+// rate tick. Each case runs MOD_BENCH_TICKS ticks MOD_BENCH_RUNS times,
+// the fastest run counts. The time is in TSC cycles on x86-64 hosts and
+// in ns elsewhere, the RP2040 needs more cycles for the same code (no
+// 64 bit multiply), the host figure is for comparing changes.
+//
+// Build and run from midi_to_cv:
+//   gcc -std=c11 -O2 -I test/stubs -I . test/mod_engine_bench.c -o mod_engine_bench
+//   ./mod_engine_bench
+// The exit code is 0 when every case is within MOD_BENCH_BUDGET per tick.
+////////////////////////////////////////////////////////////////////////////////
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <time.h>
+#include "pico/stdlib.h"
+
+// Only the wake of mcp4725.h is used, the I2C parts are left out
+#define MCP4725_H
+void control_timers_wake();
+
+#include "mod_engine.c"
+#include "cv_out.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MOD_BENCH_UNIT "cycles"
+static inline uint64_t bench_now() {
+    return __rdtsc();
+}
+#else
+#define MOD_BENCH_UNIT "ns"
+static inline uint64_t bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+#define MOD_BENCH_TICKS 1000000
+#define MOD_BENCH_RUNS 7
+#define MOD_BENCH_BUDGET 300 // Per tick, all sources routed
+
+typedef struct {
+    const char *pName;
+    void (*setup)();
+} bench_case_t;
+
+uint64_t gSimNowUs = 0;
+static uint32_t gBenchWakes = 0;
+
+void control_timers_wake() {
+    gBenchWakes++;
+}
+
+static void bench_setup_idle() {
+    init_mod_engine();
+}
+
+// Both LFOs and the envelope on the pitch and CV outputs, the envelope
+// is restarted so it never rests
+static void bench_setup_all_sine() {
+    init_mod_engine();
+    SetLfoRate(0, 5000);
+    SetLfoRate(1, 330);
+    SetLfoDestination(0, MOD_DEST_PITCH, MOD_DEPTH_ONE / 4, 0);
+    SetLfoDestination(1, MOD_DEST_CV_OUT + 1, MOD_DEPTH_ONE / 2, 0x8000);
+    SetEnvelope(0, 50, 200, 0x8000, 300);
+    SetEnvDestination(0, MOD_DEST_CV_OUT + 3, MOD_DEPTH_ONE, 0);
+    mod_env_gate(true);
+}
+
+static void bench_setup_all_shapes() {
+    bench_setup_all_sine();
+    SetLfoWave(0, MOD_WAVE_TRIANGLE);
+    SetLfoWave(1, MOD_WAVE_SAW);
+}
+
+// The fastest run, per tick
+static double bench_run(const bench_case_t *pCase) {
+    uint64_t best = UINT64_MAX;
+
+    for (int r = 0; r < MOD_BENCH_RUNS; r++) {
+        pCase->setup();
+        uint64_t start = bench_now();
+        for (int t = 0; t < MOD_BENCH_TICKS; t++) {
+            mod_engine_update();
+            if ((t & 1023) == 0) {
+                // Keep the envelope moving, as with played notes
+                mod_env_gate((t & 2048) == 0);
+            }
+        }
+        uint64_t elapsed = bench_now() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    return (double)best / MOD_BENCH_TICKS;
+}
+
+int main() {
+    static const bench_case_t cases[] = {
+        { "nothing routed", bench_setup_idle },
+        { "2 sine LFOs + envelope", bench_setup_all_sine },
+        { "tri/saw LFOs + envelope", bench_setup_all_shapes },
+    };
+    const int noOfCases = sizeof(cases) / sizeof(cases[0]);
+    int failed = 0;
+
+    printf("%d LFOs, %d envelopes, %d ticks x %d runs\n", MOD_NO_OF_LFOS,
+        MOD_NO_OF_ENVS, MOD_BENCH_TICKS, MOD_BENCH_RUNS);
+    for (int i = 0; i < noOfCases; i++) {
+        double perTick = bench_run(&cases[i]);
+        printf("%-26s %7.1f %s/tick\n", cases[i].pName, perTick, MOD_BENCH_UNIT);
+        if (perTick > MOD_BENCH_BUDGET) {
+            failed++;
+        }
+    }
+
+    printf("%s, %d of %d cases over %d %s/tick (pitch %ld, cv %u %u)\n",
+        failed ? "FAIL" : "PASS", failed, noOfCases, MOD_BENCH_BUDGET, MOD_BENCH_UNIT,
+        (long)gModPitch, gCvOut[1], gCvOut[3]);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,16 @@
+// Host stub of the Pico SDK for drift_comp_sim.c
+#pragma once
+#include "pico/stdlib.h"
+
+typedef struct {
+    volatile uint32_t fifo;
+} adc_hw_t;
+extern adc_hw_t *adc_hw;
+
+void adc_init();
+void adc_gpio_init(uint gpio);
+void adc_select_input(uint input);
+void adc_fifo_setup(bool en, bool dreqEn, uint16_t dreqThresh, bool errInFifo, bool byteShift);
+void adc_set_clkdiv(float clkdiv);
+void adc_run(bool run);
+void adc_fifo_drain();
@@ -0,0 +1,10 @@
+// Host stub of the Pico SDK for drift_comp_sim.c
+#pragma once
+#include "pico/stdlib.h"
+
+static inline uint32_t save_and_disable_interrupts() {
+    return 0;
+}
+static inline void restore_interrupts(uint32_t status) {
+    (void)status;
+}
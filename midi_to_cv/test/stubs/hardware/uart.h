@@ -0,0 +1,3 @@
+// Host stub of the Pico SDK, main.h only includes it
+#pragma once
+#include "pico/stdlib.h"
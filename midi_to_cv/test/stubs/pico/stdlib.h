@@ -0,0 +1,12 @@
+// Host stub of the Pico SDK for the host builds in test/
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef unsigned int uint;
+
+extern uint64_t gSimNowUs;
+static inline uint64_t time_us_64() {
+    return gSimNowUs;
+}
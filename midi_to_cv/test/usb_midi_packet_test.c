@@ -0,0 +1,252 @@
+/***********************************************
+/ usb_midi_packet_test.c : host test of the USB-MIDI event packet parser
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+////////////////////////////////////////////////////////////////////////////////
+// Feeds hand made USB-MIDI event packets to usb_midi_parse_packets() and
+// checks the decoded events and the error count: the size of every CIN,
+// SysEx start, continue and end, the cable numbers, reserved packets,
+// padding, channel messages with the wrong status and short transfers.
+// SysEx messages encoded by usb_midi_sysex_packets() are parsed back.
+//
+// Build and run from midi_to_cv:
+//   gcc -std=c11 -O2 -I . test/usb_midi_packet_test.c -o usb_midi_packet_test
+//   ./usb_midi_packet_test
+// The exit code is 0 when every check passes.
+////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+#include "usb_midi_packet.c"
+
+#define TEST_MAX_EVENTS 32
+
+static int gTestChecks = 0;
+static int gTestFailed = 0;
+
+#define CHECK(cond) test_check((cond), #cond, __LINE__)
+
+static inline void test_check(bool isOk, const char *pText, int line) {
+    gTestChecks++;
+    if (!isOk) {
+        gTestFailed++;
+        printf("FAIL line %d: %s\n", line, pText);
+    }
+}
+
+static inline bool test_event_is(const usb_midi_event_t *e, uint8_t cable, uint8_t cin,
+    uint8_t size, uint8_t b0, uint8_t b1, uint8_t b2) {
+    return e->cable == cable && e->cin == cin && e->size == size &&
+        e->msg[0] == b0 && e->msg[1] == b1 && e->msg[2] == b2;
+}
+
+// One packet of every CIN, the bytes past the CIN size must read as 0
+static void test_cin_sizes() {
+    static const uint8_t buf[] = {
+        0x02, 0xF3, 0x05, 0x7F, // Song select, 2 bytes
+        0x03, 0xF2, 0x10, 0x20, // Song position, 3 bytes
+        0x04, 0xF0, 0x7E, 0x7F, // SysEx start
+        0x05, 0xF6, 0x7F, 0x7F, // Tune request, 1 byte common
+        0x06, 0x01, 0xF7, 0x7F, // SysEx ends with 2 bytes
+        0x07, 0x01, 0x02, 0xF7, // SysEx ends with 3 bytes
+        0x08, 0x80, 0x3C, 0x40, // Note off
+        0x09, 0x91, 0x3C, 0x64, // Note on
+        0x0A, 0xA2, 0x3C, 0x10, // Poly key pressure
+        0x0B, 0xB3, 0x01, 0x7F, // Control change
+        0x0C, 0xC4, 0x05, 0x7F, // Program change, 2 bytes
+        0x0D, 0xD5, 0x40, 0x7F, // Channel pressure, 2 bytes
+        0x0E, 0xEF, 0x00, 0x40, // Pitch bend
+        0x0F, 0xF8, 0x7F, 0x7F, // Single byte, clock
+    };
+    usb_midi_event_t ev[TEST_MAX_EVENTS];
+    uint32_t errors = 0;
+
+    int n = usb_midi_parse_packets(buf, sizeof(buf), ev, TEST_MAX_EVENTS, &errors);
+    CHECK(n == 14);
+    CHECK(errors == 0);
+    CHECK(test_event_is(&ev[0], 0, USB_MIDI_CIN_SYSCOM_2, 2, 0xF3, 0x05, 0));
+    CHECK(test_event_is(&ev[1], 0, USB_MIDI_CIN_SYSCOM_3, 3, 0xF2, 0x10, 0x20));
+    CHECK(test_event_is(&ev[2], 0, USB_MIDI_CIN_SYSEX_START, 3, 0xF0, 0x7E, 0x7F));
+    CHECK(test_event_is(&ev[3], 0, USB_MIDI_CIN_SYSEX_END_1, 1, 0xF6, 0, 0));
+    CHECK(test_event_is(&ev[4], 0, USB_MIDI_CIN_SYSEX_END_2, 2, 0x01, 0xF7, 0));
+    CHECK(test_event_is(&ev[5], 0, USB_MIDI_CIN_SYSEX_END_3, 3, 0x01, 0x02, 0xF7));
+    CHECK(test_event_is(&ev[6], 0, USB_MIDI_CIN_NOTE_OFF, 3, 0x80, 0x3C, 0x40));
+    CHECK(test_event_is(&ev[7], 0, USB_MIDI_CIN_NOTE_ON, 3, 0x91, 0x3C, 0x64));
+    CHECK(test_event_is(&ev[8], 0, USB_MIDI_CIN_POLY_KEYPRESS, 3, 0xA2, 0x3C, 0x10));
+    CHECK(test_event_is(&ev[9], 0, USB_MIDI_CIN_CONTROL_CHANGE, 3, 0xB3, 0x01, 0x7F));
+    CHECK(test_event_is(&ev[10], 0, USB_MIDI_CIN_PROGRAM_CHANGE, 2, 0xC4, 0x05, 0));
+    CHECK(test_event_is(&ev[11], 0, USB_MIDI_CIN_CHANNEL_PRESSURE, 2, 0xD5, 0x40, 0));
+    CHECK(test_event_is(&ev[12], 0, USB_MIDI_CIN_PITCH_BEND, 3, 0xEF, 0x00, 0x40));
+    CHECK(test_event_is(&ev[13], 0, USB_MIDI_CIN_SINGLE_BYTE, 1, 0xF8, 0, 0));
+
+    // Only the SysEx fragments, not the one byte common in CIN 5
+    CHECK(!usb_midi_is_sysex(&ev[0]));
+    CHECK(!usb_midi_is_sysex(&ev[1]));
+    CHECK(usb_midi_is_sysex(&ev[2]));
+    CHECK(!usb_midi_is_sysex(&ev[3]));
+    CHECK(usb_midi_is_sysex(&ev[4]));
+    CHECK(usb_midi_is_sysex(&ev[5]));
+    CHECK(!usb_midi_is_sysex(&ev[7]));
+    CHECK(!usb_midi_is_sysex(&ev[13]));
+}
+
+// A SysEx over several packets, ended by 1, 2 and 3 byte end packets
+static void test_sysex() {
+    static const uint8_t buf[] = {
+        0x04, 0xF0, 0x7D, 0x01, // Start
+        0x04, 0x02, 0x03, 0x04, // Continue
+        0x05, 0xF7, 0x00, 0x00, // Ends with a lone F7
+        0x04, 0xF0, 0x7D, 0x05,
+        0x06, 0x06, 0xF7, 0x00, // Ends with 2 bytes
+        0x04, 0xF0, 0x7D, 0x07,
+        0x04, 0x08, 0x09, 0x0A,
+        0x07, 0x0B, 0x0C, 0xF7, // Ends with 3 bytes
+        0x06, 0xF0, 0xF7, 0x00, // Empty SysEx in one packet
+        0x07, 0xF0, 0x7D, 0xF7, // Short SysEx in one packet
+    };
+    usb_midi_event_t ev[TEST_MAX_EVENTS];
+    uint32_t errors = 0;
+
+    int n = usb_midi_parse_packets(buf, sizeof(buf), ev, TEST_MAX_EVENTS, &errors);
+    CHECK(n == 10);
+    CHECK(errors == 0);
+    for (int i = 0; i < n; i++) {
+        CHECK(usb_midi_is_sysex(&ev[i]));
+    }
+    CHECK(test_event_is(&ev[1], 0, USB_MIDI_CIN_SYSEX_START, 3, 0x02, 0x03, 0x04));
+    CHECK(test_event_is(&ev[2], 0, USB_MIDI_CIN_SYSEX_END_1, 1, 0xF7, 0, 0));
+    CHECK(test_event_is(&ev[4], 0, USB_MIDI_CIN_SYSEX_END_2, 2, 0x06, 0xF7, 0));
+    CHECK(test_event_is(&ev[7], 0, USB_MIDI_CIN_SYSEX_END_3, 3, 0x0B, 0x0C, 0xF7));
+    CHECK(test_event_is(&ev[8], 0, USB_MIDI_CIN_SYSEX_END_2, 2, 0xF0, 0xF7, 0));
+    CHECK(test_event_is(&ev[9], 0, USB_MIDI_CIN_SYSEX_END_3, 3, 0xF0, 0x7D, 0xF7));
+}
+
+// The cable number is the high nibble, every cable is passed on
+static void test_cables() {
+    uint8_t buf[16 * USB_MIDI_PACKET_SIZE];
+    usb_midi_event_t ev[TEST_MAX_EVENTS];
+    uint32_t errors = 0;
+
+    for (int c = 0; c < 16; c++) {
+        buf[c * 4 + 0] = (uint8_t)(c << 4) | USB_MIDI_CIN_NOTE_ON;
+        buf[c * 4 + 1] = 0x90 | (uint8_t)c;
+        buf[c * 4 + 2] = (uint8_t)(0x30 + c);
+        buf[c * 4 + 3] = 0x7F;
+    }
+
+    int n = usb_midi_parse_packets(buf, sizeof(buf), ev, TEST_MAX_EVENTS, &errors);
+    CHECK(n == 16);
+    CHECK(errors == 0);
+    for (int c = 0; c < n; c++) {
+        CHECK(test_event_is(&ev[c], (uint8_t)c, USB_MIDI_CIN_NOTE_ON, 3,
+            0x90 | (uint8_t)c, (uint8_t)(0x30 + c), 0x7F));
+    }
+}
+
+// Reserved CINs and channel messages with the wrong status are skipped
+// and counted, zero padding is skipped without an error
+static void test_reserved_and_malformed() {
+    static const uint8_t buf[] = {
+        0x00, 0x00, 0x00, 0x00, // Padding
+        0x00, 0x90, 0x3C, 0x40, // CIN 0, reserved misc
+        0x11, 0x90, 0x3C, 0x40, // CIN 1, reserved cable event
+        0x09, 0x80, 0x3C, 0x40, // Note on CIN with a note off status
+        0x0B, 0x3C, 0x40, 0x00, // Control change CIN with a data byte
+        0x0E, 0xF8, 0x00, 0x40, // Pitch bend CIN with a real-time status
+        0x29, 0x92, 0x40, 0x7F, // Valid note on, cable 2
+        0x00, 0x00, 0x00, 0x00, // Padding at the end of the transfer
+    };
+    usb_midi_event_t ev[TEST_MAX_EVENTS];
+    uint32_t errors = 0;
+
+    int n = usb_midi_parse_packets(buf, sizeof(buf), ev, TEST_MAX_EVENTS, &errors);
+    CHECK(n == 1);
+    CHECK(errors == 5);
+    CHECK(test_event_is(&ev[0], 2, USB_MIDI_CIN_NOTE_ON, 3, 0x92, 0x40, 0x7F));
+
+    // The error count adds up over calls, NULL is accepted
+    n = usb_midi_parse_packets(buf, sizeof(buf), ev, TEST_MAX_EVENTS, &errors);
+    CHECK(n == 1);
+    CHECK(errors == 10);
+    n = usb_midi_parse_packets(buf, sizeof(buf), ev, TEST_MAX_EVENTS, NULL);
+    CHECK(n == 1);
+}
+
+// A partial packet at the end is ignored, and no more than maxEvents
+// events are written
+static void test_lengths() {
+    static const uint8_t buf[] = {
+        0x09, 0x90, 0x3C, 0x40,
+        0x08, 0x80, 0x3C, 0x00,
+        0x0F, 0xFA, 0x00, 0x00,
+        0x09, 0x90, 0x3E, // Short
+    };
+    usb_midi_event_t ev[TEST_MAX_EVENTS];
+    uint32_t errors = 0;
+
+    memset(ev, 0xAA, sizeof(ev));
+    CHECK(usb_midi_parse_packets(buf, 0, ev, TEST_MAX_EVENTS, &errors) == 0);
+    CHECK(usb_midi_parse_packets(buf, 3, ev, TEST_MAX_EVENTS, &errors) == 0);
+    CHECK(usb_midi_parse_packets(buf, sizeof(buf), ev, TEST_MAX_EVENTS, &errors) == 3);
+    CHECK(errors == 0);
+
+    memset(ev, 0xAA, sizeof(ev));
+    CHECK(usb_midi_parse_packets(buf, sizeof(buf), ev, 2, &errors) == 2);
+    CHECK(test_event_is(&ev[1], 0, USB_MIDI_CIN_NOTE_OFF, 3, 0x80, 0x3C, 0x00));
+    CHECK(ev[2].cable == 0xAA);
+    CHECK(usb_midi_parse_packets(buf, sizeof(buf), ev, 0, &errors) == 0);
+}
+
+// Every length from F0 F7 up, the message must come back from the parser
+// in order with the right CINs
+static void test_sysex_packets() {
+    uint8_t msg[16];
+    uint8_t buf[USB_MIDI_SYSEX_PACKETS(sizeof(msg)) * USB_MIDI_PACKET_SIZE];
+    usb_midi_event_t ev[TEST_MAX_EVENTS];
+
+    for (int len = 2; len <= (int)sizeof(msg); len++) {
+        msg[0] = 0xF0;
+        for (int i = 1; i < len - 1; i++) {
+            msg[i] = (uint8_t)(i * 7);
+        }
+        msg[len - 1] = 0xF7;
+
+        int n = usb_midi_sysex_packets(msg, len, 2, buf);
+        CHECK(n == USB_MIDI_SYSEX_PACKETS(len) * USB_MIDI_PACKET_SIZE);
+
+        uint32_t errors = 0;
+        int noOfEvents = usb_midi_parse_packets(buf, n, ev, TEST_MAX_EVENTS, &errors);
+        CHECK(noOfEvents == USB_MIDI_SYSEX_PACKETS(len));
+        CHECK(errors == 0);
+
+        uint8_t back[sizeof(msg)];
+        int backLen = 0;
+        bool isOk = true;
+        for (int e = 0; e < noOfEvents; e++) {
+            bool isLast = e == noOfEvents - 1;
+            isOk = isOk && ev[e].cable == 2 && usb_midi_is_sysex(&ev[e]) &&
+                (ev[e].cin == USB_MIDI_CIN_SYSEX_START) != isLast;
+            for (int k = 0; k < ev[e].size; k++) {
+                back[backLen++] = ev[e].msg[k];
+            }
+        }
+        CHECK(isOk);
+        CHECK(backLen == len && memcmp(back, msg, len) == 0);
+    }
+}
+
+int main() {
+    test_cin_sizes();
+    test_sysex();
+    test_cables();
+    test_reserved_and_malformed();
+    test_lengths();
+    test_sysex_packets();
+
+    printf("%s, %d of %d checks failed\n", gTestFailed ? "FAIL" : "PASS",
+        gTestFailed, gTestChecks);
+    return gTestFailed ? 1 : 0;
+}
@@ -0,0 +1,169 @@
+/***********************************************
+/ tuning.c : implementation file for the tuning table and scale quantizer functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "tuning.h"
+#include "mcp4725.h"
+#include "midi_uart.h"
+
+// Global char initiation
+int32_t gTuningTable[TUNING_NO_OF_NOTES + 1]; // Q16 half notes, one guard entry
+uint8_t gScaleNote[TUNING_NO_OF_NOTES]; // Nearest allowed note
+uint16_t gScaleMask = TUNING_SCALE_CHROMATIC;
+int gScaleRoot = 0;
+
+void init_tuning() {
+    for (int n = 0; n <= TUNING_NO_OF_NOTES; n++) {
+        gTuningTable[n] = n << 16;
+    }
+    SetScale(TUNING_SCALE_CHROMATIC, 0);
+}
+
+static inline bool tuning_note_in_scale(int note) {
+    int degree = (note - gScaleRoot + 120) % 12;
+    return (gScaleMask >> degree) & 1;
+}
+
+// The mask is relative to the root, bit 0 is the root
+void SetScale(uint16_t mask, int root) {
+    mask &= TUNING_SCALE_CHROMATIC;
+    if (mask == 0 || root < 0 || root > 11) {
+        return;
+    }
+
+    gScaleMask = mask;
+    gScaleRoot = root;
+
+    // Nearest allowed note, the lower note wins a tie
+    for (int n = 0; n < TUNING_NO_OF_NOTES; n++) {
+        int nearest = n;
+        for (int d = 0; d <= 6; d++) {
+            if (n - d >= 0 && tuning_note_in_scale(n - d)) {
+                nearest = n - d;
+                break;
+            }
+            if (n + d < TUNING_NO_OF_NOTES && tuning_note_in_scale(n + d)) {
+                nearest = n + d;
+                break;
+            }
+        }
+        gScaleNote[n] = (uint8_t)nearest;
+    }
+    control_timers_wake();
+}
+
+int32_t tuning_map_pitch(int32_t pitch) {
+    if (pitch < 0) {
+        pitch = 0;
+    }
+    else if (pitch > (127 << 16)) {
+        pitch = 127 << 16;
+    }
+
+    if (gScaleMask != TUNING_SCALE_CHROMATIC) {
+        return gTuningTable[gScaleNote[(pitch + 0x8000) >> 16]];
+    }
+
+    // Linear interpolation between the tuned notes
+    int index = pitch >> 16;
+    int32_t frac = pitch & 0xFFFF;
+    int32_t a = gTuningTable[index];
+    int32_t b = gTuningTable[index + 1];
+    return a + (int32_t)(((int64_t)(b - a) * frac) >> 16);
+}
+
+// MTS frequency data: half note and 14 bit fraction (100/16384 cents)
+static inline void tuning_set_note(uint8_t note, const uint8_t *freq) {
+    uint32_t data = ((uint32_t)freq[0] << 16) | ((uint32_t)freq[1] << 8) | freq[2];
+    if (note >= TUNING_NO_OF_NOTES || data == MTS_NO_CHANGE) {
+        return;
+    }
+
+    uint32_t fraction = ((uint32_t)(freq[1] & 0x7F) << 7) | (freq[2] & 0x7F);
+    gTuningTable[note] = ((int32_t)(freq[0] & 0x7F) << 16) | (int32_t)(fraction << 2);
+    if (note == TUNING_NO_OF_NOTES - 1) {
+        gTuningTable[TUNING_NO_OF_NOTES] = gTuningTable[note] + (1 << 16);
+    }
+}
+
+// The channel mask of the scale/octave messages, bits 0 - 1 of the first
+// byte are channels 15 - 16, the last byte holds channels 1 - 7
+static inline bool tuning_mts_channel_in_mask(const uint8_t *mask, int midiCh) {
+    uint32_t bits = ((uint32_t)(mask[0] & 0x03) << 14) |
+        ((uint32_t)(mask[1] & 0x7F) << 7) | (mask[2] & 0x7F);
+
+    if (midiCh >= MIDI_CH_ALL) {
+        return bits != 0;
+    }
+    return (bits >> midiCh) & 1;
+}
+
+// XOR of the bytes from the universal ID up to the checksum
+static inline bool tuning_mts_checksum_ok(const uint8_t *data, int len) {
+    uint8_t sum = 0;
+
+    for (int i = 0; i < len - 1; i++) {
+        sum ^= data[i];
+    }
+    return (sum & 0x7F) == data[len - 1];
+}
+
+bool tuning_mts_sysex(const uint8_t *data, int len, int midiCh) {
+    // Universal ID, device ID, sub-ID#1, sub-ID#2
+    if (len < 4 || data[2] != MTS_SUB_ID_1) {
+        return false;
+    }
+    if (data[0] != SYSEX_NON_REAL_TIME && data[0] != SYSEX_REAL_TIME) {
+        return false;
+    }
+    if (data[1] != MTS_DEVICE_ID_ALL && midiCh < MIDI_CH_ALL && data[1] != midiCh) {
+        return false;
+    }
+
+    switch (data[3]) {
+    case MTS_BULK_DUMP:
+        // Program, 16 bytes name, 128 x 3 bytes, checksum
+        if (data[0] != SYSEX_NON_REAL_TIME || len < MTS_BULK_DUMP_LEN ||
+            !tuning_mts_checksum_ok(data, MTS_BULK_DUMP_LEN)) {
+            return false;
+        }
+        for (int n = 0; n < TUNING_NO_OF_NOTES; n++) {
+            tuning_set_note(n, &data[4 + 1 + 16 + 3 * n]);
+        }
+        control_timers_wake();
+        return true;
+    case MTS_NOTE_CHANGE:
+        // Program, count, count x (note, 3 bytes)
+        {
+            if (data[0] != SYSEX_REAL_TIME || len < 6) {
+                return false;
+            }
+            int count = data[5];
+            if (len < 6 + 4 * count) {
+                return false;
+            }
+            for (int i = 0; i < count; i++) {
+                const uint8_t *p = &data[6 + 4 * i];
+                tuning_set_note(p[0], &p[1]);
+            }
+        }
+        control_timers_wake();
+        return true;
+    case MTS_SCALE_OCTAVE_1:
+        // 3 bytes channel mask, 12 bytes offset in cents, 0x40 is 0 cents
+        if (len < 4 + 3 + 12 || !tuning_mts_channel_in_mask(&data[4], midiCh)) {
+            return false;
+        }
+        for (int n = 0; n < TUNING_NO_OF_NOTES; n++) {
+            int32_t cents = (int32_t)(data[4 + 3 + n % 12] & 0x7F) - 0x40;
+            gTuningTable[n] = (n << 16) + cents * 65536 / 100;
+        }
+        gTuningTable[TUNING_NO_OF_NOTES] = gTuningTable[TUNING_NO_OF_NOTES - 1] + (1 << 16);
+        control_timers_wake();
+        return true;
+    }
+
+    return false;
+}
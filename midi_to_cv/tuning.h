@@ -0,0 +1,61 @@
+/***********************************************
+/ tuning.h : header file for the tuning table and scale quantizer functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef TUNING_H
+#define TUNING_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The tuning.h is based on: 
+// MIDI Tuning Standard, MIDI 1.0 Detailed Specification 4.2, CA-020/CA-021
+//
+// Pitches are Q16 half notes (note number << 16). The tuning table holds
+// the tuned pitch of every MIDI note, 12-TET is note << 16. A pitch with
+// a fraction (glide and bend) is interpolated between two entries.
+//
+// The scale quantizer snaps the pitch to the nearest note of a 12 bit
+// scale mask. gScaleNote[] holds the nearest allowed note of every note
+// and is rebuilt when the scale changes, so quantizing is one lookup.
+////////////////////////////////////////////////////////////////////////////////
+
+#define TUNING_NO_OF_NOTES 128
+#define TUNING_SCALE_CHROMATIC 0x0FFF // All 12 pitch classes, no quantizing
+#define TUNING_SCALE_MAJOR 0x0AB5 // C D E F G A B, bit 0 is the root
+#define TUNING_SCALE_MINOR 0x05AD // C D Eb F G Ab Bb
+
+// MTS sub-IDs, the first two bytes after the universal SysEx ID
+#define MTS_SUB_ID_1 0x08
+#define MTS_BULK_DUMP 0x01 // Non-real time
+#define MTS_NOTE_CHANGE 0x02 // Real time
+#define MTS_SCALE_OCTAVE_1 0x08 // 1 byte scale/octave tuning
+#define MTS_NO_CHANGE 0x7F7F7F // Frequency data that leaves the note as is
+#define MTS_DEVICE_ID_ALL 0x7F
+#define MTS_BULK_DUMP_LEN (4 + 1 + 16 + 3 * 128 + 1) // Up to the checksum
+
+#define SYSEX_NON_REAL_TIME 0x7E
+#define SYSEX_REAL_TIME 0x7F
+
+// Global char extern declaration
+extern int32_t gTuningTable[TUNING_NO_OF_NOTES + 1]; // Q16 half notes, one guard entry
+extern uint8_t gScaleNote[TUNING_NO_OF_NOTES]; // Nearest allowed note
+extern uint16_t gScaleMask;
+extern int gScaleRoot;
+
+void init_tuning();
+void SetScale(uint16_t mask, int root);
+
+// Tuned and quantized pitch, pitch and result are Q16 half notes
+int32_t tuning_map_pitch(int32_t pitch);
+
+// MTS message without F0 and F7 from a port receiving on midiCh, returns
+// true if it was a tuning message for this device. The device ID is the
+// receive channel, 0x7F addresses every device and a port in omni
+// (MIDI_CH_ALL) takes every device ID and channel mask. A bulk dump with
+// a wrong checksum is ignored.
+bool tuning_mts_sysex(const uint8_t *data, int len, int midiCh);
+
+#endif // TUNING_H
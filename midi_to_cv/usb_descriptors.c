@@ -0,0 +1,137 @@
+/***********************************************
+/ usb_descriptors.c : USB descriptors for the CDC and MIDI composite device
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <string.h>
+#include "tusb.h"
+#include "pico/unique_id.h"
+
+#define USB_VID 0x2E8A // Raspberry Pi
+#define USB_PID 0x10C8 // MIDI-2-CV, CDC + MIDI + CDC
+#define USB_BCD 0x0200
+
+enum {
+    ITF_NUM_CDC = 0,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_MIDI,
+    ITF_NUM_MIDI_STREAMING,
+    ITF_NUM_CDC_CTRL, // Binary control protocol, see ctrl_proto.h
+    ITF_NUM_CDC_CTRL_DATA,
+    ITF_NUM_TOTAL
+};
+
+#define EPNUM_CDC_NOTIF 0x81
+#define EPNUM_CDC_OUT 0x02
+#define EPNUM_CDC_IN 0x82
+#define EPNUM_MIDI_OUT 0x03
+#define EPNUM_MIDI_IN 0x83
+#define EPNUM_CDC_CTRL_NOTIF 0x84
+#define EPNUM_CDC_CTRL_OUT 0x05
+#define EPNUM_CDC_CTRL_IN 0x85
+
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + 2 * TUD_CDC_DESC_LEN + TUD_MIDI_DESC_LEN)
+
+enum {
+    STRID_LANGID = 0,
+    STRID_MANUFACTURER,
+    STRID_PRODUCT,
+    STRID_SERIAL,
+    STRID_CDC,
+    STRID_MIDI,
+    STRID_CDC_CTRL,
+};
+
+tusb_desc_device_t const gDescDevice = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = USB_BCD,
+
+    // Use Interface Association Descriptor (IAD) for CDC
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+
+    .idVendor = USB_VID,
+    .idProduct = USB_PID,
+    .bcdDevice = 0x0101, // The interfaces changed
+
+    .iManufacturer = STRID_MANUFACTURER,
+    .iProduct = STRID_PRODUCT,
+    .iSerialNumber = STRID_SERIAL,
+
+    .bNumConfigurations = 1
+};
+
+uint8_t const gDescConfiguration[] = {
+    // Config number, interface count, string index, total length, attribute, power in mA
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
+
+    // Interface number, string index, EP notification address and size, EP data address (out, in) and size
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, STRID_CDC, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
+
+    // Interface number, string index, EP Out & EP In address, EP size
+    TUD_MIDI_DESCRIPTOR(ITF_NUM_MIDI, STRID_MIDI, EPNUM_MIDI_OUT, EPNUM_MIDI_IN, 64),
+
+    // The control protocol CDC is last, the stdio and MIDI interfaces keep their numbers
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC_CTRL, STRID_CDC_CTRL, EPNUM_CDC_CTRL_NOTIF, 8, EPNUM_CDC_CTRL_OUT, EPNUM_CDC_CTRL_IN, 64),
+};
+
+char const *gDescStrings[] = {
+    (const char[]) { 0x09, 0x04 }, // 0: English (0x0409)
+    "PunkSynth", // 1: Manufacturer
+    "MIDI-2-CV", // 2: Product
+    NULL, // 3: Serial, the flash unique id
+    "MIDI-2-CV stdio", // 4: CDC interface
+    "MIDI-2-CV MIDI", // 5: MIDI interface
+    "MIDI-2-CV control", // 6: Control protocol CDC interface
+};
+
+uint8_t const *tud_descriptor_device_cb(void) {
+    return (uint8_t const *)&gDescDevice;
+}
+
+uint8_t const *tud_descriptor_configuration_cb(uint8_t index) {
+    (void)index;
+    return gDescConfiguration;
+}
+
+uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    static uint16_t descStr[32];
+    static char serialStr[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    (void)langid;
+
+    uint8_t count = 0;
+
+    if (index == STRID_LANGID) {
+        memcpy(&descStr[1], gDescStrings[0], 2);
+        count = 1;
+    }
+    else {
+        if (index >= sizeof(gDescStrings) / sizeof(gDescStrings[0])) {
+            return NULL;
+        }
+
+        const char *str = gDescStrings[index];
+        if (index == STRID_SERIAL) {
+            pico_get_unique_board_id_string(serialStr, sizeof(serialStr));
+            str = serialStr;
+        }
+
+        // Convert the ASCII string into UTF-16
+        count = (uint8_t)strlen(str);
+        if (count > 31) {
+            count = 31;
+        }
+        for (uint8_t i = 0; i < count; i++) {
+            descStr[1 + i] = str[i];
+        }
+    }
+
+    // First byte is the length (including header), second byte is the string type
+    descStr[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 * count + 2));
+
+    return descStr;
+}
@@ -0,0 +1,103 @@
+/***********************************************
+/ usb_midi.c : implementation file for the USB MIDI device functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "midi_uart.h"
+#include "midi_thru.h"
+#include "usb_midi.h"
+#include "usb_midi_packet.h"
+#include "sysex.h"
+#include "event_sched.h"
+#include "hardware/sync.h"
+#include "tusb.h"
+
+// Global char initiation
+uint32_t gUsbMidiPackets = 0; // Decoded event packets
+uint32_t gUsbMidiErrors = 0; // Reserved or malformed packets
+
+void init_usb_midi() {
+    tusb_init();
+}
+
+static inline void usb_midi_dispatch(const usb_midi_event_t *pEvent, uint64_t timeUs) {
+    // The thru/merge output gets the bytes as if they came from a DIN
+    for (int i = 0; i < pEvent->size; i++) {
+        midi_thru_byte(MIDI_PORT_USB, pEvent->msg[i]);
+    }
+
+    if (usb_midi_is_sysex(pEvent)) {
+        // The payload is streamed to sysex.c, as for the UARTs
+        for (int i = 0; i < pEvent->size; i++) {
+            uint8_t val = pEvent->msg[i];
+            if (val == 0xF0) {
+                sysex_abort(MIDI_PORT_USB);
+                sysex_start(MIDI_PORT_USB);
+            }
+            else if (val == 0xF7) {
+                sysex_end(MIDI_PORT_USB);
+            }
+            else {
+                sysex_byte(MIDI_PORT_USB, val);
+            }
+        }
+        return;
+    }
+
+    // Real time bytes interleave a SysEx, any other status ends it, as
+    // for the UARTs
+    if (pEvent->msg[0] < 0xF8 && sysex_is_active(MIDI_PORT_USB)) {
+        sysex_abort(MIDI_PORT_USB);
+    }
+
+    if (pEvent->size == 1 && pEvent->msg[0] >= 0xF6) {
+        midi_dispatch_sys(MIDI_PORT_USB, pEvent->msg[0]);
+    }
+    else {
+        event_sched_message(MIDI_PORT_USB, gMidiChUsb, pEvent->msg[0], 
+            pEvent->msg[1], pEvent->msg[2], timeUs);
+    }
+}
+
+void usb_midi_task() {
+    tud_task();
+
+    if (!tud_midi_mounted()) {
+        return;
+    }
+
+    // Read all waiting packets, then decode them as one batch
+    uint8_t buf[USB_MIDI_BATCH_PACKETS * USB_MIDI_PACKET_SIZE];
+    int len = 0;
+    uint64_t timeUs = time_us_64(); // The USB frame is the best resolution
+    while (len < (int)sizeof(buf) && tud_midi_n_packet_read(0, &buf[len])) {
+        len += USB_MIDI_PACKET_SIZE;
+    }
+    if (len == 0) {
+        return;
+    }
+
+    usb_midi_event_t events[USB_MIDI_BATCH_PACKETS];
+    int noOfEvents = usb_midi_parse_packets(buf, len, events, 
+        USB_MIDI_BATCH_PACKETS, &gUsbMidiErrors);
+    gUsbMidiPackets += noOfEvents;
+
+    // The callbacks are shared with the UART interrupts
+    uint32_t save = save_and_disable_interrupts();
+    for (int i = 0; i < noOfEvents; i++) {
+        usb_midi_dispatch(&events[i], timeUs);
+    }
+    restore_interrupts(save);
+}
+
+// The USB interrupt queues the events for tud_task(), packets left over
+// from a full batch are still in the FIFO
+bool usb_midi_is_pending() {
+    if (tud_task_event_ready()) {
+        return true;
+    }
+    return tud_midi_mounted() && tud_midi_n_available(0, 0) > 0;
+}
@@ -0,0 +1,32 @@
+/***********************************************
+/ usb_midi.h : header file for the USB MIDI device functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef USB_MIDI_H
+#define USB_MIDI_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The native USB port is a USB-MIDI device (TinyUSB). All event packets
+// waiting in the TinyUSB FIFO are read in one go, decoded as a batch by
+// usb_midi_parse_packets() and dispatched as complete messages, so the
+// byte by byte UART parser is not used for USB.
+////////////////////////////////////////////////////////////////////////////////
+
+#define USB_MIDI_BATCH_PACKETS 16 // Packets decoded per usb_midi_task() call
+
+// Global char extern declaration
+extern uint32_t gUsbMidiPackets; // Decoded event packets
+extern uint32_t gUsbMidiErrors; // Reserved or malformed packets
+
+// Must be called before stdio_init_all(), stdio uses the CDC interface
+void init_usb_midi();
+
+// Called from the main loop, runs the TinyUSB device task
+void usb_midi_task();
+bool usb_midi_is_pending(); // A USB event or a MIDI packet is waiting
+
+#endif // USB_MIDI_H
@@ -0,0 +1,82 @@
+/***********************************************
+/ usb_midi_packet.c : implementation file for the USB-MIDI event packet parser
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include "usb_midi_packet.h"
+
+// Number of MIDI bytes per Code Index Number, 0 is reserved
+static const uint8_t gCinSize[16] = {
+    0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1 };
+
+int usb_midi_parse_packets(const uint8_t *buf, int len, 
+    usb_midi_event_t *events, int maxEvents, uint32_t *pErrors) {
+    int noOfEvents = 0;
+    uint32_t errors = 0;
+
+    for (int i = 0; i + USB_MIDI_PACKET_SIZE <= len && noOfEvents < maxEvents; 
+        i += USB_MIDI_PACKET_SIZE) {
+        const uint8_t *p = &buf[i];
+        uint8_t cin = p[0] & 0x0F;
+        uint8_t size = gCinSize[cin];
+
+        if (size == 0) {
+            // Reserved, or padding of the transfer
+            if (p[0] | p[1] | p[2] | p[3]) {
+                errors++;
+            }
+            continue;
+        }
+
+        // Channel messages must agree with the status nibble
+        if (cin >= USB_MIDI_CIN_NOTE_OFF && cin <= USB_MIDI_CIN_PITCH_BEND && 
+            (p[1] >> 4) != cin) {
+            errors++;
+            continue;
+        }
+
+        usb_midi_event_t *e = &events[noOfEvents];
+        e->cable = p[0] >> 4;
+        e->cin = cin;
+        e->size = size;
+        e->msg[0] = p[1];
+        e->msg[1] = size > 1? p[2] : 0;
+        e->msg[2] = size > 2? p[3] : 0;
+        noOfEvents++;
+    }
+
+    if (pErrors) {
+        *pErrors += errors;
+    }
+    return noOfEvents;
+}
+
+bool usb_midi_is_sysex(const usb_midi_event_t *event) {
+    switch (event->cin) {
+    case USB_MIDI_CIN_SYSEX_START:
+    case USB_MIDI_CIN_SYSEX_END_2:
+    case USB_MIDI_CIN_SYSEX_END_3:
+        return true;
+    case USB_MIDI_CIN_SYSEX_END_1:
+        // A lone F7, or a data byte, ends a SysEx
+        return event->msg[0] == 0xF7 || event->msg[0] < 0x80;
+    }
+    return false;
+}
+
+int usb_midi_sysex_packets(const uint8_t *msg, int len, uint8_t cable, uint8_t *buf) {
+    int n = 0;
+
+    for (int i = 0; i < len; i += 3) {
+        // The last packet has the F7 and gives the number of bytes
+        int left = len - i;
+        uint8_t cin = left > 3? USB_MIDI_CIN_SYSEX_START : USB_MIDI_CIN_SYSEX_END_1 + left - 1;
+
+        buf[n++] = (uint8_t)(cable << 4) | cin;
+        for (int k = 0; k < 3; k++) {
+            buf[n++] = k < left? msg[i + k] : 0;
+        }
+    }
+    return n;
+}
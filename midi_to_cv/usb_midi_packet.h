@@ -0,0 +1,68 @@
+/***********************************************
+/ usb_midi_packet.h : header file for the USB-MIDI event packet parser
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef USB_MIDI_PACKET_H
+#define USB_MIDI_PACKET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// The parser is based on:
+// Universal Serial Bus Device Class Definition for MIDI Devices
+// Release 1.0, chapter 4 USB-MIDI Event Packets
+//
+// Every packet is 4 bytes, the first byte is the cable number (high nibble)
+// and the Code Index Number (CIN, low nibble). The CIN gives the number of
+// MIDI bytes in the packet, so a whole transfer is decoded with one table
+// lookup per packet and no byte by byte state. The parser only depends on
+// the C library so it can be built for the host as well.
+////////////////////////////////////////////////////////////////////////////////
+
+#define USB_MIDI_PACKET_SIZE 4
+
+#define USB_MIDI_CIN_MISC 0x0 // Reserved
+#define USB_MIDI_CIN_CABLE_EVENT 0x1 // Reserved
+#define USB_MIDI_CIN_SYSCOM_2 0x2 // Two byte system common
+#define USB_MIDI_CIN_SYSCOM_3 0x3 // Three byte system common
+#define USB_MIDI_CIN_SYSEX_START 0x4 // SysEx starts or continues
+#define USB_MIDI_CIN_SYSEX_END_1 0x5 // SysEx ends with 1 byte, or 1 byte common
+#define USB_MIDI_CIN_SYSEX_END_2 0x6 // SysEx ends with 2 bytes
+#define USB_MIDI_CIN_SYSEX_END_3 0x7 // SysEx ends with 3 bytes
+#define USB_MIDI_CIN_NOTE_OFF 0x8
+#define USB_MIDI_CIN_NOTE_ON 0x9
+#define USB_MIDI_CIN_POLY_KEYPRESS 0xA
+#define USB_MIDI_CIN_CONTROL_CHANGE 0xB
+#define USB_MIDI_CIN_PROGRAM_CHANGE 0xC
+#define USB_MIDI_CIN_CHANNEL_PRESSURE 0xD
+#define USB_MIDI_CIN_PITCH_BEND 0xE
+#define USB_MIDI_CIN_SINGLE_BYTE 0xF
+
+// Decoded event
+typedef struct {
+    uint8_t cable; // Virtual cable number 0 - 15
+    uint8_t cin; // Code Index Number
+    uint8_t size; // Number of valid bytes in msg, 1 - 3
+    uint8_t msg[3]; // MIDI bytes, status first unless SysEx data
+} usb_midi_event_t;
+
+// Decodes len bytes of packets into at most maxEvents events and returns
+// the number of events. Reserved and malformed packets are skipped and
+// counted in *pErrors if pErrors is not NULL.
+int usb_midi_parse_packets(const uint8_t *buf, int len, 
+    usb_midi_event_t *events, int maxEvents, uint32_t *pErrors);
+
+// Returns true if the event is a SysEx fragment (CIN 4 - 7, not
+// a one byte system common in CIN 5)
+bool usb_midi_is_sysex(const usb_midi_event_t *event);
+
+// Encodes a whole SysEx message, F0 to F7, into packets on cable and
+// returns the number of bytes written to buf, USB_MIDI_SYSEX_PACKETS(len)
+// packets
+#define USB_MIDI_SYSEX_PACKETS(len) (((len) + 2) / 3)
+int usb_midi_sysex_packets(const uint8_t *msg, int len, uint8_t cable, uint8_t *buf);
+
+#endif // USB_MIDI_PACKET_H
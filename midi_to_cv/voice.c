@@ -0,0 +1,131 @@
+/***********************************************
+/ voice.c : implementation file for the monophonic voice functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#include <stdio.h>
+#include "main.h"
+#include "voice.h"
+#include "mcp4725.h"
+#include "pulse_out.h"
+#include "midi_ump.h"
+#include "cv_out.h"
+#include "mod_engine.h"
+#include "arp.h"
+#include "event_sched.h"
+
+// Global char initiation
+uint8_t gHeldNotes[VOICE_MAX_NOTES]; // The top is the latest note
+uint16_t gHeldPitch[VOICE_MAX_NOTES]; // Pitch 7.9 of the held notes
+int gNoOfHeldNotes = 0;
+uint16_t gVelocity = 0; // 16 bit velocity of the latest note on
+int32_t gPerNoteBend[128]; // Per-note pitch bend, 0 is the center
+int gPNBRange = PNB_DEFAULT_RANGE; // Per-note pitch bend range
+
+// Returns true if the note was held
+static inline bool voice_remove_note(uint8_t noteNo) {
+    for (int i = gNoOfHeldNotes - 1; i >= 0; i--) {
+        if (gHeldNotes[i] == noteNo) {
+            for (int j = i; j < gNoOfHeldNotes - 1; j++) {
+                gHeldNotes[j] = gHeldNotes[j + 1];
+                gHeldPitch[j] = gHeldPitch[j + 1];
+            }
+            gNoOfHeldNotes--;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Set the pitch and the per-note pitch bend of a note
+static inline void voice_sound_note(uint8_t noteNo, uint16_t pitch) {
+    set_midi_pitch(pitch);
+    set_per_note_pitch_bend((uint32_t)gPerNoteBend[noteNo] ^ PW_CENTER_32, 
+        gPNBRange);
+}
+
+// MIDI 1.0 note on, the velocity is translated to 16 bits
+void voice_note_on(uint8_t noteNo, uint8_t velocity) {
+    voice_note_on_pitch(noteNo, (uint16_t)noteNo << 9, 
+        (uint16_t)ump_scale_up(velocity, 7, 16));
+}
+
+// MIDI 2.0 note on, the pitch is 7.9 and the velocity 16 bits
+void voice_note_on_pitch(uint8_t noteNo, uint16_t pitch, uint16_t velocity) {
+    uint64_t timeUs = event_sched_edge_time_us();
+
+    if (gBootFirstNoteUs == 0) {
+        gBootFirstNoteUs = time_us_64();
+    }
+
+    noteNo &= 0x7F;
+    voice_remove_note(noteNo);
+    if (gNoOfHeldNotes >= VOICE_MAX_NOTES) {
+        // Forget the oldest note
+        voice_remove_note(gHeldNotes[0]);
+    }
+    gHeldNotes[gNoOfHeldNotes] = noteNo;
+    gHeldPitch[gNoOfHeldNotes] = pitch;
+    gNoOfHeldNotes++;
+    gVelocity = velocity;
+    cv_out_set(CV_OUT_VELOCITY, velocity);
+
+    // The arpeggiator plays the held notes on the clock
+    if (gArpMode != ARP_MODE_OFF) {
+        arp_notes_changed();
+        return;
+    }
+
+    voice_sound_note(noteNo, pitch);
+    pulse_out_gate(true, timeUs);
+    mod_env_gate(true);
+    pulse_out_trigger(PULSE_OUT_RETRIG, timeUs, PULSE_RETRIG_US);
+}
+
+void voice_note_off(uint8_t noteNo) {
+    bool isTop = gNoOfHeldNotes > 0 && gHeldNotes[gNoOfHeldNotes - 1] == noteNo;
+
+    if (!voice_remove_note(noteNo)) {
+        return;
+    }
+
+    if (gArpMode != ARP_MODE_OFF) {
+        arp_notes_changed();
+        return;
+    }
+
+    if (gNoOfHeldNotes == 0) {
+        pulse_out_gate(false, event_sched_edge_time_us());
+        mod_env_gate(false);
+    }
+    else if (isTop) {
+        // Legato back to the previous note
+        voice_sound_note(gHeldNotes[gNoOfHeldNotes - 1], 
+            gHeldPitch[gNoOfHeldNotes - 1]);
+    }
+}
+
+void voice_all_notes_off() {
+    gNoOfHeldNotes = 0;
+    pulse_out_gate(false, event_sched_edge_time_us());
+    mod_env_gate(false);
+    arp_notes_changed();
+}
+
+// Polyphonic pressure of the sounding note drives the aftertouch output
+void voice_poly_pressure(uint8_t noteNo, uint16_t pressure) {
+    if (gNoOfHeldNotes > 0 && gHeldNotes[gNoOfHeldNotes - 1] == noteNo) {
+        cv_out_set(CV_OUT_AFTERTOUCH, pressure);
+    }
+}
+
+// MIDI 2.0 per-note pitch bend, value is 32 bits with 0x80000000 center
+void voice_per_note_bend(uint8_t noteNo, uint32_t value) {
+    noteNo &= 0x7F;
+    gPerNoteBend[noteNo] = (int32_t)(value ^ PW_CENTER_32);
+
+    if (gNoOfHeldNotes > 0 && gHeldNotes[gNoOfHeldNotes - 1] == noteNo) {
+        set_per_note_pitch_bend(value, gPNBRange);
+    }
+}
@@ -0,0 +1,35 @@
+/***********************************************
+/ voice.h : header file for the monophonic voice functions
+/ Author: Patrik Källback - (c) 2023 PunkSynth
+/ License: GPLv3
+/***********************************************/
+
+#ifndef VOICE_H
+#define VOICE_H
+
+#include "pico/stdlib.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// The held notes are kept in a stack with last note priority. A new note
+// sets the gate and fires the retrigger, releasing the top note falls back
+// to the previous held note without retrigger (legato).
+////////////////////////////////////////////////////////////////////////////////
+
+#define VOICE_MAX_NOTES 16
+
+// Global char extern declaration
+extern uint8_t gHeldNotes[VOICE_MAX_NOTES];
+extern uint16_t gHeldPitch[VOICE_MAX_NOTES];
+extern int gNoOfHeldNotes;
+extern uint16_t gVelocity; // 16 bit velocity of the latest note on
+extern int32_t gPerNoteBend[128];
+extern int gPNBRange; // Per-note pitch bend range in half notes
+
+void voice_note_on(uint8_t noteNo, uint8_t velocity);
+void voice_note_on_pitch(uint8_t noteNo, uint16_t pitch, uint16_t velocity);
+void voice_note_off(uint8_t noteNo);
+void voice_all_notes_off();
+void voice_per_note_bend(uint8_t noteNo, uint32_t value);
+void voice_poly_pressure(uint8_t noteNo, uint16_t pressure);
+
+#endif // VOICE_H